@@ -68,7 +68,9 @@
 #include "catalog/pg_type.h"
 #include "commands/copy.h"
 #include "commands/defrem.h"
+#include "commands/trigger.h"
 #include "distributed/commands/multi_copy.h"
+#include "distributed/commands/parallel_copy.h"
 #include "distributed/commands/utility_hook.h"
 #include "distributed/intermediate_results.h"
 #include "distributed/local_executor.h"
@@ -81,6 +83,7 @@
 #include "distributed/multi_executor.h"
 #include "distributed/placement_connection.h"
 #include "distributed/relation_access_tracking.h"
+#include "distributed/relay_utility.h"
 #include "distributed/remote_commands.h"
 #include "distributed/remote_transaction.h"
 #include "distributed/resource_lock.h"
@@ -91,6 +94,8 @@
 #include "foreign/foreign.h"
 #include "libpq/pqformat.h"
 #include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "rewrite/rewriteHandler.h"
 #include "tsearch/ts_locale.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
@@ -105,6 +110,12 @@ static const char BinarySignature[11] = "PGCOPY\n\377\r\n\0";
 /* use a global connection to the master node in order to skip passing it around */
 static MultiConnection *masterConnection = NULL;
 
+/*
+ * Whether rows of a text or csv COPY into a hash-distributed table are passed
+ * on to the shards without parsing any field except the distribution column.
+ */
+bool EnableCopyPassthrough = false;
+
 /*
  * Data size threshold to switch over the active placement for a connection.
  * If this is too low, overhead of starting COPY commands will hurt the
@@ -176,13 +187,38 @@ struct CopyPlacementState
 	dlist_node bufferedPlacementNode;
 };
 
+/*
+ * CopyLocalPlacementState holds the state for inserting the tuples of a shard
+ * directly into its placement on this node, without going through a
+ * connection. See CitusCopyDestReceiverStartup() for when this happens.
+ */
+typedef struct CopyLocalPlacementState
+{
+	/* shard relation and the executor state for inserting into it */
+	Relation shardRelation;
+	EState *executorState;
+	TupleTableSlot *slot;
+
+	/* for each attribute of the shard, index of the input column or -1 */
+	int *inputColumnIndexes;
+
+	/* default expressions of attributes that are not in the input, or NULL */
+	ExprState **defaultValueStates;
+} CopyLocalPlacementState;
+
 struct CopyShardState
 {
 	/* Used as hash key. */
 	uint64 shardId;
 
-	/* List of CopyPlacementStates for all active placements of the shard. */
+	/* List of CopyPlacementStates for all remote placements of the shard. */
 	List *placementStateList;
+
+	/* Whether the shard has a placement on this node that is copied locally. */
+	bool containsLocalPlacement;
+
+	/* State for the local placement, set on the first tuple for the shard. */
+	CopyLocalPlacementState *localPlacementState;
 };
 
 /* ShardConnections represents a set of connections for each placement of a shard */
@@ -197,10 +233,16 @@ typedef struct ShardConnections
 
 /* Local functions forward declarations */
 static void CopyFromWorkerNode(CopyStmt *copyStatement, char *completionTag);
-static void CopyToExistingShards(CopyStmt *copyStatement, char *completionTag);
+static void CopyToExistingShards(CopyStmt *copyStatement, char *completionTag,
+								 int parallelWorkerCount);
+static bool CanUseCopyPassthrough(CopyStmt *copyStatement, char partitionMethod);
+static uint64 CopyRawFieldsToExistingShards(CopyState copyState,
+											CitusCopyDestReceiver *copyDest);
 static void CopyToNewShards(CopyStmt *copyStatement, char *completionTag, Oid relationId);
 static char MasterPartitionMethod(RangeVar *relation);
 static void RemoveMasterOptions(CopyStmt *copyStatement);
+static int RemoveParallelCopyOption(CopyStmt *copyStatement);
+static void ErrorIfParallelCopyOptionGiven(int parallelWorkerCount);
 static void OpenCopyConnectionsForNewShards(CopyStmt *copyStatement,
 											ShardConnections *shardConnections, bool
 											stopOnFailure,
@@ -219,7 +261,6 @@ static void SendCopyDataToAll(StringInfo dataBuffer, int64 shardId, List *connec
 static void SendCopyDataToPlacement(StringInfo dataBuffer, int64 shardId,
 									MultiConnection *connection);
 static void ReportCopyError(MultiConnection *connection, PGresult *result);
-static uint32 AvailableColumnCount(TupleDesc tupleDescriptor);
 static int64 StartCopyToNewShard(ShardConnections *shardConnections,
 								 CopyStmt *copyStatement, bool useBinaryCopyFormat);
 static int64 MasterCreateEmptyShard(char *relationName);
@@ -248,13 +289,23 @@ static CopyConnectionState * GetConnectionState(HTAB *connectionStateHash,
 												MultiConnection *connection);
 static CopyShardState * GetShardState(uint64 shardId, HTAB *shardStateHash,
 									  HTAB *connectionStateHash, bool stopOnFailure,
-									  bool *found);
+									  bool shouldUseLocalCopy, bool *found);
 static MultiConnection * CopyGetPlacementConnection(ShardPlacement *placement,
 													bool stopOnFailure);
 static List * ConnectionStateList(HTAB *connectionStateHash);
 static void InitializeCopyShardState(CopyShardState *shardState,
 									 HTAB *connectionStateHash,
-									 uint64 shardId, bool stopOnFailure);
+									 uint64 shardId, bool stopOnFailure,
+									 bool shouldUseLocalCopy);
+static CopyLocalPlacementState * CreateLocalPlacementState(CitusCopyDestReceiver *
+														   copyDest,
+														   uint64 shardId);
+static EState * CreateLocalPlacementExecutorState(Relation shardRelation);
+static int InputColumnIndex(CitusCopyDestReceiver *copyDest, char *columnName);
+static void InsertTupleIntoLocalPlacement(CitusCopyDestReceiver *copyDest,
+										  CopyLocalPlacementState *localPlacementState,
+										  Datum *columnValues, bool *columnNulls);
+static void EndLocalPlacementCopies(CitusCopyDestReceiver *copyDest);
 static void StartPlacementStateCopyCommand(CopyPlacementState *placementState,
 										   CopyStmt *copyStatement,
 										   CopyOutState copyOutState);
@@ -274,14 +325,28 @@ static void CopyAttributeOutText(CopyOutState outputState, char *string);
 static inline void CopyFlushOutput(CopyOutState outputState, char *start, char *pointer);
 static bool CitusSendTupleToPlacements(TupleTableSlot *slot,
 									   CitusCopyDestReceiver *copyDest);
+static void CitusSendRawFieldsToPlacements(char **fieldArray, int fieldCount,
+										   CitusCopyDestReceiver *copyDest);
+static CopyShardState * LookupCopyShardState(CitusCopyDestReceiver *copyDest,
+											 uint64 shardId);
+static void SendCopyRowToPlacements(CitusCopyDestReceiver *copyDest,
+									CopyShardState *shardState, StringInfo rowData);
 static uint64 ShardIdForTuple(CitusCopyDestReceiver *copyDest, Datum *columnValues,
 							  bool *columnNulls);
+static uint64 ShardIdForRawFields(CitusCopyDestReceiver *copyDest, char **fieldArray,
+								  int fieldCount);
+static void AppendCopyRawFields(char **fieldArray, int fieldCount,
+								CopyOutState rowOutputState);
+static void SetupRawFieldPassthrough(CitusCopyDestReceiver *copyDest,
+									 TupleDesc inputTupleDescriptor);
 
 /* CitusCopyDestReceiver functions */
 static void CitusCopyDestReceiverStartup(DestReceiver *copyDest, int operation,
 										 TupleDesc inputTupleDesc);
 static bool CitusCopyDestReceiverReceive(TupleTableSlot *slot,
 										 DestReceiver *copyDest);
+static void CitusCopyDestReceiverReceiveRawFields(CitusCopyDestReceiver *copyDest,
+												  char **fieldArray, int fieldCount);
 static void CitusCopyDestReceiverShutdown(DestReceiver *destReceiver);
 static void CitusCopyDestReceiverDestroy(DestReceiver *destReceiver);
 
@@ -322,9 +387,15 @@ CitusCopyFrom(CopyStmt *copyStatement, char *completionTag)
 	}
 
 	masterConnection = NULL; /* reset, might still be set after error */
+
+	/* the workers option is ours, remove it before PostgreSQL sees it */
+	int parallelWorkerCount = RemoveParallelCopyOption(copyStatement);
+
 	bool isCopyFromWorker = IsCopyFromWorker(copyStatement);
 	if (isCopyFromWorker)
 	{
+		ErrorIfParallelCopyOptionGiven(parallelWorkerCount);
+
 		CopyFromWorkerNode(copyStatement, completionTag);
 	}
 	else
@@ -338,10 +409,12 @@ CitusCopyFrom(CopyStmt *copyStatement, char *completionTag)
 		if (partitionMethod == DISTRIBUTE_BY_HASH || partitionMethod ==
 			DISTRIBUTE_BY_RANGE || partitionMethod == DISTRIBUTE_BY_NONE)
 		{
-			CopyToExistingShards(copyStatement, completionTag);
+			CopyToExistingShards(copyStatement, completionTag, parallelWorkerCount);
 		}
 		else if (partitionMethod == DISTRIBUTE_BY_APPEND)
 		{
+			ErrorIfParallelCopyOptionGiven(parallelWorkerCount);
+
 			CopyToNewShards(copyStatement, completionTag, relationId);
 		}
 		else
@@ -427,7 +500,8 @@ CopyFromWorkerNode(CopyStmt *copyStatement, char *completionTag)
  * rows.
  */
 static void
-CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
+CopyToExistingShards(CopyStmt *copyStatement, char *completionTag,
+					 int parallelWorkerCount)
 {
 	Oid tableId = RangeVarGetRelid(copyStatement->relation, NoLock, false);
 
@@ -445,6 +519,8 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 
 	char partitionMethod = 0;
 	bool stopOnFailure = false;
+	bool copyPassthrough = false;
+	bool parallelCopy = false;
 
 	CopyState copyState = NULL;
 	uint64 processedRowCount = 0;
@@ -500,9 +576,28 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 		stopOnFailure = true;
 	}
 
+	parallelCopy = CanUseParallelCopy(copyStatement, tupleDescriptor,
+									  parallelWorkerCount);
+	if (!parallelCopy)
+	{
+		if (parallelWorkerCount > 0)
+		{
+			ereport(NOTICE, (errmsg("COPY workers option is ignored"),
+							 errdetail("Parallel workers can only route text or "
+									   "csv input that contains all columns, "
+									   "when all functions involved are parallel "
+									   "safe and the COPY runs outside of "
+									   "parallel mode and local execution.")));
+		}
+
+		copyPassthrough = CanUseCopyPassthrough(copyStatement, partitionMethod);
+	}
+
 	/* set up the destination for the COPY */
 	copyDest = CreateCitusCopyDestReceiver(tableId, columnNameList, partitionColumnIndex,
 										   executorState, stopOnFailure, NULL);
+	copyDest->rawFieldPassthrough = copyPassthrough;
+	copyDest->parallelCopy = parallelCopy;
 	dest = (DestReceiver *) copyDest;
 	dest->rStartup(dest, 0, tupleDescriptor);
 
@@ -552,29 +647,41 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 	errorCallback.previous = error_context_stack;
 	error_context_stack = &errorCallback;
 
-	while (true)
+	if (parallelCopy)
 	{
-		ResetPerTupleExprContext(executorState);
+		processedRowCount = ParallelCopyToExistingShards(copyState, copyDest,
+														 parallelWorkerCount);
+	}
+	else if (copyPassthrough)
+	{
+		processedRowCount = CopyRawFieldsToExistingShards(copyState, copyDest);
+	}
+	else
+	{
+		while (true)
+		{
+			ResetPerTupleExprContext(executorState);
 
-		MemoryContext oldContext = MemoryContextSwitchTo(executorTupleContext);
+			MemoryContext oldContext = MemoryContextSwitchTo(executorTupleContext);
 
-		/* parse a row from the input */
-		bool nextRowFound = NextCopyFromCompat(copyState, executorExpressionContext,
-											   columnValues, columnNulls);
+			/* parse a row from the input */
+			bool nextRowFound = NextCopyFromCompat(copyState, executorExpressionContext,
+												   columnValues, columnNulls);
 
-		if (!nextRowFound)
-		{
-			MemoryContextSwitchTo(oldContext);
-			break;
-		}
+			if (!nextRowFound)
+			{
+				MemoryContextSwitchTo(oldContext);
+				break;
+			}
 
-		CHECK_FOR_INTERRUPTS();
+			CHECK_FOR_INTERRUPTS();
 
-		MemoryContextSwitchTo(oldContext);
+			MemoryContextSwitchTo(oldContext);
 
-		dest->receiveSlot(tupleTableSlot, dest);
+			dest->receiveSlot(tupleTableSlot, dest);
 
-		processedRowCount += 1;
+			processedRowCount += 1;
+		}
 	}
 
 	EndCopyFrom(copyState);
@@ -603,6 +710,105 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 }
 
 
+/*
+ * CanUseCopyPassthrough returns whether the rows of the given COPY can be sent
+ * to the shards as the raw text fields of the input. This requires that only
+ * the distribution column is needed on the coordinator, which holds for text
+ * and csv input into hash-distributed tables when the input contains all the
+ * columns and there are no options that change how fields are converted.
+ * Fields other than the distribution column are then only validated by the
+ * workers.
+ */
+static bool
+CanUseCopyPassthrough(CopyStmt *copyStatement, char partitionMethod)
+{
+	ListCell *optionCell = NULL;
+
+	if (!EnableCopyPassthrough)
+	{
+		return false;
+	}
+
+	if (partitionMethod != DISTRIBUTE_BY_HASH)
+	{
+		return false;
+	}
+
+	/* rows for local placements then have to be parsed and inserted locally */
+	if (LocalExecutionHappened)
+	{
+		return false;
+	}
+
+	/* omitted columns would need their defaults evaluated on the coordinator */
+	if (copyStatement->attlist != NIL)
+	{
+		return false;
+	}
+
+	if (CopyStatementHasFormat(copyStatement, "binary"))
+	{
+		return false;
+	}
+
+	foreach(optionCell, copyStatement->options)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+
+		/* these options are applied when converting the fields into a tuple */
+		if (strcmp(option->defname, "force_not_null") == 0 ||
+			strcmp(option->defname, "force_null") == 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * CopyRawFieldsToExistingShards reads the rows of the COPY input as raw text
+ * fields and sends them to the shards without converting them to tuples. It
+ * returns the number of rows that were copied.
+ */
+static uint64
+CopyRawFieldsToExistingShards(CopyState copyState, CitusCopyDestReceiver *copyDest)
+{
+	EState *executorState = copyDest->executorState;
+	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
+	uint64 processedRowCount = 0;
+
+	while (true)
+	{
+		char **fieldArray = NULL;
+		int fieldCount = 0;
+
+		ResetPerTupleExprContext(executorState);
+
+		MemoryContext oldContext = MemoryContextSwitchTo(executorTupleContext);
+
+		/* split a row from the input into fields, without parsing them */
+		bool nextRowFound = NextCopyFromRawFields(copyState, &fieldArray, &fieldCount);
+
+		MemoryContextSwitchTo(oldContext);
+
+		if (!nextRowFound)
+		{
+			break;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+
+		CitusCopyDestReceiverReceiveRawFields(copyDest, fieldArray, fieldCount);
+
+		processedRowCount += 1;
+	}
+
+	return processedRowCount;
+}
+
+
 /*
  * CopyToNewShards implements the COPY table_name FROM ... for append-partitioned
  * tables where we create new shards into which to copy rows.
@@ -891,6 +1097,61 @@ RemoveMasterOptions(CopyStmt *copyStatement)
 }
 
 
+/*
+ * RemoveParallelCopyOption removes the workers option from the option list of
+ * the copy statement, and returns the number of workers it asks for, or 0 if
+ * the option is not given. Callers report it when they cannot use the workers.
+ */
+static int
+RemoveParallelCopyOption(CopyStmt *copyStatement)
+{
+	List *newOptionList = NIL;
+	ListCell *optionCell = NULL;
+	int parallelWorkerCount = 0;
+
+	foreach(optionCell, copyStatement->options)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+
+		if (strncmp(option->defname, "workers", NAMEDATALEN) == 0)
+		{
+			parallelWorkerCount = defGetInt32(option);
+			if (parallelWorkerCount < 0 || parallelWorkerCount > max_worker_processes)
+			{
+				ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+								errmsg("COPY workers must be between 0 and %d",
+									   max_worker_processes)));
+			}
+
+			continue;
+		}
+
+		newOptionList = lappend(newOptionList, option);
+	}
+
+	copyStatement->options = newOptionList;
+
+	return parallelWorkerCount;
+}
+
+
+/*
+ * ErrorIfParallelCopyOptionGiven errors out if the workers option asks for
+ * parallel workers for a COPY that creates new shards, since only rows of
+ * existing shards can be routed by the workers.
+ */
+static void
+ErrorIfParallelCopyOptionGiven(int parallelWorkerCount)
+{
+	if (parallelWorkerCount > 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("COPY workers option is not supported for "
+							   "append-distributed tables")));
+	}
+}
+
+
 /*
  * OpenCopyConnectionsForNewShards opens a connection for each placement of a shard and
  * starts a COPY transaction if necessary. If a connection cannot be opened,
@@ -1039,6 +1300,36 @@ CanUseBinaryCopyFormat(TupleDesc tupleDescription)
 }
 
 
+/*
+ * CanUseBinaryCopyFormatForTargetList returns true if we can use binary
+ * copy format for all columns of the given target list.
+ */
+bool
+CanUseBinaryCopyFormatForTargetList(List *targetEntryList)
+{
+	ListCell *targetEntryCell = NULL;
+
+	foreach(targetEntryCell, targetEntryList)
+	{
+		TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+		Node *targetExpr = (Node *) targetEntry->expr;
+
+		if (targetEntry->resjunk)
+		{
+			continue;
+		}
+
+		Oid columnType = exprType(targetExpr);
+		if (!CanUseBinaryCopyFormatForType(columnType))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
 /*
  * CanUseBinaryCopyFormatForType determines whether it is safe to use the
  * binary copy format for the given type. The binary copy format cannot
@@ -1765,7 +2056,7 @@ CoerceColumnValue(Datum inputValue, CopyCoercionData *coercionPath)
  * AvailableColumnCount returns the number of columns in a tuple descriptor, excluding
  * columns that were dropped.
  */
-static uint32
+uint32
 AvailableColumnCount(TupleDesc tupleDescriptor)
 {
 	uint32 columnCount = 0;
@@ -2195,8 +2486,21 @@ CitusCopyDestReceiverStartup(DestReceiver *dest, int operation,
 	const char *delimiterCharacter = "\t";
 	const char *nullPrintCharacter = "\\N";
 
-	/* Citus currently doesn't know how to handle COPY command locally */
-	ErrorIfLocalExecutionHappened();
+	/*
+	 * Tuples for placements on this node are inserted directly into the shards
+	 * if the rules of local execution allow it. Intermediate results, raw
+	 * fields and rows that parallel COPY workers serialized are always sent
+	 * over connections, and since those cannot see the writes of an earlier
+	 * local execution in the transaction, we error out in that case.
+	 */
+	copyDest->shouldUseLocalCopy = copyDest->intermediateResultIdPrefix == NULL &&
+								   !copyDest->rawFieldPassthrough &&
+								   !copyDest->parallelCopy &&
+								   ShouldUseLocalCopy(tableId);
+	if (!copyDest->shouldUseLocalCopy)
+	{
+		ErrorIfLocalExecutionHappened();
+	}
 
 	/* look up table properties */
 	Relation distributedRelation = heap_open(tableId, RowExclusiveLock);
@@ -2270,6 +2574,24 @@ CitusCopyDestReceiverStartup(DestReceiver *dest, int operation,
 	copyDest->copyOutState = copyOutState;
 	copyDest->multiShardCopy = false;
 
+	/* raw fields of the COPY input can only be passed on in text format */
+	if (copyDest->rawFieldPassthrough)
+	{
+		copyOutState->binary = false;
+
+		SetupRawFieldPassthrough(copyDest, inputTupleDescriptor);
+	}
+
+	/*
+	 * Rows are serialized into a separate buffer, since the message buffer of
+	 * copyOutState is also used for the binary headers and footers when we
+	 * switch between placements.
+	 */
+	CopyOutState rowOutputState = (CopyOutState) palloc0(sizeof(CopyOutStateData));
+	*rowOutputState = *copyOutState;
+	rowOutputState->fe_msgbuf = makeStringInfo();
+	copyDest->rowOutputState = rowOutputState;
+
 	/* prepare functions to call on received tuples */
 	{
 		TupleDesc destTupleDescriptor = distributedRelation->rd_att;
@@ -2365,6 +2687,72 @@ CitusCopyDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 }
 
 
+/*
+ * CitusCopyDestReceiverReceiveRawFields sends a row of the COPY input, given as
+ * its raw text fields, to the appropriate shard placement(s).
+ */
+static void
+CitusCopyDestReceiverReceiveRawFields(CitusCopyDestReceiver *copyDest,
+									  char **fieldArray, int fieldCount)
+{
+	PG_TRY();
+	{
+		CitusSendRawFieldsToPlacements(fieldArray, fieldCount, copyDest);
+	}
+	PG_CATCH();
+	{
+		/*
+		 * We might be able to recover from errors with ROLLBACK TO SAVEPOINT,
+		 * so unclaim the connections before throwing errors.
+		 */
+		List *connectionStateList = ConnectionStateList(copyDest->connectionStateHash);
+		UnclaimCopyConnections(connectionStateList);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+}
+
+
+/*
+ * CitusCopyDestReceiverReceiveRow sends a row that is already serialized in
+ * the COPY format of the receiver to the placements of the given shard. This
+ * is used for rows that parallel COPY workers routed.
+ */
+void
+CitusCopyDestReceiverReceiveRow(CitusCopyDestReceiver *copyDest, uint64 shardId,
+								StringInfo rowData)
+{
+	PG_TRY();
+	{
+		/* connections hash is kept in memory context */
+		MemoryContext oldContext = MemoryContextSwitchTo(copyDest->memoryContext);
+
+		/* routed rows are never copied locally, see CitusCopyDestReceiverStartup */
+		CopyShardState *shardState = LookupCopyShardState(copyDest, shardId);
+		Assert(shardState->localPlacementState == NULL);
+
+		SendCopyRowToPlacements(copyDest, shardState, rowData);
+
+		MemoryContextSwitchTo(oldContext);
+
+		copyDest->tuplesSent++;
+	}
+	PG_CATCH();
+	{
+		/*
+		 * We might be able to recover from errors with ROLLBACK TO SAVEPOINT,
+		 * so unclaim the connections before throwing errors.
+		 */
+		List *connectionStateList = ConnectionStateList(copyDest->connectionStateHash);
+		UnclaimCopyConnections(connectionStateList);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+}
+
+
 /*
  * CitusSendTupleToPlacements sends the given TupleTableSlot to the appropriate
  * shard placement(s).
@@ -2373,17 +2761,10 @@ static bool
 CitusSendTupleToPlacements(TupleTableSlot *slot, CitusCopyDestReceiver *copyDest)
 {
 	TupleDesc tupleDescriptor = copyDest->tupleDescriptor;
-	CopyStmt *copyStatement = copyDest->copyStatement;
 
-	CopyOutState copyOutState = copyDest->copyOutState;
+	CopyOutState rowOutputState = copyDest->rowOutputState;
 	FmgrInfo *columnOutputFunctions = copyDest->columnOutputFunctions;
 	CopyCoercionData *columnCoercionPaths = copyDest->columnCoercionPaths;
-	ListCell *placementStateCell = NULL;
-	bool cachedShardStateFound = false;
-	bool firstTupleInShard = false;
-
-	bool stopOnFailure = copyDest->stopOnFailure;
-
 
 	EState *executorState = copyDest->executorState;
 	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
@@ -2399,30 +2780,144 @@ CitusSendTupleToPlacements(TupleTableSlot *slot, CitusCopyDestReceiver *copyDest
 	/* connections hash is kept in memory context */
 	MemoryContextSwitchTo(copyDest->memoryContext);
 
-	CopyShardState *shardState = GetShardState(shardId, copyDest->shardStateHash,
-											   copyDest->connectionStateHash,
-											   stopOnFailure,
-											   &cachedShardStateFound);
-	if (!cachedShardStateFound)
+	CopyShardState *shardState = LookupCopyShardState(copyDest, shardId);
+
+	MemoryContextSwitchTo(executorTupleContext);
+
+	if (shardState->localPlacementState != NULL)
 	{
-		firstTupleInShard = true;
+		InsertTupleIntoLocalPlacement(copyDest, shardState->localPlacementState,
+									  columnValues, columnNulls);
 	}
 
-	if (firstTupleInShard && !copyDest->multiShardCopy &&
-		hash_get_num_entries(copyDest->shardStateHash) == 2)
+	if (shardState->placementStateList != NIL)
 	{
-		Oid relationId = copyDest->distributedRelationId;
+		/* serialize the row once for all remote placements */
+		resetStringInfo(rowOutputState->fe_msgbuf);
+		AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
+						  rowOutputState, columnOutputFunctions, columnCoercionPaths);
 
-		/* mark as multi shard to skip doing the same thing over and over */
-		copyDest->multiShardCopy = true;
+		MemoryContextSwitchTo(copyDest->memoryContext);
 
-		if (MultiShardConnectionType != SEQUENTIAL_CONNECTION)
-		{
-			/* when we see multiple shard connections, we mark COPY as parallel modify */
+		SendCopyRowToPlacements(copyDest, shardState, rowOutputState->fe_msgbuf);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	copyDest->tuplesSent++;
+
+	/*
+	 * Release per tuple memory allocated in this function. If we're writing
+	 * the results of an INSERT ... SELECT then the SELECT execution will use
+	 * its own executor state and reset the per tuple expression context
+	 * separately.
+	 */
+	ResetPerTupleExprContext(executorState);
+
+	return true;
+}
+
+
+/*
+ * CitusSendRawFieldsToPlacements sends a row that is given as the raw text
+ * fields of the COPY input to the appropriate shard placement(s). Only the
+ * partition column field is parsed, the other fields are escaped and sent
+ * as they are.
+ */
+static void
+CitusSendRawFieldsToPlacements(char **fieldArray, int fieldCount,
+							   CitusCopyDestReceiver *copyDest)
+{
+	CopyOutState rowOutputState = copyDest->rowOutputState;
+
+	EState *executorState = copyDest->executorState;
+	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
+	MemoryContext oldContext = MemoryContextSwitchTo(executorTupleContext);
+
+	int64 shardId = ShardIdForRawFields(copyDest, fieldArray, fieldCount);
+
+	resetStringInfo(rowOutputState->fe_msgbuf);
+	AppendCopyRawFields(fieldArray, fieldCount, rowOutputState);
+
+	/* connections hash is kept in memory context */
+	MemoryContextSwitchTo(copyDest->memoryContext);
+
+	/* raw fields are never copied locally, see CitusCopyDestReceiverStartup */
+	CopyShardState *shardState = LookupCopyShardState(copyDest, shardId);
+	Assert(shardState->localPlacementState == NULL);
+
+	SendCopyRowToPlacements(copyDest, shardState, rowOutputState->fe_msgbuf);
+
+	MemoryContextSwitchTo(oldContext);
+
+	copyDest->tuplesSent++;
+
+	ResetPerTupleExprContext(executorState);
+}
+
+
+/*
+ * LookupCopyShardState returns the CopyShardState for the given shard, and
+ * initializes it on the first tuple for the shard.
+ */
+static CopyShardState *
+LookupCopyShardState(CitusCopyDestReceiver *copyDest, uint64 shardId)
+{
+	bool cachedShardStateFound = false;
+	bool firstTupleInShard = false;
+
+	bool stopOnFailure = copyDest->stopOnFailure;
+
+	CopyShardState *shardState = GetShardState(shardId, copyDest->shardStateHash,
+											   copyDest->connectionStateHash,
+											   stopOnFailure,
+											   copyDest->shouldUseLocalCopy,
+											   &cachedShardStateFound);
+	if (!cachedShardStateFound)
+	{
+		firstTupleInShard = true;
+
+		if (shardState->containsLocalPlacement)
+		{
+			shardState->localPlacementState = CreateLocalPlacementState(copyDest,
+																		 shardId);
+		}
+	}
+
+	if (firstTupleInShard && !copyDest->multiShardCopy &&
+		hash_get_num_entries(copyDest->shardStateHash) == 2)
+	{
+		Oid relationId = copyDest->distributedRelationId;
+
+		/* mark as multi shard to skip doing the same thing over and over */
+		copyDest->multiShardCopy = true;
+
+		if (MultiShardConnectionType != SEQUENTIAL_CONNECTION)
+		{
+			/* when we see multiple shard connections, we mark COPY as parallel modify */
 			RecordParallelModifyAccess(relationId);
 		}
 	}
 
+	return shardState;
+}
+
+
+/*
+ * SendCopyRowToPlacements sends the serialized row in rowData to all remote
+ * placements of the given shard. If the connection of a placement currently
+ * copies into another placement, the row is buffered until the connection
+ * switches over.
+ */
+static void
+SendCopyRowToPlacements(CitusCopyDestReceiver *copyDest, CopyShardState *shardState,
+						StringInfo rowData)
+{
+	CopyStmt *copyStatement = copyDest->copyStatement;
+	CopyOutState copyOutState = copyDest->copyOutState;
+	uint64 shardId = shardState->shardId;
+	ListCell *placementStateCell = NULL;
+
 	foreach(placementStateCell, shardState->placementStateList)
 	{
 		CopyPlacementState *currentPlacementState = lfirst(placementStateCell);
@@ -2464,13 +2959,8 @@ CitusSendTupleToPlacements(TupleTableSlot *slot, CitusCopyDestReceiver *copyDest
 		else if (currentPlacementState != activePlacementState)
 		{
 			/* buffer data */
-			StringInfo copyBuffer = copyOutState->fe_msgbuf;
-			resetStringInfo(copyBuffer);
-			AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
-							  copyOutState, columnOutputFunctions,
-							  columnCoercionPaths);
-			appendBinaryStringInfo(currentPlacementState->data, copyBuffer->data,
-								   copyBuffer->len);
+			appendBinaryStringInfo(currentPlacementState->data, rowData->data,
+								   rowData->len);
 		}
 		else
 		{
@@ -2480,27 +2970,9 @@ CitusSendTupleToPlacements(TupleTableSlot *slot, CitusCopyDestReceiver *copyDest
 
 		if (sendTupleOverConnection)
 		{
-			resetStringInfo(copyOutState->fe_msgbuf);
-			AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
-							  copyOutState, columnOutputFunctions, columnCoercionPaths);
-			SendCopyDataToPlacement(copyOutState->fe_msgbuf, shardId,
-									connectionState->connection);
+			SendCopyDataToPlacement(rowData, shardId, connectionState->connection);
 		}
 	}
-
-	MemoryContextSwitchTo(oldContext);
-
-	copyDest->tuplesSent++;
-
-	/*
-	 * Release per tuple memory allocated in this function. If we're writing
-	 * the results of an INSERT ... SELECT then the SELECT execution will use
-	 * its own executor state and reset the per tuple expression context
-	 * separately.
-	 */
-	ResetPerTupleExprContext(executorState);
-
-	return true;
 }
 
 
@@ -2527,16 +2999,7 @@ ShardIdForTuple(CitusCopyDestReceiver *copyDest, Datum *columnValues, bool *colu
 
 		if (columnNulls[partitionColumnIndex])
 		{
-			Oid relationId = copyDest->distributedRelationId;
-			char *relationName = get_rel_name(relationId);
-			Oid schemaOid = get_rel_namespace(relationId);
-			char *schemaName = get_namespace_name(schemaOid);
-			char *qualifiedTableName = quote_qualified_identifier(schemaName,
-																  relationName);
-
-			ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
-							errmsg("the partition column of table %s cannot be NULL",
-								   qualifiedTableName)));
+			ErrorPartitionColumnIsNull(copyDest->distributedRelationId);
 		}
 
 		/* find the partition column value */
@@ -2566,6 +3029,157 @@ ShardIdForTuple(CitusCopyDestReceiver *copyDest, Datum *columnValues, bool *colu
 }
 
 
+/*
+ * ShardIdForRawFields returns id of the shard to which the row with the given
+ * raw text fields belongs to. Only the partition column field is parsed.
+ */
+static uint64
+ShardIdForRawFields(CitusCopyDestReceiver *copyDest, char **fieldArray, int fieldCount)
+{
+	/* same checks as NextCopyFrom, since the fields are not parsed there */
+	if (fieldCount > copyDest->rawFieldCount)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("extra data after last expected column")));
+	}
+	else if (fieldCount < copyDest->rawFieldCount)
+	{
+		char *columnName = (char *) list_nth(copyDest->columnNameList, fieldCount);
+
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("missing data for column \"%s\"", columnName)));
+	}
+
+	char *partitionValueString = fieldArray[copyDest->partitionFieldIndex];
+	if (partitionValueString == NULL)
+	{
+		ErrorPartitionColumnIsNull(copyDest->distributedRelationId);
+	}
+
+	Datum partitionColumnValue = InputFunctionCall(&copyDest->partitionInputFunction,
+												   partitionValueString,
+												   copyDest->partitionTypeIOParam,
+												   copyDest->partitionTypeMod);
+
+	ShardInterval *shardInterval = FindShardInterval(partitionColumnValue,
+													 copyDest->tableMetadata);
+	if (shardInterval == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						errmsg("could not find shard for partition column "
+							   "value")));
+	}
+
+	return shardInterval->shardId;
+}
+
+
+/*
+ * ErrorPartitionColumnIsNull errors out for a row that has a NULL value in the
+ * partition column.
+ */
+void
+ErrorPartitionColumnIsNull(Oid relationId)
+{
+	char *relationName = get_rel_name(relationId);
+	Oid schemaOid = get_rel_namespace(relationId);
+	char *schemaName = get_namespace_name(schemaOid);
+	char *qualifiedTableName = quote_qualified_identifier(schemaName, relationName);
+
+	ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					errmsg("the partition column of table %s cannot be NULL",
+						   qualifiedTableName)));
+}
+
+
+/*
+ * SetupRawFieldPassthrough looks up the position of the partition column in the
+ * raw fields of the COPY input and how to parse it.
+ */
+static void
+SetupRawFieldPassthrough(CitusCopyDestReceiver *copyDest, TupleDesc inputTupleDescriptor)
+{
+	int partitionColumnIndex = copyDest->partitionColumnIndex;
+	int partitionFieldIndex = 0;
+	Oid inputFunctionId = InvalidOid;
+	Oid typeIOParam = InvalidOid;
+
+	Assert(partitionColumnIndex != INVALID_PARTITION_COLUMN_INDEX);
+
+	/* dropped and generated columns do not appear in the input */
+	for (int columnIndex = 0; columnIndex < partitionColumnIndex; columnIndex++)
+	{
+		Form_pg_attribute currentColumn = TupleDescAttr(inputTupleDescriptor,
+														columnIndex);
+
+		if (currentColumn->attisdropped
+#if PG_VERSION_NUM >= 120000
+			|| currentColumn->attgenerated == ATTRIBUTE_GENERATED_STORED
+#endif
+			)
+		{
+			continue;
+		}
+
+		partitionFieldIndex++;
+	}
+
+	Form_pg_attribute partitionColumn = TupleDescAttr(inputTupleDescriptor,
+													  partitionColumnIndex);
+
+	getTypeInputInfo(partitionColumn->atttypid, &inputFunctionId, &typeIOParam);
+	fmgr_info_cxt(inputFunctionId, &copyDest->partitionInputFunction,
+				  copyDest->memoryContext);
+
+	copyDest->partitionFieldIndex = partitionFieldIndex;
+	copyDest->rawFieldCount = AvailableColumnCount(inputTupleDescriptor);
+	copyDest->partitionTypeIOParam = typeIOParam;
+	copyDest->partitionTypeMod = partitionColumn->atttypmod;
+}
+
+
+/*
+ * AppendCopyRawFields serializes a row that is given as the raw text fields of
+ * the COPY input in text format, and appends the data to the row output state
+ * object's message buffer.
+ */
+static void
+AppendCopyRawFields(char **fieldArray, int fieldCount, CopyOutState rowOutputState)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(rowOutputState->rowcontext);
+
+	Assert(!rowOutputState->binary);
+
+	for (int fieldIndex = 0; fieldIndex < fieldCount; fieldIndex++)
+	{
+		char *fieldText = fieldArray[fieldIndex];
+
+		if (fieldIndex > 0)
+		{
+			CopySendChar(rowOutputState, rowOutputState->delim[0]);
+		}
+
+		if (fieldText != NULL)
+		{
+			CopyAttributeOutText(rowOutputState, fieldText);
+		}
+		else
+		{
+			CopySendString(rowOutputState, rowOutputState->null_print_client);
+		}
+	}
+
+	/* append default line termination string depending on the platform */
+#ifndef WIN32
+	CopySendChar(rowOutputState, '\n');
+#else
+	CopySendString(rowOutputState, "\r\n");
+#endif
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
 /*
  * CitusCopyDestReceiverShutdown implements the rShutdown interface of
  * CitusCopyDestReceiver. It ends the COPY on all the open connections and closes
@@ -2604,6 +3218,11 @@ CitusCopyDestReceiverShutdown(DestReceiver *destReceiver)
 	}
 	PG_END_TRY();
 
+	if (copyDest->localCopyExecutorState != NULL)
+	{
+		EndLocalPlacementCopies(copyDest);
+	}
+
 	heap_close(distributedRelation, NoLock);
 }
 
@@ -2737,7 +3356,7 @@ ProcessCopyStmt(CopyStmt *copyStatement, char *completionTag, const char *queryS
 
 		if (copyStatement->is_from)
 		{
-			ReceiveQueryResultViaCopy(resultId);
+			ReceiveQueryResultViaCopy(resultId, copyStatement->options);
 		}
 		else
 		{
@@ -3214,14 +3833,15 @@ ConnectionStateList(HTAB *connectionStateHash)
  */
 static CopyShardState *
 GetShardState(uint64 shardId, HTAB *shardStateHash,
-			  HTAB *connectionStateHash, bool stopOnFailure, bool *found)
+			  HTAB *connectionStateHash, bool stopOnFailure,
+			  bool shouldUseLocalCopy, bool *found)
 {
 	CopyShardState *shardState = (CopyShardState *) hash_search(shardStateHash, &shardId,
 																HASH_ENTER, found);
 	if (!*found)
 	{
 		InitializeCopyShardState(shardState, connectionStateHash,
-								 shardId, stopOnFailure);
+								 shardId, stopOnFailure, shouldUseLocalCopy);
 	}
 
 	return shardState;
@@ -3231,15 +3851,18 @@ GetShardState(uint64 shardId, HTAB *shardStateHash,
 /*
  * InitializeCopyShardState initializes the given shardState. It finds all
  * placements for the given shardId, assignes connections to them, and
- * adds them to shardState->placementStateList.
+ * adds them to shardState->placementStateList. If shouldUseLocalCopy is
+ * set, a placement on this node does not get a connection and is only
+ * marked in shardState->containsLocalPlacement.
  */
 static void
 InitializeCopyShardState(CopyShardState *shardState,
 						 HTAB *connectionStateHash, uint64 shardId,
-						 bool stopOnFailure)
+						 bool stopOnFailure, bool shouldUseLocalCopy)
 {
 	ListCell *placementCell = NULL;
 	int failedPlacementCount = 0;
+	int32 localGroupId = GetLocalGroupId();
 
 	MemoryContext localContext =
 		AllocSetContextCreateExtended(CurrentMemoryContext,
@@ -3257,11 +3880,19 @@ InitializeCopyShardState(CopyShardState *shardState,
 
 	shardState->shardId = shardId;
 	shardState->placementStateList = NIL;
+	shardState->containsLocalPlacement = false;
+	shardState->localPlacementState = NULL;
 
 	foreach(placementCell, finalizedPlacementList)
 	{
 		ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
 
+		if (shouldUseLocalCopy && placement->groupId == localGroupId)
+		{
+			shardState->containsLocalPlacement = true;
+			continue;
+		}
+
 		MultiConnection *connection =
 			CopyGetPlacementConnection(placement, stopOnFailure);
 		if (connection == NULL)
@@ -3316,6 +3947,315 @@ InitializeCopyShardState(CopyShardState *shardState,
 }
 
 
+/*
+ * ShouldUseLocalCopy returns whether the tuples of a COPY into the given
+ * relation that belong to placements on this node should be inserted directly
+ * into the shards. It follows the rules of local_executor.c: once a local
+ * execution happened in the transaction, local placements have to be accessed
+ * locally, and a transaction block that did not start with a local execution
+ * keeps using connections. Outside of transaction blocks there are no later
+ * commands to be affected, so we copy locally unless a connection has already
+ * accessed the placements.
+ */
+bool
+ShouldUseLocalCopy(Oid relationId)
+{
+	if (!EnableLocalExecution)
+	{
+		return false;
+	}
+
+	/* partitioned shards would need tuple routing, foreign shards an FDW */
+	if (get_rel_relkind(relationId) != RELKIND_RELATION)
+	{
+		return false;
+	}
+
+	if (LocalExecutionHappened)
+	{
+		return true;
+	}
+
+	if (IsMultiStatementTransaction())
+	{
+		return false;
+	}
+
+	return !AnyConnectionAccessedPlacements();
+}
+
+
+/*
+ * CreateLocalPlacementState opens the placement of the given shard on this
+ * node and prepares for inserting tuples into it. The tuples are inserted in
+ * the same way as logical replication applies changes, which checks the
+ * constraints, maintains the indexes and fires the triggers of the shard.
+ */
+static CopyLocalPlacementState *
+CreateLocalPlacementState(CitusCopyDestReceiver *copyDest, uint64 shardId)
+{
+	Oid distributedRelationId = copyDest->distributedRelationId;
+	char *shardRelationName = get_rel_name(distributedRelationId);
+	Oid schemaId = get_rel_namespace(distributedRelationId);
+
+	AppendShardIdToName(&shardRelationName, shardId);
+
+	Oid shardRelationId = get_relname_relid(shardRelationName, schemaId);
+	if (!OidIsValid(shardRelationId))
+	{
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_TABLE),
+						errmsg("could not find shard relation \"%s\" on the local node",
+							   shardRelationName)));
+	}
+
+	/* the AFTER triggers of all local placements fire when the COPY ends */
+	if (copyDest->localCopyExecutorState == NULL)
+	{
+		copyDest->localCopyExecutorState = CreateExecutorState();
+		AfterTriggerBeginQuery();
+	}
+
+	/* take the same lock as an INSERT into the shard */
+	Relation shardRelation = heap_open(shardRelationId, RowExclusiveLock);
+	TupleDesc shardTupleDescriptor = RelationGetDescr(shardRelation);
+	int attributeCount = shardTupleDescriptor->natts;
+
+	CopyLocalPlacementState *localPlacementState =
+		palloc0(sizeof(CopyLocalPlacementState));
+	localPlacementState->shardRelation = shardRelation;
+	localPlacementState->executorState =
+		CreateLocalPlacementExecutorState(shardRelation);
+	localPlacementState->slot =
+		MakeSingleTupleTableSlotCompat(shardTupleDescriptor, &TTSOpsVirtual);
+	localPlacementState->inputColumnIndexes = palloc(attributeCount * sizeof(int));
+	localPlacementState->defaultValueStates =
+		palloc0(attributeCount * sizeof(ExprState *));
+
+	/*
+	 * Match the attributes of the shard to the input columns by name, since
+	 * the shard might have different dropped columns than the distributed
+	 * table, and the input might only contain some of the columns.
+	 */
+	for (int attributeIndex = 0; attributeIndex < attributeCount; attributeIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(shardTupleDescriptor,
+													attributeIndex);
+
+		localPlacementState->inputColumnIndexes[attributeIndex] = -1;
+
+		/* generated columns are computed when the tuple is inserted */
+		if (attribute->attisdropped
+#if PG_VERSION_NUM >= 120000
+			|| attribute->attgenerated == ATTRIBUTE_GENERATED_STORED
+#endif
+			)
+		{
+			continue;
+		}
+
+		int inputColumnIndex = InputColumnIndex(copyDest, NameStr(attribute->attname));
+		if (inputColumnIndex != -1)
+		{
+			localPlacementState->inputColumnIndexes[attributeIndex] = inputColumnIndex;
+			continue;
+		}
+
+		Node *defaultExpression = build_column_default(shardRelation,
+													   attributeIndex + 1);
+		if (defaultExpression != NULL)
+		{
+			localPlacementState->defaultValueStates[attributeIndex] =
+				ExecPrepareExpr((Expr *) defaultExpression,
+								localPlacementState->executorState);
+		}
+	}
+
+	/* later commands in the transaction have to see the local writes */
+	LocalExecutionHappened = true;
+
+	return localPlacementState;
+}
+
+
+/*
+ * CreateLocalPlacementExecutorState creates an EState with the given shard
+ * relation as its result relation.
+ */
+static EState *
+CreateLocalPlacementExecutorState(Relation shardRelation)
+{
+	EState *executorState = CreateExecutorState();
+
+	RangeTblEntry *rangeTableEntry = makeNode(RangeTblEntry);
+	rangeTableEntry->rtekind = RTE_RELATION;
+	rangeTableEntry->relid = RelationGetRelid(shardRelation);
+	rangeTableEntry->relkind = shardRelation->rd_rel->relkind;
+
+#if PG_VERSION_NUM >= 120000
+	rangeTableEntry->rellockmode = RowExclusiveLock;
+	ExecInitRangeTable(executorState, list_make1(rangeTableEntry));
+#else
+	executorState->es_range_table = list_make1(rangeTableEntry);
+#endif
+
+	ResultRelInfo *resultRelationInfo = makeNode(ResultRelInfo);
+	InitResultRelInfo(resultRelationInfo, shardRelation, 1, NULL, 0);
+
+	executorState->es_result_relations = resultRelationInfo;
+	executorState->es_num_result_relations = 1;
+	executorState->es_result_relation_info = resultRelationInfo;
+	executorState->es_output_cid = GetCurrentCommandId(true);
+
+#if PG_VERSION_NUM < 120000
+
+	/* triggers might need a slot */
+	if (resultRelationInfo->ri_TrigDesc != NULL)
+	{
+		executorState->es_trig_tuple_slot = ExecInitExtraTupleSlot(executorState, NULL);
+	}
+#endif
+
+	ExecOpenIndices(resultRelationInfo, false);
+
+	return executorState;
+}
+
+
+/*
+ * InputColumnIndex returns the index of the input column with the given name
+ * in the tuples that are received, or -1 if the column is not in the input.
+ */
+static int
+InputColumnIndex(CitusCopyDestReceiver *copyDest, char *columnName)
+{
+	TupleDesc inputTupleDescriptor = copyDest->tupleDescriptor;
+	ListCell *columnNameCell = list_head(copyDest->columnNameList);
+
+	for (int columnIndex = 0; columnIndex < inputTupleDescriptor->natts &&
+		 columnNameCell != NULL; columnIndex++)
+	{
+		Form_pg_attribute inputColumn = TupleDescAttr(inputTupleDescriptor, columnIndex);
+
+		/* these are not in the column name list, see AppendCopyRowData */
+		if (inputColumn->attisdropped
+#if PG_VERSION_NUM >= 120000
+			|| inputColumn->attgenerated == ATTRIBUTE_GENERATED_STORED
+#endif
+			)
+		{
+			continue;
+		}
+
+		if (strcmp((char *) lfirst(columnNameCell), columnName) == 0)
+		{
+			return columnIndex;
+		}
+
+		columnNameCell = lnext(columnNameCell);
+	}
+
+	return -1;
+}
+
+
+/*
+ * InsertTupleIntoLocalPlacement builds a tuple of the shard from the received
+ * column values and inserts it into the local placement of the shard.
+ */
+static void
+InsertTupleIntoLocalPlacement(CitusCopyDestReceiver *copyDest,
+							  CopyLocalPlacementState *localPlacementState,
+							  Datum *columnValues, bool *columnNulls)
+{
+	CopyCoercionData *columnCoercionPaths = copyDest->columnCoercionPaths;
+	EState *executorState = localPlacementState->executorState;
+	ExprContext *expressionContext = GetPerTupleExprContext(executorState);
+	TupleTableSlot *slot = localPlacementState->slot;
+	int attributeCount = slot->tts_tupleDescriptor->natts;
+
+	ExecClearTuple(slot);
+
+	for (int attributeIndex = 0; attributeIndex < attributeCount; attributeIndex++)
+	{
+		int inputColumnIndex = localPlacementState->inputColumnIndexes[attributeIndex];
+		ExprState *defaultValueState =
+			localPlacementState->defaultValueStates[attributeIndex];
+
+		if (inputColumnIndex != -1)
+		{
+			bool isNull = columnNulls[inputColumnIndex];
+			Datum value = columnValues[inputColumnIndex];
+
+			if (!isNull)
+			{
+				value = CoerceColumnValue(value,
+										  &columnCoercionPaths[inputColumnIndex]);
+			}
+
+			slot->tts_values[attributeIndex] = value;
+			slot->tts_isnull[attributeIndex] = isNull;
+		}
+		else if (defaultValueState != NULL)
+		{
+			slot->tts_values[attributeIndex] =
+				ExecEvalExpr(defaultValueState, expressionContext,
+							 &slot->tts_isnull[attributeIndex]);
+		}
+		else
+		{
+			slot->tts_values[attributeIndex] = (Datum) 0;
+			slot->tts_isnull[attributeIndex] = true;
+		}
+	}
+
+	ExecStoreVirtualTuple(slot);
+
+	ExecSimpleRelationInsert(executorState, slot);
+
+	ResetPerTupleExprContext(executorState);
+}
+
+
+/*
+ * EndLocalPlacementCopies closes the local placements that tuples were
+ * inserted into, and fires the queued AFTER triggers such as foreign key
+ * checks.
+ */
+static void
+EndLocalPlacementCopies(CitusCopyDestReceiver *copyDest)
+{
+	EState *triggerExecutorState = copyDest->localCopyExecutorState;
+	HASH_SEQ_STATUS status;
+	CopyShardState *shardState = NULL;
+
+	hash_seq_init(&status, copyDest->shardStateHash);
+
+	while ((shardState = (CopyShardState *) hash_seq_search(&status)) != NULL)
+	{
+		CopyLocalPlacementState *localPlacementState = shardState->localPlacementState;
+		if (localPlacementState == NULL)
+		{
+			continue;
+		}
+
+		EState *executorState = localPlacementState->executorState;
+
+		ExecCloseIndices(executorState->es_result_relation_info);
+		ExecDropSingleTupleTableSlot(localPlacementState->slot);
+		FreeExecutorState(executorState);
+		heap_close(localPlacementState->shardRelation, NoLock);
+
+		shardState->localPlacementState = NULL;
+	}
+
+	AfterTriggerEndQuery(triggerExecutorState);
+	ExecCleanUpTriggerState(triggerExecutorState);
+	FreeExecutorState(triggerExecutorState);
+
+	copyDest->localCopyExecutorState = NULL;
+}
+
+
 /*
  * CopyGetPlacementConnection assigns a connection to the given placement. If
  * a connection has already been assigned the placement in the current transaction
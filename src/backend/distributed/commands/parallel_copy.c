@@ -0,0 +1,923 @@
+/*-------------------------------------------------------------------------
+ *
+ * parallel_copy.c
+ *    Parsing and routing the rows of a COPY into a distributed table in
+ *    parallel workers.
+ *
+ * When COPY into a distributed table is given the workers option, the
+ * backend that runs the COPY (the leader) only splits the input into rows
+ * of raw fields and hands out batches of rows to parallel workers over
+ * shared memory queues. The workers parse the fields with the input
+ * functions of the columns, find the shard of each row and serialize the
+ * row in the format of the COPY commands that are sent to the shards. The
+ * routed rows are sent back to the leader, which forwards them to the
+ * shard placements over its own connections.
+ *
+ * The connections stay with the leader since the writes of a COPY have to
+ * be part of the distributed transaction of the leader, which background
+ * workers cannot join. Parsing, coercing, hashing and serializing the rows
+ * is what makes a COPY CPU-bound on the coordinator, and that is what the
+ * workers take over. The leader stays in parallel mode until the workers
+ * exit, and opens the connections to the shards as the routed rows arrive.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#include "access/heapam.h"
+#include "access/parallel.h"
+#include "access/xact.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_proc.h"
+#include "commands/defrem.h"
+#include "distributed/commands/multi_copy.h"
+#include "distributed/commands/parallel_copy.h"
+#include "distributed/local_executor.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/shardinterval_utils.h"
+#include "distributed/version_compat.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+
+/* keys of the shared memory table of contents of a parallel COPY */
+#define PARALLEL_COPY_KEY_SHARED UINT64CONST(0xC175C09700000001)
+#define PARALLEL_COPY_KEY_INPUT_QUEUES UINT64CONST(0xC175C09700000002)
+#define PARALLEL_COPY_KEY_OUTPUT_QUEUES UINT64CONST(0xC175C09700000003)
+
+/* size of each of the queues between the leader and a worker */
+#define PARALLEL_COPY_QUEUE_SIZE (256 * 1024)
+
+/* rows are handed out to the workers in batches of about this size */
+#define PARALLEL_COPY_BATCH_SIZE (64 * 1024)
+
+
+/*
+ * ParallelCopyShared is the state that the leader shares with the workers of
+ * a parallel COPY.
+ */
+typedef struct ParallelCopyShared
+{
+	Oid relationId;
+	int partitionColumnIndex;
+
+	/* whether rows are serialized in binary COPY format */
+	bool binaryOutput;
+} ParallelCopyShared;
+
+
+/*
+ * ParallelCopyRouter holds what is needed to parse a row of raw fields, find
+ * its shard and serialize it.
+ */
+typedef struct ParallelCopyRouter
+{
+	Oid relationId;
+	TupleDesc tupleDescriptor;
+
+	/* attribute index for each of the raw fields of a row */
+	int fieldCount;
+	int *fieldColumnIndexes;
+
+	/* input functions of the attributes */
+	FmgrInfo *inputFunctions;
+	Oid *typeIOParams;
+	int32 *typeMods;
+
+	int partitionColumnIndex;
+	DistTableCacheEntry *tableMetadata;
+
+	/* state for serializing a row */
+	CopyOutState rowOutputState;
+	FmgrInfo *columnOutputFunctions;
+
+	/* values of the row that is routed, dropped columns stay NULL */
+	Datum *columnValues;
+	bool *columnNulls;
+
+	/* reset after every row */
+	MemoryContext rowContext;
+} ParallelCopyRouter;
+
+
+/*
+ * ParallelCopyLeader is the state of the leader of a parallel COPY.
+ */
+typedef struct ParallelCopyLeader
+{
+	CitusCopyDestReceiver *copyDest;
+	ParallelContext *parallelContext;
+
+	/* number of workers that were launched */
+	int workerCount;
+
+	/* queues for sending rows to and receiving routed rows from each worker */
+	shm_mq_handle **inputQueues;
+	shm_mq_handle **outputQueues;
+	bool *outputQueueDone;
+	int activeOutputQueueCount;
+
+	/* worker to send the next batch to */
+	int nextWorkerIndex;
+
+	/* used to route the rows on the leader if no worker could be launched */
+	ParallelCopyRouter *router;
+	StringInfo routedRowBatch;
+} ParallelCopyLeader;
+
+
+/* local function forward declarations */
+static bool ParallelSafeFunction(Oid functionId);
+static ParallelCopyLeader * StartParallelCopyWorkers(CitusCopyDestReceiver *copyDest,
+													 int parallelWorkerCount);
+static void FinishParallelCopyWorkers(ParallelCopyLeader *leader);
+static void CheckRawFieldCount(CitusCopyDestReceiver *copyDest, int fieldCount,
+							   int expectedFieldCount);
+static void AppendRawFieldsToBatch(StringInfo rowBatch, char **fieldArray,
+								   int fieldCount);
+static void DispatchRowBatch(ParallelCopyLeader *leader, StringInfo rowBatch);
+static bool ReceiveRoutedRowBatches(ParallelCopyLeader *leader);
+static void ForwardRoutedRows(CitusCopyDestReceiver *copyDest, char *routedRows,
+							  Size routedRowsSize);
+static void WaitForParallelCopyWorkers(void);
+static void ErrorParallelCopyWorkerExited(ParallelCopyLeader *leader);
+static ParallelCopyRouter * CreateParallelCopyRouter(Relation relation,
+													 int partitionColumnIndex,
+													 bool binaryOutput);
+static void RouteRowBatch(ParallelCopyRouter *router, char *rowBatch,
+						  Size rowBatchSize, StringInfo routedRowBatch);
+static uint64 RoutedRowShardId(ParallelCopyRouter *router);
+
+
+/*
+ * CanUseParallelCopy returns whether the rows of the given COPY can be parsed
+ * and routed by the given number of parallel workers. As with raw field
+ * passthrough, the input has to be text or csv that contains all columns, so
+ * that the rows can be handed out as raw fields without evaluating defaults
+ * or applying options on the leader. All functions that the workers call for
+ * a row also have to be parallel safe.
+ */
+bool
+CanUseParallelCopy(CopyStmt *copyStatement, TupleDesc tupleDescriptor,
+				   int parallelWorkerCount)
+{
+	ListCell *optionCell = NULL;
+
+	if (parallelWorkerCount <= 0)
+	{
+		return false;
+	}
+
+	/* rows for local placements would have to be inserted by the leader */
+	if (LocalExecutionHappened)
+	{
+		return false;
+	}
+
+	/* parallel contexts cannot be nested */
+	if (IsInParallelMode())
+	{
+		return false;
+	}
+
+	/* omitted columns would need their defaults evaluated on the leader */
+	if (copyStatement->attlist != NIL)
+	{
+		return false;
+	}
+
+	foreach(optionCell, copyStatement->options)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+
+		if (strcmp(option->defname, "format") == 0 &&
+			strcmp(defGetString(option), "binary") == 0)
+		{
+			return false;
+		}
+
+		/* these options are applied when converting the fields into a tuple */
+		if (strcmp(option->defname, "force_not_null") == 0 ||
+			strcmp(option->defname, "force_null") == 0)
+		{
+			return false;
+		}
+	}
+
+	bool binaryOutput = CanUseBinaryCopyFormat(tupleDescriptor);
+
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute column = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid inputFunctionId = InvalidOid;
+		Oid outputFunctionId = InvalidOid;
+		Oid typeIOParam = InvalidOid;
+		bool typeVariableLength = false;
+
+		if (column->attisdropped
+#if PG_VERSION_NUM >= 120000
+			|| column->attgenerated == ATTRIBUTE_GENERATED_STORED
+#endif
+			)
+		{
+			continue;
+		}
+
+		getTypeInputInfo(column->atttypid, &inputFunctionId, &typeIOParam);
+
+		if (binaryOutput)
+		{
+			getTypeBinaryOutputInfo(column->atttypid, &outputFunctionId,
+									&typeVariableLength);
+		}
+		else
+		{
+			getTypeOutputInfo(column->atttypid, &outputFunctionId, &typeVariableLength);
+		}
+
+		if (!ParallelSafeFunction(inputFunctionId) ||
+			!ParallelSafeFunction(outputFunctionId))
+		{
+			return false;
+		}
+	}
+
+	Oid relationId = RangeVarGetRelid(copyStatement->relation, NoLock, false);
+
+	DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(relationId);
+	if ((cacheEntry->hashFunction != NULL &&
+		 !ParallelSafeFunction(cacheEntry->hashFunction->fn_oid)) ||
+		(cacheEntry->shardColumnCompareFunction != NULL &&
+		 !ParallelSafeFunction(cacheEntry->shardColumnCompareFunction->fn_oid)))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * ParallelSafeFunction returns whether the function with the given id is
+ * marked parallel safe.
+ */
+static bool
+ParallelSafeFunction(Oid functionId)
+{
+	return func_parallel(functionId) == PROPARALLEL_SAFE;
+}
+
+
+/*
+ * ParallelCopyToExistingShards reads the rows of the COPY input as raw fields
+ * and has them parsed and routed by the given number of parallel workers,
+ * while forwarding the routed rows to the shards. It returns the number of
+ * rows that were copied. If no worker can be launched, the rows are routed
+ * by the leader itself.
+ */
+uint64
+ParallelCopyToExistingShards(CopyState copyState, CitusCopyDestReceiver *copyDest,
+							 int parallelWorkerCount)
+{
+	EState *executorState = copyDest->executorState;
+	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
+	int expectedFieldCount = AvailableColumnCount(copyDest->tupleDescriptor);
+	StringInfo rowBatch = makeStringInfo();
+	uint64 processedRowCount = 0;
+
+	ParallelCopyLeader *leader = StartParallelCopyWorkers(copyDest, parallelWorkerCount);
+
+	while (true)
+	{
+		char **fieldArray = NULL;
+		int fieldCount = 0;
+
+		ResetPerTupleExprContext(executorState);
+
+		MemoryContext oldContext = MemoryContextSwitchTo(executorTupleContext);
+
+		/* split a row from the input into fields, the workers parse them */
+		bool nextRowFound = NextCopyFromRawFields(copyState, &fieldArray, &fieldCount);
+
+		MemoryContextSwitchTo(oldContext);
+
+		if (!nextRowFound)
+		{
+			break;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+
+		CheckRawFieldCount(copyDest, fieldCount, expectedFieldCount);
+
+		AppendRawFieldsToBatch(rowBatch, fieldArray, fieldCount);
+
+		if (rowBatch->len >= PARALLEL_COPY_BATCH_SIZE)
+		{
+			DispatchRowBatch(leader, rowBatch);
+			resetStringInfo(rowBatch);
+		}
+
+		processedRowCount += 1;
+	}
+
+	if (rowBatch->len > 0)
+	{
+		DispatchRowBatch(leader, rowBatch);
+	}
+
+	FinishParallelCopyWorkers(leader);
+
+	return processedRowCount;
+}
+
+
+/*
+ * StartParallelCopyWorkers sets up the shared memory queues for the given
+ * number of workers and launches them.
+ */
+static ParallelCopyLeader *
+StartParallelCopyWorkers(CitusCopyDestReceiver *copyDest, int parallelWorkerCount)
+{
+	Size queueSpaceSize = mul_size(PARALLEL_COPY_QUEUE_SIZE, parallelWorkerCount);
+
+	ParallelCopyLeader *leader = palloc0(sizeof(ParallelCopyLeader));
+	leader->copyDest = copyDest;
+
+	/*
+	 * While the workers run, the leader is in parallel mode, which forbids
+	 * assigning a transaction id, writing to the catalogs and changing GUCs.
+	 * The coordinated transaction is started by CitusCopyDestReceiverStartup
+	 * before we get here. Forwarding a routed row reads the placements of its
+	 * shard from the metadata cache, and may open a connection, send BEGIN,
+	 * and start or switch over the COPY of a placement. Those only involve
+	 * libpq and backend-local state: the connection and placement access
+	 * hashes and the shard states of the receiver. Hence connections are
+	 * opened lazily for the shards that receive rows.
+	 */
+	EnterParallelMode();
+
+	ParallelContext *parallelContext =
+		CreateParallelContextCompat("citus", "ParallelCopyWorkerMain",
+									parallelWorkerCount);
+
+	shm_toc_estimate_chunk(&parallelContext->estimator, sizeof(ParallelCopyShared));
+	shm_toc_estimate_chunk(&parallelContext->estimator, queueSpaceSize);
+	shm_toc_estimate_chunk(&parallelContext->estimator, queueSpaceSize);
+	shm_toc_estimate_keys(&parallelContext->estimator, 3);
+
+	InitializeParallelDSM(parallelContext);
+
+	ParallelCopyShared *shared = shm_toc_allocate(parallelContext->toc,
+												  sizeof(ParallelCopyShared));
+	shared->relationId = copyDest->distributedRelationId;
+	shared->partitionColumnIndex = copyDest->partitionColumnIndex;
+	shared->binaryOutput = copyDest->copyOutState->binary;
+	shm_toc_insert(parallelContext->toc, PARALLEL_COPY_KEY_SHARED, shared);
+
+	char *inputQueueSpace = shm_toc_allocate(parallelContext->toc, queueSpaceSize);
+	shm_toc_insert(parallelContext->toc, PARALLEL_COPY_KEY_INPUT_QUEUES,
+				   inputQueueSpace);
+
+	char *outputQueueSpace = shm_toc_allocate(parallelContext->toc, queueSpaceSize);
+	shm_toc_insert(parallelContext->toc, PARALLEL_COPY_KEY_OUTPUT_QUEUES,
+				   outputQueueSpace);
+
+	/* InitializeParallelDSM might have reduced the number of workers */
+	int plannedWorkerCount = parallelContext->nworkers;
+
+	leader->inputQueues = palloc0(parallelWorkerCount * sizeof(shm_mq_handle *));
+	leader->outputQueues = palloc0(parallelWorkerCount * sizeof(shm_mq_handle *));
+	leader->outputQueueDone = palloc0(parallelWorkerCount * sizeof(bool));
+
+	for (int workerIndex = 0; workerIndex < plannedWorkerCount; workerIndex++)
+	{
+		Size queueOffset = mul_size(PARALLEL_COPY_QUEUE_SIZE, workerIndex);
+
+		shm_mq *inputQueue = shm_mq_create(inputQueueSpace + queueOffset,
+										   PARALLEL_COPY_QUEUE_SIZE);
+		shm_mq_set_sender(inputQueue, MyProc);
+		leader->inputQueues[workerIndex] =
+			shm_mq_attach(inputQueue, parallelContext->seg, NULL);
+
+		shm_mq *outputQueue = shm_mq_create(outputQueueSpace + queueOffset,
+											PARALLEL_COPY_QUEUE_SIZE);
+		shm_mq_set_receiver(outputQueue, MyProc);
+		leader->outputQueues[workerIndex] =
+			shm_mq_attach(outputQueue, parallelContext->seg, NULL);
+	}
+
+	LaunchParallelWorkers(parallelContext);
+
+	leader->parallelContext = parallelContext;
+	leader->workerCount = parallelContext->nworkers_launched;
+	leader->activeOutputQueueCount = leader->workerCount;
+
+	/* notice when a worker dies before attaching to its queues */
+	for (int workerIndex = 0; workerIndex < leader->workerCount; workerIndex++)
+	{
+		BackgroundWorkerHandle *workerHandle =
+			parallelContext->worker[workerIndex].bgwhandle;
+
+		shm_mq_set_handle(leader->inputQueues[workerIndex], workerHandle);
+		shm_mq_set_handle(leader->outputQueues[workerIndex], workerHandle);
+	}
+
+	if (leader->workerCount == 0)
+	{
+		ereport(DEBUG1, (errmsg("could not launch parallel COPY workers, "
+								"routing rows in the current backend")));
+
+		/* no need to stay in parallel mode without workers */
+		DestroyParallelContext(parallelContext);
+		ExitParallelMode();
+
+		leader->parallelContext = NULL;
+
+		leader->router = CreateParallelCopyRouter(copyDest->distributedRelation,
+												  copyDest->partitionColumnIndex,
+												  copyDest->copyOutState->binary);
+		leader->routedRowBatch = makeStringInfo();
+	}
+
+	return leader;
+}
+
+
+/*
+ * FinishParallelCopyWorkers tells the workers that there are no more rows,
+ * forwards the remaining routed rows and waits for the workers to exit.
+ */
+static void
+FinishParallelCopyWorkers(ParallelCopyLeader *leader)
+{
+	ParallelContext *parallelContext = leader->parallelContext;
+
+	/* workers exit once they routed all rows of their detached queue */
+	for (int workerIndex = 0; workerIndex < leader->workerCount; workerIndex++)
+	{
+		shm_mq_detach(leader->inputQueues[workerIndex]);
+	}
+
+	while (leader->activeOutputQueueCount > 0)
+	{
+		if (!ReceiveRoutedRowBatches(leader))
+		{
+			WaitForParallelCopyWorkers();
+		}
+	}
+
+	if (parallelContext == NULL)
+	{
+		/* rows were routed by the leader, which is not in parallel mode */
+		return;
+	}
+
+	/* rethrows errors of the workers */
+	WaitForParallelWorkersToFinish(parallelContext);
+
+	DestroyParallelContext(parallelContext);
+	ExitParallelMode();
+}
+
+
+/*
+ * CheckRawFieldCount errors out if a row of the input does not have a field
+ * for each column, with the same errors as NextCopyFrom.
+ */
+static void
+CheckRawFieldCount(CitusCopyDestReceiver *copyDest, int fieldCount,
+				   int expectedFieldCount)
+{
+	if (fieldCount > expectedFieldCount)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("extra data after last expected column")));
+	}
+	else if (fieldCount < expectedFieldCount)
+	{
+		char *columnName = (char *) list_nth(copyDest->columnNameList, fieldCount);
+
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("missing data for column \"%s\"", columnName)));
+	}
+}
+
+
+/*
+ * AppendRawFieldsToBatch appends a row of raw fields to the given batch. Each
+ * field is written as its length, or -1 for NULL, followed by the field and
+ * a terminating zero byte such that workers can parse it in place.
+ */
+static void
+AppendRawFieldsToBatch(StringInfo rowBatch, char **fieldArray, int fieldCount)
+{
+	for (int fieldIndex = 0; fieldIndex < fieldCount; fieldIndex++)
+	{
+		char *fieldValue = fieldArray[fieldIndex];
+		int32 fieldLength = -1;
+
+		if (fieldValue == NULL)
+		{
+			appendBinaryStringInfo(rowBatch, (char *) &fieldLength, sizeof(int32));
+			continue;
+		}
+
+		fieldLength = strlen(fieldValue);
+
+		appendBinaryStringInfo(rowBatch, (char *) &fieldLength, sizeof(int32));
+		appendBinaryStringInfo(rowBatch, fieldValue, fieldLength + 1);
+	}
+}
+
+
+/*
+ * DispatchRowBatch hands out the given batch of rows to the next worker. While
+ * the queue of the worker is full, the rows that the workers routed in the
+ * meantime are forwarded to the shards, so that workers that wait for the
+ * leader to receive their rows do not block the leader in turn.
+ */
+static void
+DispatchRowBatch(ParallelCopyLeader *leader, StringInfo rowBatch)
+{
+	if (leader->workerCount == 0)
+	{
+		StringInfo routedRowBatch = leader->routedRowBatch;
+
+		RouteRowBatch(leader->router, rowBatch->data, rowBatch->len, routedRowBatch);
+		ForwardRoutedRows(leader->copyDest, routedRowBatch->data, routedRowBatch->len);
+		resetStringInfo(routedRowBatch);
+
+		return;
+	}
+
+	int workerIndex = leader->nextWorkerIndex;
+	shm_mq_handle *inputQueue = leader->inputQueues[workerIndex];
+
+	leader->nextWorkerIndex = (workerIndex + 1) % leader->workerCount;
+
+	while (true)
+	{
+		/* a partially sent batch is continued when called again */
+		shm_mq_result result = shm_mq_send(inputQueue, rowBatch->len, rowBatch->data,
+										   true);
+		if (result == SHM_MQ_SUCCESS)
+		{
+			break;
+		}
+		else if (result == SHM_MQ_DETACHED)
+		{
+			ErrorParallelCopyWorkerExited(leader);
+		}
+
+		if (!ReceiveRoutedRowBatches(leader))
+		{
+			WaitForParallelCopyWorkers();
+		}
+	}
+}
+
+
+/*
+ * ReceiveRoutedRowBatches forwards the batches of routed rows that are ready
+ * in the queues of the workers, without waiting. It returns whether any batch
+ * was received or any worker finished.
+ */
+static bool
+ReceiveRoutedRowBatches(ParallelCopyLeader *leader)
+{
+	bool madeProgress = false;
+
+	for (int workerIndex = 0; workerIndex < leader->workerCount; workerIndex++)
+	{
+		Size routedRowsSize = 0;
+		void *routedRows = NULL;
+
+		if (leader->outputQueueDone[workerIndex])
+		{
+			continue;
+		}
+
+		shm_mq_result result = shm_mq_receive(leader->outputQueues[workerIndex],
+											  &routedRowsSize, &routedRows, true);
+		if (result == SHM_MQ_SUCCESS)
+		{
+			ForwardRoutedRows(leader->copyDest, routedRows, routedRowsSize);
+			madeProgress = true;
+		}
+		else if (result == SHM_MQ_DETACHED)
+		{
+			/* the worker exited, errors are reported by the parallel context */
+			leader->outputQueueDone[workerIndex] = true;
+			leader->activeOutputQueueCount--;
+			madeProgress = true;
+		}
+	}
+
+	return madeProgress;
+}
+
+
+/*
+ * ForwardRoutedRows sends each row in the given batch of routed rows to the
+ * placements of its shard.
+ */
+static void
+ForwardRoutedRows(CitusCopyDestReceiver *copyDest, char *routedRows,
+				  Size routedRowsSize)
+{
+	char *currentPosition = routedRows;
+	char *endPosition = routedRows + routedRowsSize;
+
+	while (currentPosition < endPosition)
+	{
+		uint64 shardId = 0;
+		int32 rowLength = 0;
+		StringInfoData rowData;
+
+		memcpy(&shardId, currentPosition, sizeof(uint64));
+		currentPosition += sizeof(uint64);
+
+		memcpy(&rowLength, currentPosition, sizeof(int32));
+		currentPosition += sizeof(int32);
+
+		/* the row is only read, so point into the batch */
+		rowData.data = currentPosition;
+		rowData.len = rowLength;
+		rowData.maxlen = rowLength;
+		rowData.cursor = 0;
+
+		CitusCopyDestReceiverReceiveRow(copyDest, shardId, &rowData);
+
+		currentPosition += rowLength;
+	}
+}
+
+
+/*
+ * WaitForParallelCopyWorkers waits until a worker makes progress with its
+ * queues, which sets the latch of the leader.
+ */
+static void
+WaitForParallelCopyWorkers(void)
+{
+	int rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_POSTMASTER_DEATH, -1L,
+					   PG_WAIT_EXTENSION);
+
+	if (rc & WL_POSTMASTER_DEATH)
+	{
+		proc_exit(1);
+	}
+
+	ResetLatch(MyLatch);
+
+	CHECK_FOR_INTERRUPTS();
+}
+
+
+/*
+ * ErrorParallelCopyWorkerExited errors out when a worker stopped receiving
+ * rows. The error of the worker is reported if it had one.
+ */
+static void
+ErrorParallelCopyWorkerExited(ParallelCopyLeader *leader)
+{
+	WaitForParallelWorkersToFinish(leader->parallelContext);
+
+	ereport(ERROR, (errmsg("parallel COPY worker exited unexpectedly")));
+}
+
+
+/*
+ * ParallelCopyWorkerMain is the entry point of the workers of a parallel COPY.
+ * It routes the batches of rows that the leader sends until the leader
+ * detaches from the queue, and sends the routed rows back.
+ */
+void
+ParallelCopyWorkerMain(dsm_segment *segment, shm_toc *toc)
+{
+	Size queueOffset = mul_size(PARALLEL_COPY_QUEUE_SIZE, ParallelWorkerNumber);
+
+	ParallelCopyShared *shared = shm_toc_lookup(toc, PARALLEL_COPY_KEY_SHARED, false);
+	char *inputQueueSpace = shm_toc_lookup(toc, PARALLEL_COPY_KEY_INPUT_QUEUES, false);
+	char *outputQueueSpace = shm_toc_lookup(toc, PARALLEL_COPY_KEY_OUTPUT_QUEUES,
+											false);
+
+	shm_mq *inputQueue = (shm_mq *) (inputQueueSpace + queueOffset);
+	shm_mq_set_receiver(inputQueue, MyProc);
+	shm_mq_handle *inputQueueHandle = shm_mq_attach(inputQueue, segment, NULL);
+
+	shm_mq *outputQueue = (shm_mq *) (outputQueueSpace + queueOffset);
+	shm_mq_set_sender(outputQueue, MyProc);
+	shm_mq_handle *outputQueueHandle = shm_mq_attach(outputQueue, segment, NULL);
+
+	Relation relation = heap_open(shared->relationId, AccessShareLock);
+
+	ParallelCopyRouter *router = CreateParallelCopyRouter(relation,
+														  shared->partitionColumnIndex,
+														  shared->binaryOutput);
+	StringInfo routedRowBatch = makeStringInfo();
+
+	while (true)
+	{
+		Size rowBatchSize = 0;
+		void *rowBatch = NULL;
+
+		shm_mq_result result = shm_mq_receive(inputQueueHandle, &rowBatchSize,
+											  &rowBatch, false);
+		if (result == SHM_MQ_DETACHED)
+		{
+			/* the leader sent all rows */
+			break;
+		}
+
+		RouteRowBatch(router, rowBatch, rowBatchSize, routedRowBatch);
+
+		result = shm_mq_send(outputQueueHandle, routedRowBatch->len,
+							 routedRowBatch->data, false);
+		if (result == SHM_MQ_DETACHED)
+		{
+			/* the leader is erroring out */
+			break;
+		}
+
+		resetStringInfo(routedRowBatch);
+	}
+
+	heap_close(relation, AccessShareLock);
+}
+
+
+/*
+ * CreateParallelCopyRouter prepares for routing rows of raw fields into the
+ * shards of the given relation.
+ */
+static ParallelCopyRouter *
+CreateParallelCopyRouter(Relation relation, int partitionColumnIndex,
+						 bool binaryOutput)
+{
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	int columnCount = tupleDescriptor->natts;
+
+	ParallelCopyRouter *router = palloc0(sizeof(ParallelCopyRouter));
+	router->relationId = RelationGetRelid(relation);
+	router->tupleDescriptor = tupleDescriptor;
+	router->fieldColumnIndexes = palloc0(columnCount * sizeof(int));
+	router->inputFunctions = palloc0(columnCount * sizeof(FmgrInfo));
+	router->typeIOParams = palloc0(columnCount * sizeof(Oid));
+	router->typeMods = palloc0(columnCount * sizeof(int32));
+	router->partitionColumnIndex = partitionColumnIndex;
+	router->tableMetadata = DistributedTableCacheEntry(router->relationId);
+	router->columnValues = palloc0(columnCount * sizeof(Datum));
+	router->columnNulls = palloc0(columnCount * sizeof(bool));
+	router->rowContext = AllocSetContextCreate(CurrentMemoryContext,
+											   "Parallel COPY Row Context",
+											   ALLOCSET_DEFAULT_SIZES);
+
+	/* the raw fields are the columns that AppendCopyRowData writes */
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute column = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid inputFunctionId = InvalidOid;
+
+		router->columnNulls[columnIndex] = true;
+
+		if (column->attisdropped
+#if PG_VERSION_NUM >= 120000
+			|| column->attgenerated == ATTRIBUTE_GENERATED_STORED
+#endif
+			)
+		{
+			continue;
+		}
+
+		getTypeInputInfo(column->atttypid, &inputFunctionId,
+						 &router->typeIOParams[columnIndex]);
+		fmgr_info(inputFunctionId, &router->inputFunctions[columnIndex]);
+		router->typeMods[columnIndex] = column->atttypmod;
+
+		router->fieldColumnIndexes[router->fieldCount] = columnIndex;
+		router->fieldCount++;
+	}
+
+	/* serialize rows the same way as CitusCopyDestReceiverStartup */
+	CopyOutState rowOutputState = (CopyOutState) palloc0(sizeof(CopyOutStateData));
+	rowOutputState->delim = (char *) "\t";
+	rowOutputState->null_print = (char *) "\\N";
+	rowOutputState->null_print_client = (char *) "\\N";
+	rowOutputState->binary = binaryOutput;
+	rowOutputState->fe_msgbuf = makeStringInfo();
+	rowOutputState->rowcontext = router->rowContext;
+	router->rowOutputState = rowOutputState;
+
+	router->columnOutputFunctions = ColumnOutputFunctions(tupleDescriptor,
+														  binaryOutput);
+
+	return router;
+}
+
+
+/*
+ * RouteRowBatch parses the rows in the given batch of raw fields, and appends
+ * each row to routedRowBatch as the id of its shard, followed by the length
+ * of the serialized row and the row itself.
+ */
+static void
+RouteRowBatch(ParallelCopyRouter *router, char *rowBatch, Size rowBatchSize,
+			  StringInfo routedRowBatch)
+{
+	StringInfo rowData = router->rowOutputState->fe_msgbuf;
+	char *currentPosition = rowBatch;
+	char *endPosition = rowBatch + rowBatchSize;
+
+	while (currentPosition < endPosition)
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(router->rowContext);
+
+		for (int fieldIndex = 0; fieldIndex < router->fieldCount; fieldIndex++)
+		{
+			int columnIndex = router->fieldColumnIndexes[fieldIndex];
+			int32 fieldLength = 0;
+			char *fieldValue = NULL;
+
+			memcpy(&fieldLength, currentPosition, sizeof(int32));
+			currentPosition += sizeof(int32);
+
+			if (fieldLength >= 0)
+			{
+				fieldValue = currentPosition;
+				currentPosition += fieldLength + 1;
+			}
+
+			/* called for NULL as well, such that domain constraints are checked */
+			router->columnValues[columnIndex] =
+				InputFunctionCall(&router->inputFunctions[columnIndex], fieldValue,
+								  router->typeIOParams[columnIndex],
+								  router->typeMods[columnIndex]);
+			router->columnNulls[columnIndex] = (fieldValue == NULL);
+		}
+
+		uint64 shardId = RoutedRowShardId(router);
+		int32 rowLength = 0;
+
+		resetStringInfo(rowData);
+		AppendCopyRowData(router->columnValues, router->columnNulls,
+						  router->tupleDescriptor, router->rowOutputState,
+						  router->columnOutputFunctions, NULL);
+
+		MemoryContextSwitchTo(oldContext);
+
+		rowLength = rowData->len;
+
+		appendBinaryStringInfo(routedRowBatch, (char *) &shardId, sizeof(uint64));
+		appendBinaryStringInfo(routedRowBatch, (char *) &rowLength, sizeof(int32));
+		appendBinaryStringInfo(routedRowBatch, rowData->data, rowLength);
+
+		MemoryContextReset(router->rowContext);
+	}
+}
+
+
+/*
+ * RoutedRowShardId returns the id of the shard that the row in the router
+ * belongs to.
+ */
+static uint64
+RoutedRowShardId(ParallelCopyRouter *router)
+{
+	int partitionColumnIndex = router->partitionColumnIndex;
+	Datum partitionColumnValue = 0;
+
+	/* reference tables have a single shard and no partition column */
+	if (partitionColumnIndex != INVALID_PARTITION_COLUMN_INDEX)
+	{
+		if (router->columnNulls[partitionColumnIndex])
+		{
+			ErrorPartitionColumnIsNull(router->relationId);
+		}
+
+		partitionColumnValue = router->columnValues[partitionColumnIndex];
+	}
+
+	ShardInterval *shardInterval = FindShardInterval(partitionColumnValue,
+													 router->tableMetadata);
+	if (shardInterval == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						errmsg("could not find shard for partition column "
+							   "value")));
+	}
+
+	return shardInterval->shardId;
+}
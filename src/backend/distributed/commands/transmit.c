@@ -40,6 +40,20 @@ static bool ReceiveCopyData(StringInfo copyData);
  */
 void
 RedirectCopyDataToRegularFile(const char *filename)
+{
+	RedirectCopyDataToRegularFileAndForward(filename, NULL, NULL);
+}
+
+
+/*
+ * RedirectCopyDataToRegularFileAndForward does the same as
+ * RedirectCopyDataToRegularFile, but also passes every chunk of received data
+ * to forwardFunction, if any, before appending it to the file.
+ */
+void
+RedirectCopyDataToRegularFileAndForward(const char *filename,
+										CopyDataForwardFunction forwardFunction,
+										void *forwardArg)
 {
 	StringInfo copyData = makeStringInfo();
 	const int fileFlags = (O_APPEND | O_CREAT | O_RDWR | O_TRUNC | PG_BINARY);
@@ -55,6 +69,11 @@ RedirectCopyDataToRegularFile(const char *filename)
 		/* if received data has contents, append to regular file */
 		if (copyData->len > 0)
 		{
+			if (forwardFunction != NULL)
+			{
+				forwardFunction(copyData, forwardArg);
+			}
+
 			int appended = FileWriteCompat(&fileCompat, copyData->data,
 										   copyData->len, PG_WAIT_IO);
 
@@ -49,6 +49,7 @@
 #include "distributed/metadata_sync.h"
 #include "distributed/multi_executor.h"
 #include "distributed/resource_lock.h"
+#include "distributed/shared_metadata_cache.h"
 #include "distributed/transmit.h"
 #include "distributed/version_compat.h"
 #include "distributed/worker_transaction.h"
@@ -136,6 +137,11 @@ multi_ProcessUtility(PlannedStmt *pstmt,
 		 * that state. Since we never need to intercept transaction statements,
 		 * skip our checks and immediately fall into standard_ProcessUtility.
 		 */
+		if (IsA(parsetree, TransactionStmt))
+		{
+			SharedMetadataCacheTransactionStmt((TransactionStmt *) parsetree);
+		}
+
 		standard_ProcessUtility(pstmt, queryString, context,
 								params, queryEnv, dest, completionTag);
 
@@ -24,22 +24,30 @@
 #include "distributed/metadata_cache.h"
 #include "distributed/hash_helpers.h"
 #include "distributed/placement_connection.h"
+#include "distributed/prepared_statement_cache.h"
 #include "distributed/run_from_same_connection.h"
+#include "distributed/shared_connection_stats.h"
 #include "distributed/cancel_utils.h"
 #include "distributed/remote_commands.h"
 #include "distributed/version_compat.h"
+#include "distributed/worker_manager.h"
 #include "mb/pg_wchar.h"
+#include "storage/ipc.h"
 #include "utils/hsearch.h"
 #include "utils/memutils.h"
 
 
 int NodeConnectionTimeout = 5000;
 int MaxCachedConnectionsPerWorker = 1;
+bool PrewarmConnections = false;
 
 HTAB *ConnectionHash = NULL;
 HTAB *ConnParamsHash = NULL;
 MemoryContext ConnectionContext = NULL;
 
+/* whether connections started by PrewarmWorkerConnections may still be connecting */
+static bool ConnectionsPrewarming = false;
+
 static uint32 ConnectionHashHash(const void *key, Size keysize);
 static int ConnectionHashCompare(const void *a, const void *b, Size keysize);
 static MultiConnection * StartConnectionEstablishment(ConnectionHashKey *key);
@@ -53,6 +61,10 @@ static MultiConnection * FindAvailableConnection(dlist_head *connections, uint32
 static void GivePurposeToConnection(MultiConnection *connection, int flags);
 static bool RemoteTransactionIdle(MultiConnection *connection);
 static int EventSetSizeForConnectionList(List *connections);
+static bool ReserveSharedConnectionSlot(const char *hostname, int port, uint32 flags);
+static void ReleaseSharedConnectionSlot(MultiConnection *connection);
+static void ReleaseAllSharedConnectionSlots(int code, Datum arg);
+static bool IsCitusInitiatedBackend(void);
 
 /* types for async connection management */
 enum MultiConnectionPhase
@@ -151,6 +163,9 @@ AfterXactConnectionHandling(bool isCommit)
 	HASH_SEQ_STATUS status;
 	ConnectionHashEntry *entry;
 
+	/* prewarmed connections that are not established by now are closed below */
+	ConnectionsPrewarming = false;
+
 	hash_seq_init(&status, ConnectionHash);
 	while ((entry = (ConnectionHashEntry *) hash_seq_search(&status)) != 0)
 	{
@@ -165,6 +180,129 @@ AfterXactConnectionHandling(bool isCommit)
 }
 
 
+/*
+ * PrewarmWorkerConnections starts establishing a connection to the nodes of
+ * the given shard placements once the session has planned its first
+ * distributed query, if citus.prewarm_connections is enabled. Only the nodes
+ * that the query accesses are connected to, and the connections are
+ * established in the background while the executor starts up, e.g. while it
+ * runs the subplans of the query. The executor then finds them in the
+ * connection cache. Unused connections are kept if they are established by
+ * the end of the transaction.
+ *
+ * The connections do not exceed the shared connection budget, and are kept
+ * according to citus.max_cached_conns_per_worker like any other connection.
+ */
+void
+PrewarmWorkerConnections(List *placementList)
+{
+	static bool connectionsPrewarmed = false;
+	ListCell *placementCell = NULL;
+
+	if (!PrewarmConnections || connectionsPrewarmed)
+	{
+		return;
+	}
+
+	connectionsPrewarmed = true;
+
+	/* internal connections do not cache connections, so do not bother */
+	if (IsCitusInitiatedBackend())
+	{
+		return;
+	}
+
+	int32 localGroupId = GetLocalGroupId();
+
+	foreach(placementCell, placementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+		int connectionFlags = OPTIONAL_CONNECTION;
+
+		if (placement->groupId == localGroupId)
+		{
+			/* local shards are accessed without connections if possible */
+			continue;
+		}
+
+		/* returns the connection of an earlier placement on the same node */
+		MultiConnection *connection = StartNodeConnection(connectionFlags,
+														  placement->nodeName,
+														  placement->nodePort);
+		if (connection == NULL)
+		{
+			/* the shared connection budget is used up */
+			continue;
+		}
+
+		if (PQstatus(connection->pgConn) != CONNECTION_OK)
+		{
+			connection->prewarmed = true;
+			ConnectionsPrewarming = true;
+		}
+	}
+}
+
+
+/*
+ * FinishPrewarmedConnections processes what the workers sent so far on the
+ * connections started by PrewarmWorkerConnections that the transaction did
+ * not use, such that the ones that are established by now can be cached at
+ * the end of the transaction. The function does not wait for the workers, so
+ * committing is never delayed by prewarming. Connections that are not
+ * established yet are closed at the end of the transaction, without failing
+ * it.
+ */
+void
+FinishPrewarmedConnections(void)
+{
+	HASH_SEQ_STATUS status;
+	ConnectionHashEntry *entry;
+
+	if (!ConnectionsPrewarming)
+	{
+		return;
+	}
+
+	hash_seq_init(&status, ConnectionHash);
+	while ((entry = (ConnectionHashEntry *) hash_seq_search(&status)) != 0)
+	{
+		dlist_iter iter;
+
+		dlist_foreach(iter, entry->connections)
+		{
+			MultiConnection *connection =
+				dlist_container(MultiConnection, connectionNode, iter.cur);
+
+			if (connection->prewarmed)
+			{
+				connection->prewarmed = false;
+
+				if (PQstatus(connection->pgConn) != CONNECTION_OK &&
+					PQstatus(connection->pgConn) != CONNECTION_BAD)
+				{
+					MultiConnectionPollState connectionState;
+					bool connectionStateChanged = true;
+
+					memset(&connectionState, 0, sizeof(connectionState));
+					connectionState.connection = connection;
+					connectionState.phase = MULTI_CONNECTION_PHASE_CONNECTING;
+
+					/* poll until the connection waits for the worker */
+					while (connectionStateChanged &&
+						   connectionState.phase == MULTI_CONNECTION_PHASE_CONNECTING)
+					{
+						connectionStateChanged = MultiConnectionStatePoll(&connectionState);
+					}
+				}
+			}
+		}
+	}
+
+	ConnectionsPrewarming = false;
+}
+
+
 /*
  * GetNodeConnection() establishes a connection to remote node, using default
  * user and database.
@@ -244,6 +382,8 @@ StartWorkerListConnections(List *workerNodeList, uint32 flags, const char *user,
  * If user or database are NULL, the current session's defaults are used. The
  * following flags influence connection establishment behaviour:
  * - FORCE_NEW_CONNECTION - a new connection is required
+ * - OPTIONAL_CONNECTION - return NULL instead of opening a new connection if
+ *   that would exceed citus.max_shared_pool_size for the node
  *
  * The returned connection has only been initiated, not fully
  * established. That's useful to allow parallel connection establishment. If
@@ -318,10 +458,22 @@ StartNodeUserDatabaseConnection(uint32 flags, const char *hostname, int32 port,
 
 	/*
 	 * Either no caching desired, or no pre-established, non-claimed,
-	 * connection present. Initiate connection establishment.
+	 * connection present. Initiate connection establishment, if the
+	 * connections of all backends to the node stay within the budget.
 	 */
+	bool sharedCounterIncremented = false;
+	if (GetMaxSharedPoolSize() != DISABLE_SHARED_CONNECTION_BUDGET)
+	{
+		if (!ReserveSharedConnectionSlot(hostname, port, flags))
+		{
+			return NULL;
+		}
+
+		sharedCounterIncremented = true;
+	}
 
 	connection = StartConnectionEstablishment(&key);
+	connection->sharedCounterIncremented = sharedCounterIncremented;
 
 	dlist_push_tail(entry->connections, &connection->connectionNode);
 
@@ -463,6 +615,8 @@ CloseConnection(MultiConnection *connection)
 	/* close connection */
 	PQfinish(connection->pgConn);
 	connection->pgConn = NULL;
+	ReleaseSharedConnectionSlot(connection);
+	FreePreparedStatementCache(connection);
 
 	strlcpy(key.hostname, connection->hostname, MAX_NODE_LENGTH);
 	key.port = connection->port;
@@ -513,6 +667,91 @@ ShutdownConnection(MultiConnection *connection)
 	}
 	PQfinish(connection->pgConn);
 	connection->pgConn = NULL;
+	ReleaseSharedConnectionSlot(connection);
+	FreePreparedStatementCache(connection);
+}
+
+
+/*
+ * ReserveSharedConnectionSlot counts a new connection to the given node in
+ * the connection budget that all backends share. If the caller passed the
+ * OPTIONAL_CONNECTION flag, the connection is only counted if the budget is
+ * not used up yet, and the function returns whether it was. Other connections
+ * are always counted, since the caller cannot proceed without them.
+ */
+static bool
+ReserveSharedConnectionSlot(const char *hostname, int port, uint32 flags)
+{
+	static bool exitCallbackRegistered = false;
+
+	if (flags & OPTIONAL_CONNECTION)
+	{
+		if (!TryToIncrementSharedConnectionCounter(hostname, port))
+		{
+			ereport(DEBUG4, (errmsg("reached the shared pool size of %s:%d",
+									hostname, port)));
+			return false;
+		}
+	}
+	else
+	{
+		IncrementSharedConnectionCounter(hostname, port);
+	}
+
+	/* release the counted connections if the backend exits with them open */
+	if (!exitCallbackRegistered)
+	{
+		before_shmem_exit(ReleaseAllSharedConnectionSlots, 0);
+		exitCallbackRegistered = true;
+	}
+
+	return true;
+}
+
+
+/*
+ * ReleaseSharedConnectionSlot removes the given connection from the shared
+ * connection budget after it was closed, if it was counted. It is safe to
+ * call more than once for the same connection.
+ */
+static void
+ReleaseSharedConnectionSlot(MultiConnection *connection)
+{
+	if (!connection->sharedCounterIncremented)
+	{
+		return;
+	}
+
+	DecrementSharedConnectionCounter(connection->hostname, connection->port);
+	connection->sharedCounterIncremented = false;
+}
+
+
+/*
+ * ReleaseAllSharedConnectionSlots is called when the backend exits, and
+ * removes the connections that the backend still has open from the shared
+ * connection budget. The connections themselves are closed by the operating
+ * system.
+ */
+static void
+ReleaseAllSharedConnectionSlots(int code, Datum arg)
+{
+	HASH_SEQ_STATUS status;
+	ConnectionHashEntry *entry;
+
+	hash_seq_init(&status, ConnectionHash);
+	while ((entry = (ConnectionHashEntry *) hash_seq_search(&status)) != 0)
+	{
+		dlist_iter iter;
+
+		dlist_foreach(iter, entry->connections)
+		{
+			MultiConnection *connection =
+				dlist_container(MultiConnection, connectionNode, iter.cur);
+
+			ReleaseSharedConnectionSlot(connection);
+		}
+	}
 }
 
 
@@ -533,6 +772,7 @@ MultiConnectionStatePoll(MultiConnectionPollState *connectionState)
 	if (status == CONNECTION_OK)
 	{
 		connectionState->phase = MULTI_CONNECTION_PHASE_CONNECTED;
+		MarkConnectionConnected(connection);
 		return true;
 	}
 	else if (status == CONNECTION_BAD)
@@ -559,6 +799,7 @@ MultiConnectionStatePoll(MultiConnectionPollState *connectionState)
 	else if (connectionState->pollmode == PGRES_POLLING_OK)
 	{
 		connectionState->phase = MULTI_CONNECTION_PHASE_CONNECTED;
+		MarkConnectionConnected(connection);
 		return true;
 	}
 	else
@@ -651,6 +892,25 @@ WaitEventSetFromMultiConnectionStates(List *connections, int *waitCount)
 }
 
 
+/*
+ * MarkConnectionConnected records how long it took to establish the given
+ * connection, the first time it is found to be established.
+ */
+void
+MarkConnectionConnected(MultiConnection *connection)
+{
+	if (connection->connectionEstablishmentEnd != 0)
+	{
+		return;
+	}
+
+	connection->connectionEstablishmentEnd = GetCurrentTimestamp();
+
+	RecordLatency(CONNECTION_ESTABLISHMENT_LATENCY, connection->connectionStart,
+				  connection->connectionEstablishmentEnd);
+}
+
+
 /*
  * MultiConnectionStateEventMask returns the eventMask use by the WaitEventSet for the
  * for the socket associated with the connection based on the pollmode PQconnectPoll
@@ -876,6 +1136,7 @@ CloseNotReadyMultiConnectionStates(List *connectionStates)
 		/* close connection, otherwise we take up resource on the other side */
 		PQfinish(connection->pgConn);
 		connection->pgConn = NULL;
+		ReleaseSharedConnectionSlot(connection);
 	}
 }
 
@@ -1115,20 +1376,12 @@ AfterXactHostConnectionHandling(ConnectionHashEntry *entry, bool isCommit)
 static bool
 ShouldShutdownConnection(MultiConnection *connection, const int cachedConnectionCount)
 {
-	bool isCitusInitiatedBackend = false;
-
 	/*
 	 * When we are in a backend that was created to serve an internal connection
 	 * from the coordinator or another worker, we disable connection caching to avoid
-	 * escalating the number of cached connections. We can recognize such backends
-	 * from their application name.
+	 * escalating the number of cached connections.
 	 */
-	if (application_name != NULL && strcmp(application_name, CITUS_APPLICATION_NAME) == 0)
-	{
-		isCitusInitiatedBackend = true;
-	}
-
-	return isCitusInitiatedBackend ||
+	return IsCitusInitiatedBackend() ||
 		   cachedConnectionCount >= MaxCachedConnectionsPerWorker ||
 		   connection->forceCloseAtTransactionEnd ||
 		   PQstatus(connection->pgConn) != CONNECTION_OK ||
@@ -1136,6 +1389,19 @@ ShouldShutdownConnection(MultiConnection *connection, const int cachedConnection
 }
 
 
+/*
+ * IsCitusInitiatedBackend returns whether the backend was created to serve an
+ * internal connection from the coordinator or another worker. We can
+ * recognize such backends from their application name.
+ */
+static bool
+IsCitusInitiatedBackend(void)
+{
+	return application_name != NULL &&
+		   strcmp(application_name, CITUS_APPLICATION_NAME) == 0;
+}
+
+
 /*
  * ResetConnection preserves the given connection for later usage by
  * resetting its states.
@@ -0,0 +1,451 @@
+/*-------------------------------------------------------------------------
+ *
+ * prepared_statement_cache.c
+ *   Keeps track of the named prepared statements that a backend created on
+ *   each of its connections to the workers, such that repeated executions of
+ *   the same parameterized shard query only need a Bind/Execute round trip
+ *   instead of having the worker parse and plan the query every time.
+ *
+ *   Statements are keyed by the shard-specific query text, so they can only
+ *   be reused for the same shard. A shard query is prepared the second time it
+ *   is sent over a connection, such that queries that only run once do not
+ *   pay for an additional round trip. The caches of all connections are
+ *   dropped when a distributed table changes (e.g. due to DDL), since the
+ *   worker would otherwise refuse to execute a statement whose result type
+ *   changed.
+ *
+ *   None of the functions wait for the worker. Commands are sent without
+ *   waiting for their results, which the adaptive executor passes to
+ *   FinishPreparingStatement from its event loop.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "libpq-fe.h"
+
+#include "access/hash.h"
+#include "distributed/connection_management.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/prepared_statement_cache.h"
+#include "distributed/remote_commands.h"
+#include "distributed/tuplestore.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+/* number of columns returned by citus_prepared_statement_cache_stats */
+#define PREPARED_STATEMENT_CACHE_STATS_COLUMNS 2
+
+
+/*
+ * PreparedStatementState describes how far a shard query got on its way to
+ * being prepared on a connection.
+ */
+typedef enum PreparedStatementState
+{
+	/* the query was sent once without preparing it */
+	PREPARED_STATEMENT_SEEN,
+
+	/* the Parse message was sent, its result did not arrive yet */
+	PREPARED_STATEMENT_PREPARING,
+
+	/* the statement can be executed */
+	PREPARED_STATEMENT_PREPARED,
+
+	/* the worker failed to prepare the statement, do not try again */
+	PREPARED_STATEMENT_FAILED
+} PreparedStatementState;
+
+
+/*
+ * PreparedStatementCacheEntry describes a statement that was (or is about to
+ * be) prepared on a connection. Entries are keyed by the hash of the query
+ * text, statements whose query text collides with that of a cached one are not
+ * cached.
+ */
+typedef struct PreparedStatementCacheEntry
+{
+	uint32 queryHash; /* hash key, must be first */
+	char *queryString;
+	int parameterCount;
+	Oid *parameterTypes;
+	PreparedStatementState state;
+	char statementName[NAMEDATALEN];
+} PreparedStatementCacheEntry;
+
+
+/* config variable managed via guc.c, 0 disables the cache */
+int MaxCachedStatementsPerConnection = 0;
+
+/*
+ * PreparedStatementGeneration is incremented whenever the caches of all
+ * connections should be dropped. Connections keep the generation at which
+ * their cache was created, and drop it when that no longer matches.
+ */
+static uint64 PreparedStatementGeneration = 1;
+
+/* counters for citus_prepared_statement_cache_stats, for the current session */
+static uint64 StatementsPreparedCount = 0;
+static uint64 PreparedStatementExecutionCount = 0;
+
+
+static bool ConnectionIsIdle(MultiConnection *connection);
+static PreparedStatementCacheEntry * LookupPreparedStatement(MultiConnection *connection,
+															 const char *queryString,
+															 int parameterCount,
+															 const Oid *parameterTypes,
+															 bool addEntry, bool *found);
+static void CreatePreparedStatementCache(MultiConnection *connection);
+static bool ParameterTypesMatch(PreparedStatementCacheEntry *cacheEntry,
+								int parameterCount, const Oid *parameterTypes);
+
+
+PG_FUNCTION_INFO_V1(citus_prepared_statement_cache_stats);
+
+
+/*
+ * PreparedStatementName returns the name of the statement that is prepared for
+ * the given query on the connection, or NULL if there is none, in which case
+ * the caller can try StartPreparingStatement.
+ */
+const char *
+PreparedStatementName(MultiConnection *connection, const char *queryString,
+					  int parameterCount, const Oid *parameterTypes)
+{
+	bool addEntry = false;
+	bool found = false;
+
+	if (MaxCachedStatementsPerConnection <= 0 ||
+		connection->preparedStatementCache == NULL ||
+		connection->preparedStatementGeneration != PreparedStatementGeneration)
+	{
+		return NULL;
+	}
+
+	PreparedStatementCacheEntry *cacheEntry =
+		LookupPreparedStatement(connection, queryString, parameterCount,
+								parameterTypes, addEntry, &found);
+	if (cacheEntry == NULL || !found ||
+		cacheEntry->state != PREPARED_STATEMENT_PREPARED)
+	{
+		return NULL;
+	}
+
+	PreparedStatementExecutionCount++;
+
+	return cacheEntry->statementName;
+}
+
+
+/*
+ * StartPreparingStatement sends a command that brings the connection closer to
+ * having a statement prepared for the given query, without waiting for its
+ * result. It returns false if no command was sent, in which case the caller
+ * should send the query as is. Otherwise, the caller should pass the result
+ * of the command to FinishPreparingStatement once it arrives, and then send
+ * the query.
+ *
+ * The first time a query is seen, it is only remembered. The second time, the
+ * Parse message is sent. When the statements on the connection are stale or
+ * the cache is full, DEALLOCATE ALL is sent instead.
+ *
+ * Statements are only prepared when the connection is not in a transaction
+ * block, such that a failure to prepare cannot abort a remote transaction.
+ */
+bool
+StartPreparingStatement(MultiConnection *connection, const char *queryString,
+						int parameterCount, const Oid *parameterTypes)
+{
+	bool addEntry = true;
+	bool found = false;
+
+	if (MaxCachedStatementsPerConnection <= 0 || !ConnectionIsIdle(connection))
+	{
+		return false;
+	}
+
+	if (connection->preparingStatement != NULL)
+	{
+		/* the result of an earlier attempt was discarded, e.g. on cancellation */
+		connection->preparingStatement->state = PREPARED_STATEMENT_FAILED;
+		connection->preparingStatement = NULL;
+	}
+
+	if (connection->preparedStatementCache == NULL)
+	{
+		CreatePreparedStatementCache(connection);
+	}
+	else if (connection->preparedStatementGeneration != PreparedStatementGeneration)
+	{
+		/* a distributed table changed, statements may have become stale */
+		FreePreparedStatementCache(connection);
+		CreatePreparedStatementCache(connection);
+
+		return SendRemoteCommand(connection, "DEALLOCATE ALL") != 0;
+	}
+
+	PreparedStatementCacheEntry *cacheEntry =
+		LookupPreparedStatement(connection, queryString, parameterCount,
+								parameterTypes, addEntry, &found);
+	if (cacheEntry == NULL)
+	{
+		return false;
+	}
+
+	if (!found)
+	{
+		if (hash_get_num_entries(connection->preparedStatementCache) >
+			MaxCachedStatementsPerConnection)
+		{
+			/* start over rather than tracking which statements are used least */
+			FreePreparedStatementCache(connection);
+			CreatePreparedStatementCache(connection);
+
+			return SendRemoteCommand(connection, "DEALLOCATE ALL") != 0;
+		}
+
+		/* prepare the query if it is sent again */
+		return false;
+	}
+
+	if (cacheEntry->state != PREPARED_STATEMENT_SEEN)
+	{
+		return false;
+	}
+
+	/* use a new name for every attempt, in case an earlier one failed halfway */
+	connection->preparedStatementCounter++;
+	snprintf(cacheEntry->statementName, NAMEDATALEN, "citus_ps_" UINT64_FORMAT,
+			 connection->preparedStatementCounter);
+
+	if (!SendRemotePrepare(connection, cacheEntry->statementName, queryString,
+						   parameterCount, parameterTypes))
+	{
+		return false;
+	}
+
+	cacheEntry->state = PREPARED_STATEMENT_PREPARING;
+	connection->preparingStatement = cacheEntry;
+
+	return true;
+}
+
+
+/*
+ * FinishPreparingStatement processes a result of the command that
+ * StartPreparingStatement sent. Errors are not reported, since the query will
+ * be sent as is after a failure and report the error if it persists.
+ */
+void
+FinishPreparingStatement(MultiConnection *connection, PGresult *result)
+{
+	PreparedStatementCacheEntry *cacheEntry = connection->preparingStatement;
+
+	if (cacheEntry == NULL)
+	{
+		/* result of DEALLOCATE ALL, nothing to remember */
+		return;
+	}
+
+	if (IsResponseOK(result))
+	{
+		cacheEntry->state = PREPARED_STATEMENT_PREPARED;
+		StatementsPreparedCount++;
+	}
+	else
+	{
+		cacheEntry->state = PREPARED_STATEMENT_FAILED;
+	}
+
+	connection->preparingStatement = NULL;
+}
+
+
+/*
+ * FreePreparedStatementCache forgets about the statements that were prepared
+ * on the connection. It does not deallocate them on the remote node, which is
+ * only safe when the connection is being closed or they are deallocated
+ * by the caller.
+ */
+void
+FreePreparedStatementCache(MultiConnection *connection)
+{
+	if (connection->preparedStatementContext != NULL)
+	{
+		MemoryContextDelete(connection->preparedStatementContext);
+	}
+
+	connection->preparedStatementContext = NULL;
+	connection->preparedStatementCache = NULL;
+	connection->preparingStatement = NULL;
+}
+
+
+/*
+ * InvalidatePreparedStatementCaches makes all connections drop their prepared
+ * statements before they prepare or use another one.
+ */
+void
+InvalidatePreparedStatementCaches(void)
+{
+	PreparedStatementGeneration++;
+}
+
+
+/*
+ * citus_prepared_statement_cache_stats returns how many statements were
+ * prepared on the connections of the current session, and how many times such
+ * a statement was executed.
+ */
+Datum
+citus_prepared_statement_cache_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+	Datum values[PREPARED_STATEMENT_CACHE_STATS_COLUMNS];
+	bool isNulls[PREPARED_STATEMENT_CACHE_STATS_COLUMNS];
+
+	CheckCitusVersion(ERROR);
+	Tuplestorestate *tupleStore = SetupTuplestore(fcinfo, &tupleDescriptor);
+
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[0] = Int64GetDatum((int64) StatementsPreparedCount);
+	values[1] = Int64GetDatum((int64) PreparedStatementExecutionCount);
+
+	tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * ConnectionIsIdle returns whether the connection is healthy and not in a
+ * (remote) transaction block.
+ */
+static bool
+ConnectionIsIdle(MultiConnection *connection)
+{
+	PGconn *pgConn = connection->pgConn;
+
+	return pgConn != NULL && PQstatus(pgConn) == CONNECTION_OK &&
+		   PQtransactionStatus(pgConn) == PQTRANS_IDLE &&
+		   connection->remoteTransaction.transactionState ==
+		   REMOTE_TRANS_NOT_STARTED;
+}
+
+
+/*
+ * LookupPreparedStatement finds the cache entry for the given query on the
+ * connection. If there is none, it adds one in the PREPARED_STATEMENT_SEEN
+ * state when addEntry is set, and returns NULL otherwise. It also returns NULL
+ * if the entry belongs to another query with the same hash, or was created
+ * with different parameter types.
+ */
+static PreparedStatementCacheEntry *
+LookupPreparedStatement(MultiConnection *connection, const char *queryString,
+						int parameterCount, const Oid *parameterTypes, bool addEntry,
+						bool *found)
+{
+	HTAB *statementCache = connection->preparedStatementCache;
+	uint32 queryHash = DatumGetUInt32(hash_any((const unsigned char *) queryString,
+											   strlen(queryString)));
+
+	PreparedStatementCacheEntry *cacheEntry =
+		hash_search(statementCache, &queryHash, HASH_FIND, found);
+	if (*found)
+	{
+		if (strcmp(cacheEntry->queryString, queryString) != 0 ||
+			!ParameterTypesMatch(cacheEntry, parameterCount, parameterTypes))
+		{
+			return NULL;
+		}
+
+		return cacheEntry;
+	}
+
+	if (!addEntry)
+	{
+		return NULL;
+	}
+
+	MemoryContext oldContext =
+		MemoryContextSwitchTo(connection->preparedStatementContext);
+
+	cacheEntry = hash_search(statementCache, &queryHash, HASH_ENTER, found);
+	cacheEntry->queryString = pstrdup(queryString);
+	cacheEntry->parameterCount = parameterCount;
+	cacheEntry->parameterTypes = NULL;
+	if (parameterCount > 0)
+	{
+		cacheEntry->parameterTypes = palloc(parameterCount * sizeof(Oid));
+		memcpy(cacheEntry->parameterTypes, parameterTypes,
+			   parameterCount * sizeof(Oid));
+	}
+	cacheEntry->state = PREPARED_STATEMENT_SEEN;
+	cacheEntry->statementName[0] = '\0';
+
+	MemoryContextSwitchTo(oldContext);
+
+	return cacheEntry;
+}
+
+
+/*
+ * CreatePreparedStatementCache creates an empty statement cache for the
+ * connection, in a memory context that lives as long as the cache.
+ */
+static void
+CreatePreparedStatementCache(MultiConnection *connection)
+{
+	HASHCTL info;
+
+	connection->preparedStatementContext =
+		AllocSetContextCreateExtended(ConnectionContext,
+									  "Prepared Statement Cache",
+									  ALLOCSET_SMALL_MINSIZE,
+									  ALLOCSET_SMALL_INITSIZE,
+									  ALLOCSET_DEFAULT_MAXSIZE);
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(uint32);
+	info.entrysize = sizeof(PreparedStatementCacheEntry);
+	info.hash = tag_hash;
+	info.hcxt = connection->preparedStatementContext;
+	uint32 hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	connection->preparedStatementCache =
+		hash_create("Prepared Statement Cache Hash", 32, &info, hashFlags);
+	connection->preparedStatementGeneration = PreparedStatementGeneration;
+}
+
+
+/*
+ * ParameterTypesMatch returns whether the cached statement was prepared with
+ * the given parameter types.
+ */
+static bool
+ParameterTypesMatch(PreparedStatementCacheEntry *cacheEntry, int parameterCount,
+					const Oid *parameterTypes)
+{
+	if (cacheEntry->parameterCount != parameterCount)
+	{
+		return false;
+	}
+
+	for (int parameterIndex = 0; parameterIndex < parameterCount; parameterIndex++)
+	{
+		if (cacheEntry->parameterTypes[parameterIndex] != parameterTypes[parameterIndex])
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -459,11 +459,15 @@ ExecuteOptionalRemoteCommand(MultiConnection *connection, const char *command,
  * send commands asynchronously without blocking (at the potential expense of
  * an additional memory allocation). The command string can only include a single
  * command since PQsendQueryParams() supports only that.
+ *
+ * If binaryResults is true, the worker is asked to return the results in
+ * binary format, in which case the caller needs to decode each column using
+ * the receive function of its type.
  */
 int
 SendRemoteCommandParams(MultiConnection *connection, const char *command,
 						int parameterCount, const Oid *parameterTypes,
-						const char *const *parameterValues)
+						const char *const *parameterValues, bool binaryResults)
 {
 	PGconn *pgConn = connection->pgConn;
 
@@ -481,7 +485,72 @@ SendRemoteCommandParams(MultiConnection *connection, const char *command,
 	Assert(PQisnonblocking(pgConn));
 
 	int rc = PQsendQueryParams(pgConn, command, parameterCount, parameterTypes,
-							   parameterValues, NULL, NULL, 0);
+							   parameterValues, NULL, NULL, binaryResults ? 1 : 0);
+
+	return rc;
+}
+
+
+/*
+ * SendRemotePrepare is a PQsendPrepare wrapper that logs remote commands, and
+ * accepts a MultiConnection instead of a plain PGconn. It creates a named
+ * prepared statement for the given command on the remote node, which can then
+ * be executed using SendRemotePreparedCommand.
+ */
+int
+SendRemotePrepare(MultiConnection *connection, const char *statementName,
+				  const char *command, int parameterCount, const Oid *parameterTypes)
+{
+	PGconn *pgConn = connection->pgConn;
+
+	LogRemoteCommand(connection, command);
+
+	/*
+	 * Don't try to send command if connection is entirely gone
+	 * (PQisnonblocking() would crash).
+	 */
+	if (!pgConn || PQstatus(pgConn) != CONNECTION_OK)
+	{
+		return 0;
+	}
+
+	Assert(PQisnonblocking(pgConn));
+
+	int rc = PQsendPrepare(pgConn, statementName, command, parameterCount,
+						   parameterTypes);
+
+	return rc;
+}
+
+
+/*
+ * SendRemotePreparedCommand is a PQsendQueryPrepared wrapper that logs remote
+ * commands, and accepts a MultiConnection instead of a plain PGconn. It
+ * executes a statement that SendRemotePrepare created for the given command,
+ * such that the remote node skips parsing and planning the command.
+ */
+int
+SendRemotePreparedCommand(MultiConnection *connection, const char *statementName,
+						  const char *command, int parameterCount,
+						  const char *const *parameterValues, bool binaryResults)
+{
+	PGconn *pgConn = connection->pgConn;
+
+	LogRemoteCommand(connection, command);
+
+	/*
+	 * Don't try to send command if connection is entirely gone
+	 * (PQisnonblocking() would crash).
+	 */
+	if (!pgConn || PQstatus(pgConn) != CONNECTION_OK)
+	{
+		return 0;
+	}
+
+	Assert(PQisnonblocking(pgConn));
+
+	int rc = PQsendQueryPrepared(pgConn, statementName, parameterCount,
+								 parameterValues, NULL, NULL, binaryResults ? 1 : 0);
 
 	return rc;
 }
@@ -0,0 +1,531 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_connection_stats.c
+ *   Keeps track of the number of connections that all backends of this node
+ *   have open to each worker node, such that the executor can stay within a
+ *   budget of connections per worker (citus.max_shared_pool_size) instead of
+ *   every backend opening up to citus.max_adaptive_executor_pool_size
+ *   connections on its own.
+ *
+ *   It also keeps histograms of how long connection establishment and the
+ *   first distributed query of a session take on this node.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "distributed/connection_management.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/shared_connection_stats.h"
+#include "distributed/tuplestore.h"
+#include "distributed/worker_manager.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+
+
+#define REMOTE_CONNECTION_STATS_COLUMNS 3
+#define LATENCY_HISTOGRAM_COLUMNS 3
+
+/* the upper bound of the first latency bucket, the next ones double it */
+#define FIRST_LATENCY_BUCKET_BOUND_US 250
+#define LATENCY_BUCKET_COUNT 14
+
+
+/*
+ * SharedConnStatsControlData contains the lock that protects the hash of
+ * connection counters, and the latency histograms.
+ */
+typedef struct SharedConnStatsControlData
+{
+	int trancheId;
+	char *lockTrancheName;
+	LWLock lock;
+
+	/* number of measurements per bucket, the last bucket has no upper bound */
+	pg_atomic_uint64 latencyHistogram[LATENCY_METRIC_COUNT][LATENCY_BUCKET_COUNT];
+} SharedConnStatsControlData;
+
+
+/*
+ * SharedConnStatsHashKey identifies a worker node. We do not use the node id,
+ * since connections are also opened to nodes that are not in the metadata,
+ * e.g. from the tests.
+ */
+typedef struct SharedConnStatsHashKey
+{
+	char hostname[MAX_NODE_LENGTH];
+	int32 port;
+} SharedConnStatsHashKey;
+
+
+/* number of connections that all backends have open to a worker node */
+typedef struct SharedConnStatsHashEntry
+{
+	SharedConnStatsHashKey key;
+	int connectionCount;
+} SharedConnStatsHashEntry;
+
+
+/*
+ * Maximum number of connections that the backends of this node may open to a
+ * single worker node. 0 means max_connections, and
+ * DISABLE_SHARED_CONNECTION_BUDGET means that the connections are not limited
+ * or counted.
+ */
+int MaxSharedPoolSize = 0;
+
+
+static SharedConnStatsControlData *ConnectionStatsSharedState = NULL;
+static HTAB *SharedConnStatsHash = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* names of the latency metrics in citus_connection_latency_histogram */
+static const char *LatencyMetricNames[LATENCY_METRIC_COUNT] = {
+	"connection_establishment",
+	"first_query_in_session"
+};
+
+/* when the first distributed query of the session started, 0 if not yet */
+static TimestampTz FirstQueryStartTime = 0;
+static bool FirstQueryRecorded = false;
+
+
+static bool IncrementSharedConnectionCounterInternal(const char *hostname, int port,
+													 bool checkBudget);
+static void StoreAllRemoteConnectionStats(Tuplestorestate *tupleStore,
+										  TupleDesc tupleDescriptor);
+static double LatencyBucketUpperBound(int bucketIndex);
+static size_t SharedConnectionStatsShmemSize(void);
+static void SharedConnectionStatsShmemInit(void);
+
+
+PG_FUNCTION_INFO_V1(citus_remote_connection_stats);
+PG_FUNCTION_INFO_V1(citus_connection_latency_histogram);
+PG_FUNCTION_INFO_V1(citus_reset_connection_latency_histogram);
+
+
+/*
+ * citus_remote_connection_stats returns the number of connections that the
+ * backends of this node have open to each worker node.
+ */
+Datum
+citus_remote_connection_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+
+	CheckCitusVersion(ERROR);
+	Tuplestorestate *tupleStore = SetupTuplestore(fcinfo, &tupleDescriptor);
+
+	StoreAllRemoteConnectionStats(tupleStore, tupleDescriptor);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * StoreAllRemoteConnectionStats adds a row for each worker node with open
+ * connections to the given tuple store.
+ */
+static void
+StoreAllRemoteConnectionStats(Tuplestorestate *tupleStore, TupleDesc tupleDescriptor)
+{
+	Datum values[REMOTE_CONNECTION_STATS_COLUMNS];
+	bool isNulls[REMOTE_CONNECTION_STATS_COLUMNS];
+	HASH_SEQ_STATUS status;
+	SharedConnStatsHashEntry *connectionEntry = NULL;
+
+	LWLockAcquire(&ConnectionStatsSharedState->lock, LW_SHARED);
+
+	hash_seq_init(&status, SharedConnStatsHash);
+	while ((connectionEntry = (SharedConnStatsHashEntry *) hash_seq_search(&status)) != 0)
+	{
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = PointerGetDatum(cstring_to_text(connectionEntry->key.hostname));
+		values[1] = Int32GetDatum(connectionEntry->key.port);
+		values[2] = Int32GetDatum(connectionEntry->connectionCount);
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+	}
+
+	LWLockRelease(&ConnectionStatsSharedState->lock);
+}
+
+
+/*
+ * citus_connection_latency_histogram returns how many of the measured
+ * latencies fell into each bucket, per latency metric.
+ */
+Datum
+citus_connection_latency_histogram(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+	Datum values[LATENCY_HISTOGRAM_COLUMNS];
+	bool isNulls[LATENCY_HISTOGRAM_COLUMNS];
+
+	CheckCitusVersion(ERROR);
+	Tuplestorestate *tupleStore = SetupTuplestore(fcinfo, &tupleDescriptor);
+
+	for (int metric = 0; metric < LATENCY_METRIC_COUNT; metric++)
+	{
+		for (int bucketIndex = 0; bucketIndex < LATENCY_BUCKET_COUNT; bucketIndex++)
+		{
+			pg_atomic_uint64 *bucket =
+				&ConnectionStatsSharedState->latencyHistogram[metric][bucketIndex];
+
+			memset(values, 0, sizeof(values));
+			memset(isNulls, false, sizeof(isNulls));
+
+			values[0] = PointerGetDatum(cstring_to_text(LatencyMetricNames[metric]));
+			values[2] = Int64GetDatum((int64) pg_atomic_read_u64(bucket));
+
+			/* the last bucket has no upper bound */
+			if (bucketIndex < LATENCY_BUCKET_COUNT - 1)
+			{
+				values[1] = Float8GetDatum(LatencyBucketUpperBound(bucketIndex));
+			}
+			else
+			{
+				isNulls[1] = true;
+			}
+
+			tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+		}
+	}
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * citus_reset_connection_latency_histogram sets all buckets of the latency
+ * histograms back to 0.
+ */
+Datum
+citus_reset_connection_latency_histogram(PG_FUNCTION_ARGS)
+{
+	CheckCitusVersion(ERROR);
+
+	for (int metric = 0; metric < LATENCY_METRIC_COUNT; metric++)
+	{
+		for (int bucketIndex = 0; bucketIndex < LATENCY_BUCKET_COUNT; bucketIndex++)
+		{
+			pg_atomic_write_u64(
+				&ConnectionStatsSharedState->latencyHistogram[metric][bucketIndex], 0);
+		}
+	}
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * LatencyBucketUpperBound returns the upper bound of the given latency
+ * bucket in milliseconds.
+ */
+static double
+LatencyBucketUpperBound(int bucketIndex)
+{
+	return (double) (FIRST_LATENCY_BUCKET_BOUND_US << bucketIndex) / 1000.0;
+}
+
+
+/*
+ * RecordLatency adds the time between the given timestamps to the histogram
+ * of the given latency metric.
+ */
+void
+RecordLatency(LatencyMetric metric, TimestampTz startTime, TimestampTz endTime)
+{
+	int64 latencyUs = endTime - startTime;
+	int bucketIndex = 0;
+
+	while (bucketIndex < LATENCY_BUCKET_COUNT - 1 &&
+		   latencyUs > ((int64) FIRST_LATENCY_BUCKET_BOUND_US << bucketIndex))
+	{
+		bucketIndex++;
+	}
+
+	pg_atomic_fetch_add_u64(
+		&ConnectionStatsSharedState->latencyHistogram[metric][bucketIndex], 1);
+}
+
+
+/*
+ * MarkFirstDistributedQueryStart remembers when the first distributed query
+ * of the session started.
+ */
+void
+MarkFirstDistributedQueryStart(void)
+{
+	if (FirstQueryStartTime == 0)
+	{
+		FirstQueryStartTime = GetCurrentTimestamp();
+	}
+}
+
+
+/*
+ * MarkFirstDistributedQueryEnd records the latency of the first distributed
+ * query of the session, once it finished.
+ */
+void
+MarkFirstDistributedQueryEnd(void)
+{
+	if (FirstQueryStartTime == 0 || FirstQueryRecorded)
+	{
+		return;
+	}
+
+	RecordLatency(FIRST_QUERY_LATENCY, FirstQueryStartTime, GetCurrentTimestamp());
+	FirstQueryRecorded = true;
+}
+
+
+/*
+ * GetMaxSharedPoolSize returns the maximum number of connections that the
+ * backends of this node may open to a single worker node, or
+ * DISABLE_SHARED_CONNECTION_BUDGET if the connections are not limited.
+ */
+int
+GetMaxSharedPoolSize(void)
+{
+	if (MaxSharedPoolSize == 0)
+	{
+		/* a worker presumably allows as many connections as this node */
+		return MaxConnections;
+	}
+
+	return MaxSharedPoolSize;
+}
+
+
+/*
+ * TryToIncrementSharedConnectionCounter counts a new connection to the given
+ * worker node and returns true if the connections of all backends to the node
+ * stay within the budget. Otherwise, it returns false without counting the
+ * connection, and the caller should not open it.
+ */
+bool
+TryToIncrementSharedConnectionCounter(const char *hostname, int port)
+{
+	bool checkBudget = true;
+
+	return IncrementSharedConnectionCounterInternal(hostname, port, checkBudget);
+}
+
+
+/*
+ * IncrementSharedConnectionCounter counts a new connection to the given worker
+ * node, regardless of the budget. We use it for the connections that we cannot
+ * do without, such that the budget never blocks a backend entirely.
+ */
+void
+IncrementSharedConnectionCounter(const char *hostname, int port)
+{
+	bool checkBudget = false;
+
+	IncrementSharedConnectionCounterInternal(hostname, port, checkBudget);
+}
+
+
+/*
+ * IncrementSharedConnectionCounterInternal counts a new connection to the given
+ * worker node, unless checkBudget is set and the budget is already used up.
+ */
+static bool
+IncrementSharedConnectionCounterInternal(const char *hostname, int port,
+										 bool checkBudget)
+{
+	SharedConnStatsHashKey connKey;
+	bool entryFound = false;
+	bool counterIncremented = true;
+
+	memset(&connKey, 0, sizeof(connKey));
+	strlcpy(connKey.hostname, hostname, MAX_NODE_LENGTH);
+	connKey.port = port;
+
+	LWLockAcquire(&ConnectionStatsSharedState->lock, LW_EXCLUSIVE);
+
+	SharedConnStatsHashEntry *connectionEntry =
+		hash_search(SharedConnStatsHash, &connKey, HASH_ENTER_NULL, &entryFound);
+
+	if (connectionEntry == NULL)
+	{
+		/*
+		 * We track up to citus.max_worker_nodes_tracked nodes, and do not limit
+		 * the connections to the rest.
+		 */
+		LWLockRelease(&ConnectionStatsSharedState->lock);
+
+		ereport(DEBUG4, (errmsg("cannot track the connections to %s:%d",
+								hostname, port)));
+
+		return true;
+	}
+
+	if (!entryFound)
+	{
+		connectionEntry->connectionCount = 0;
+	}
+
+	if (checkBudget && connectionEntry->connectionCount >= GetMaxSharedPoolSize())
+	{
+		counterIncremented = false;
+	}
+	else
+	{
+		connectionEntry->connectionCount++;
+	}
+
+	LWLockRelease(&ConnectionStatsSharedState->lock);
+
+	return counterIncremented;
+}
+
+
+/*
+ * DecrementSharedConnectionCounter releases a connection to the given worker
+ * node from the budget, and forgets about the node once no backend has any
+ * connections to it.
+ */
+void
+DecrementSharedConnectionCounter(const char *hostname, int port)
+{
+	SharedConnStatsHashKey connKey;
+	bool entryFound = false;
+
+	memset(&connKey, 0, sizeof(connKey));
+	strlcpy(connKey.hostname, hostname, MAX_NODE_LENGTH);
+	connKey.port = port;
+
+	LWLockAcquire(&ConnectionStatsSharedState->lock, LW_EXCLUSIVE);
+
+	SharedConnStatsHashEntry *connectionEntry =
+		hash_search(SharedConnStatsHash, &connKey, HASH_FIND, &entryFound);
+
+	/* the node might not have been tracked, see above */
+	if (entryFound)
+	{
+		connectionEntry->connectionCount--;
+
+		if (connectionEntry->connectionCount <= 0)
+		{
+			hash_search(SharedConnStatsHash, &connKey, HASH_REMOVE, NULL);
+		}
+	}
+
+	LWLockRelease(&ConnectionStatsSharedState->lock);
+}
+
+
+/*
+ * InitializeSharedConnectionStats, called at server start, requests the
+ * shared memory for the connection counters.
+ */
+void
+InitializeSharedConnectionStats(void)
+{
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(SharedConnectionStatsShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = SharedConnectionStatsShmemInit;
+}
+
+
+/*
+ * SharedConnectionStatsShmemSize computes how much shared memory is required.
+ */
+static size_t
+SharedConnectionStatsShmemSize(void)
+{
+	Size size = 0;
+
+	size = add_size(size, sizeof(SharedConnStatsControlData));
+
+	Size hashSize = hash_estimate_size(MaxWorkerNodesTracked,
+									   sizeof(SharedConnStatsHashEntry));
+	size = add_size(size, hashSize);
+
+	return size;
+}
+
+
+/*
+ * SharedConnectionStatsShmemInit initializes the requested shared memory for
+ * the connection counters.
+ */
+static void
+SharedConnectionStatsShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	ConnectionStatsSharedState =
+		(SharedConnStatsControlData *) ShmemInitStruct("Shared Connection Stats Data",
+													   sizeof(SharedConnStatsControlData),
+													   &alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		ConnectionStatsSharedState->trancheId = LWLockNewTrancheId();
+		ConnectionStatsSharedState->lockTrancheName = "Shared Connection Tracking";
+		LWLockRegisterTranche(ConnectionStatsSharedState->trancheId,
+							  ConnectionStatsSharedState->lockTrancheName);
+
+		LWLockInitialize(&ConnectionStatsSharedState->lock,
+						 ConnectionStatsSharedState->trancheId);
+
+		for (int metric = 0; metric < LATENCY_METRIC_COUNT; metric++)
+		{
+			for (int bucketIndex = 0; bucketIndex < LATENCY_BUCKET_COUNT; bucketIndex++)
+			{
+				pg_atomic_init_u64(
+					&ConnectionStatsSharedState->latencyHistogram[metric][bucketIndex],
+					0);
+			}
+		}
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(SharedConnStatsHashKey);
+	hashInfo.entrysize = sizeof(SharedConnStatsHashEntry);
+	hashInfo.hash = tag_hash;
+	int hashFlags = (HASH_ELEM | HASH_FUNCTION);
+
+	SharedConnStatsHash = ShmemInitHash("Shared Connection Stats Hash",
+										MaxWorkerNodesTracked, MaxWorkerNodesTracked,
+										&hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
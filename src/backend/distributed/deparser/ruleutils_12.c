@@ -284,6 +284,12 @@ typedef struct
 	List	   *usingNames;		/* names assigned to merged columns */
 } deparse_columns;
 
+/*
+ * Number of shard name slots written while deparsing a task query template
+ * in pg_get_query_template_def, or -1 when not deparsing a template.
+ */
+static int shard_name_slot_count = -1;
+
 /* This macro is analogous to rt_fetch(), but for deparse_columns structs */
 #define deparse_columns_fetch(rangetable_index, dpns) \
 	((deparse_columns *) list_nth((dpns)->rtable_columns, (rangetable_index)-1))
@@ -431,6 +437,8 @@ static char *get_relation_name(Oid relid);
 static char *generate_relation_or_shard_name(Oid relid, Oid distrelid,
 				int64 shardid, List *namespaces);
 static char *generate_fragment_name(char *schemaName, char *tableName);
+static char *generate_shard_name_or_slot(RangeTblEntry *rte, char *schemaName,
+							char *tableName);
 static char *generate_function_name(Oid funcid, int nargs,
 					   List *argnames, Oid *argtypes,
 					   bool has_variadic, bool *use_variadic_p,
@@ -451,6 +459,39 @@ pg_get_query_def(Query *query, StringInfo buffer)
 }
 
 
+/*
+ * pg_get_query_template_def parses back a query tree whose relations have
+ * been updated to shards like pg_get_query_def, but writes a slot holding the
+ * relation id instead of the (quoted) table name of each shard. The slots are
+ * delimited by SHARD_NAME_SLOT_MARKER, and the function returns the number of
+ * slots it wrote.
+ */
+int
+pg_get_query_template_def(Query *query, StringInfo buffer)
+{
+	int			slotCount = 0;
+
+	Assert(shard_name_slot_count < 0);
+	shard_name_slot_count = 0;
+
+	PG_TRY();
+	{
+		get_query_def(query, buffer, NIL, NULL, 0, WRAP_COLUMN_DEFAULT, 0);
+	}
+	PG_CATCH();
+	{
+		shard_name_slot_count = -1;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	slotCount = shard_name_slot_count;
+	shard_name_slot_count = -1;
+
+	return slotCount;
+}
+
+
 /*
  * pg_get_rule_expr deparses an expression and returns the result as a string.
  */
@@ -3255,7 +3296,8 @@ get_update_query_def(Query *query, deparse_context *context)
 		/* use schema and table name from the remote alias */
 		appendStringInfo(buf, "UPDATE %s%s",
 						 only_marker(rte),
-						 generate_fragment_name(fragmentSchemaName, fragmentTableName));
+						 generate_shard_name_or_slot(rte, fragmentSchemaName,
+													 fragmentTableName));
 
 		if(rte->eref != NULL)
 			appendStringInfo(buf, " %s",
@@ -3487,7 +3529,8 @@ get_delete_query_def(Query *query, deparse_context *context)
 		/* use schema and table name from the remote alias */
 		appendStringInfo(buf, "DELETE FROM %s%s",
 						 only_marker(rte),
-						 generate_fragment_name(fragmentSchemaName, fragmentTableName));
+						 generate_shard_name_or_slot(rte, fragmentSchemaName,
+													 fragmentTableName));
 
 		if(rte->eref != NULL)
 			appendStringInfo(buf, " %s",
@@ -7013,8 +7056,9 @@ get_from_clause_item(Node *jtnode, Query *query, deparse_context *context)
 
 					/* use schema and table name from the remote alias */
 					appendStringInfoString(buf,
-										   generate_fragment_name(fragmentSchemaName,
-																  fragmentTableName));
+										   generate_shard_name_or_slot(rte,
+																	   fragmentSchemaName,
+																	   fragmentTableName));
 					break;
 				}
 
@@ -7753,6 +7797,31 @@ generate_fragment_name(char *schemaName, char *tableName)
 	return fragmentNameString->data;
 }
 
+/*
+ * generate_shard_name_or_slot
+ *		Compute the name to display for a shard, or when deparsing a task
+ *		query template, the schema prefix followed by a slot for the name of
+ *		the shard of the relation
+ */
+static char *
+generate_shard_name_or_slot(RangeTblEntry *rte, char *schemaName, char *tableName)
+{
+	StringInfo	slotString = NULL;
+
+	if (shard_name_slot_count < 0 || !OidIsValid(rte->relid))
+		return generate_fragment_name(schemaName, tableName);
+
+	slotString = makeStringInfo();
+	if (schemaName != NULL)
+		appendStringInfo(slotString, "%s.", quote_identifier(schemaName));
+
+	appendStringInfo(slotString, "%c%u%c", SHARD_NAME_SLOT_MARKER, rte->relid,
+					 SHARD_NAME_SLOT_MARKER);
+	shard_name_slot_count++;
+
+	return slotString->data;
+}
+
 /*
  * generate_function_name
  *		Compute the name to display for a function specified by OID,
@@ -53,6 +53,13 @@
  * from pendingTaskQueue to readyTaskQueue. The same approach is used to
  * fail over read-only tasks to another placement.
  *
+ * The map and merge tasks of a repartition join depend on each other (see
+ * ExecuteTaskListInDependencyOrder). Tasks that wait for other tasks start
+ * out in the pendingTaskQueue and every ShardCommandExecution counts the
+ * tasks it still waits for. When a task finishes, the counts of the tasks
+ * that depend on it are decremented and the ones that reach 0 move to the
+ * readyTaskQueue of the pools, which are running already.
+ *
  * Once all the tasks are added to a queue, the main loop in
  * RunDistributedExecution repeatedly does the following:
  *
@@ -113,7 +120,22 @@
  * table.
  *
  * Execution finishes when all tasks are done, the query errors out, or
- * the user cancels the query.
+ * the user cancels the query. Read-only queries that only apply a LIMIT
+ * on the coordinator also finish once enough rows arrived, in which case
+ * the running tasks are cancelled (see DistributedPlanRowLimit).
+ *
+ * Read-only queries that do not sort or aggregate on the coordinator may
+ * instead use a streaming execution (see ShouldStreamDistributedPlan), in
+ * which RunDistributedExecutionLoop returns as soon as rows arrive and
+ * CitusExecScan continues the execution once it returned them. We do not
+ * read from the connections in the meantime, such that a slow client
+ * slows down the workers rather than filling up the coordinator.
+ *
+ * Several independent read-only plans, such as the subplans of a query, can
+ * also share a single execution (see ExecuteDistributedPlansIntoDestReceivers).
+ * Each task then has its own TaskResultDestination, which converts its rows
+ * with the tuple descriptor of its plan and sends them to the DestReceiver
+ * of that plan as they arrive.
  *
  *-------------------------------------------------------------------------
  */
@@ -127,14 +149,18 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "access/htup_details.h"
 #include "access/transam.h"
 #include "access/xact.h"
 #include "catalog/pg_type.h"
 #include "commands/dbcommands.h"
 #include "distributed/citus_custom_scan.h"
+#include "distributed/commands/multi_copy.h"
 #include "distributed/connection_management.h"
+#include "distributed/deparse_shard_query.h"
 #include "distributed/distributed_execution_locks.h"
 #include "distributed/local_executor.h"
+#include "distributed/metadata_cache.h"
 #include "distributed/multi_client_executor.h"
 #include "distributed/multi_executor.h"
 #include "distributed/multi_physical_planner.h"
@@ -142,16 +168,20 @@
 #include "distributed/multi_server_executor.h"
 #include "distributed/placement_access.h"
 #include "distributed/placement_connection.h"
+#include "distributed/prepared_statement_cache.h"
 #include "distributed/relation_access_tracking.h"
 #include "distributed/cancel_utils.h"
 #include "distributed/remote_commands.h"
 #include "distributed/resource_lock.h"
+#include "distributed/sorted_merge.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/transaction_management.h"
+#include "distributed/tuplestore.h"
 #include "distributed/worker_protocol.h"
 #include "distributed/version_compat.h"
 #include "distributed/adaptive_executor.h"
 #include "distributed/repartition_join_execution.h"
+#include "executor/executor.h"
 #include "lib/ilist.h"
 #include "commands/schemacmds.h"
 #include "storage/fd.h"
@@ -162,6 +192,36 @@
 #include "utils/timestamp.h"
 
 
+/* the session is not (yet) in the wait event set of the execution */
+#define WAIT_EVENT_SET_INDEX_NOT_INITIALIZED -1
+
+/* number of columns returned by citus_executor_event_loop_stats */
+#define EVENT_LOOP_STATS_COLUMNS 4
+#define TASK_STATS_COLUMNS 3
+
+
+/*
+ * TaskResultDestination is the destination of the rows of the tasks of one
+ * distributed plan, when the tasks of several plans share an execution.
+ */
+typedef struct TaskResultDestination
+{
+	/* tuple descriptor of the plan, which its tasks return */
+	TupleDesc tupleDescriptor;
+
+	/* the rows of the tasks are sent here as soon as they arrive */
+	DestReceiver *destReceiver;
+	TupleTableSlot *slot;
+
+	/* used to convert the rows, see the fields in DistributedExecution */
+	AttInMetadata *attributeInputMetadata;
+	char **columnArray;
+
+	/* the intermediate result size limit applies to each plan on its own */
+	DistributedExecutionStats *executionStats;
+} TaskResultDestination;
+
+
 /*
  * DistributedExecution represents the execution of a distributed query
  * plan.
@@ -190,6 +250,31 @@ typedef struct DistributedExecution
 	TupleDesc tupleDescriptor;
 	Tuplestorestate *tupleStore;
 
+	/*
+	 * When the scan merges the sorted task results, the destination of the
+	 * results of each task in tasksToExecute, in the same order. NULL if all
+	 * tasks write into tupleStore.
+	 */
+	Tuplestorestate **taskTupleStores;
+
+	/*
+	 * When the execution runs the tasks of several plans, the destination of
+	 * the results of each task in tasksToExecute, in the same order. NULL if
+	 * the results go to a tuple store.
+	 */
+	TaskResultDestination **taskDestinations;
+
+	/*
+	 * Whether a task may only start once the tasks on its dependentTaskList
+	 * that are part of the execution have finished.
+	 */
+	bool followTaskDependencies;
+
+	/*
+	 * Shard command executions that finished since the last iteration of the
+	 * event loop and have downstream executions waiting for them.
+	 */
+	List *finishedUpstreamExecutionList;
 
 	/* list of workers involved in the execution */
 	List *workerList;
@@ -199,20 +284,20 @@ typedef struct DistributedExecution
 
 	/*
 	 * Flag to indiciate that the set of connections we are interested
-	 * in has changed and waitEventSet needs to be rebuilt.
+	 * in has changed and waitEventSet needs to be rebuilt. We only need
+	 * to rebuild it when connections are removed, since sockets cannot
+	 * be removed from a WaitEventSet.
 	 */
 	bool connectionSetChanged;
 
+	/* sessions that were opened, but are not yet in the waitEventSet */
+	List *newSessionList;
+
 	/*
-	 * Flag to indiciate that the set of wait events we are interested
-	 * in might have changed and waitEventSet needs to be updated.
-	 *
-	 * Note that we set this flag whenever we assign a value to waitFlags,
-	 * but we don't check that the waitFlags is actually different from the
-	 * previous value. So we might have some false positives for this flag,
-	 * which is OK, because in this case ModifyWaitEvent() is noop.
+	 * Sessions whose wait flags changed since the waitEventSet was last
+	 * updated, such that we only modify their wait events.
 	 */
-	bool waitFlagsChanged;
+	List *waitFlagsChangedSessionList;
 
 	/*
 	 * WaitEventSet used for waiting for I/O events.
@@ -226,6 +311,25 @@ typedef struct DistributedExecution
 	 */
 	WaitEventSet *waitEventSet;
 
+	/*
+	 * Array for the events returned by WaitEventSetWait and its size. These
+	 * are kept here since a streaming execution leaves the event loop whenever
+	 * it received rows and continues from where it left once they are consumed.
+	 */
+	WaitEvent *events;
+	int eventSetSize;
+
+	/* number of events in the waitEventSet, which can hold eventSetSize events */
+	int waitEventCount;
+
+	/*
+	 * For streaming executions, the memory context in which the execution
+	 * continues. Rows are returned to the custom scan before the execution
+	 * finishes, so we may be called from within arbitrary memory contexts
+	 * afterwards. NULL for executions that run to completion at once.
+	 */
+	MemoryContext streamingContext;
+
 	/*
 	 * The number of connections we aim to open per worker.
 	 *
@@ -240,6 +344,9 @@ typedef struct DistributedExecution
 	/* number of tasks that still need to be executed */
 	int unfinishedTaskCount;
 
+	/* number of unfinished tasks that wait for the tasks they depend on */
+	int waitingTaskCount;
+
 	/*
 	 * Flag to indicate whether throwing errors on cancellation is
 	 * allowed.
@@ -263,6 +370,13 @@ typedef struct DistributedExecution
 	 */
 	uint64 rowsProcessed;
 
+	/*
+	 * For SELECT commands that only apply a LIMIT on the coordinator, the
+	 * number of rows after which the remaining tasks are no longer needed.
+	 * 0 means that all the tasks run to completion.
+	 */
+	uint64 rowLimit;
+
 	/* statistics on distributed execution */
 	DistributedExecutionStats *executionStats;
 
@@ -277,6 +391,18 @@ typedef struct DistributedExecution
 	AttInMetadata *attributeInputMetadata;
 	char **columnArray;
 
+	/*
+	 * When useBinaryProtocol is set, the workers return the results in binary
+	 * format and we decode each column using the receive function of its type,
+	 * which is typically much cheaper than the input function. Similar to the
+	 * columnArray, the arrays below are allocated once per execution.
+	 */
+	bool useBinaryProtocol;
+	FmgrInfo *columnReceiveFunctions;
+	Oid *columnTypeIoParams;
+	Datum *columnValues;
+	bool *columnNulls;
+
 	/*
 	 * jobIdList contains all jobs in the job tree, this is used to
 	 * do cleanup for repartition queries.
@@ -411,6 +537,12 @@ typedef struct WorkerSession
 	/* task the worker should work on or NULL */
 	struct TaskPlacementExecution *currentTask;
 
+	/*
+	 * Tasks whose commands were sent in the same request as the command of
+	 * currentTask, in the order in which their results arrive.
+	 */
+	List *coalescedTaskList;
+
 	/*
 	 * The number of commands sent to the worker over the session. Excludes
 	 * distributed transaction related commands such as BEGIN/COMMIT etc.
@@ -420,6 +552,12 @@ typedef struct WorkerSession
 	/* index in the wait event set */
 	int waitEventSetIndex;
 
+	/* socket of the connection when it was added to the wait event set */
+	int waitEventSetSocket;
+
+	/* whether the session is in the waitFlagsChangedSessionList of the execution */
+	bool waitFlagsChanged;
+
 	/* events reported by the latest call to WaitEventSetWait */
 	int latestUnconsumedWaitEvents;
 } WorkerSession;
@@ -434,6 +572,45 @@ int MaxAdaptiveExecutorPoolSize = 16;
 /* GUC, number of ms to wait between opening connections to the same worker */
 int ExecutorSlowStartInterval = 10;
 
+/* GUC, determining whether the workers return SELECT results in binary format */
+bool EnableBinaryProtocol = false;
+
+/* GUC, number of rows the executor converts before cleaning up after them */
+int ExecutorFetchBatchSize = 1;
+
+/* GUC, determining whether eligible SELECTs return rows while they arrive */
+bool EnableStreamingExecution = false;
+
+/* GUC, determining whether SELECTs with a LIMIT stop once enough rows arrived */
+bool EnableEarlyLimitTermination = true;
+
+/* GUC, maximum number of tasks sent to a worker in a single request */
+int MaxCoalescedTasks = 1;
+
+/*
+ * Counters for citus_executor_event_loop_stats, which cover the executions
+ * of the current session.
+ */
+static uint64 EventLoopIterationCount = 0;
+static uint64 WaitEventSetRebuildCount = 0;
+static uint64 WaitEventSetAdditionCount = 0;
+static uint64 WaitEventSetModificationCount = 0;
+
+/*
+ * Counters for citus_executor_task_stats, which cover the executions of the
+ * current session.
+ */
+static uint64 DependencyOrderedTaskCount = 0;
+static uint64 EarlyTaskStartCount = 0;
+static uint64 CoalescedTaskCount = 0;
+
+/*
+ * The streaming execution that still has unread rows on its connections,
+ * if any. At most one execution streams at a time, the others are run to
+ * completion (see MaterializeActiveStreamingExecution).
+ */
+static struct DistributedExecution *ActiveStreamingExecution = NULL;
+
 
 /*
  * TaskExecutionState indicates whether or not a command on a shard
@@ -484,9 +661,35 @@ typedef struct ShardCommandExecution
 	 */
 	bool gotResults;
 
+	/* destination for the results of the task */
+	Tuplestorestate *tupleStore;
+
+	/* destination of the rows if they do not go to tupleStore, otherwise NULL */
+	TaskResultDestination *resultDestination;
+
+	/*
+	 * When following task dependencies, the number of tasks this task depends
+	 * on that have not finished yet, and the shard command executions of the
+	 * tasks that depend on this task.
+	 */
+	int unfinishedDependencyCount;
+	List *downstreamExecutionList;
+
 	TaskExecutionState executionState;
 } ShardCommandExecution;
 
+/*
+ * ShardCommandExecutionHashEntry maps a task to its shard command execution
+ * while linking the executions of tasks that depend on each other.
+ */
+typedef struct ShardCommandExecutionHashEntry
+{
+	/* hash key, the task itself */
+	Task *task;
+
+	ShardCommandExecution *shardCommandExecution;
+} ShardCommandExecutionHashEntry;
+
 /*
  * TaskPlacementExecutionState indicates whether a command is running
  * on a shard placement, or finished or failed.
@@ -555,7 +758,11 @@ static TransactionProperties DecideTransactionPropertiesForTaskList(RowModifyLev
 																	exludeFromTransaction);
 static void StartDistributedExecution(DistributedExecution *execution);
 static void RunLocalExecution(CitusScanState *scanState, DistributedExecution *execution);
+static uint64 ExecuteLocalTasksForSortedMerge(CitusScanState *scanState,
+											  List *localTaskList);
 static void RunDistributedExecution(DistributedExecution *execution);
+static bool RunDistributedExecutionLoop(DistributedExecution *execution,
+										bool returnOnRows);
 static bool ShouldRunTasksSequentially(List *taskList);
 static void SequentialRunDistributedExecution(DistributedExecution *execution);
 
@@ -585,13 +792,25 @@ static void CheckConnectionTimeout(WorkerPool *workerPool);
 static int UsableConnectionCount(WorkerPool *workerPool);
 static long NextEventTimeout(DistributedExecution *execution);
 static long MillisecondsBetweenTimestamps(TimestampTz startTime, TimestampTz endTime);
-static WaitEventSet * BuildWaitEventSet(List *sessionList);
-static void UpdateWaitEventSetFlags(WaitEventSet *waitEventSet, List *sessionList);
+static void UpdateWaitEventSet(DistributedExecution *execution);
+static void RebuildWaitEventSet(DistributedExecution *execution);
+static bool AddSessionToWaitEventSet(DistributedExecution *execution,
+									 WorkerSession *session);
+static bool UpdateSessionWaitEvent(DistributedExecution *execution,
+								   WorkerSession *session);
+static void ResetWaitEventSetChanges(DistributedExecution *execution);
 static TaskPlacementExecution * PopPlacementExecution(WorkerSession *session);
 static TaskPlacementExecution * PopAssignedPlacementExecution(WorkerSession *session);
 static TaskPlacementExecution * PopUnassignedPlacementExecution(WorkerPool *workerPool);
 static bool StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
 											 WorkerSession *session);
+static bool SendPlacementExecutionCommand(WorkerSession *session);
+static char * CoalescePlacementExecutions(WorkerSession *session, char *queryString);
+static bool TaskCanBeCoalesced(Task *task, char *queryString);
+static void StartCoalescedPlacementExecution(WorkerSession *session,
+											 TaskPlacementExecution *placementExecution,
+											 StringInfo queryString);
+static bool StartNextCoalescedPlacementExecution(WorkerSession *session);
 static void ConnectionStateMachine(WorkerSession *session);
 static void HandleMultiConnectionSuccess(WorkerSession *session);
 static void Activate2PCIfModifyingTransactionExpandsToNewNode(WorkerSession *session);
@@ -608,12 +827,40 @@ static void ScheduleNextPlacementExecution(TaskPlacementExecution *placementExec
 										   bool succeeded);
 static bool ShouldMarkPlacementsInvalidOnFailure(DistributedExecution *execution);
 static void PlacementExecutionReady(TaskPlacementExecution *placementExecution);
+static HTAB * CreateShardCommandExecutionHash(List *taskList);
+static int UnfinishedDependencyCount(Task *task, HTAB *shardCommandExecutionHash);
+static void LinkDownstreamExecutions(HTAB *shardCommandExecutionHash);
+static void ReleaseDownstreamExecutions(DistributedExecution *execution);
+static void ShardCommandExecutionReady(ShardCommandExecution *shardCommandExecution);
 static TaskExecutionState TaskExecutionStateMachine(ShardCommandExecution *
 													shardCommandExecution);
 static bool HasDependentJobs(Job *mainJob);
+static bool CanUseBinaryProtocol(RowModifyLevel modLevel, TupleDesc tupleDescriptor);
+static void InitializeBinaryResultMetadata(DistributedExecution *execution);
+static bool SetResultFetchMode(MultiConnection *connection);
+static bool IsPartialTuplesResult(ExecStatusType resultStatus);
+static HeapTuple BuildTupleFromBinaryResult(DistributedExecution *execution,
+											PGresult *result, int rowIndex);
 static void ExtractParametersForRemoteExecution(ParamListInfo paramListInfo,
 												Oid **parameterTypes,
 												const char ***parameterValues);
+static bool ShouldStreamDistributedPlan(CitusScanState *scanState);
+static void StartStreamingExecution(CitusScanState *scanState,
+									DistributedExecution *execution);
+static void StreamingExecutionContextCallback(void *arg);
+static void MaterializeActiveStreamingExecution(void);
+static void AbandonDistributedExecution(DistributedExecution *execution);
+static uint64 DistributedPlanRowLimit(CitusScanState *scanState);
+static void StopDistributedExecutionAtRowLimit(DistributedExecution *execution);
+static TaskResultDestination * CreateTaskResultDestination(TupleDesc tupleDescriptor,
+														   DestReceiver *destReceiver);
+static void SendTupleToResultDestination(TaskResultDestination *resultDestination,
+										 HeapTuple heapTuple);
+
+
+PG_FUNCTION_INFO_V1(citus_executor_event_loop_stats);
+PG_FUNCTION_INFO_V1(citus_executor_task_stats);
+
 
 /*
  * AdaptiveExecutor is called via CitusExecScan on the
@@ -629,7 +876,6 @@ AdaptiveExecutor(CitusScanState *scanState)
 	EState *executorState = ScanStateGetExecutorState(scanState);
 	ParamListInfo paramListInfo = executorState->es_param_list_info;
 	TupleDesc tupleDescriptor = ScanStateGetTupleDescriptor(scanState);
-	bool randomAccess = true;
 	bool interTransactions = false;
 	int targetPoolSize = MaxAdaptiveExecutorPoolSize;
 	List *jobIdList = NIL;
@@ -640,6 +886,9 @@ AdaptiveExecutor(CitusScanState *scanState)
 	/* we should only call this once before the scan finished */
 	Assert(!scanState->finishedRemoteScan);
 
+	/* we need the connections of an ongoing streaming execution */
+	MaterializeActiveStreamingExecution();
+
 	/*
 	 * PostgreSQL takes locks on all partitions in the executor. It's not entirely
 	 * clear why this is necessary (instead of locking the parent during DDL), but
@@ -661,6 +910,13 @@ AdaptiveExecutor(CitusScanState *scanState)
 		targetPoolSize = 1;
 	}
 
+	/*
+	 * When streaming, the tuple store only buffers the rows that arrived since
+	 * the scan last asked for more, hence we do not need random access.
+	 */
+	bool streamResults = ShouldStreamDistributedPlan(scanState);
+	bool randomAccess = !streamResults;
+
 	scanState->tuplestorestate =
 		tuplestore_begin_heap(randomAccess, interTransactions, work_mem);
 
@@ -679,6 +935,31 @@ AdaptiveExecutor(CitusScanState *scanState)
 		targetPoolSize,
 		&xactProperties);
 
+	/*
+	 * Streaming executions stop once the scan stops reading instead. We cannot
+	 * cancel commands that run in remote transaction blocks.
+	 */
+	if (!streamResults &&
+		xactProperties.useRemoteTransactionBlocks != TRANSACTION_BLOCKS_REQUIRED)
+	{
+		execution->rowLimit = DistributedPlanRowLimit(scanState);
+	}
+
+	if (distributedPlan->sortedMerge)
+	{
+		/*
+		 * The workers sort the results of the tasks, hence we keep the results
+		 * of each task apart and CitusExecScan merges them. The local tasks come
+		 * first, followed by the remote tasks.
+		 */
+		int localTaskCount = list_length(execution->localTaskList);
+		int taskCount = list_length(execution->tasksToExecute);
+
+		scanState->sortedMergeState = CreateSortedMergeState(scanState, taskCount);
+		execution->taskTupleStores =
+			scanState->sortedMergeState->tupleStores + localTaskCount;
+	}
+
 	/*
 	 * Make sure that we acquire the appropriate locks even if the local tasks
 	 * are going to be executed with local execution.
@@ -698,6 +979,13 @@ AdaptiveExecutor(CitusScanState *scanState)
 	{
 		SequentialRunDistributedExecution(execution);
 	}
+	else if (streamResults && list_length(execution->localTaskList) == 0)
+	{
+		/* CitusExecScan continues the execution as it consumes the rows */
+		StartStreamingExecution(scanState, execution);
+
+		return resultSlot;
+	}
 	else
 	{
 		RunDistributedExecution(execution);
@@ -735,6 +1023,13 @@ AdaptiveExecutor(CitusScanState *scanState)
 		SortTupleStore(scanState);
 	}
 
+	if (scanState->sortedMergeState != NULL &&
+		(scanState->eflags & (EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK | EXEC_FLAG_REWIND)))
+	{
+		/* the merge only moves forward, so merge everything up front */
+		MergeSortedTaskResults(scanState);
+	}
+
 	return resultSlot;
 }
 
@@ -751,154 +1046,787 @@ HasDependentJobs(Job *mainJob)
 
 
 /*
- * RunLocalExecution runs the localTaskList in the execution, fills the tuplestore
- * and sets the es_processed if necessary.
+ * ShouldStreamDistributedPlan returns whether the rows of the given scan can be
+ * returned while the execution is still in progress, instead of receiving all
+ * of them into the tuple store first.
  *
- * It also sorts the tuplestore if there are no remote tasks remaining.
+ * A streaming execution keeps its connections busy until the scan reads the
+ * last row, so we only stream read-only plans outside of transaction blocks
+ * that the executor is going to read to the end within the current
+ * ExecutorRun call. We also skip plans that sort, group or aggregate on the
+ * coordinator, since those read all the rows before returning the first one.
  */
-static void
-RunLocalExecution(CitusScanState *scanState, DistributedExecution *execution)
+static bool
+ShouldStreamDistributedPlan(CitusScanState *scanState)
 {
-	uint64 rowsProcessed = ExecuteLocalTaskList(scanState, execution->localTaskList);
+	DistributedPlan *distributedPlan = scanState->distributedPlan;
+	Query *masterQuery = distributedPlan->masterQuery;
 
-	LocalExecutionHappened = true;
+	if (!EnableStreamingExecution)
+	{
+		return false;
+	}
 
-	/*
-	 * We're deliberately not setting execution->rowsProceessed here. The main reason
-	 * is that modifications to reference tables would end-up setting it both here
-	 * and in AdaptiveExecutor. Instead, we set executorState here and skip updating it
-	 * for reference table modifications in AdaptiveExecutor.
-	 */
-	EState *executorState = ScanStateGetExecutorState(scanState);
-	executorState->es_processed = rowsProcessed;
-}
+	if (distributedPlan->modLevel != ROW_MODIFY_READONLY ||
+		HasDependentJobs(distributedPlan->workerJob))
+	{
+		return false;
+	}
 
+	/* we only buffer the rows, so we cannot go back to an earlier one */
+	if (scanState->eflags & (EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK | EXEC_FLAG_REWIND))
+	{
+		return false;
+	}
 
-/*
- * AdjustDistributedExecutionAfterLocalExecution simply updates the necessary fields of
- * the distributed execution.
- */
-static void
-AdjustDistributedExecutionAfterLocalExecution(DistributedExecution *execution)
-{
-	/* we only need to execute the remote tasks */
-	execution->tasksToExecute = execution->remoteTaskList;
+	/* cursors fetch rows across multiple ExecutorRun calls */
+	if (!ExecutorRunFetchesAllRows)
+	{
+		return false;
+	}
 
-	execution->totalTaskCount = list_length(execution->remoteTaskList);
-	execution->unfinishedTaskCount = list_length(execution->remoteTaskList);
-}
+	if (IsMultiStatementTransaction() || InCoordinatedTransaction())
+	{
+		return false;
+	}
 
+	if (masterQuery != NULL &&
+		(masterQuery->sortClause != NIL || masterQuery->groupClause != NIL ||
+		 masterQuery->groupingSets != NIL || masterQuery->distinctClause != NIL ||
+		 masterQuery->hasAggs || masterQuery->hasWindowFuncs))
+	{
+		return false;
+	}
 
-/*
- * ExecuteUtilityTaskListWithoutResults is a wrapper around executing task
- * list for utility commands. It simply calls in adaptive executor's task
- * execution function.
- */
-void
-ExecuteUtilityTaskListWithoutResults(List *taskList)
-{
-	ExecuteTaskList(ROW_MODIFY_NONE, taskList, MaxAdaptiveExecutorPoolSize);
+	return true;
 }
 
 
 /*
- * ExecuteTaskListRepartiton is a proxy to ExecuteTaskListExtended() with defaults
- * for some of the arguments for a repartition query.
+ * DistributedPlanRowLimit returns the number of rows after which the execution
+ * of the given scan can stop, or 0 if the scan needs all the rows.
+ *
+ * That is the case when the coordinator only applies a LIMIT (and OFFSET) to
+ * the rows of the tasks, since the Limit node stops reading the tuple store
+ * after that many rows. We cancel the running tasks once we have the rows, so
+ * we only do so outside of transaction blocks, where cancelling a command does
+ * not abort a remote transaction.
  */
-uint64
-ExecuteTaskListOutsideTransaction(RowModifyLevel modLevel, List *taskList, int
-								  targetPoolSize)
+static uint64
+DistributedPlanRowLimit(CitusScanState *scanState)
 {
-	TupleDesc tupleDescriptor = NULL;
-	Tuplestorestate *tupleStore = NULL;
-	bool hasReturning = false;
+	DistributedPlan *distributedPlan = scanState->distributedPlan;
+	Query *masterQuery = distributedPlan->masterQuery;
 
-	TransactionProperties xactProperties = DecideTransactionPropertiesForTaskList(
-		modLevel, taskList, true);
+	if (!EnableEarlyLimitTermination)
+	{
+		return 0;
+	}
 
+	if (distributedPlan->modLevel != ROW_MODIFY_READONLY ||
+		HasDependentJobs(distributedPlan->workerJob))
+	{
+		return 0;
+	}
 
-	return ExecuteTaskListExtended(modLevel, taskList, tupleDescriptor,
-								   tupleStore, hasReturning, targetPoolSize,
-								   &xactProperties);
-}
+	if (masterQuery == NULL || masterQuery->limitCount == NULL)
+	{
+		return 0;
+	}
 
+	if (masterQuery->sortClause != NIL || masterQuery->groupClause != NIL ||
+		masterQuery->groupingSets != NIL || masterQuery->distinctClause != NIL ||
+		masterQuery->hasAggs || masterQuery->hasWindowFuncs ||
+		masterQuery->hasTargetSRFs || masterQuery->havingQual != NULL ||
+		(masterQuery->jointree != NULL && masterQuery->jointree->quals != NULL))
+	{
+		return 0;
+	}
 
-/*
- * ExecuteTaskList is a proxy to ExecuteTaskListExtended() with defaults
- * for some of the arguments.
- */
-uint64
-ExecuteTaskList(RowModifyLevel modLevel, List *taskList, int targetPoolSize)
-{
-	TupleDesc tupleDescriptor = NULL;
-	Tuplestorestate *tupleStore = NULL;
-	bool hasReturning = false;
+	if (IsMultiStatementTransaction() || InCoordinatedTransaction())
+	{
+		return 0;
+	}
 
-	TransactionProperties xactProperties =
-		DecideTransactionPropertiesForTaskList(modLevel, taskList, false);
+	/* we only know the number of rows upfront for constant LIMIT and OFFSET clauses */
+	if (!IsA(masterQuery->limitCount, Const) ||
+		(masterQuery->limitOffset != NULL && !IsA(masterQuery->limitOffset, Const)))
+	{
+		return 0;
+	}
 
-	return ExecuteTaskListExtended(modLevel, taskList, tupleDescriptor,
-								   tupleStore, hasReturning, targetPoolSize,
-								   &xactProperties);
-}
+	Const *limitCountConst = (Const *) masterQuery->limitCount;
+	Const *limitOffsetConst = (Const *) masterQuery->limitOffset;
 
+	/* LIMIT NULL means LIMIT ALL */
+	if (limitCountConst->constisnull)
+	{
+		return 0;
+	}
 
-/*
- * ExecuteTaskListIntoTupleStore is a proxy to ExecuteTaskListExtended() with defaults
- * for some of the arguments.
- */
-uint64
-ExecuteTaskListIntoTupleStore(RowModifyLevel modLevel, List *taskList,
-							  TupleDesc tupleDescriptor, Tuplestorestate *tupleStore,
-							  bool hasReturning)
-{
-	int targetPoolSize = MaxAdaptiveExecutorPoolSize;
+	int64 limitCount = DatumGetInt64(limitCountConst->constvalue);
+	int64 limitOffset = 0;
 
-	TransactionProperties xactProperties = DecideTransactionPropertiesForTaskList(
-		modLevel, taskList, false);
+	if (limitOffsetConst != NULL && !limitOffsetConst->constisnull)
+	{
+		limitOffset = DatumGetInt64(limitOffsetConst->constvalue);
+	}
 
-	return ExecuteTaskListExtended(modLevel, taskList, tupleDescriptor,
-								   tupleStore, hasReturning, targetPoolSize,
-								   &xactProperties);
+	/* the Limit node errors out on negative values */
+	if (limitCount <= 0 || limitOffset < 0 || limitOffset > PG_INT64_MAX - limitCount)
+	{
+		return 0;
+	}
+
+	return (uint64) (limitCount + limitOffset);
 }
 
 
 /*
- * ExecuteTaskListExtended sets up the execution for given task list and
- * runs it.
+ * StopDistributedExecutionAtRowLimit stops an execution that received the
+ * number of rows given by its row limit. It sends cancellation requests to the
+ * sessions that are still running a task, waits for the commands to finish and
+ * discards the rest of their results, such that the connections can be reused.
+ * The sessions are then left in the same state as sessions that finished their
+ * task, such that CleanUpSessions finds them idle. The tasks that did not start
+ * yet are skipped.
  */
-uint64
-ExecuteTaskListExtended(RowModifyLevel modLevel, List *taskList,
-						TupleDesc tupleDescriptor, Tuplestorestate *tupleStore,
-						bool hasReturning, int targetPoolSize,
-						TransactionProperties *xactProperties)
+static void
+StopDistributedExecutionAtRowLimit(DistributedExecution *execution)
 {
-	ParamListInfo paramListInfo = NULL;
-
-	/*
-	 * The code-paths that rely on this function do not know how execute
-	 * commands locally.
-	 */
-	ErrorIfLocalExecutionHappened();
+	List *runningSessionList = NIL;
+	ListCell *sessionCell = NULL;
 
-	if (MultiShardConnectionType == SEQUENTIAL_CONNECTION)
+	/* send all the cancellation requests first, so the workers stop in parallel */
+	foreach(sessionCell, execution->sessionList)
 	{
-		targetPoolSize = 1;
-	}
+		WorkerSession *session = lfirst(sessionCell);
 
-	DistributedExecution *execution =
-		CreateDistributedExecution(modLevel, taskList, hasReturning, paramListInfo,
-								   tupleDescriptor, tupleStore, targetPoolSize,
-								   xactProperties);
+		if (session->currentTask == NULL)
+		{
+			continue;
+		}
 
-	StartDistributedExecution(execution);
-	RunDistributedExecution(execution);
+		SendCancelationRequest(session->connection);
+
+		runningSessionList = lappend(runningSessionList, session);
+	}
+
+	foreach(sessionCell, runningSessionList)
+	{
+		WorkerSession *session = lfirst(sessionCell);
+		MultiConnection *connection = session->connection;
+		PGconn *pgConn = connection->pgConn;
+
+		/* the command ends with an error if the cancellation arrived in time */
+		while (PQstatus(pgConn) == CONNECTION_OK)
+		{
+			PGresult *result = GetRemoteCommandResult(connection,
+													  execution->raiseInterrupts);
+			if (result == NULL)
+			{
+				break;
+			}
+
+			PQclear(result);
+		}
+
+		if (PQstatus(pgConn) != CONNECTION_OK)
+		{
+			/* CleanUpSessions closes the connection */
+			connection->connectionState = MULTI_CONNECTION_LOST;
+		}
+
+		/* the connection is idle again, as after TransactionStateMachine cleared it */
+		RemoteTransaction *transaction = &(connection->remoteTransaction);
+		if (transaction->beginSent)
+		{
+			transaction->transactionState = REMOTE_TRANS_STARTED;
+		}
+		else
+		{
+			transaction->transactionState = REMOTE_TRANS_NOT_STARTED;
+		}
+
+		/* we do not need the results of the cancelled placement executions */
+		session->currentTask->executionState = PLACEMENT_EXECUTION_FINISHED;
+
+		ListCell *placementExecutionCell = NULL;
+		foreach(placementExecutionCell, session->coalescedTaskList)
+		{
+			TaskPlacementExecution *placementExecution =
+				(TaskPlacementExecution *) lfirst(placementExecutionCell);
+
+			placementExecution->executionState = PLACEMENT_EXECUTION_FINISHED;
+		}
+
+		session->currentTask = NULL;
+		session->coalescedTaskList = NIL;
+		session->workerPool->idleConnectionCount++;
+	}
+
+	ereport(DEBUG4, (errmsg("stopped the execution after " UINT64_FORMAT " rows, "
+							"cancelled %d running tasks", execution->rowsProcessed,
+							list_length(runningSessionList))));
+
+	/* the remaining tasks are not needed */
+	execution->unfinishedTaskCount = 0;
+}
+
+
+/*
+ * StartStreamingExecution prepares the execution to be continued by
+ * ContinueStreamingExecution whenever the scan consumed all the rows in the
+ * tuple store, and starts it until the first rows arrive.
+ */
+static void
+StartStreamingExecution(CitusScanState *scanState, DistributedExecution *execution)
+{
+	bool returnOnRows = true;
+
+	/* the execution outlives AdaptiveExecutor, so copy its stack variables */
+	TransactionProperties *xactProperties = palloc(sizeof(TransactionProperties));
+	*xactProperties = *execution->transactionProperties;
+	execution->transactionProperties = xactProperties;
+
+	/*
+	 * Other executions may use the same placements before this one finishes
+	 * and we are not in a transaction block, so do not associate the placements
+	 * with the connections.
+	 */
+	xactProperties->useRemoteTransactionBlocks = TRANSACTION_BLOCKS_DISALLOWED;
+
+	/*
+	 * Make sure that we do not leak the wait event set if the query errors out
+	 * before the scan finishes.
+	 */
+	MemoryContextCallback *callback = palloc0(sizeof(MemoryContextCallback));
+	callback->func = StreamingExecutionContextCallback;
+	callback->arg = execution;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+
+	execution->streamingContext = CurrentMemoryContext;
+	scanState->streamingExecution = execution;
+
+	AssignTasksToConnections(execution);
+
+	/* always (re)build the wait event set the first time */
+	execution->connectionSetChanged = true;
+
+	bool executionFinished = RunDistributedExecutionLoop(execution, returnOnRows);
+	if (executionFinished)
+	{
+		FinishDistributedExecution(execution);
+		scanState->streamingExecution = NULL;
+	}
+	else
+	{
+		ActiveStreamingExecution = execution;
+	}
+}
+
+
+/*
+ * ContinueStreamingExecution is called by CitusExecScan after it returned all
+ * the rows in the tuple store of a streaming execution. It continues the
+ * execution until more rows arrive or the execution finishes.
+ */
+void
+ContinueStreamingExecution(CitusScanState *scanState)
+{
+	DistributedExecution *execution = scanState->streamingExecution;
+	bool returnOnRows = true;
+
+	/* all the rows in the buffer have been returned, make room for new ones */
+	tuplestore_clear(execution->tupleStore);
+
+	if (ActiveStreamingExecution == execution)
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(execution->streamingContext);
+
+		/* make sure we do not continue the execution after a failure */
+		ActiveStreamingExecution = NULL;
+
+		bool executionFinished = RunDistributedExecutionLoop(execution, returnOnRows);
+
+		MemoryContextSwitchTo(oldContext);
+
+		if (!executionFinished)
+		{
+			ActiveStreamingExecution = execution;
+			return;
+		}
+	}
+	else if (execution->unfinishedTaskCount > 0)
+	{
+		/* MaterializeActiveStreamingExecution failed and the error was caught */
+		ereport(ERROR, (errmsg("distributed execution was interrupted before "
+							   "receiving all rows")));
+	}
+
+	FinishDistributedExecution(execution);
+	scanState->streamingExecution = NULL;
+}
+
+
+/*
+ * EndStreamingExecution is called when the scan of a streaming execution ends
+ * before reading all the rows, for instance because of a LIMIT. In that case
+ * we do not need the remaining rows and abandon the execution.
+ */
+void
+EndStreamingExecution(CitusScanState *scanState)
+{
+	DistributedExecution *execution = scanState->streamingExecution;
+
+	if (ActiveStreamingExecution == execution)
+	{
+		ActiveStreamingExecution = NULL;
+
+		AbandonDistributedExecution(execution);
+	}
+
+	FinishDistributedExecution(execution);
+	scanState->streamingExecution = NULL;
+}
+
+
+/*
+ * StreamingExecutionContextCallback is called when the memory context of a
+ * streaming execution goes away. On success, the execution has already been
+ * finished by then. Otherwise, the query errored out and we only need to
+ * release the wait event set, since the connections are cleaned up at the
+ * end of the transaction.
+ */
+static void
+StreamingExecutionContextCallback(void *arg)
+{
+	DistributedExecution *execution = (DistributedExecution *) arg;
+
+	if (execution->waitEventSet != NULL)
+	{
+		FreeWaitEventSet(execution->waitEventSet);
+		execution->waitEventSet = NULL;
+	}
+
+	if (ActiveStreamingExecution == execution)
+	{
+		ActiveStreamingExecution = NULL;
+	}
+}
+
+
+/*
+ * MaterializeActiveStreamingExecution receives the remaining rows of the
+ * ongoing streaming execution, if any, into its tuple store such that its
+ * connections can be used by a new execution. The scan then returns the
+ * rows from the tuple store as usual.
+ */
+static void
+MaterializeActiveStreamingExecution(void)
+{
+	DistributedExecution *execution = ActiveStreamingExecution;
+	bool returnOnRows = false;
+
+	if (execution == NULL)
+	{
+		return;
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(execution->streamingContext);
+
+	/* make sure we do not continue the execution after a failure */
+	ActiveStreamingExecution = NULL;
+
+	RunDistributedExecutionLoop(execution, returnOnRows);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * AbandonDistributedExecution stops an unfinished execution. Connections
+ * that are still busy with a task are cancelled and closed, idle ones are
+ * kept for subsequent executions.
+ */
+static void
+AbandonDistributedExecution(DistributedExecution *execution)
+{
+	ListCell *sessionCell = NULL;
+
+	if (execution->waitEventSet != NULL)
+	{
+		FreeWaitEventSet(execution->waitEventSet);
+		execution->waitEventSet = NULL;
+	}
+
+	foreach(sessionCell, execution->sessionList)
+	{
+		WorkerSession *session = lfirst(sessionCell);
+		MultiConnection *connection = session->connection;
+		RemoteTransaction *transaction = &(connection->remoteTransaction);
+
+		UnclaimConnection(connection);
+
+		if (connection->connectionState == MULTI_CONNECTION_CONNECTED &&
+			transaction->transactionState == REMOTE_TRANS_NOT_STARTED)
+		{
+			/* get ready for the next executions if we need use the same connection */
+			connection->waitFlags = WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE;
+		}
+		else
+		{
+			/* cancels the running command, if any */
+			ShutdownConnection(connection);
+			CloseConnection(connection);
+		}
+	}
+}
+
+
+/*
+ * RunLocalExecution runs the localTaskList in the execution, fills the tuplestore
+ * and sets the es_processed if necessary.
+ *
+ * It also sorts the tuplestore if there are no remote tasks remaining.
+ */
+static void
+RunLocalExecution(CitusScanState *scanState, DistributedExecution *execution)
+{
+	uint64 rowsProcessed = 0;
+
+	if (scanState->sortedMergeState != NULL)
+	{
+		rowsProcessed = ExecuteLocalTasksForSortedMerge(scanState,
+														execution->localTaskList);
+	}
+	else
+	{
+		rowsProcessed = ExecuteLocalTaskList(scanState, execution->localTaskList);
+	}
+
+	LocalExecutionHappened = true;
+
+	/*
+	 * We're deliberately not setting execution->rowsProceessed here. The main reason
+	 * is that modifications to reference tables would end-up setting it both here
+	 * and in AdaptiveExecutor. Instead, we set executorState here and skip updating it
+	 * for reference table modifications in AdaptiveExecutor.
+	 */
+	EState *executorState = ScanStateGetExecutorState(scanState);
+	executorState->es_processed = rowsProcessed;
+}
+
+
+/*
+ * ExecuteLocalTasksForSortedMerge executes each of the local tasks into its
+ * own tuple store of the sorted merge, which are the first ones.
+ */
+static uint64
+ExecuteLocalTasksForSortedMerge(CitusScanState *scanState, List *localTaskList)
+{
+	Tuplestorestate *scanTupleStore = scanState->tuplestorestate;
+	Tuplestorestate **taskTupleStores = scanState->sortedMergeState->tupleStores;
+	uint64 rowsProcessed = 0;
+	int taskIndex = 0;
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, localTaskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		scanState->tuplestorestate = taskTupleStores[taskIndex];
+		rowsProcessed += ExecuteLocalTaskList(scanState, list_make1(task));
+
+		taskIndex++;
+	}
+
+	scanState->tuplestorestate = scanTupleStore;
+
+	return rowsProcessed;
+}
+
+
+/*
+ * AdjustDistributedExecutionAfterLocalExecution simply updates the necessary fields of
+ * the distributed execution.
+ */
+static void
+AdjustDistributedExecutionAfterLocalExecution(DistributedExecution *execution)
+{
+	/* we only need to execute the remote tasks */
+	execution->tasksToExecute = execution->remoteTaskList;
+
+	execution->totalTaskCount = list_length(execution->remoteTaskList);
+	execution->unfinishedTaskCount = list_length(execution->remoteTaskList);
+}
+
+
+/*
+ * ExecuteUtilityTaskListWithoutResults is a wrapper around executing task
+ * list for utility commands. It simply calls in adaptive executor's task
+ * execution function.
+ */
+void
+ExecuteUtilityTaskListWithoutResults(List *taskList)
+{
+	ExecuteTaskList(ROW_MODIFY_NONE, taskList, MaxAdaptiveExecutorPoolSize);
+}
+
+
+/*
+ * ExecuteTaskListRepartiton is a proxy to ExecuteTaskListExtended() with defaults
+ * for some of the arguments for a repartition query.
+ */
+uint64
+ExecuteTaskListOutsideTransaction(RowModifyLevel modLevel, List *taskList, int
+								  targetPoolSize)
+{
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	bool hasReturning = false;
+
+	TransactionProperties xactProperties = DecideTransactionPropertiesForTaskList(
+		modLevel, taskList, true);
+
+
+	return ExecuteTaskListExtended(modLevel, taskList, tupleDescriptor,
+								   tupleStore, hasReturning, targetPoolSize,
+								   &xactProperties);
+}
+
+
+/*
+ * ExecuteTaskListInDependencyOrder executes the given tasks outside of a
+ * transaction block, such that a task only starts once the tasks on its
+ * dependentTaskList have finished. Dependencies that are not in the task
+ * list are considered to have finished already.
+ *
+ * Unlike executing the tasks in waves, a task starts as soon as its own
+ * dependencies have finished, over the connections that the execution has
+ * already opened to its worker.
+ */
+uint64
+ExecuteTaskListInDependencyOrder(RowModifyLevel modLevel, List *taskList,
+								 int targetPoolSize)
+{
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	bool hasReturning = false;
+	ParamListInfo paramListInfo = NULL;
+
+	/*
+	 * The code-paths that rely on this function do not know how execute
+	 * commands locally.
+	 */
+	ErrorIfLocalExecutionHappened();
+
+	/* we need the connections of an ongoing streaming execution */
+	MaterializeActiveStreamingExecution();
+
+	if (MultiShardConnectionType == SEQUENTIAL_CONNECTION)
+	{
+		targetPoolSize = 1;
+	}
+
+	TransactionProperties xactProperties = DecideTransactionPropertiesForTaskList(
+		modLevel, taskList, true);
+
+	DistributedExecution *execution =
+		CreateDistributedExecution(modLevel, taskList, hasReturning, paramListInfo,
+								   tupleDescriptor, tupleStore, targetPoolSize,
+								   &xactProperties);
+
+	execution->followTaskDependencies = true;
+
+	DependencyOrderedTaskCount += list_length(taskList);
+
+	StartDistributedExecution(execution);
+	RunDistributedExecution(execution);
+	FinishDistributedExecution(execution);
+
+	return execution->rowsProcessed;
+}
+
+
+/*
+ * ExecuteTaskList is a proxy to ExecuteTaskListExtended() with defaults
+ * for some of the arguments.
+ */
+uint64
+ExecuteTaskList(RowModifyLevel modLevel, List *taskList, int targetPoolSize)
+{
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	bool hasReturning = false;
+
+	TransactionProperties xactProperties =
+		DecideTransactionPropertiesForTaskList(modLevel, taskList, false);
+
+	return ExecuteTaskListExtended(modLevel, taskList, tupleDescriptor,
+								   tupleStore, hasReturning, targetPoolSize,
+								   &xactProperties);
+}
+
+
+/*
+ * ExecuteTaskListIntoTupleStore is a proxy to ExecuteTaskListExtended() with defaults
+ * for some of the arguments.
+ */
+uint64
+ExecuteTaskListIntoTupleStore(RowModifyLevel modLevel, List *taskList,
+							  TupleDesc tupleDescriptor, Tuplestorestate *tupleStore,
+							  bool hasReturning)
+{
+	int targetPoolSize = MaxAdaptiveExecutorPoolSize;
+
+	TransactionProperties xactProperties = DecideTransactionPropertiesForTaskList(
+		modLevel, taskList, false);
+
+	return ExecuteTaskListExtended(modLevel, taskList, tupleDescriptor,
+								   tupleStore, hasReturning, targetPoolSize,
+								   &xactProperties);
+}
+
+
+/*
+ * ExecuteTaskListExtended sets up the execution for given task list and
+ * runs it.
+ */
+uint64
+ExecuteTaskListExtended(RowModifyLevel modLevel, List *taskList,
+						TupleDesc tupleDescriptor, Tuplestorestate *tupleStore,
+						bool hasReturning, int targetPoolSize,
+						TransactionProperties *xactProperties)
+{
+	ParamListInfo paramListInfo = NULL;
+
+	/*
+	 * The code-paths that rely on this function do not know how execute
+	 * commands locally.
+	 */
+	ErrorIfLocalExecutionHappened();
+
+	/* we need the connections of an ongoing streaming execution */
+	MaterializeActiveStreamingExecution();
+
+	if (MultiShardConnectionType == SEQUENTIAL_CONNECTION)
+	{
+		targetPoolSize = 1;
+	}
+
+	DistributedExecution *execution =
+		CreateDistributedExecution(modLevel, taskList, hasReturning, paramListInfo,
+								   tupleDescriptor, tupleStore, targetPoolSize,
+								   xactProperties);
+
+	StartDistributedExecution(execution);
+	RunDistributedExecution(execution);
 	FinishDistributedExecution(execution);
 
 	return execution->rowsProcessed;
 }
 
 
+/*
+ * ExecuteDistributedPlansIntoDestReceivers executes the tasks of the given
+ * read-only distributed plans in a single distributed execution, such that
+ * the plans run concurrently. The rows of the tasks of each plan are sent
+ * to the DestReceiver at the same position in destReceiverList as soon as
+ * they arrive, after converting them using the tuple descriptor at the same
+ * position in tupleDescriptorList. The caller starts up and shuts down the
+ * receivers.
+ *
+ * The plans should return the rows of their tasks without any processing on
+ * the coordinator (see IsTaskResultPassthroughPlan) and should not have any
+ * subplans of their own.
+ */
+void
+ExecuteDistributedPlansIntoDestReceivers(List *distributedPlanList,
+										 List *tupleDescriptorList,
+										 List *destReceiverList)
+{
+	List *taskList = NIL;
+	List *destinationList = NIL;
+	ListCell *distributedPlanCell = NULL;
+	ListCell *tupleDescriptorCell = NULL;
+	ListCell *destReceiverCell = NULL;
+	ListCell *destinationCell = NULL;
+	int targetPoolSize = MaxAdaptiveExecutorPoolSize;
+	bool hasReturning = false;
+	ParamListInfo paramListInfo = NULL;
+	int taskIndex = 0;
+
+	/* the rows go to the destinations of the tasks rather than a tuple store */
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+
+	/* we need the connections of an ongoing streaming execution */
+	MaterializeActiveStreamingExecution();
+
+	forthree(distributedPlanCell, distributedPlanList,
+			 tupleDescriptorCell, tupleDescriptorList,
+			 destReceiverCell, destReceiverList)
+	{
+		DistributedPlan *distributedPlan = (DistributedPlan *) lfirst(distributedPlanCell);
+		List *planTaskList = distributedPlan->workerJob->taskList;
+		ListCell *taskCell = NULL;
+
+		Assert(distributedPlan->modLevel == ROW_MODIFY_READONLY);
+		Assert(distributedPlan->subPlanList == NIL);
+
+		TaskResultDestination *resultDestination =
+			CreateTaskResultDestination((TupleDesc) lfirst(tupleDescriptorCell),
+										(DestReceiver *) lfirst(destReceiverCell));
+
+		LockPartitionsForDistributedPlan(distributedPlan);
+
+		foreach(taskCell, planTaskList)
+		{
+			taskList = lappend(taskList, lfirst(taskCell));
+			destinationList = lappend(destinationList, resultDestination);
+		}
+	}
+
+	if (MultiShardConnectionType == SEQUENTIAL_CONNECTION)
+	{
+		targetPoolSize = 1;
+	}
+
+	TransactionProperties xactProperties = DecideTransactionPropertiesForTaskList(
+		ROW_MODIFY_READONLY, taskList, false);
+
+	DistributedExecution *execution =
+		CreateDistributedExecution(ROW_MODIFY_READONLY, taskList, hasReturning,
+								   paramListInfo, tupleDescriptor, tupleStore,
+								   targetPoolSize, &xactProperties);
+
+	execution->taskDestinations =
+		(TaskResultDestination **) palloc0(list_length(taskList) *
+										   sizeof(TaskResultDestination *));
+
+	foreach(destinationCell, destinationList)
+	{
+		execution->taskDestinations[taskIndex] =
+			(TaskResultDestination *) lfirst(destinationCell);
+		taskIndex++;
+	}
+
+	StartDistributedExecution(execution);
+
+	if (ShouldRunTasksSequentially(execution->tasksToExecute))
+	{
+		SequentialRunDistributedExecution(execution);
+	}
+	else
+	{
+		RunDistributedExecution(execution);
+	}
+
+	FinishDistributedExecution(execution);
+}
+
+
 /*
  * CreateDistributedExecution creates a distributed execution data structure for
  * a distributed plan.
@@ -933,11 +1861,14 @@ CreateDistributedExecution(RowModifyLevel modLevel, List *taskList, bool hasRetu
 	execution->totalTaskCount = list_length(taskList);
 	execution->unfinishedTaskCount = list_length(taskList);
 	execution->rowsProcessed = 0;
+	execution->rowLimit = 0;
 
 	execution->raiseInterrupts = true;
 
 	execution->connectionSetChanged = false;
-	execution->waitFlagsChanged = false;
+	execution->newSessionList = NIL;
+	execution->waitFlagsChangedSessionList = NIL;
+	execution->waitEventCount = 0;
 
 	/* allocate execution specific data once, on the ExecutorState memory context */
 	if (tupleDescriptor != NULL)
@@ -952,6 +1883,12 @@ CreateDistributedExecution(RowModifyLevel modLevel, List *taskList, bool hasRetu
 		execution->columnArray = NULL;
 	}
 
+	execution->useBinaryProtocol = CanUseBinaryProtocol(modLevel, tupleDescriptor);
+	if (execution->useBinaryProtocol)
+	{
+		InitializeBinaryResultMetadata(execution);
+	}
+
 	if (ShouldExecuteTasksLocally(taskList))
 	{
 		bool readOnlyPlan = !TaskListModifiesDatabase(modLevel, taskList);
@@ -964,6 +1901,72 @@ CreateDistributedExecution(RowModifyLevel modLevel, List *taskList, bool hasRetu
 }
 
 
+/*
+ * CanUseBinaryProtocol returns whether the results of an execution can be
+ * requested in binary format. We only do that for read-only executions that
+ * return rows, and only when all the columns have a binary representation that
+ * is safe to transfer between nodes (see CanUseBinaryCopyFormatForType).
+ *
+ * libpq only allows us to pick a single result format for all the columns, so
+ * if any of the columns cannot be received in binary format, we fall back to
+ * the text format for the whole execution.
+ */
+static bool
+CanUseBinaryProtocol(RowModifyLevel modLevel, TupleDesc tupleDescriptor)
+{
+	if (!EnableBinaryProtocol)
+	{
+		return false;
+	}
+
+	if (modLevel != ROW_MODIFY_READONLY || tupleDescriptor == NULL)
+	{
+		return false;
+	}
+
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute column = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (!CanUseBinaryCopyFormatForType(column->atttypid))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * InitializeBinaryResultMetadata looks up the receive functions for the columns
+ * in the tuple descriptor of the execution and allocates the arrays that are
+ * used to build tuples from binary results.
+ */
+static void
+InitializeBinaryResultMetadata(DistributedExecution *execution)
+{
+	TupleDesc tupleDescriptor = execution->tupleDescriptor;
+	int columnCount = tupleDescriptor->natts;
+
+	execution->columnReceiveFunctions =
+		(FmgrInfo *) palloc0(columnCount * sizeof(FmgrInfo));
+	execution->columnTypeIoParams = (Oid *) palloc0(columnCount * sizeof(Oid));
+	execution->columnValues = (Datum *) palloc0(columnCount * sizeof(Datum));
+	execution->columnNulls = (bool *) palloc0(columnCount * sizeof(bool));
+
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute column = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid receiveFunctionId = InvalidOid;
+
+		getTypeBinaryInputInfo(column->atttypid, &receiveFunctionId,
+							   &execution->columnTypeIoParams[columnIndex]);
+		fmgr_info(receiveFunctionId, &execution->columnReceiveFunctions[columnIndex]);
+	}
+}
+
+
 /*
  * DecideTransactionPropertiesForTaskList decides whether to use remote transaction
  * blocks, whether to use 2PC for the given task list, and whether to error on any
@@ -1594,10 +2597,17 @@ AssignTasksToConnections(DistributedExecution *execution)
 	RowModifyLevel modLevel = execution->modLevel;
 	List *taskList = execution->tasksToExecute;
 	bool hasReturning = execution->hasReturning;
+	int taskIndex = 0;
+	HTAB *shardCommandExecutionHash = NULL;
 
 	ListCell *taskCell = NULL;
 	ListCell *sessionCell = NULL;
 
+	if (execution->followTaskDependencies)
+	{
+		shardCommandExecutionHash = CreateShardCommandExecutionHash(taskList);
+	}
+
 	foreach(taskCell, taskList)
 	{
 		Task *task = (Task *) lfirst(taskCell);
@@ -1623,6 +2633,46 @@ AssignTasksToConnections(DistributedExecution *execution)
 			(hasReturning && !task->partiallyLocalOrRemote) ||
 			modLevel == ROW_MODIFY_READONLY;
 
+		if (execution->taskTupleStores != NULL)
+		{
+			shardCommandExecution->tupleStore = execution->taskTupleStores[taskIndex];
+		}
+		else
+		{
+			shardCommandExecution->tupleStore = execution->tupleStore;
+		}
+
+		if (execution->taskDestinations != NULL)
+		{
+			shardCommandExecution->resultDestination =
+				execution->taskDestinations[taskIndex];
+		}
+
+		if (shardCommandExecutionHash != NULL)
+		{
+			bool found = false;
+
+			ShardCommandExecutionHashEntry *hashEntry =
+				hash_search(shardCommandExecutionHash, &task, HASH_FIND, &found);
+			Assert(found);
+
+			hashEntry->shardCommandExecution = shardCommandExecution;
+
+			/*
+			 * Tasks that wait for other tasks start out in the pending queues
+			 * and are moved to the ready queues by ShardCommandExecutionReady.
+			 */
+			shardCommandExecution->unfinishedDependencyCount =
+				UnfinishedDependencyCount(task, shardCommandExecutionHash);
+			if (shardCommandExecution->unfinishedDependencyCount > 0)
+			{
+				placementExecutionReady = false;
+				execution->waitingTaskCount++;
+			}
+		}
+
+		taskIndex++;
+
 		foreach(taskPlacementCell, task->taskPlacementList)
 		{
 			ShardPlacement *taskPlacement = (ShardPlacement *) lfirst(taskPlacementCell);
@@ -1743,6 +2793,12 @@ AssignTasksToConnections(DistributedExecution *execution)
 		}
 	}
 
+	if (shardCommandExecutionHash != NULL)
+	{
+		LinkDownstreamExecutions(shardCommandExecutionHash);
+		hash_destroy(shardCommandExecutionHash);
+	}
+
 	/*
 	 * The executor claims connections exclusively to make sure that calls to
 	 * StartNodeUserDatabaseConnection do not return the same connections.
@@ -1760,6 +2816,109 @@ AssignTasksToConnections(DistributedExecution *execution)
 }
 
 
+/*
+ * CreateShardCommandExecutionHash creates a hash that maps the tasks in the
+ * given list to their shard command executions, which are filled in by the
+ * caller.
+ */
+static HTAB *
+CreateShardCommandExecutionHash(List *taskList)
+{
+	HASHCTL info;
+	ListCell *taskCell = NULL;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(Task *);
+	info.entrysize = sizeof(ShardCommandExecutionHashEntry);
+	info.hcxt = CurrentMemoryContext;
+	int hashFlags = (HASH_ELEM | HASH_CONTEXT | HASH_BLOBS);
+
+	HTAB *shardCommandExecutionHash =
+		hash_create("Shard Command Execution Hash", Max(list_length(taskList), 32),
+					&info, hashFlags);
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		bool found = false;
+
+		ShardCommandExecutionHashEntry *hashEntry =
+			hash_search(shardCommandExecutionHash, &task, HASH_ENTER, &found);
+		hashEntry->shardCommandExecution = NULL;
+	}
+
+	return shardCommandExecutionHash;
+}
+
+
+/*
+ * UnfinishedDependencyCount returns the number of tasks on the dependentTaskList
+ * of the given task that are part of the execution. Tasks outside of the
+ * execution are considered to have finished already.
+ */
+static int
+UnfinishedDependencyCount(Task *task, HTAB *shardCommandExecutionHash)
+{
+	int unfinishedDependencyCount = 0;
+	ListCell *dependentTaskCell = NULL;
+
+	foreach(dependentTaskCell, task->dependentTaskList)
+	{
+		Task *dependentTask = (Task *) lfirst(dependentTaskCell);
+		bool found = false;
+
+		hash_search(shardCommandExecutionHash, &dependentTask, HASH_FIND, &found);
+		if (found)
+		{
+			unfinishedDependencyCount++;
+		}
+	}
+
+	return unfinishedDependencyCount;
+}
+
+
+/*
+ * LinkDownstreamExecutions adds the shard command execution of every task to
+ * the downstreamExecutionList of the executions of the tasks it depends on,
+ * such that finishing a task only needs to look at the tasks that wait for it.
+ */
+static void
+LinkDownstreamExecutions(HTAB *shardCommandExecutionHash)
+{
+	HASH_SEQ_STATUS status;
+	ShardCommandExecutionHashEntry *hashEntry = NULL;
+
+	hash_seq_init(&status, shardCommandExecutionHash);
+
+	while ((hashEntry = hash_seq_search(&status)) != NULL)
+	{
+		Task *task = hashEntry->task;
+		ListCell *dependentTaskCell = NULL;
+
+		foreach(dependentTaskCell, task->dependentTaskList)
+		{
+			Task *dependentTask = (Task *) lfirst(dependentTaskCell);
+			bool found = false;
+
+			ShardCommandExecutionHashEntry *upstreamEntry =
+				hash_search(shardCommandExecutionHash, &dependentTask, HASH_FIND,
+							&found);
+			if (!found)
+			{
+				continue;
+			}
+
+			ShardCommandExecution *upstreamExecution =
+				upstreamEntry->shardCommandExecution;
+			upstreamExecution->downstreamExecutionList =
+				lappend(upstreamExecution->downstreamExecutionList,
+						hashEntry->shardCommandExecution);
+		}
+	}
+}
+
+
 /*
  * UseConnectionPerPlacement returns whether we should use a separate connection
  * per placement even if another connection is idle. We mostly use this in testing
@@ -1892,6 +3051,7 @@ FindOrCreateWorkerSession(WorkerPool *workerPool, MultiConnection *connection)
 	session->connection = connection;
 	session->workerPool = workerPool;
 	session->commandsSent = 0;
+	session->waitEventSetIndex = WAIT_EVENT_SET_INDEX_NOT_INITIALIZED;
 	dlist_init(&session->pendingTaskQueue);
 	dlist_init(&session->readyTaskQueue);
 
@@ -1965,6 +3125,9 @@ static void
 SequentialRunDistributedExecution(DistributedExecution *execution)
 {
 	List *taskList = execution->tasksToExecute;
+	Tuplestorestate **taskTupleStores = execution->taskTupleStores;
+	TaskResultDestination **taskDestinations = execution->taskDestinations;
+	int taskIndex = 0;
 
 	ListCell *taskCell = NULL;
 	int connectionMode = MultiShardConnectionType;
@@ -1984,6 +3147,18 @@ SequentialRunDistributedExecution(DistributedExecution *execution)
 		execution->totalTaskCount = 1;
 		execution->unfinishedTaskCount = 1;
 
+		if (taskTupleStores != NULL)
+		{
+			execution->taskTupleStores = taskTupleStores + taskIndex;
+		}
+
+		if (taskDestinations != NULL)
+		{
+			execution->taskDestinations = taskDestinations + taskIndex;
+		}
+
+		taskIndex++;
+
 		CHECK_FOR_INTERRUPTS();
 
 		if (IsHoldOffCancellationReceived())
@@ -2004,81 +3179,93 @@ SequentialRunDistributedExecution(DistributedExecution *execution)
  * RunDistributedExecution runs a distributed execution to completion. It first opens
  * connections for distributed execution and assigns each task with shard placements
  * that have previously been modified in the current transaction to the connection
- * that modified them. Then, it creates a wait event set to listen for events on
- * any of the connections and runs the connection state machine when a connection
- * has an event.
+ * that modified them. Then, it runs the event loop in RunDistributedExecutionLoop.
  */
 void
 RunDistributedExecution(DistributedExecution *execution)
 {
-	WaitEvent *events = NULL;
+	bool returnOnRows = false;
 
 	AssignTasksToConnections(execution);
 
+	/* always (re)build the wait event set the first time */
+	execution->connectionSetChanged = true;
+
+	RunDistributedExecutionLoop(execution, returnOnRows);
+}
+
+
+/*
+ * RunDistributedExecutionLoop creates a wait event set to listen for events on
+ * any of the connections of the execution and runs the connection state machine
+ * when a connection has an event, until all tasks are finished.
+ *
+ * If returnOnRows is set, the function instead returns as soon as rows were
+ * added to the tuple store, while keeping the connections and the wait event
+ * set around, such that a subsequent call continues the execution. The
+ * function returns true when the execution finished, and false otherwise.
+ */
+static bool
+RunDistributedExecutionLoop(DistributedExecution *execution, bool returnOnRows)
+{
+	bool executionPaused = false;
+
 	PG_TRY();
 	{
 		bool cancellationReceived = false;
-
-		/* additional 2 is for postmaster and latch */
-		int eventSetSize = list_length(execution->sessionList) + 2;
-
-		/* always (re)build the wait event set the first time */
-		execution->connectionSetChanged = true;
+		uint64 rowsProcessedAtStart = execution->rowsProcessed;
 
 		while (execution->unfinishedTaskCount > 0 && !cancellationReceived)
 		{
 			int eventIndex = 0;
 			ListCell *workerCell = NULL;
-			long timeout = NextEventTimeout(execution);
 
-			foreach(workerCell, execution->workerList)
+			EventLoopIterationCount++;
+
+			if (returnOnRows && execution->rowsProcessed > rowsProcessedAtStart)
 			{
-				WorkerPool *workerPool = lfirst(workerCell);
-				ManageWorkerPool(workerPool);
+				/*
+				 * Let the caller consume the rows before reading any further. We
+				 * do not read from the sockets in the meantime, which eventually
+				 * makes the workers wait until the rows are consumed.
+				 */
+				executionPaused = true;
+				break;
 			}
 
-			if (execution->connectionSetChanged)
+			if (execution->rowLimit > 0 &&
+				execution->rowsProcessed >= execution->rowLimit)
 			{
-				if (execution->waitEventSet != NULL)
-				{
-					FreeWaitEventSet(execution->waitEventSet);
-					execution->waitEventSet = NULL;
-				}
-
-				if (events != NULL)
-				{
-					/*
-					 * The execution might take a while, so explicitly free at this point
-					 * because we don't need anymore.
-					 */
-					pfree(events);
-					events = NULL;
-				}
-
-				execution->waitEventSet = BuildWaitEventSet(execution->sessionList);
+				/* the tuple store has all the rows the scan is going to read */
+				StopDistributedExecutionAtRowLimit(execution);
+				break;
+			}
 
-				/* recalculate (and allocate) since the sessions have changed */
-				eventSetSize = list_length(execution->sessionList) + 2;
+			if (execution->finishedUpstreamExecutionList != NIL)
+			{
+				ReleaseDownstreamExecutions(execution);
+			}
 
-				events = palloc0(eventSetSize * sizeof(WaitEvent));
+			long timeout = NextEventTimeout(execution);
 
-				execution->connectionSetChanged = false;
-				execution->waitFlagsChanged = false;
-			}
-			else if (execution->waitFlagsChanged)
+			foreach(workerCell, execution->workerList)
 			{
-				UpdateWaitEventSetFlags(execution->waitEventSet, execution->sessionList);
-				execution->waitFlagsChanged = false;
+				WorkerPool *workerPool = lfirst(workerCell);
+				ManageWorkerPool(workerPool);
 			}
 
+			UpdateWaitEventSet(execution);
+
 			/* wait for I/O events */
-			int eventCount = WaitEventSetWait(execution->waitEventSet, timeout, events,
-											  eventSetSize, WAIT_EVENT_CLIENT_READ);
+			int eventCount = WaitEventSetWait(execution->waitEventSet, timeout,
+											  execution->events,
+											  execution->eventSetSize,
+											  WAIT_EVENT_CLIENT_READ);
 
 			/* process I/O events */
 			for (; eventIndex < eventCount; eventIndex++)
 			{
-				WaitEvent *event = &events[eventIndex];
+				WaitEvent *event = &execution->events[eventIndex];
 
 				if (event->events & WL_POSTMASTER_DEATH)
 				{
@@ -2115,18 +3302,22 @@ RunDistributedExecution(DistributedExecution *execution)
 			}
 		}
 
-		if (events != NULL)
+		if (!executionPaused)
 		{
-			pfree(events);
-		}
+			if (execution->events != NULL)
+			{
+				pfree(execution->events);
+				execution->events = NULL;
+			}
 
-		if (execution->waitEventSet != NULL)
-		{
-			FreeWaitEventSet(execution->waitEventSet);
-			execution->waitEventSet = NULL;
-		}
+			if (execution->waitEventSet != NULL)
+			{
+				FreeWaitEventSet(execution->waitEventSet);
+				execution->waitEventSet = NULL;
+			}
 
-		CleanUpSessions(execution);
+			CleanUpSessions(execution);
+		}
 	}
 	PG_CATCH();
 	{
@@ -2151,12 +3342,14 @@ RunDistributedExecution(DistributedExecution *execution)
 		PG_RE_THROW();
 	}
 	PG_END_TRY();
+
+	return !executionPaused;
 }
 
 
 /*
  * ManageWorkerPool ensures the worker pool has the appropriate number of connections
- * based on the number of pending tasks.
+ * based on the number of pending tasks and the shared connection budget.
  */
 static void
 ManageWorkerPool(WorkerPool *workerPool)
@@ -2260,6 +3453,8 @@ ManageWorkerPool(WorkerPool *workerPool)
 	ereport(DEBUG4, (errmsg("opening %d new connections to %s:%d", newConnectionCount,
 							workerPool->nodeName, workerPool->nodePort)));
 
+	int openedConnectionCount = 0;
+
 	for (int connectionIndex = 0; connectionIndex < newConnectionCount; connectionIndex++)
 	{
 		/* experimental: just to see the perf benefits of caching connections */
@@ -2271,11 +3466,32 @@ ManageWorkerPool(WorkerPool *workerPool)
 			connectionFlags |= OUTSIDE_TRANSACTION;
 		}
 
+		/*
+		 * The pool needs at least one connection to make progress, but any
+		 * further connections should not exceed the connection budget that
+		 * the backends share. Once it is used up, the remaining tasks wait
+		 * for the connections that the pool already has. With
+		 * force_max_query_parallelization, the user asked for a connection
+		 * per task, so we open them regardless.
+		 */
+		if (initiatedConnectionCount + connectionIndex > 0 &&
+			!UseConnectionPerPlacement())
+		{
+			connectionFlags |= OPTIONAL_CONNECTION;
+		}
+
 		/* open a new connection to the worker */
 		MultiConnection *connection = StartNodeUserDatabaseConnection(connectionFlags,
 																	  workerPool->nodeName,
 																	  workerPool->nodePort,
 																	  NULL, NULL);
+		if (connection == NULL)
+		{
+			/* connection budget is used up, try again in the next round */
+			break;
+		}
+
+		openedConnectionCount++;
 
 		/*
 		 * Assign the initial state in the connection state machine. The connection
@@ -2295,10 +3511,17 @@ ManageWorkerPool(WorkerPool *workerPool)
 
 		/* always poll the connection in the first round */
 		UpdateConnectionWaitFlags(session, WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE);
+
+		/* add the connection to the wait event set */
+		execution->newSessionList = lappend(execution->newSessionList, session);
+	}
+
+	if (openedConnectionCount == 0)
+	{
+		return;
 	}
 
 	workerPool->lastConnectionOpenTime = GetCurrentTimestamp();
-	execution->connectionSetChanged = true;
 }
 
 
@@ -2677,6 +3900,8 @@ HandleMultiConnectionSuccess(WorkerSession *session)
 							connection->hostname, connection->port,
 							session->sessionId)));
 
+	MarkConnectionConnected(connection);
+
 	workerPool->activeConnectionCount++;
 	workerPool->idleConnectionCount++;
 }
@@ -2822,8 +4047,6 @@ TransactionStateMachine(WorkerSession *session)
 
 						return;
 					}
-
-					transaction->transactionState = REMOTE_TRANS_SENT_COMMAND;
 				}
 
 				UpdateConnectionWaitFlags(session,
@@ -2907,30 +4130,72 @@ TransactionStateMachine(WorkerSession *session)
 					return;
 				}
 
-				transaction->transactionState = REMOTE_TRANS_SENT_COMMAND;
 				break;
 			}
 
-			case REMOTE_TRANS_SENT_COMMAND:
+			case REMOTE_TRANS_PREPARING_STATEMENT:
 			{
-				TaskPlacementExecution *placementExecution = session->currentTask;
-				ShardCommandExecution *shardCommandExecution =
-					placementExecution->shardCommandExecution;
-				bool storeRows = shardCommandExecution->expectResults;
+				PGresult *result = PQgetResult(connection->pgConn);
+				if (result != NULL)
+				{
+					/* failing to prepare is not an error, we send the query as is */
+					FinishPreparingStatement(connection, result);
+
+					PQclear(result);
+
+					/* wake up WaitEventSetWait */
+					UpdateConnectionWaitFlags(session,
+											  WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE);
+
+					break;
+				}
 
-				if (shardCommandExecution->gotResults)
+				/* the worker is ready for the query of the current task */
+				bool querySent = SendPlacementExecutionCommand(session);
+				if (!querySent)
 				{
-					/* already received results from another replica */
-					storeRows = false;
+					/* no need to continue, connection is lost */
+					Assert(session->connection->connectionState == MULTI_CONNECTION_LOST);
+
+					return;
 				}
 
-				bool fetchDone = ReceiveResults(session, storeRows);
+				UpdateConnectionWaitFlags(session,
+										  WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE);
+				break;
+			}
+
+			case REMOTE_TRANS_SENT_COMMAND:
+			{
+				bool fetchDone = false;
+
+				/* the results of coalesced tasks follow each other */
+				do {
+					TaskPlacementExecution *placementExecution = session->currentTask;
+					ShardCommandExecution *shardCommandExecution =
+						placementExecution->shardCommandExecution;
+					bool storeRows = shardCommandExecution->expectResults;
+
+					if (shardCommandExecution->gotResults)
+					{
+						/* already received results from another replica */
+						storeRows = false;
+					}
+
+					fetchDone = ReceiveResults(session, storeRows);
+					if (!fetchDone)
+					{
+						break;
+					}
+
+					shardCommandExecution->gotResults = true;
+				} while (StartNextCoalescedPlacementExecution(session));
+
 				if (!fetchDone)
 				{
 					break;
 				}
 
-				shardCommandExecution->gotResults = true;
 				transaction->transactionState = REMOTE_TRANS_CLEARING_RESULTS;
 				break;
 			}
@@ -2948,11 +4213,8 @@ TransactionStateMachine(WorkerSession *session)
 
 /*
  * UpdateConnectionWaitFlags is a wrapper around setting waitFlags of the connection.
- *
- * This function might further improved in a sense that to use use ModifyWaitEvent on
- * waitFlag changes as opposed to what we do now: always rebuild the wait event sets.
- * Our initial benchmarks didn't show any significant performance improvements, but
- * good to keep in mind the potential improvements.
+ * The session is remembered, such that UpdateWaitEventSet only modifies the wait
+ * events of the sessions whose flags changed.
  */
 static void
 UpdateConnectionWaitFlags(WorkerSession *session, int waitFlags)
@@ -2969,7 +4231,12 @@ UpdateConnectionWaitFlags(WorkerSession *session, int waitFlags)
 	connection->waitFlags = waitFlags;
 
 	/* without signalling the execution, the flag changes won't be reflected */
-	execution->waitFlagsChanged = true;
+	if (!session->waitFlagsChanged)
+	{
+		session->waitFlagsChanged = true;
+		execution->waitFlagsChangedSessionList =
+			lappend(execution->waitFlagsChangedSessionList, session);
+	}
 }
 
 
@@ -3110,8 +4377,8 @@ PopUnassignedPlacementExecution(WorkerPool *workerPool)
  * accesses with the connection and updating session's local variables. For
  * details read the comments in the function.
  *
- * The function returns true if the query is successfully sent over the
- * connection, otherwise false.
+ * The function returns true if the query (or the command to prepare it) is
+ * successfully sent over the connection, otherwise false.
  */
 static bool
 StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
@@ -3119,15 +4386,12 @@ StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
 {
 	WorkerPool *workerPool = session->workerPool;
 	DistributedExecution *execution = workerPool->distributedExecution;
-	ParamListInfo paramListInfo = execution->paramListInfo;
 	MultiConnection *connection = session->connection;
 	ShardCommandExecution *shardCommandExecution =
 		placementExecution->shardCommandExecution;
 	Task *task = shardCommandExecution->task;
 	ShardPlacement *taskPlacement = placementExecution->shardPlacement;
 	List *placementAccessList = PlacementAccessListForTask(task, taskPlacement);
-	char *queryString = task->queryString;
-	int querySent = 0;
 
 	if (execution->transactionProperties->useRemoteTransactionBlocks !=
 		TRANSACTION_BLOCKS_DISALLOWED)
@@ -3154,6 +4418,37 @@ StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
 	session->currentTask = placementExecution;
 	placementExecution->executionState = PLACEMENT_EXECUTION_RUNNING;
 
+	return SendPlacementExecutionCommand(session);
+}
+
+
+/*
+ * SendPlacementExecutionCommand sends the query of the current task of the
+ * session over its connection, and moves the remote transaction to
+ * REMOTE_TRANS_SENT_COMMAND.
+ *
+ * Parameterized queries that are sent repeatedly over the connection are
+ * prepared on the worker first. In that case, the function only sends the
+ * command to prepare the statement and moves the remote transaction to
+ * REMOTE_TRANS_PREPARING_STATEMENT. TransactionStateMachine calls the function
+ * again once the result of that command arrived, such that we never wait for
+ * the worker outside of the event loop.
+ *
+ * The function returns true if a command is successfully sent over the
+ * connection, otherwise false.
+ */
+static bool
+SendPlacementExecutionCommand(WorkerSession *session)
+{
+	DistributedExecution *execution = session->workerPool->distributedExecution;
+	ParamListInfo paramListInfo = execution->paramListInfo;
+	MultiConnection *connection = session->connection;
+	RemoteTransaction *transaction = &(connection->remoteTransaction);
+	TaskPlacementExecution *placementExecution = session->currentTask;
+	Task *task = placementExecution->shardCommandExecution->task;
+	char *queryString = TaskQueryString(task);
+	int querySent = 0;
+
 	if (paramListInfo != NULL)
 	{
 		int parameterCount = paramListInfo->numParams;
@@ -3165,11 +4460,47 @@ StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
 
 		ExtractParametersForRemoteExecution(paramListInfo, &parameterTypes,
 											&parameterValues);
-		querySent = SendRemoteCommandParams(connection, queryString, parameterCount,
-											parameterTypes, parameterValues);
+
+		/*
+		 * Queries with parameters are typically executed many times with
+		 * different parameters, in which case a statement prepared on the
+		 * connection saves the worker from parsing and planning the query
+		 * every time.
+		 */
+		const char *statementName = PreparedStatementName(connection, queryString,
+														  parameterCount,
+														  parameterTypes);
+		if (statementName != NULL)
+		{
+			querySent = SendRemotePreparedCommand(connection, statementName,
+												  queryString, parameterCount,
+												  parameterValues,
+												  execution->useBinaryProtocol);
+		}
+		else if (StartPreparingStatement(connection, queryString, parameterCount,
+										 parameterTypes))
+		{
+			transaction->transactionState = REMOTE_TRANS_PREPARING_STATEMENT;
+			return true;
+		}
+		else
+		{
+			querySent = SendRemoteCommandParams(connection, queryString,
+												parameterCount, parameterTypes,
+												parameterValues,
+												execution->useBinaryProtocol);
+		}
+	}
+	else if (execution->useBinaryProtocol)
+	{
+		/* the result format can only be specified via the extended protocol */
+		querySent = SendRemoteCommandParams(connection, queryString, 0, NULL, NULL,
+											true);
 	}
 	else
 	{
+		queryString = CoalescePlacementExecutions(session, queryString);
+
 		querySent = SendRemoteCommand(connection, queryString);
 	}
 
@@ -3179,13 +4510,190 @@ StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
 		return false;
 	}
 
-	int singleRowMode = PQsetSingleRowMode(connection->pgConn);
-	if (singleRowMode == 0)
+	if (!SetResultFetchMode(connection))
 	{
 		connection->connectionState = MULTI_CONNECTION_LOST;
 		return false;
 	}
 
+	transaction->transactionState = REMOTE_TRANS_SENT_COMMAND;
+
+	return true;
+}
+
+
+/*
+ * CoalescePlacementExecutions pops other placement executions that are ready
+ * to run on the given session and appends their commands to the query string
+ * of the current task of the session, such that the worker receives them in a
+ * single request. The results of the commands arrive one after the other, and
+ * TransactionStateMachine moves on to the next task in the coalescedTaskList
+ * of the session after each of them.
+ *
+ * Multiple statements can only be sent via the simple query protocol, so the
+ * caller only coalesces tasks without parameters that do not use the binary
+ * protocol. To keep the other connections to the worker busy, the session only
+ * takes its share of the unassigned tasks.
+ *
+ * The function returns the query string to send over the session.
+ */
+static char *
+CoalescePlacementExecutions(WorkerSession *session, char *queryString)
+{
+	WorkerPool *workerPool = session->workerPool;
+	DistributedExecution *execution = workerPool->distributedExecution;
+	Task *task = session->currentTask->shardCommandExecution->task;
+	StringInfo coalescedQueryString = NULL;
+	int taskCount = 1;
+
+	if (MaxCoalescedTasks <= 1 || UseConnectionPerPlacement() ||
+		!TaskCanBeCoalesced(task, queryString))
+	{
+		return queryString;
+	}
+
+	coalescedQueryString = makeStringInfo();
+	appendStringInfoString(coalescedQueryString, queryString);
+
+	/* tasks assigned to the session come first, as in PopPlacementExecution */
+	while (taskCount < MaxCoalescedTasks && !dlist_is_empty(&session->readyTaskQueue))
+	{
+		TaskPlacementExecution *placementExecution =
+			dlist_head_element(TaskPlacementExecution, sessionReadyQueueNode,
+							   &session->readyTaskQueue);
+		Task *nextTask = placementExecution->shardCommandExecution->task;
+
+		if (!TaskCanBeCoalesced(nextTask, TaskQueryString(nextTask)))
+		{
+			break;
+		}
+
+		dlist_pop_head_node(&session->readyTaskQueue);
+
+		StartCoalescedPlacementExecution(session, placementExecution,
+										 coalescedQueryString);
+		taskCount++;
+	}
+
+	int unassignedTaskShare = (workerPool->readyTaskCount + execution->targetPoolSize) /
+							  execution->targetPoolSize;
+	int taskLimit = Min(MaxCoalescedTasks, taskCount + unassignedTaskShare - 1);
+
+	while (taskCount < taskLimit && !dlist_is_empty(&workerPool->readyTaskQueue))
+	{
+		TaskPlacementExecution *placementExecution =
+			dlist_head_element(TaskPlacementExecution, workerReadyQueueNode,
+							   &workerPool->readyTaskQueue);
+		Task *nextTask = placementExecution->shardCommandExecution->task;
+
+		if (!TaskCanBeCoalesced(nextTask, TaskQueryString(nextTask)))
+		{
+			break;
+		}
+
+		dlist_pop_head_node(&workerPool->readyTaskQueue);
+		workerPool->readyTaskCount--;
+
+		StartCoalescedPlacementExecution(session, placementExecution,
+										 coalescedQueryString);
+		taskCount++;
+	}
+
+	if (taskCount == 1)
+	{
+		return queryString;
+	}
+
+	return coalescedQueryString->data;
+}
+
+
+/*
+ * TaskCanBeCoalesced returns whether the command of the given task can be
+ * sent to a worker together with the commands of other tasks. That is the
+ * case for SELECT and DML tasks that consist of a single statement, such that
+ * each task gets exactly one result.
+ */
+static bool
+TaskCanBeCoalesced(Task *task, char *queryString)
+{
+	if (task->taskType != SELECT_TASK && task->taskType != MODIFY_TASK)
+	{
+		return false;
+	}
+
+	/* conservatively skip commands with a semicolon, even in a literal */
+	if (strchr(queryString, ';') != NULL)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * StartCoalescedPlacementExecution appends the command of the given placement
+ * execution to the query string of the session and does the same bookkeeping
+ * as StartPlacementExecutionOnSession, except that the connection is already
+ * in use.
+ */
+static void
+StartCoalescedPlacementExecution(WorkerSession *session,
+								 TaskPlacementExecution *placementExecution,
+								 StringInfo queryString)
+{
+	DistributedExecution *execution = session->workerPool->distributedExecution;
+	Task *task = placementExecution->shardCommandExecution->task;
+
+	if (execution->transactionProperties->useRemoteTransactionBlocks !=
+		TRANSACTION_BLOCKS_DISALLOWED)
+	{
+		List *placementAccessList =
+			PlacementAccessListForTask(task, placementExecution->shardPlacement);
+
+		AssignPlacementListToConnection(placementAccessList, session->connection);
+	}
+
+	appendStringInfoChar(queryString, ';');
+	appendStringInfoString(queryString, TaskQueryString(task));
+
+	session->commandsSent++;
+	session->coalescedTaskList = lappend(session->coalescedTaskList,
+										 placementExecution);
+	placementExecution->executionState = PLACEMENT_EXECUTION_RUNNING;
+
+	CoalescedTaskCount++;
+}
+
+
+/*
+ * StartNextCoalescedPlacementExecution marks the current task of the session
+ * as done once its results were received and continues with the next task
+ * that was sent in the same request, if any. The function returns false if
+ * there are no more coalesced tasks, in which case the current task is done
+ * once the remaining results are cleared.
+ */
+static bool
+StartNextCoalescedPlacementExecution(WorkerSession *session)
+{
+	TaskPlacementExecution *placementExecution = session->currentTask;
+	bool succeeded = true;
+
+	if (session->coalescedTaskList == NIL)
+	{
+		return false;
+	}
+
+	/* as in TransactionStateMachine, finished tasks make the connection critical */
+	MarkRemoteTransactionCritical(session->connection);
+
+	session->currentTask = (TaskPlacementExecution *) linitial(
+		session->coalescedTaskList);
+	session->coalescedTaskList = list_delete_first(session->coalescedTaskList);
+
+	PlacementExecutionDone(placementExecution, succeeded);
+
 	return true;
 }
 
@@ -3207,7 +4715,18 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 	AttInMetadata *attributeInputMetadata = execution->attributeInputMetadata;
 	uint32 expectedColumnCount = 0;
 	char **columnArray = execution->columnArray;
-	Tuplestorestate *tupleStore = execution->tupleStore;
+	ShardCommandExecution *shardCommandExecution =
+		session->currentTask->shardCommandExecution;
+	Tuplestorestate *tupleStore = shardCommandExecution->tupleStore;
+	TaskResultDestination *resultDestination = shardCommandExecution->resultDestination;
+
+	if (resultDestination != NULL)
+	{
+		executionStats = resultDestination->executionStats;
+		tupleDescriptor = resultDestination->tupleDescriptor;
+		attributeInputMetadata = resultDestination->attributeInputMetadata;
+		columnArray = resultDestination->columnArray;
+	}
 
 	if (tupleDescriptor != NULL)
 	{
@@ -3215,15 +4734,18 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 	}
 
 	/*
-	 * We use this context while converting each row fetched from remote node
-	 * into tuple. The context is reseted on every row, thus we create it at the
-	 * start of the loop and reset on every iteration.
+	 * We use this context while converting the rows fetched from remote node
+	 * into tuples. The context is reset after every batch of
+	 * citus.executor_fetch_batch_size rows, which spans as many results in
+	 * single-row mode and a single result in chunked mode, thus we create it
+	 * at the start of the loop and reset it once a batch is complete.
 	 */
 	MemoryContext ioContext = AllocSetContextCreate(CurrentMemoryContext,
 													"IoContext",
 													ALLOCSET_DEFAULT_MINSIZE,
 													ALLOCSET_DEFAULT_INITSIZE,
 													ALLOCSET_DEFAULT_MAXSIZE);
+	uint32 rowsInBatch = 0;
 
 	while (!PQisBusy(connection->pgConn))
 	{
@@ -3243,8 +4765,6 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 		{
 			char *currentAffectedTupleString = PQcmdTuples(result);
 			int64 currentAffectedTupleCount = 0;
-			ShardCommandExecution *shardCommandExecution =
-				session->currentTask->shardCommandExecution;
 
 			/* if there are multiple replicas, make sure to consider only one */
 			if (!shardCommandExecution->gotResults && *currentAffectedTupleString != '\0')
@@ -3273,7 +4793,7 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 			fetchDone = true;
 			break;
 		}
-		else if (resultStatus != PGRES_SINGLE_TUPLE)
+		else if (!IsPartialTuplesResult(resultStatus))
 		{
 			/* query failures are always hard errors */
 			ReportResultError(connection, result, ERROR);
@@ -3290,6 +4810,7 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 
 		rowsProcessed = PQntuples(result);
 		uint32 columnCount = PQnfields(result);
+		bool binaryResults = PQbinaryTuples(result);
 
 		if (columnCount != expectedColumnCount)
 		{
@@ -3298,58 +4819,232 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 								   columnCount, expectedColumnCount)));
 		}
 
+		/*
+		 * Switch to a temporary memory context that we reset after each batch.
+		 * This protects us from any memory leaks that might be present in I/O
+		 * functions called by BuildTupleFromCStrings or the receive functions.
+		 * The tuple store copies the tuples into its own memory context, so we
+		 * can convert the whole batch before resetting.
+		 */
+		MemoryContext oldContextPerResult = MemoryContextSwitchTo(ioContext);
+
 		for (uint32 rowIndex = 0; rowIndex < rowsProcessed; rowIndex++)
 		{
-			memset(columnArray, 0, columnCount * sizeof(char *));
+			HeapTuple heapTuple = NULL;
 
-			for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+			if (binaryResults)
 			{
-				if (PQgetisnull(result, rowIndex, columnIndex))
-				{
-					columnArray[columnIndex] = NULL;
-				}
-				else
+				heapTuple = BuildTupleFromBinaryResult(execution, result, rowIndex);
+			}
+			else
+			{
+				/* every column is (re)assigned, so no need to clear the array */
+				for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
 				{
-					columnArray[columnIndex] = PQgetvalue(result, rowIndex, columnIndex);
-					if (SubPlanLevel > 0 && executionStats != NULL)
+					if (PQgetisnull(result, rowIndex, columnIndex))
 					{
-						executionStats->totalIntermediateResultSize += PQgetlength(result,
-																				   rowIndex,
-																				   columnIndex);
+						columnArray[columnIndex] = NULL;
+					}
+					else
+					{
+						columnArray[columnIndex] = PQgetvalue(result, rowIndex,
+															  columnIndex);
+						if (SubPlanLevel > 0 && executionStats != NULL)
+						{
+							executionStats->totalIntermediateResultSize +=
+								PQgetlength(result, rowIndex, columnIndex);
+						}
 					}
 				}
+
+				heapTuple = BuildTupleFromCStrings(attributeInputMetadata, columnArray);
+			}
+
+			if (resultDestination != NULL)
+			{
+				SendTupleToResultDestination(resultDestination, heapTuple);
+			}
+			else
+			{
+				tuplestore_puttuple(tupleStore, heapTuple);
+			}
+
+			/* the size limit is enforced for every row, regardless of the batch */
+			if (executionStats != NULL && CheckIfSizeLimitIsExceeded(executionStats))
+			{
+				ErrorSizeLimitIsExceeded();
 			}
+		}
+
+		MemoryContextSwitchTo(oldContextPerResult);
+
+		execution->rowsProcessed += rowsProcessed;
+		rowsInBatch += rowsProcessed;
+
+		PQclear(result);
+
+		if (rowsInBatch < (uint32) ExecutorFetchBatchSize)
+		{
+			/* batch is not complete yet, keep converting rows */
+			continue;
+		}
+
+		MemoryContextReset(ioContext);
+		rowsInBatch = 0;
+	}
+
+	/* the context is local to the function, so not needed anymore */
+	MemoryContextDelete(ioContext);
+
+	return fetchDone;
+}
+
+
+/*
+ * SetResultFetchMode puts the connection in a mode in which the results of
+ * the last command are returned incrementally, rather than as one PGresult
+ * that holds all the rows. When libpq supports chunked mode and
+ * citus.executor_fetch_batch_size is larger than 1, each PGresult contains
+ * up to that many rows. Otherwise, we fall back to single-row mode.
+ *
+ * The function returns false if the mode could not be set.
+ */
+static bool
+SetResultFetchMode(MultiConnection *connection)
+{
+#ifdef LIBPQ_HAS_CHUNK_MODE
+	if (ExecutorFetchBatchSize > 1)
+	{
+		return PQsetChunkedRowsMode(connection->pgConn, ExecutorFetchBatchSize) != 0;
+	}
+#endif
+
+	return PQsetSingleRowMode(connection->pgConn) != 0;
+}
+
+
+/*
+ * IsPartialTuplesResult returns whether the given result status indicates
+ * that the result holds a part of the rows of a query, as returned in
+ * single-row or chunked mode.
+ */
+static bool
+IsPartialTuplesResult(ExecStatusType resultStatus)
+{
+#ifdef LIBPQ_HAS_CHUNK_MODE
+	if (resultStatus == PGRES_TUPLES_CHUNK)
+	{
+		return true;
+	}
+#endif
 
-			/*
-			 * Switch to a temporary memory context that we reset after each tuple. This
-			 * protects us from any memory leaks that might be present in I/O functions
-			 * called by BuildTupleFromCStrings.
-			 */
-			MemoryContext oldContextPerRow = MemoryContextSwitchTo(ioContext);
+	return resultStatus == PGRES_SINGLE_TUPLE;
+}
 
-			HeapTuple heapTuple = BuildTupleFromCStrings(attributeInputMetadata,
-														 columnArray);
 
-			MemoryContextSwitchTo(oldContextPerRow);
+/*
+ * BuildTupleFromBinaryResult builds a heap tuple from a row of a PGresult
+ * that was returned in binary format, by calling the receive function of
+ * each column. The tuple is allocated in the current memory context.
+ */
+static HeapTuple
+BuildTupleFromBinaryResult(DistributedExecution *execution, PGresult *result,
+						   int rowIndex)
+{
+	TupleDesc tupleDescriptor = execution->tupleDescriptor;
+	DistributedExecutionStats *executionStats = execution->executionStats;
+	Datum *columnValues = execution->columnValues;
+	bool *columnNulls = execution->columnNulls;
+	int columnCount = tupleDescriptor->natts;
 
-			tuplestore_puttuple(tupleStore, heapTuple);
-			MemoryContextReset(ioContext);
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute column = TupleDescAttr(tupleDescriptor, columnIndex);
+		StringInfoData columnBuffer;
 
-			execution->rowsProcessed++;
+		if (PQgetisnull(result, rowIndex, columnIndex))
+		{
+			columnValues[columnIndex] = (Datum) 0;
+			columnNulls[columnIndex] = true;
+			continue;
 		}
 
-		PQclear(result);
+		/* libpq always terminates values with a zero byte, even in binary mode */
+		columnBuffer.data = PQgetvalue(result, rowIndex, columnIndex);
+		columnBuffer.len = PQgetlength(result, rowIndex, columnIndex);
+		columnBuffer.maxlen = columnBuffer.len + 1;
+		columnBuffer.cursor = 0;
+
+		if (SubPlanLevel > 0 && executionStats != NULL)
+		{
+			executionStats->totalIntermediateResultSize += columnBuffer.len;
+		}
 
-		if (executionStats != NULL && CheckIfSizeLimitIsExceeded(executionStats))
+		columnValues[columnIndex] =
+			ReceiveFunctionCall(&execution->columnReceiveFunctions[columnIndex],
+								&columnBuffer,
+								execution->columnTypeIoParams[columnIndex],
+								column->atttypmod);
+		columnNulls[columnIndex] = false;
+
+		if (columnBuffer.cursor != columnBuffer.len)
 		{
-			ErrorSizeLimitIsExceeded();
+			ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+							errmsg("incorrect binary data format in column %d "
+								   "of a result from the worker", columnIndex + 1)));
 		}
 	}
 
-	/* the context is local to the function, so not needed anymore */
-	MemoryContextDelete(ioContext);
+	return heap_form_tuple(tupleDescriptor, columnValues, columnNulls);
+}
 
-	return fetchDone;
+
+/*
+ * CreateTaskResultDestination creates the destination of the rows of the
+ * tasks of a plan that are converted using the given tuple descriptor and
+ * sent to the given DestReceiver.
+ */
+static TaskResultDestination *
+CreateTaskResultDestination(TupleDesc tupleDescriptor, DestReceiver *destReceiver)
+{
+	TaskResultDestination *resultDestination =
+		(TaskResultDestination *) palloc0(sizeof(TaskResultDestination));
+
+	resultDestination->tupleDescriptor = tupleDescriptor;
+	resultDestination->destReceiver = destReceiver;
+	resultDestination->slot = MakeSingleTupleTableSlotCompat(tupleDescriptor,
+															 &TTSOpsHeapTuple);
+	resultDestination->attributeInputMetadata =
+		TupleDescGetAttInMetadata(tupleDescriptor);
+	resultDestination->columnArray =
+		(char **) palloc0(tupleDescriptor->natts * sizeof(char *));
+	resultDestination->executionStats =
+		(DistributedExecutionStats *) palloc0(sizeof(DistributedExecutionStats));
+
+	return resultDestination;
+}
+
+
+/*
+ * SendTupleToResultDestination sends a tuple that was received from a worker
+ * to the DestReceiver of the given destination.
+ */
+static void
+SendTupleToResultDestination(TaskResultDestination *resultDestination,
+							 HeapTuple heapTuple)
+{
+	TupleTableSlot *slot = resultDestination->slot;
+	DestReceiver *destReceiver = resultDestination->destReceiver;
+
+#if PG_VERSION_NUM >= 120000
+	ExecStoreHeapTuple(heapTuple, slot, false);
+#else
+	ExecStoreTuple(heapTuple, slot, InvalidBuffer, false);
+#endif
+
+	destReceiver->receiveSlot(slot, destReceiver);
+
+	ExecClearTuple(slot);
 }
 
 
@@ -3435,6 +5130,7 @@ static void
 WorkerSessionFailed(WorkerSession *session)
 {
 	TaskPlacementExecution *placementExecution = session->currentTask;
+	ListCell *placementExecutionCell = NULL;
 	bool succeeded = false;
 	dlist_iter iter;
 
@@ -3444,6 +5140,13 @@ WorkerSessionFailed(WorkerSession *session)
 		PlacementExecutionDone(placementExecution, succeeded);
 	}
 
+	foreach(placementExecutionCell, session->coalescedTaskList)
+	{
+		placementExecution = (TaskPlacementExecution *) lfirst(placementExecutionCell);
+
+		PlacementExecutionDone(placementExecution, succeeded);
+	}
+
 	dlist_foreach(iter, &session->pendingTaskQueue)
 	{
 		placementExecution =
@@ -3531,6 +5234,19 @@ PlacementExecutionDone(TaskPlacementExecution *placementExecution, bool succeede
 	if (newExecutionState == TASK_EXECUTION_FINISHED)
 	{
 		execution->unfinishedTaskCount--;
+
+		if (shardCommandExecution->downstreamExecutionList != NIL)
+		{
+			/*
+			 * We may be called while iterating over the queues of a failed pool
+			 * or session, so we only release the downstream tasks in the next
+			 * iteration of the event loop.
+			 */
+			execution->finishedUpstreamExecutionList =
+				lappend(execution->finishedUpstreamExecutionList,
+						shardCommandExecution);
+		}
+
 		return;
 	}
 	else if (newExecutionState == TASK_EXECUTION_FAILED)
@@ -3693,6 +5409,95 @@ PlacementExecutionReady(TaskPlacementExecution *placementExecution)
 }
 
 
+/*
+ * ReleaseDownstreamExecutions makes the tasks that depend on the tasks that
+ * finished since the last call ready to start once all of the tasks they
+ * depend on have finished. The ready placement executions are added to the
+ * queues of the worker pools that are already running, such that they can
+ * use the connections that are already open.
+ */
+static void
+ReleaseDownstreamExecutions(DistributedExecution *execution)
+{
+	List *finishedUpstreamExecutionList = execution->finishedUpstreamExecutionList;
+	ListCell *upstreamExecutionCell = NULL;
+
+	/* tasks that run now cannot be among the ones the released tasks wait for */
+	bool otherTasksRunning =
+		execution->unfinishedTaskCount > execution->waitingTaskCount;
+
+	execution->finishedUpstreamExecutionList = NIL;
+
+	foreach(upstreamExecutionCell, finishedUpstreamExecutionList)
+	{
+		ShardCommandExecution *upstreamExecution = lfirst(upstreamExecutionCell);
+		ListCell *downstreamExecutionCell = NULL;
+
+		foreach(downstreamExecutionCell, upstreamExecution->downstreamExecutionList)
+		{
+			ShardCommandExecution *downstreamExecution =
+				lfirst(downstreamExecutionCell);
+
+			Assert(downstreamExecution->unfinishedDependencyCount > 0);
+
+			downstreamExecution->unfinishedDependencyCount--;
+			if (downstreamExecution->unfinishedDependencyCount == 0)
+			{
+				execution->waitingTaskCount--;
+
+				if (otherTasksRunning)
+				{
+					EarlyTaskStartCount++;
+				}
+
+				ShardCommandExecutionReady(downstreamExecution);
+			}
+		}
+	}
+
+	list_free(finishedUpstreamExecutionList);
+}
+
+
+/*
+ * ShardCommandExecutionReady moves the placement executions of a task whose
+ * dependencies have finished to the ready queues, in the same way
+ * AssignTasksToConnections does for tasks without dependencies: all
+ * placements for parallel execution orders and otherwise only the first
+ * placement that did not fail while the task was pending.
+ */
+static void
+ShardCommandExecutionReady(ShardCommandExecution *shardCommandExecution)
+{
+	int placementExecutionIndex = 0;
+	int placementExecutionCount = shardCommandExecution->placementExecutionCount;
+
+	if (shardCommandExecution->executionState != TASK_EXECUTION_NOT_FINISHED)
+	{
+		/* all placements failed while the task was pending */
+		return;
+	}
+
+	for (; placementExecutionIndex < placementExecutionCount; placementExecutionIndex++)
+	{
+		TaskPlacementExecution *placementExecution =
+			shardCommandExecution->placementExecutions[placementExecutionIndex];
+
+		if (placementExecution->executionState != PLACEMENT_EXECUTION_NOT_READY)
+		{
+			continue;
+		}
+
+		PlacementExecutionReady(placementExecution);
+
+		if (shardCommandExecution->executionOrder != EXECUTION_ORDER_PARALLEL)
+		{
+			break;
+		}
+	}
+}
+
+
 /*
  * TaskExecutionStateMachine returns whether a shard command execution
  * finished or failed according to its execution order. If the task is
@@ -3758,94 +5563,299 @@ TaskExecutionStateMachine(ShardCommandExecution *shardCommandExecution)
 
 
 /*
- * BuildWaitEventSet creates a WaitEventSet for the given array of connections
- * which can be used to wait for any of the sockets to become read-ready or
- * write-ready.
+ * UpdateWaitEventSet brings the wait event set of the execution up to date
+ * before waiting for events. It adds the sockets of newly opened connections
+ * and modifies the wait events of the sessions whose wait flags changed,
+ * instead of rebuilding the whole set whenever a connection is opened.
+ *
+ * Sockets cannot be removed from a WaitEventSet, so we still rebuild it when
+ * a connection is closed, when the set is full, or when libpq moved on to a
+ * new socket while connecting.
+ */
+static void
+UpdateWaitEventSet(DistributedExecution *execution)
+{
+	ListCell *sessionCell = NULL;
+
+	if (!execution->connectionSetChanged)
+	{
+		foreach(sessionCell, execution->newSessionList)
+		{
+			WorkerSession *session = lfirst(sessionCell);
+
+			if (!AddSessionToWaitEventSet(execution, session))
+			{
+				execution->connectionSetChanged = true;
+				break;
+			}
+
+			WaitEventSetAdditionCount++;
+		}
+	}
+
+	if (!execution->connectionSetChanged)
+	{
+		foreach(sessionCell, execution->waitFlagsChangedSessionList)
+		{
+			WorkerSession *session = lfirst(sessionCell);
+
+			if (!UpdateSessionWaitEvent(execution, session))
+			{
+				execution->connectionSetChanged = true;
+				break;
+			}
+		}
+	}
+
+	if (execution->connectionSetChanged)
+	{
+		RebuildWaitEventSet(execution);
+	}
+
+	ResetWaitEventSetChanges(execution);
+}
+
+
+/*
+ * RebuildWaitEventSet creates a new WaitEventSet for the sessions of the
+ * execution, which can be used to wait for any of the sockets to become
+ * read-ready or write-ready. The set leaves room for as many connections
+ * as there are now, such that connections opened later on can usually be
+ * added to it.
  */
-static WaitEventSet *
-BuildWaitEventSet(List *sessionList)
+static void
+RebuildWaitEventSet(DistributedExecution *execution)
 {
 	ListCell *sessionCell = NULL;
+	int sessionCount = list_length(execution->sessionList);
+
+	if (execution->waitEventSet != NULL)
+	{
+		FreeWaitEventSet(execution->waitEventSet);
+		execution->waitEventSet = NULL;
+	}
+
+	if (execution->events != NULL)
+	{
+		/*
+		 * The execution might take a while, so explicitly free at this point
+		 * because we don't need anymore.
+		 */
+		pfree(execution->events);
+		execution->events = NULL;
+	}
 
 	/* additional 2 is for postmaster and latch */
-	int eventSetSize = list_length(sessionList) + 2;
+	execution->eventSetSize = sessionCount + Max(sessionCount, 8) + 2;
+	execution->waitEventSet = CreateWaitEventSet(CurrentMemoryContext,
+												 execution->eventSetSize);
+	execution->events = palloc0(execution->eventSetSize * sizeof(WaitEvent));
 
-	WaitEventSet *waitEventSet =
-		CreateWaitEventSet(CurrentMemoryContext, eventSetSize);
+	AddWaitEventToSet(execution->waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET,
+					  NULL, NULL);
+	AddWaitEventToSet(execution->waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET,
+					  MyLatch, NULL);
+	execution->waitEventCount = 2;
 
-	foreach(sessionCell, sessionList)
+	foreach(sessionCell, execution->sessionList)
 	{
 		WorkerSession *session = lfirst(sessionCell);
-		MultiConnection *connection = session->connection;
 
-		if (connection->pgConn == NULL)
-		{
-			/* connection died earlier in the transaction */
-			continue;
-		}
+		session->waitEventSetIndex = WAIT_EVENT_SET_INDEX_NOT_INITIALIZED;
 
-		if (connection->waitFlags == 0)
-		{
-			/* not currently waiting for this connection */
-			continue;
-		}
+		AddSessionToWaitEventSet(execution, session);
+	}
 
-		int sock = PQsocket(connection->pgConn);
-		if (sock == -1)
-		{
-			/* connection was closed */
-			continue;
-		}
+	execution->connectionSetChanged = false;
+
+	WaitEventSetRebuildCount++;
+}
+
+
+/*
+ * AddSessionToWaitEventSet adds the socket of the given session to the wait
+ * event set of the execution, unless we are not waiting for the connection.
+ * The function returns false if there is no room left in the set.
+ */
+static bool
+AddSessionToWaitEventSet(DistributedExecution *execution, WorkerSession *session)
+{
+	MultiConnection *connection = session->connection;
+
+	if (session->waitEventSetIndex != WAIT_EVENT_SET_INDEX_NOT_INITIALIZED)
+	{
+		/* already in the wait event set */
+		return true;
+	}
+
+	if (connection->pgConn == NULL)
+	{
+		/* connection died earlier in the transaction */
+		return true;
+	}
+
+	if (connection->waitFlags == 0)
+	{
+		/* not currently waiting for this connection */
+		return true;
+	}
+
+	int sock = PQsocket(connection->pgConn);
+	if (sock == -1)
+	{
+		/* connection was closed */
+		return true;
+	}
+
+	if (execution->waitEventCount >= execution->eventSetSize)
+	{
+		return false;
+	}
+
+	session->waitEventSetIndex = AddWaitEventToSet(execution->waitEventSet,
+												   connection->waitFlags, sock,
+												   NULL, (void *) session);
+	session->waitEventSetSocket = sock;
+	execution->waitEventCount++;
+
+	return true;
+}
 
-		int waitEventSetIndex = AddWaitEventToSet(waitEventSet, connection->waitFlags,
-												  sock,
-												  NULL, (void *) session);
-		session->waitEventSetIndex = waitEventSetIndex;
+
+/*
+ * UpdateSessionWaitEvent modifies the wait event of the given session in the
+ * wait event set of the execution to reflect its current wait flags. The
+ * function returns false if the wait event set needs to be rebuilt instead.
+ */
+static bool
+UpdateSessionWaitEvent(DistributedExecution *execution, WorkerSession *session)
+{
+	MultiConnection *connection = session->connection;
+
+	if (connection->pgConn == NULL)
+	{
+		/* connection died earlier in the transaction */
+		return true;
+	}
+
+	if (connection->waitFlags == 0)
+	{
+		/* not currently waiting for this connection */
+		return true;
+	}
+
+	int sock = PQsocket(connection->pgConn);
+	if (sock == -1)
+	{
+		/* connection was closed */
+		return true;
+	}
+
+	if (session->waitEventSetIndex == WAIT_EVENT_SET_INDEX_NOT_INITIALIZED)
+	{
+		/* we were not waiting for the connection when the set was built */
+		return AddSessionToWaitEventSet(execution, session);
+	}
+
+	if (sock != session->waitEventSetSocket)
+	{
+		/* libpq may retry the connection on a new socket */
+		return false;
 	}
 
-	AddWaitEventToSet(waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
-	AddWaitEventToSet(waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+	ModifyWaitEvent(execution->waitEventSet, session->waitEventSetIndex,
+					connection->waitFlags, NULL);
 
-	return waitEventSet;
+	WaitEventSetModificationCount++;
+
+	return true;
 }
 
 
 /*
- * UpdateWaitEventSetFlags modifies the given waitEventSet with the wait flags
- * for connections in the sessionList.
+ * ResetWaitEventSetChanges forgets about the new sessions and changed wait
+ * flags once they are reflected in the wait event set.
  */
 static void
-UpdateWaitEventSetFlags(WaitEventSet *waitEventSet, List *sessionList)
+ResetWaitEventSetChanges(DistributedExecution *execution)
 {
 	ListCell *sessionCell = NULL;
 
-	foreach(sessionCell, sessionList)
+	foreach(sessionCell, execution->waitFlagsChangedSessionList)
 	{
 		WorkerSession *session = lfirst(sessionCell);
-		MultiConnection *connection = session->connection;
-		int waitEventSetIndex = session->waitEventSetIndex;
 
-		if (connection->pgConn == NULL)
-		{
-			/* connection died earlier in the transaction */
-			continue;
-		}
+		session->waitFlagsChanged = false;
+	}
 
-		if (connection->waitFlags == 0)
-		{
-			/* not currently waiting for this connection */
-			continue;
-		}
+	list_free(execution->waitFlagsChangedSessionList);
+	execution->waitFlagsChangedSessionList = NIL;
 
-		int sock = PQsocket(connection->pgConn);
-		if (sock == -1)
-		{
-			/* connection was closed */
-			continue;
-		}
+	list_free(execution->newSessionList);
+	execution->newSessionList = NIL;
+}
 
-		ModifyWaitEvent(waitEventSet, waitEventSetIndex, connection->waitFlags, NULL);
-	}
+
+/*
+ * citus_executor_event_loop_stats returns how often the adaptive executor ran
+ * an iteration of its event loop in the current session, how often it rebuilt
+ * the wait event set, and how often it added sockets to or modified the wait
+ * events of the existing wait event set instead.
+ */
+Datum
+citus_executor_event_loop_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+	Datum values[EVENT_LOOP_STATS_COLUMNS];
+	bool isNulls[EVENT_LOOP_STATS_COLUMNS];
+
+	CheckCitusVersion(ERROR);
+	Tuplestorestate *tupleStore = SetupTuplestore(fcinfo, &tupleDescriptor);
+
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[0] = Int64GetDatum((int64) EventLoopIterationCount);
+	values[1] = Int64GetDatum((int64) WaitEventSetRebuildCount);
+	values[2] = Int64GetDatum((int64) WaitEventSetAdditionCount);
+	values[3] = Int64GetDatum((int64) WaitEventSetModificationCount);
+
+	tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * citus_executor_task_stats returns how many tasks the adaptive executor ran
+ * in dependency order in the current session, how many of those started
+ * while tasks they did not depend on were still running, and how many tasks
+ * were sent along with the command of another task.
+ */
+Datum
+citus_executor_task_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+	Datum values[TASK_STATS_COLUMNS];
+	bool isNulls[TASK_STATS_COLUMNS];
+
+	CheckCitusVersion(ERROR);
+	Tuplestorestate *tupleStore = SetupTuplestore(fcinfo, &tupleDescriptor);
+
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[0] = Int64GetDatum((int64) DependencyOrderedTaskCount);
+	values[1] = Int64GetDatum((int64) EarlyTaskStartCount);
+	values[2] = Int64GetDatum((int64) CoalescedTaskCount);
+
+	tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
 }
 
 
@@ -11,6 +11,7 @@
 
 #include "miscadmin.h"
 
+#include "access/parallel.h"
 #include "commands/copy.h"
 #include "distributed/backend_data.h"
 #include "distributed/citus_clauses.h"
@@ -22,7 +23,11 @@
 #include "distributed/multi_executor.h"
 #include "distributed/multi_server_executor.h"
 #include "distributed/multi_router_planner.h"
+#include "distributed/parallel_combine.h"
+#include "distributed/prepared_statement_cache.h"
 #include "distributed/query_stats.h"
+#include "distributed/shared_connection_stats.h"
+#include "distributed/sorted_merge.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/worker_protocol.h"
 #include "executor/executor.h"
@@ -42,6 +47,14 @@ static void CitusBeginScan(CustomScanState *node, EState *estate, int eflags);
 static void CitusModifyBeginScan(CustomScanState *node, EState *estate, int eflags);
 static void CitusEndScan(CustomScanState *node);
 static void CitusReScan(CustomScanState *node);
+static Size CitusEstimateDSMScan(CustomScanState *node, ParallelContext *pcxt);
+static void CitusInitializeDSMScan(CustomScanState *node, ParallelContext *pcxt,
+								   void *coordinate);
+static void CitusReInitializeDSMScan(CustomScanState *node, ParallelContext *pcxt,
+									 void *coordinate);
+static void CitusInitializeWorkerScan(CustomScanState *node, shm_toc *toc,
+									  void *coordinate);
+static void CitusShutdownScan(CustomScanState *node);
 
 
 /* create custom scan methods for all executors */
@@ -75,6 +88,11 @@ static CustomExecMethods AdaptiveExecutorCustomExecMethods = {
 	.ExecCustomScan = CitusExecScan,
 	.EndCustomScan = CitusEndScan,
 	.ReScanCustomScan = CitusReScan,
+	.EstimateDSMCustomScan = CitusEstimateDSMScan,
+	.InitializeDSMCustomScan = CitusInitializeDSMScan,
+	.ReInitializeDSMCustomScan = CitusReInitializeDSMScan,
+	.InitializeWorkerCustomScan = CitusInitializeWorkerScan,
+	.ShutdownCustomScan = CitusShutdownScan,
 	.ExplainCustomScan = CitusExplainScan
 };
 
@@ -121,10 +139,16 @@ CitusBeginScan(CustomScanState *node, EState *estate, int eflags)
 {
 	DistributedPlan *distributedPlan = NULL;
 
-	MarkCitusInitiatedCoordinatorBackend();
+	/* parallel workers only combine the rows that the coordinator received */
+	if (!IsParallelWorker())
+	{
+		MarkCitusInitiatedCoordinatorBackend();
+	}
 
 	CitusScanState *scanState = (CitusScanState *) node;
 
+	scanState->eflags = eflags;
+
 #if PG_VERSION_NUM >= 120000
 	ExecInitResultSlot(&scanState->customScanState.ss.ps, &TTSOpsMinimalTuple);
 #endif
@@ -146,12 +170,22 @@ CitusBeginScan(CustomScanState *node, EState *estate, int eflags)
  * On the first call, it executes the distributed query and writes the
  * results to a tuple store. The postgres executor calls this function
  * repeatedly to read tuples from the tuple store.
+ *
+ * For streaming executions, the tuple store only contains the rows that
+ * arrived so far, and we continue the execution whenever we returned all
+ * of them. When the workers sorted the results of the tasks, we merge them
+ * instead.
  */
 TupleTableSlot *
 CitusExecScan(CustomScanState *node)
 {
 	CitusScanState *scanState = (CitusScanState *) node;
 
+	if (scanState->parallelCombineState != NULL)
+	{
+		return ReturnTupleFromParallelCombine(scanState);
+	}
+
 	if (!scanState->finishedRemoteScan)
 	{
 		AdaptiveExecutor(scanState);
@@ -159,8 +193,20 @@ CitusExecScan(CustomScanState *node)
 		scanState->finishedRemoteScan = true;
 	}
 
+	if (scanState->sortedMergeState != NULL)
+	{
+		return ReturnTupleFromSortedMerge(scanState);
+	}
+
 	TupleTableSlot *resultSlot = ReturnTupleFromTuplestore(scanState);
 
+	while (TupIsNull(resultSlot) && scanState->streamingExecution != NULL)
+	{
+		ContinueStreamingExecution(scanState);
+
+		resultSlot = ReturnTupleFromTuplestore(scanState);
+	}
+
 	return resultSlot;
 }
 
@@ -194,23 +240,52 @@ CitusModifyBeginScan(CustomScanState *node, EState *estate, int eflags)
 	{
 		PlanState *planState = &(scanState->customScanState.ss.ps);
 		EState *executorState = planState->state;
+		ParamListInfo paramListInfo = executorState->es_param_list_info;
+		bool keepParameters = false;
 
-		ExecuteMasterEvaluableFunctions(jobQuery, planState);
+		if (paramListInfo != NULL && MaxCachedStatementsPerConnection > 0 &&
+			!IsMultiRowInsert(jobQuery))
+		{
+			/*
+			 * Statements prepared on the worker connections can only be reused
+			 * when the parameters are sent along with the shard query, rather
+			 * than deparsed as constants. That works if all parameters are
+			 * still referenced once the functions are evaluated.
+			 */
+			ExecuteMasterEvaluableFunctionsKeepingParameters(jobQuery, planState);
+
+			keepParameters = QueryReferencesAllParameters(jobQuery,
+														  paramListInfo->numParams);
+		}
 
-		/*
-		 * We've processed parameters in ExecuteMasterEvaluableFunctions and
-		 * don't need to send their values to workers, since they will be
-		 * represented as constants in the deparsed query. To avoid sending
-		 * parameter values, we set the parameter list to NULL.
-		 */
-		executorState->es_param_list_info = NULL;
+		/* query in which the parameters are replaced by their values */
+		Query *evaluatedQuery = jobQuery;
+
+		if (!keepParameters)
+		{
+			ExecuteMasterEvaluableFunctions(jobQuery, planState);
+
+			/*
+			 * We've processed parameters in ExecuteMasterEvaluableFunctions and
+			 * don't need to send their values to workers, since they will be
+			 * represented as constants in the deparsed query. To avoid sending
+			 * parameter values, we set the parameter list to NULL.
+			 */
+			executorState->es_param_list_info = NULL;
+		}
+		else if (workerJob->deferredPruning)
+		{
+			/* only the parameters are left to evaluate, shard pruning needs them */
+			evaluatedQuery = copyObject(jobQuery);
+			ExecuteMasterEvaluableFunctions(evaluatedQuery, planState);
+		}
 
 		if (workerJob->deferredPruning)
 		{
 			DeferredErrorMessage *planningError = NULL;
 
 			/* need to perform shard pruning, rebuild the task list from scratch */
-			taskList = RouterInsertTaskList(jobQuery, &planningError);
+			taskList = RouterInsertTaskList(evaluatedQuery, &planningError);
 
 			if (planningError != NULL)
 			{
@@ -218,7 +293,8 @@ CitusModifyBeginScan(CustomScanState *node, EState *estate, int eflags)
 			}
 
 			workerJob->taskList = taskList;
-			workerJob->partitionKeyValue = ExtractInsertPartitionKeyValue(jobQuery);
+			workerJob->partitionKeyValue =
+				ExtractInsertPartitionKeyValue(evaluatedQuery);
 		}
 
 		RebuildQueryStrings(jobQuery, taskList);
@@ -332,8 +408,11 @@ CitusEndScan(CustomScanState *node)
 		partitionKeyConst = workerJob->partitionKeyValue;
 	}
 
-	/* queryId is not set if pg_stat_statements is not installed */
-	if (queryId != 0)
+	/*
+	 * queryId is not set if pg_stat_statements is not installed, parallel
+	 * workers do not execute the query
+	 */
+	if (queryId != 0 && !IsParallelWorker())
 	{
 		if (partitionKeyConst != NULL && executorType == MULTI_EXECUTOR_ADAPTIVE)
 		{
@@ -345,11 +424,24 @@ CitusEndScan(CustomScanState *node)
 		CitusQueryStatsExecutorsEntry(queryId, executorType, partitionKeyString);
 	}
 
+	if (scanState->streamingExecution != NULL)
+	{
+		/* the scan ended before reading all the rows */
+		EndStreamingExecution(scanState);
+	}
+
+	if (scanState->sortedMergeState != NULL)
+	{
+		EndSortedMerge(scanState);
+	}
+
 	if (scanState->tuplestorestate)
 	{
 		tuplestore_end(scanState->tuplestorestate);
 		scanState->tuplestorestate = NULL;
 	}
+
+	MarkFirstDistributedQueryEnd();
 }
 
 
@@ -373,6 +465,72 @@ CitusReScan(CustomScanState *node)
 }
 
 
+/*
+ * CitusEstimateDSMScan returns the size of the shared memory that parallel
+ * aware scans need. The planner only makes the scan parallel aware when
+ * parallel workers combine the aggregates on top of it.
+ */
+static Size
+CitusEstimateDSMScan(CustomScanState *node, ParallelContext *pcxt)
+{
+	CitusScanState *scanState = (CitusScanState *) node;
+
+	return EstimateParallelCombine(scanState, pcxt);
+}
+
+
+/*
+ * CitusInitializeDSMScan executes the distributed query in the coordinator
+ * backend and shares the rows with the parallel workers.
+ */
+static void
+CitusInitializeDSMScan(CustomScanState *node, ParallelContext *pcxt, void *coordinate)
+{
+	CitusScanState *scanState = (CitusScanState *) node;
+
+	InitializeParallelCombine(scanState, pcxt, coordinate);
+}
+
+
+/*
+ * CitusReInitializeDSMScan lets the parallel workers read the shared rows
+ * again when the Gather node is rescanned.
+ */
+static void
+CitusReInitializeDSMScan(CustomScanState *node, ParallelContext *pcxt, void *coordinate)
+{
+	CitusScanState *scanState = (CitusScanState *) node;
+
+	ReinitializeParallelCombine(scanState, coordinate);
+}
+
+
+/*
+ * CitusInitializeWorkerScan sets up the scan in a parallel worker to read the
+ * rows that the coordinator backend shared.
+ */
+static void
+CitusInitializeWorkerScan(CustomScanState *node, shm_toc *toc, void *coordinate)
+{
+	CitusScanState *scanState = (CitusScanState *) node;
+
+	AttachParallelCombine(scanState, coordinate);
+}
+
+
+/*
+ * CitusShutdownScan is called before the Gather node releases the shared
+ * memory of a parallel aware scan.
+ */
+static void
+CitusShutdownScan(CustomScanState *node)
+{
+	CitusScanState *scanState = (CitusScanState *) node;
+
+	ShutdownParallelCombine(scanState);
+}
+
+
 /*
  * ScanStateGetTupleDescriptor returns the tuple descriptor for the given
  * scan state.
@@ -474,3 +632,66 @@ IsCitusCustomScan(Plan *plan)
 
 	return true;
 }
+
+
+/*
+ * IsTaskResultPassthroughPlan returns whether the given plan is an adaptive
+ * executor scan of a read-only distributed plan whose output is exactly the
+ * output of its tasks. The rows of such plans do not need any processing on
+ * the coordinator, so the results of the tasks can be consumed directly.
+ */
+bool
+IsTaskResultPassthroughPlan(Plan *plan)
+{
+	ListCell *targetEntryCell = NULL;
+
+	if (!IsCitusCustomScan(plan))
+	{
+		return false;
+	}
+
+	CustomScan *customScan = (CustomScan *) plan;
+	if (customScan->methods != &AdaptiveExecutorCustomScanMethods)
+	{
+		return false;
+	}
+
+	DistributedPlan *distributedPlan = GetDistributedPlan(customScan);
+	Job *workerJob = distributedPlan->workerJob;
+
+	if (distributedPlan->planningError != NULL || workerJob == NULL)
+	{
+		return false;
+	}
+
+	if (distributedPlan->modLevel > ROW_MODIFY_READONLY ||
+		workerJob->dependentJobList != NIL || workerJob->deferredPruning)
+	{
+		return false;
+	}
+
+	/* the coordinator should only project the task columns as they are */
+	List *taskTargetList = workerJob->jobQuery->targetList;
+	if (list_length(plan->targetlist) != list_length(taskTargetList))
+	{
+		return false;
+	}
+
+	foreach(targetEntryCell, plan->targetlist)
+	{
+		TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+
+		if (targetEntry->resjunk || !IsA(targetEntry->expr, Var))
+		{
+			return false;
+		}
+
+		Var *column = (Var *) targetEntry->expr;
+		if (column->varattno != targetEntry->resno)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
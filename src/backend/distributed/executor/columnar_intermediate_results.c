@@ -0,0 +1,694 @@
+/*-------------------------------------------------------------------------
+ *
+ * columnar_intermediate_results.c
+ *   Functions for writing and reading intermediate results in a compressed,
+ *   columnar format.
+ *
+ * A columnar result file starts with a header that consists of a signature,
+ * a flags word and the number of columns. The header is followed by a series
+ * of blocks, each of which holds up to COLUMNAR_BLOCK_ROW_LIMIT rows. A block
+ * starts with its row count and then contains one chunk per column. A chunk
+ * is the raw size and stored size of the column data, followed by the column
+ * data itself, which is compressed using pglz when that makes it smaller.
+ * The column data is a sequence of values, each of which is prefixed with
+ * its length, or -1 for NULL. A block with a row count of 0 marks the end of
+ * the file. All integers are in network byte order.
+ *
+ * Since the values of a column are stored next to each other, they compress
+ * much better than rows in the COPY formats, and the reader can decompress
+ * and decode a block one column at a time.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "common/pg_lzcompress.h"
+#include "distributed/intermediate_results.h"
+#include "distributed/version_compat.h"
+#include "lib/stringinfo.h"
+#include "port/pg_bswap.h"
+#include "storage/fd.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+
+/* signature at the start of columnar result files, contains a \0 like PGCOPY */
+static const char ColumnarResultSignature[11] = "CITUSC\n\377\r\n\0";
+
+/* values in the flags word of the header */
+#define COLUMNAR_FLAG_BINARY_VALUES 0x1
+
+/* thresholds for closing a block */
+#define COLUMNAR_BLOCK_ROW_LIMIT 10000
+#define COLUMNAR_BLOCK_BYTE_LIMIT (1024 * 1024)
+
+
+/*
+ * ColumnarResultWriter buffers the values of rows per column until a block
+ * is complete.
+ */
+struct ColumnarResultWriter
+{
+	/* how to serialise the values of each column */
+	TupleDesc tupleDescriptor;
+	FmgrInfo *columnOutputFunctions;
+	bool binaryFormat;
+
+	/* number of columns that are written, which excludes dropped columns */
+	int columnCount;
+
+	/* index in the tuple descriptor of each written column */
+	int *columnIndexArray;
+
+	/* serialised values of the rows in the current block, per column */
+	StringInfo *columnBuffers;
+	int blockRowCount;
+	int blockByteCount;
+
+	/* scratch space for compressing column data */
+	MemoryContext memoryContext;
+	char *compressionBuffer;
+	int compressionBufferSize;
+};
+
+
+/*
+ * ColumnarResultReader holds the state for reading a columnar result file.
+ */
+typedef struct ColumnarResultReader
+{
+	const char *fileName;
+	FILE *file;
+
+	TupleDesc tupleDescriptor;
+	int columnCount;
+	bool binaryFormat;
+
+	/* functions and parameters for decoding the values of each column */
+	FmgrInfo *columnInputFunctions;
+	Oid *columnTypeIoParams;
+
+	/* values of the current block, per column and per row */
+	Datum **blockValues;
+	bool **blockNulls;
+} ColumnarResultReader;
+
+
+static void AppendColumnarValue(StringInfo columnBuffer, FmgrInfo *outputFunction,
+								Datum value, bool binaryFormat);
+static void AppendColumnarChunk(ColumnarResultWriter *writer, StringInfo columnBuffer,
+								StringInfo output);
+static void AppendNetworkInt32(StringInfo output, int32 value);
+static int32 ReadNetworkInt32(ColumnarResultReader *reader);
+static void ReadColumnarBytes(ColumnarResultReader *reader, char *buffer, int size);
+static void ReadColumnarHeader(ColumnarResultReader *reader);
+static bool ReadColumnarBlockIntoTupleStore(ColumnarResultReader *reader,
+											Tuplestorestate *tupleStore);
+static char * ReadColumnarChunk(ColumnarResultReader *reader, int32 *rawSize);
+static void DecodeColumnarValues(ColumnarResultReader *reader, int columnIndex,
+								 char *columnData, int32 columnDataSize, int rowCount);
+
+
+/* GUC, whether to write intermediate results in the columnar format */
+bool ColumnarIntermediateResults = false;
+
+
+/*
+ * CreateColumnarResultWriter creates a writer that serialises rows of the
+ * given tuple descriptor using the given (binary or text) output functions.
+ */
+ColumnarResultWriter *
+CreateColumnarResultWriter(TupleDesc tupleDescriptor, FmgrInfo *columnOutputFunctions,
+						   bool binaryFormat)
+{
+	ColumnarResultWriter *writer = palloc0(sizeof(ColumnarResultWriter));
+	int totalColumnCount = tupleDescriptor->natts;
+
+	writer->tupleDescriptor = tupleDescriptor;
+	writer->columnOutputFunctions = columnOutputFunctions;
+	writer->binaryFormat = binaryFormat;
+	writer->memoryContext = CurrentMemoryContext;
+	writer->columnIndexArray = palloc0(totalColumnCount * sizeof(int));
+	writer->columnBuffers = palloc0(totalColumnCount * sizeof(StringInfo));
+
+	for (int columnIndex = 0; columnIndex < totalColumnCount; columnIndex++)
+	{
+		Form_pg_attribute currentColumn = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (currentColumn->attisdropped
+#if PG_VERSION_NUM >= 120000
+			|| currentColumn->attgenerated == ATTRIBUTE_GENERATED_STORED
+#endif
+			)
+		{
+			continue;
+		}
+
+		writer->columnIndexArray[writer->columnCount] = columnIndex;
+		writer->columnBuffers[writer->columnCount] = makeStringInfo();
+		writer->columnCount++;
+	}
+
+	return writer;
+}
+
+
+/*
+ * AppendColumnarResultHeader appends the header of a columnar result file
+ * to the output buffer.
+ */
+void
+AppendColumnarResultHeader(ColumnarResultWriter *writer, StringInfo output)
+{
+	int32 flags = writer->binaryFormat ? COLUMNAR_FLAG_BINARY_VALUES : 0;
+
+	appendBinaryStringInfo(output, ColumnarResultSignature,
+						   sizeof(ColumnarResultSignature));
+	AppendNetworkInt32(output, flags);
+	AppendNetworkInt32(output, writer->columnCount);
+}
+
+
+/*
+ * AppendColumnarResultRow adds a row to the current block of the writer. It
+ * returns true when the block is full, in which case the caller should call
+ * AppendColumnarResultBlock. The caller is expected to switch to a per-tuple
+ * memory context, since the output functions may allocate memory.
+ */
+bool
+AppendColumnarResultRow(ColumnarResultWriter *writer, Datum *columnValues,
+						bool *columnNulls)
+{
+	int byteCount = 0;
+
+	for (int columnIndex = 0; columnIndex < writer->columnCount; columnIndex++)
+	{
+		int attributeIndex = writer->columnIndexArray[columnIndex];
+		StringInfo columnBuffer = writer->columnBuffers[columnIndex];
+		int previousLength = columnBuffer->len;
+
+		if (columnNulls[attributeIndex])
+		{
+			AppendNetworkInt32(columnBuffer, -1);
+		}
+		else
+		{
+			AppendColumnarValue(columnBuffer,
+								&writer->columnOutputFunctions[attributeIndex],
+								columnValues[attributeIndex], writer->binaryFormat);
+		}
+
+		byteCount += columnBuffer->len - previousLength;
+	}
+
+	writer->blockRowCount++;
+	writer->blockByteCount += byteCount;
+
+	return writer->blockRowCount >= COLUMNAR_BLOCK_ROW_LIMIT ||
+		   writer->blockByteCount >= COLUMNAR_BLOCK_BYTE_LIMIT;
+}
+
+
+/*
+ * AppendColumnarValue serialises a non-NULL value and appends it to the
+ * given column buffer, prefixed with its length.
+ */
+static void
+AppendColumnarValue(StringInfo columnBuffer, FmgrInfo *outputFunction, Datum value,
+					bool binaryFormat)
+{
+	if (binaryFormat)
+	{
+		bytea *outputBytes = SendFunctionCall(outputFunction, value);
+		int outputLength = VARSIZE(outputBytes) - VARHDRSZ;
+
+		AppendNetworkInt32(columnBuffer, outputLength);
+		appendBinaryStringInfo(columnBuffer, VARDATA(outputBytes), outputLength);
+	}
+	else
+	{
+		char *outputText = OutputFunctionCall(outputFunction, value);
+		int outputLength = strlen(outputText);
+
+		AppendNetworkInt32(columnBuffer, outputLength);
+		appendBinaryStringInfo(columnBuffer, outputText, outputLength);
+	}
+}
+
+
+/*
+ * AppendColumnarResultBlock compresses the rows that were added to the writer
+ * since the last block and appends them to the output buffer as a block. It
+ * does nothing if there are no such rows.
+ */
+void
+AppendColumnarResultBlock(ColumnarResultWriter *writer, StringInfo output)
+{
+	if (writer->blockRowCount == 0)
+	{
+		return;
+	}
+
+	AppendNetworkInt32(output, writer->blockRowCount);
+
+	for (int columnIndex = 0; columnIndex < writer->columnCount; columnIndex++)
+	{
+		StringInfo columnBuffer = writer->columnBuffers[columnIndex];
+
+		AppendColumnarChunk(writer, columnBuffer, output);
+		resetStringInfo(columnBuffer);
+	}
+
+	writer->blockRowCount = 0;
+	writer->blockByteCount = 0;
+}
+
+
+/*
+ * AppendColumnarChunk appends the data of a single column in a block to the
+ * output buffer, compressed if pglz manages to make it smaller.
+ */
+static void
+AppendColumnarChunk(ColumnarResultWriter *writer, StringInfo columnBuffer,
+					StringInfo output)
+{
+	int32 rawSize = columnBuffer->len;
+	int32 maxCompressedSize = PGLZ_MAX_OUTPUT(rawSize);
+
+	if (maxCompressedSize > writer->compressionBufferSize)
+	{
+		if (writer->compressionBuffer != NULL)
+		{
+			pfree(writer->compressionBuffer);
+		}
+
+		writer->compressionBuffer = MemoryContextAlloc(writer->memoryContext,
+													   maxCompressedSize);
+		writer->compressionBufferSize = maxCompressedSize;
+	}
+
+	int32 compressedSize = pglz_compress(columnBuffer->data, rawSize,
+										 writer->compressionBuffer,
+										 PGLZ_strategy_default);
+
+	AppendNetworkInt32(output, rawSize);
+
+	if (compressedSize >= 0 && compressedSize < rawSize)
+	{
+		AppendNetworkInt32(output, compressedSize);
+		appendBinaryStringInfo(output, writer->compressionBuffer, compressedSize);
+	}
+	else
+	{
+		/* data did not compress, store it as is */
+		AppendNetworkInt32(output, rawSize);
+		appendBinaryStringInfo(output, columnBuffer->data, rawSize);
+	}
+}
+
+
+/*
+ * AppendColumnarResultFooter appends the remaining rows of the writer and
+ * the end-of-file marker to the output buffer.
+ */
+void
+AppendColumnarResultFooter(ColumnarResultWriter *writer, StringInfo output)
+{
+	AppendColumnarResultBlock(writer, output);
+	AppendNetworkInt32(output, 0);
+}
+
+
+/*
+ * AppendNetworkInt32 appends a 32-bit integer in network byte order.
+ */
+static void
+AppendNetworkInt32(StringInfo output, int32 value)
+{
+	uint32 networkValue = pg_hton32((uint32) value);
+
+	appendBinaryStringInfo(output, (char *) &networkValue, sizeof(networkValue));
+}
+
+
+/*
+ * IsColumnarResultFile returns whether the given file starts with the
+ * signature of a columnar result file. Files in the COPY text and csv formats
+ * never contain a \0 byte and the binary format has a different signature,
+ * so the format of an intermediate result can be detected from the file.
+ */
+bool
+IsColumnarResultFile(const char *fileName)
+{
+	char signature[sizeof(ColumnarResultSignature)];
+	bool isColumnar = false;
+
+	FILE *file = AllocateFile(fileName, PG_BINARY_R);
+	if (file == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", fileName)));
+	}
+
+	if (fread(signature, 1, sizeof(signature), file) == sizeof(signature) &&
+		memcmp(signature, ColumnarResultSignature, sizeof(signature)) == 0)
+	{
+		isColumnar = true;
+	}
+
+	FreeFile(file);
+
+	return isColumnar;
+}
+
+
+/*
+ * ReadColumnarResultFileIntoTupleStore reads a columnar result file and stores
+ * its rows in the given tuple store. Blocks are decompressed and decoded one
+ * column at a time, after which the rows of the block are added to the tuple
+ * store.
+ */
+void
+ReadColumnarResultFileIntoTupleStore(const char *fileName, TupleDesc tupleDescriptor,
+									 Tuplestorestate *tupleStore)
+{
+	ColumnarResultReader reader;
+	memset(&reader, 0, sizeof(reader));
+
+	MemoryContext blockContext =
+		AllocSetContextCreateExtended(CurrentMemoryContext,
+									  "Columnar Result Block Context",
+									  ALLOCSET_DEFAULT_MINSIZE,
+									  ALLOCSET_DEFAULT_INITSIZE,
+									  ALLOCSET_DEFAULT_MAXSIZE);
+
+	reader.fileName = fileName;
+	reader.tupleDescriptor = tupleDescriptor;
+	reader.file = AllocateFile(fileName, PG_BINARY_R);
+	if (reader.file == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", fileName)));
+	}
+
+	ReadColumnarHeader(&reader);
+
+	while (true)
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(blockContext);
+
+		bool blockFound = ReadColumnarBlockIntoTupleStore(&reader, tupleStore);
+
+		MemoryContextSwitchTo(oldContext);
+		MemoryContextReset(blockContext);
+
+		if (!blockFound)
+		{
+			break;
+		}
+	}
+
+	FreeFile(reader.file);
+	MemoryContextDelete(blockContext);
+}
+
+
+/*
+ * ReadColumnarHeader reads the header of a columnar result file, checks that
+ * it matches the tuple descriptor of the reader, and looks up the functions
+ * for decoding values.
+ */
+static void
+ReadColumnarHeader(ColumnarResultReader *reader)
+{
+	char signature[sizeof(ColumnarResultSignature)];
+	TupleDesc tupleDescriptor = reader->tupleDescriptor;
+
+	ReadColumnarBytes(reader, signature, sizeof(signature));
+	if (memcmp(signature, ColumnarResultSignature, sizeof(signature)) != 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+						errmsg("\"%s\" is not a columnar result file",
+							   reader->fileName)));
+	}
+
+	int32 flags = ReadNetworkInt32(reader);
+	int32 columnCount = ReadNetworkInt32(reader);
+
+	if (columnCount != tupleDescriptor->natts)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+						errmsg("result has %d columns, but %d columns were expected",
+							   columnCount, tupleDescriptor->natts)));
+	}
+
+	reader->columnCount = columnCount;
+	reader->binaryFormat = (flags & COLUMNAR_FLAG_BINARY_VALUES) != 0;
+	reader->columnInputFunctions = palloc0(columnCount * sizeof(FmgrInfo));
+	reader->columnTypeIoParams = palloc0(columnCount * sizeof(Oid));
+	reader->blockValues = palloc0(columnCount * sizeof(Datum *));
+	reader->blockNulls = palloc0(columnCount * sizeof(bool *));
+
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Oid columnTypeId = TupleDescAttr(tupleDescriptor, columnIndex)->atttypid;
+		Oid inputFunctionId = InvalidOid;
+
+		if (reader->binaryFormat)
+		{
+			getTypeBinaryInputInfo(columnTypeId, &inputFunctionId,
+								   &reader->columnTypeIoParams[columnIndex]);
+		}
+		else
+		{
+			getTypeInputInfo(columnTypeId, &inputFunctionId,
+							 &reader->columnTypeIoParams[columnIndex]);
+		}
+
+		fmgr_info(inputFunctionId, &reader->columnInputFunctions[columnIndex]);
+	}
+}
+
+
+/*
+ * ReadColumnarBlockIntoTupleStore reads the next block of the file into the
+ * tuple store. It returns false when the end of the file is reached.
+ */
+static bool
+ReadColumnarBlockIntoTupleStore(ColumnarResultReader *reader,
+								Tuplestorestate *tupleStore)
+{
+	int columnCount = reader->columnCount;
+
+	int32 rowCount = ReadNetworkInt32(reader);
+	if (rowCount == 0)
+	{
+		return false;
+	}
+	else if (rowCount < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+						errmsg("invalid row count in columnar result file \"%s\"",
+							   reader->fileName)));
+	}
+
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		int32 columnDataSize = 0;
+		char *columnData = ReadColumnarChunk(reader, &columnDataSize);
+
+		reader->blockValues[columnIndex] = palloc(rowCount * sizeof(Datum));
+		reader->blockNulls[columnIndex] = palloc(rowCount * sizeof(bool));
+
+		DecodeColumnarValues(reader, columnIndex, columnData, columnDataSize,
+							 rowCount);
+	}
+
+	Datum *rowValues = palloc0(columnCount * sizeof(Datum));
+	bool *rowNulls = palloc0(columnCount * sizeof(bool));
+
+	for (int rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+		{
+			rowValues[columnIndex] = reader->blockValues[columnIndex][rowIndex];
+			rowNulls[columnIndex] = reader->blockNulls[columnIndex][rowIndex];
+		}
+
+		tuplestore_putvalues(tupleStore, reader->tupleDescriptor, rowValues, rowNulls);
+	}
+
+	return true;
+}
+
+
+/*
+ * ReadColumnarChunk reads the data of a single column in a block and returns
+ * it uncompressed. The returned buffer has one spare byte at the end, which
+ * DecodeColumnarValues uses to terminate values in place.
+ */
+static char *
+ReadColumnarChunk(ColumnarResultReader *reader, int32 *rawSize)
+{
+	int32 columnDataSize = ReadNetworkInt32(reader);
+	int32 storedSize = ReadNetworkInt32(reader);
+
+	if (columnDataSize < 0 || storedSize < 0 || storedSize > columnDataSize)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+						errmsg("invalid column size in columnar result file \"%s\"",
+							   reader->fileName)));
+	}
+
+	char *columnData = palloc(columnDataSize + 1);
+
+	if (storedSize == columnDataSize)
+	{
+		ReadColumnarBytes(reader, columnData, columnDataSize);
+	}
+	else
+	{
+		char *compressedData = palloc(storedSize);
+
+		ReadColumnarBytes(reader, compressedData, storedSize);
+
+		int32 decompressedSize = PglzDecompressCompat(compressedData, storedSize,
+													  columnData, columnDataSize);
+		if (decompressedSize != columnDataSize)
+		{
+			ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+							errmsg("could not decompress columnar result file "
+								   "\"%s\"", reader->fileName)));
+		}
+
+		pfree(compressedData);
+	}
+
+	*rawSize = columnDataSize;
+
+	return columnData;
+}
+
+
+/*
+ * DecodeColumnarValues decodes rowCount values of a column from the given
+ * data into the block arrays of the reader.
+ */
+static void
+DecodeColumnarValues(ColumnarResultReader *reader, int columnIndex, char *columnData,
+					 int32 columnDataSize, int rowCount)
+{
+	FmgrInfo *inputFunction = &reader->columnInputFunctions[columnIndex];
+	Oid typeIoParam = reader->columnTypeIoParams[columnIndex];
+	int32 typeMod = TupleDescAttr(reader->tupleDescriptor, columnIndex)->atttypmod;
+	Datum *values = reader->blockValues[columnIndex];
+	bool *nulls = reader->blockNulls[columnIndex];
+	int32 offset = 0;
+
+	for (int rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		uint32 networkLength = 0;
+
+		if (columnDataSize - offset < (int32) sizeof(networkLength))
+		{
+			ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+							errmsg("unexpected end of column data in columnar "
+								   "result file \"%s\"", reader->fileName)));
+		}
+
+		memcpy(&networkLength, columnData + offset, sizeof(networkLength));
+		offset += sizeof(networkLength);
+
+		int32 valueLength = (int32) pg_ntoh32(networkLength);
+		if (valueLength == -1)
+		{
+			values[rowIndex] = (Datum) 0;
+			nulls[rowIndex] = true;
+			continue;
+		}
+		else if (valueLength < 0 || valueLength > columnDataSize - offset)
+		{
+			ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+							errmsg("invalid value length in columnar result file "
+								   "\"%s\"", reader->fileName)));
+		}
+
+		/*
+		 * Input and receive functions expect terminated data, so temporarily
+		 * overwrite the first byte after the value (the next length word or
+		 * the spare byte at the end of the buffer).
+		 */
+		char *valueData = columnData + offset;
+		char savedByte = valueData[valueLength];
+		valueData[valueLength] = '\0';
+
+		if (reader->binaryFormat)
+		{
+			StringInfoData valueBuffer;
+
+			valueBuffer.data = valueData;
+			valueBuffer.len = valueLength;
+			valueBuffer.maxlen = valueLength + 1;
+			valueBuffer.cursor = 0;
+
+			values[rowIndex] = ReceiveFunctionCall(inputFunction, &valueBuffer,
+												   typeIoParam, typeMod);
+
+			if (valueBuffer.cursor != valueBuffer.len)
+			{
+				ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+								errmsg("incorrect binary data format in columnar "
+									   "result file \"%s\"", reader->fileName)));
+			}
+		}
+		else
+		{
+			values[rowIndex] = InputFunctionCall(inputFunction, valueData,
+												 typeIoParam, typeMod);
+		}
+
+		valueData[valueLength] = savedByte;
+		nulls[rowIndex] = false;
+		offset += valueLength;
+	}
+}
+
+
+/*
+ * ReadNetworkInt32 reads a 32-bit integer in network byte order.
+ */
+static int32
+ReadNetworkInt32(ColumnarResultReader *reader)
+{
+	uint32 networkValue = 0;
+
+	ReadColumnarBytes(reader, (char *) &networkValue, sizeof(networkValue));
+
+	return (int32) pg_ntoh32(networkValue);
+}
+
+
+/*
+ * ReadColumnarBytes reads exactly size bytes from the file of the reader and
+ * errors out if the file ends early.
+ */
+static void
+ReadColumnarBytes(ColumnarResultReader *reader, char *buffer, int size)
+{
+	if (fread(buffer, 1, size, reader->file) != (size_t) size)
+	{
+		if (ferror(reader->file))
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not read file \"%s\": %m",
+								   reader->fileName)));
+		}
+
+		ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+						errmsg("unexpected end of columnar result file \"%s\"",
+							   reader->fileName)));
+	}
+}
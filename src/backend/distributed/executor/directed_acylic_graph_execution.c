@@ -37,18 +37,19 @@ typedef struct TaskHashEntry
 
 static HASHCTL InitHashTableInfo(void);
 static HTAB * CreateTaskHashTable(void);
-static bool IsAllDependencyCompleted(Task *task, HTAB *completedTasks);
 static void AddCompletedTasks(List *curCompletedTasks, HTAB *completedTasks);
-static List * FindExecutableTasks(List *allTasks, HTAB *completedTasks);
+static List * FilterCompletedTasks(List *allTasks, HTAB *completedTasks);
 static int TaskHashCompare(const void *key1, const void *key2, Size keysize);
 static uint32 TaskHash(const void *key, Size keysize);
 static bool IsTaskAlreadyCompleted(Task *task, HTAB *completedTasks);
 
 /*
  * ExecuteTasksInDependencyOrder executes the given tasks except the excluded
- * tasks in their dependency order. To do so, it iterates all
- * the tasks and finds the ones that can be executed at that time, it tries to
- * execute all of them in parallel. The parallelism is bound by MaxAdaptiveExecutorPoolSize.
+ * tasks in their dependency order. All tasks are handed to a single execution,
+ * which starts a task as soon as the tasks it depends on have finished, rather
+ * than waiting for all tasks of the previous "level" of the graph. That way,
+ * the merge tasks of a partition can run while map tasks of unrelated jobs
+ * are still running. The parallelism is bound by MaxAdaptiveExecutorPoolSize.
  */
 void
 ExecuteTasksInDependencyOrder(List *allTasks, List *excludedTasks)
@@ -58,46 +59,39 @@ ExecuteTasksInDependencyOrder(List *allTasks, List *excludedTasks)
 	/* We only execute depended jobs' tasks, therefore to not execute */
 	/* top level tasks, we add them to the completedTasks. */
 	AddCompletedTasks(excludedTasks, completedTasks);
-	while (true)
-	{
-		List *curTasks = FindExecutableTasks(allTasks, completedTasks);
-		if (list_length(curTasks) == 0)
-		{
-			break;
-		}
-		ExecuteTaskListOutsideTransaction(ROW_MODIFY_NONE, curTasks,
-										  MaxAdaptiveExecutorPoolSize);
 
-		AddCompletedTasks(curTasks, completedTasks);
-		curTasks = NIL;
+	List *tasksToExecute = FilterCompletedTasks(allTasks, completedTasks);
+	if (list_length(tasksToExecute) == 0)
+	{
+		return;
 	}
+
+	ExecuteTaskListInDependencyOrder(ROW_MODIFY_NONE, tasksToExecute,
+									 MaxAdaptiveExecutorPoolSize);
 }
 
 
 /*
- * FindExecutableTasks finds the tasks that can be executed currently,
- * which means that all of their dependencies are executed. If a task
- * is already executed, it is not added to the result.
+ * FilterCompletedTasks returns the tasks in allTasks that are not in
+ * completedTasks.
  */
 static List *
-FindExecutableTasks(List *allTasks, HTAB *completedTasks)
+FilterCompletedTasks(List *allTasks, HTAB *completedTasks)
 {
-	List *curTasks = NIL;
+	List *remainingTasks = NIL;
 	ListCell *taskCell = NULL;
 
-
 	foreach(taskCell, allTasks)
 	{
 		Task *task = (Task *) lfirst(taskCell);
 
-		if (IsAllDependencyCompleted(task, completedTasks) &&
-			!IsTaskAlreadyCompleted(task, completedTasks))
+		if (!IsTaskAlreadyCompleted(task, completedTasks))
 		{
-			curTasks = lappend(curTasks, task);
+			remainingTasks = lappend(remainingTasks, task);
 		}
 	}
 
-	return curTasks;
+	return remainingTasks;
 }
 
 
@@ -143,37 +137,11 @@ IsTaskAlreadyCompleted(Task *task, HTAB *completedTasks)
 	bool found;
 
 	TaskHashKey taskKey = { task->jobId, task->taskId };
-	hash_search(completedTasks, &taskKey, HASH_ENTER, &found);
+	hash_search(completedTasks, &taskKey, HASH_FIND, &found);
 	return found;
 }
 
 
-/*
- * IsAllDependencyCompleted return true if the given task's
- * dependencies are completed.
- */
-static bool
-IsAllDependencyCompleted(Task *targetTask, HTAB *completedTasks)
-{
-	ListCell *taskCell = NULL;
-	bool found = false;
-
-
-	foreach(taskCell, targetTask->dependentTaskList)
-	{
-		Task *task = (Task *) lfirst(taskCell);
-		TaskHashKey taskKey = { task->jobId, task->taskId };
-
-		hash_search(completedTasks, &taskKey, HASH_FIND, &found);
-		if (!found)
-		{
-			return false;
-		}
-	}
-	return true;
-}
-
-
 /*
  * InitHashTableInfo returns hash table info, the hash table is
  * configured to be created in the CurrentMemoryContext so that
@@ -0,0 +1,590 @@
+/*-------------------------------------------------------------------------
+ *
+ * distributed_intermediate_results.c
+ *   Functions for reading and writing distributed intermediate results.
+ *
+ * A distributed intermediate result is the result of a set of tasks that
+ * is partitioned on the nodes where the tasks ran, using the shard ranges
+ * of a distributed table, and then moved to the nodes that have the
+ * placements of the corresponding shards. The rows never pass through the
+ * coordinator.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "access/tupdesc.h"
+#include "catalog/pg_type.h"
+#include "distributed/deparse_shard_query.h"
+#include "distributed/distributed_planner.h"
+#include "distributed/intermediate_results.h"
+#include "distributed/listutils.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_executor.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/transaction_management.h"
+#include "distributed/version_compat.h"
+#include "executor/tuptable.h"
+#include "lib/stringinfo.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/tuplestore.h"
+
+
+/* number of columns returned by the partitioning tasks */
+#define PARTITION_TASK_RESULT_COLUMNS 4
+
+
+/*
+ * NodePair contains the source and the target node of a
+ * NodeToNodeFragmentsTransfer.
+ */
+typedef struct NodePair
+{
+	uint32 sourceNodeId;
+	uint32 targetNodeId;
+} NodePair;
+
+
+/*
+ * NodeToNodeFragmentsTransfer contains all fragments that need to be fetched
+ * from the source node to the target node of the NodePair.
+ */
+typedef struct NodeToNodeFragmentsTransfer
+{
+	NodePair nodes;
+	List *fragmentList;
+} NodeToNodeFragmentsTransfer;
+
+
+static List * WrapTasksForPartitioning(char *resultIdPrefix, List *selectTaskList,
+									   int partitionColumnIndex,
+									   DistTableCacheEntry *targetRelation,
+									   bool binaryFormat);
+static void ShardMinMaxValueArrays(ShardInterval **shardIntervalArray, int shardCount,
+								   char **minValueArrayString,
+								   char **maxValueArrayString);
+static char * TextArrayString(Datum *textArray, int textCount);
+static List * ExecutePartitionTaskList(List *partitionTaskList,
+									   DistTableCacheEntry *targetRelation);
+static List * ColocationTransfers(List *fragmentList,
+								  DistTableCacheEntry *targetRelation);
+static List * FragmentTransferTaskList(List *fragmentListTransfers);
+static char * QueryStringForFragmentsTransfer(List *fragmentListTransfers);
+static Tuplestorestate * ExecuteSelectTasksIntoTupleStore(List *taskList,
+														  TupleDesc resultDescriptor);
+
+
+/*
+ * RedistributeTaskListResults partitions the results of the given task list
+ * using the shard ranges and partition method of the given target relation,
+ * and moves the partitions to the nodes that have the placements of the
+ * corresponding target shards.
+ *
+ * It returns an array of lists of result ids, where the i-th list contains
+ * the results that belong to the i-th shard in the sorted shard list of the
+ * target relation. All of those results are available on all placements of
+ * that shard when the function returns.
+ */
+List **
+RedistributeTaskListResults(char *resultIdPrefix, List *selectTaskList,
+							int partitionColumnIndex,
+							DistTableCacheEntry *targetRelation,
+							bool binaryFormat)
+{
+	int shardCount = targetRelation->shardIntervalArrayLength;
+	ListCell *fragmentCell = NULL;
+
+	/*
+	 * Make sure that this transaction has a distributed transaction ID.
+	 *
+	 * Intermediate results will be stored in a directory that is derived
+	 * from the distributed transaction ID.
+	 */
+	UseCoordinatedTransaction();
+
+	List *fragmentList = PartitionTasklistResults(resultIdPrefix, selectTaskList,
+												  partitionColumnIndex,
+												  targetRelation, binaryFormat);
+
+	List *fragmentListTransfers = ColocationTransfers(fragmentList, targetRelation);
+	List *fetchTaskList = FragmentTransferTaskList(fragmentListTransfers);
+
+	if (fetchTaskList != NIL)
+	{
+		TupleDesc resultDescriptor = NULL;
+
+#if PG_VERSION_NUM < 120000
+		resultDescriptor = CreateTemplateTupleDesc(1, false);
+#else
+		resultDescriptor = CreateTemplateTupleDesc(1);
+#endif
+		TupleDescInitEntry(resultDescriptor, (AttrNumber) 1, "byte_count",
+						   INT8OID, -1, 0);
+
+		ExecuteSelectTasksIntoTupleStore(fetchTaskList, resultDescriptor);
+	}
+
+	List **shardResultIdList = palloc0(shardCount * sizeof(List *));
+
+	foreach(fragmentCell, fragmentList)
+	{
+		DistributedResultFragment *fragment = lfirst(fragmentCell);
+		int shardIndex = fragment->targetShardIndex;
+
+		shardResultIdList[shardIndex] = lappend(shardResultIdList[shardIndex],
+												fragment->resultId);
+	}
+
+	return shardResultIdList;
+}
+
+
+/*
+ * PartitionTasklistResults executes the given task list, and partitions the
+ * results of each task based on the partition method and shard ranges of the
+ * target relation. The results are written to files on the nodes where the
+ * tasks ran, and the function returns a list of DistributedResultFragment
+ * that describes the non-empty files.
+ */
+List *
+PartitionTasklistResults(char *resultIdPrefix, List *selectTaskList,
+						 int partitionColumnIndex,
+						 DistTableCacheEntry *targetRelation,
+						 bool binaryFormat)
+{
+	if (targetRelation->partitionMethod != DISTRIBUTE_BY_HASH &&
+		targetRelation->partitionMethod != DISTRIBUTE_BY_RANGE)
+	{
+		ereport(ERROR, (errmsg("repartitioning results of a tasklist is only "
+							   "supported when target relation is hash or range "
+							   "partitioned.")));
+	}
+
+	selectTaskList = WrapTasksForPartitioning(resultIdPrefix, selectTaskList,
+											  partitionColumnIndex, targetRelation,
+											  binaryFormat);
+
+	return ExecutePartitionTaskList(selectTaskList, targetRelation);
+}
+
+
+/*
+ * WrapTasksForPartitioning wraps the query of each task in a call to
+ * worker_partition_query_result. The result of a task with id i is written
+ * to the files <resultIdPrefix>_from_<i>_to_<shardIndex>.
+ *
+ * Each task runs on its first placement, such that the location of the
+ * results is known upfront.
+ */
+static List *
+WrapTasksForPartitioning(char *resultIdPrefix, List *selectTaskList,
+						 int partitionColumnIndex,
+						 DistTableCacheEntry *targetRelation,
+						 bool binaryFormat)
+{
+	List *wrappedTaskList = NIL;
+	ListCell *taskCell = NULL;
+	ShardInterval **shardIntervalArray = targetRelation->sortedShardIntervalArray;
+	int shardCount = targetRelation->shardIntervalArrayLength;
+	char *minValueArrayString = NULL;
+	char *maxValueArrayString = NULL;
+	const char *partitionMethodString =
+		targetRelation->partitionMethod == DISTRIBUTE_BY_HASH ? "hash" : "range";
+
+	ShardMinMaxValueArrays(shardIntervalArray, shardCount, &minValueArrayString,
+						   &maxValueArrayString);
+
+	foreach(taskCell, selectTaskList)
+	{
+		Task *selectTask = (Task *) lfirst(taskCell);
+		ShardPlacement *shardPlacement = linitial(selectTask->taskPlacementList);
+		StringInfo taskPrefix = makeStringInfo();
+		StringInfo wrappedQuery = makeStringInfo();
+
+		appendStringInfo(taskPrefix, "%s_from_%u_to", resultIdPrefix,
+						 selectTask->taskId);
+
+		appendStringInfo(wrappedQuery,
+						 "SELECT %u, partition_index, %s || '_' || "
+						 "partition_index::text, rows_written "
+						 "FROM worker_partition_query_result(%s,%s,%d,%s,%s,%s,%s,%s) "
+						 "WHERE rows_written > 0",
+						 shardPlacement->nodeId,
+						 quote_literal_cstr(taskPrefix->data),
+						 quote_literal_cstr(taskPrefix->data),
+						 quote_literal_cstr(TaskQueryString(selectTask)),
+						 partitionColumnIndex,
+						 quote_literal_cstr(partitionMethodString),
+						 minValueArrayString, maxValueArrayString,
+						 binaryFormat ? "true" : "false",
+						 ColumnarIntermediateResults ? "true" : "false");
+
+		Task *wrappedSelectTask = copyObject(selectTask);
+		wrappedSelectTask->queryString = wrappedQuery->data;
+		wrappedSelectTask->taskPlacementList = list_make1(shardPlacement);
+
+		wrappedTaskList = lappend(wrappedTaskList, wrappedSelectTask);
+	}
+
+	return wrappedTaskList;
+}
+
+
+/*
+ * ShardMinMaxValueArrays returns the quoted text array literals of the min
+ * and max values of the given shard intervals, in the form that
+ * worker_partition_query_result expects them.
+ */
+static void
+ShardMinMaxValueArrays(ShardInterval **shardIntervalArray, int shardCount,
+					   char **minValueArrayString, char **maxValueArrayString)
+{
+	Datum *minValues = palloc0(shardCount * sizeof(Datum));
+	Datum *maxValues = palloc0(shardCount * sizeof(Datum));
+
+	for (int shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval = shardIntervalArray[shardIndex];
+		Oid outputFunctionId = InvalidOid;
+		bool typeVarLength = false;
+
+		if (!shardInterval->minValueExists || !shardInterval->maxValueExists)
+		{
+			ereport(ERROR, (errmsg("cannot repartition results for shard "
+								   UINT64_FORMAT " without a range",
+								   shardInterval->shardId)));
+		}
+
+		getTypeOutputInfo(shardInterval->valueTypeId, &outputFunctionId,
+						  &typeVarLength);
+
+		char *minValue = OidOutputFunctionCall(outputFunctionId,
+											   shardInterval->minValue);
+		char *maxValue = OidOutputFunctionCall(outputFunctionId,
+											   shardInterval->maxValue);
+
+		minValues[shardIndex] = CStringGetTextDatum(minValue);
+		maxValues[shardIndex] = CStringGetTextDatum(maxValue);
+	}
+
+	*minValueArrayString = TextArrayString(minValues, shardCount);
+	*maxValueArrayString = TextArrayString(maxValues, shardCount);
+}
+
+
+/*
+ * TextArrayString returns a quoted literal of the text array that consists
+ * of the given elements.
+ */
+static char *
+TextArrayString(Datum *textArray, int textCount)
+{
+	Oid outputFunctionId = InvalidOid;
+	bool typeVarLength = false;
+
+	ArrayType *arrayObject = DatumArrayToArrayType(textArray, textCount, TEXTOID);
+
+	getTypeOutputInfo(TEXTARRAYOID, &outputFunctionId, &typeVarLength);
+	char *arrayString = OidOutputFunctionCall(outputFunctionId,
+											  PointerGetDatum(arrayObject));
+
+	return quote_literal_cstr(arrayString);
+}
+
+
+/*
+ * ExecutePartitionTaskList executes the queries formed in
+ * WrapTasksForPartitioning, and returns the fragments they wrote.
+ */
+static List *
+ExecutePartitionTaskList(List *partitionTaskList, DistTableCacheEntry *targetRelation)
+{
+	TupleDesc resultDescriptor = NULL;
+	List *fragmentList = NIL;
+	bool goForward = true;
+	bool doCopy = false;
+
+#if PG_VERSION_NUM < 120000
+	resultDescriptor = CreateTemplateTupleDesc(PARTITION_TASK_RESULT_COLUMNS, false);
+#else
+	resultDescriptor = CreateTemplateTupleDesc(PARTITION_TASK_RESULT_COLUMNS);
+#endif
+	TupleDescInitEntry(resultDescriptor, (AttrNumber) 1, "node_id",
+					   INT4OID, -1, 0);
+	TupleDescInitEntry(resultDescriptor, (AttrNumber) 2, "partition_index",
+					   INT4OID, -1, 0);
+	TupleDescInitEntry(resultDescriptor, (AttrNumber) 3, "result_id",
+					   TEXTOID, -1, 0);
+	TupleDescInitEntry(resultDescriptor, (AttrNumber) 4, "rows_written",
+					   INT8OID, -1, 0);
+
+	Tuplestorestate *resultStore =
+		ExecuteSelectTasksIntoTupleStore(partitionTaskList, resultDescriptor);
+
+	TupleTableSlot *slot = MakeSingleTupleTableSlotCompat(resultDescriptor,
+														  &TTSOpsMinimalTuple);
+
+	while (tuplestore_gettupleslot(resultStore, goForward, doCopy, slot))
+	{
+		bool isNull = false;
+
+		uint32 nodeId = DatumGetInt32(slot_getattr(slot, 1, &isNull));
+		int shardIndex = DatumGetInt32(slot_getattr(slot, 2, &isNull));
+		text *resultIdText = DatumGetTextP(slot_getattr(slot, 3, &isNull));
+		uint64 rowCount = DatumGetInt64(slot_getattr(slot, 4, &isNull));
+
+		if (shardIndex < 0 || shardIndex >= targetRelation->shardIntervalArrayLength)
+		{
+			ereport(ERROR, (errmsg("worker returned an invalid partition index %d",
+								   shardIndex)));
+		}
+
+		ShardInterval *shardInterval =
+			targetRelation->sortedShardIntervalArray[shardIndex];
+
+		DistributedResultFragment *fragment =
+			palloc0(sizeof(DistributedResultFragment));
+		fragment->resultId = text_to_cstring(resultIdText);
+		fragment->nodeId = nodeId;
+		fragment->rowCount = rowCount;
+		fragment->targetShardId = shardInterval->shardId;
+		fragment->targetShardIndex = shardIndex;
+
+		fragmentList = lappend(fragmentList, fragment);
+
+		ExecClearTuple(slot);
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+	tuplestore_end(resultStore);
+
+	return fragmentList;
+}
+
+
+/*
+ * ColocationTransfers returns the list of transfers that are needed to make
+ * each fragment available on all placements of its target shard. Fragments
+ * that move between the same pair of nodes are grouped into one transfer.
+ */
+static List *
+ColocationTransfers(List *fragmentList, DistTableCacheEntry *targetRelation)
+{
+	HASHCTL transferHashInfo;
+	List *fragmentListTransfers = NIL;
+	ListCell *fragmentCell = NULL;
+
+	memset(&transferHashInfo, 0, sizeof(HASHCTL));
+	transferHashInfo.keysize = sizeof(NodePair);
+	transferHashInfo.entrysize = sizeof(NodeToNodeFragmentsTransfer);
+	transferHashInfo.hcxt = CurrentMemoryContext;
+
+	HTAB *transferHash = hash_create("Fragment transfer hash", 32, &transferHashInfo,
+									 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	foreach(fragmentCell, fragmentList)
+	{
+		DistributedResultFragment *fragment = lfirst(fragmentCell);
+		List *placementList = FinalizedShardPlacementList(fragment->targetShardId);
+		ListCell *placementCell = NULL;
+
+		foreach(placementCell, placementList)
+		{
+			ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+			NodePair transferKey;
+			bool foundInCache = false;
+
+			if (placement->nodeId == fragment->nodeId)
+			{
+				/* the fragment is already where it needs to be */
+				continue;
+			}
+
+			memset(&transferKey, 0, sizeof(NodePair));
+			transferKey.sourceNodeId = fragment->nodeId;
+			transferKey.targetNodeId = placement->nodeId;
+
+			NodeToNodeFragmentsTransfer *fragmentListTransfer =
+				hash_search(transferHash, &transferKey, HASH_ENTER, &foundInCache);
+			if (!foundInCache)
+			{
+				fragmentListTransfer->nodes = transferKey;
+				fragmentListTransfer->fragmentList = NIL;
+				fragmentListTransfers = lappend(fragmentListTransfers,
+												fragmentListTransfer);
+			}
+
+			fragmentListTransfer->fragmentList =
+				lappend(fragmentListTransfer->fragmentList, fragment);
+		}
+	}
+
+	return fragmentListTransfers;
+}
+
+
+/*
+ * FragmentTransferTaskList returns a list of tasks that run on the target
+ * nodes of the transfers. Each task fetches the fragments of all transfers
+ * to its node, such that the node fetches from the source nodes concurrently.
+ */
+static List *
+FragmentTransferTaskList(List *fragmentListTransfers)
+{
+	List *fetchTaskList = NIL;
+	List *targetNodeTransferLists = NIL;
+	ListCell *transferCell = NULL;
+	ListCell *transferListCell = NULL;
+	uint32 taskId = 1;
+
+	/* group the transfers by target node */
+	foreach(transferCell, fragmentListTransfers)
+	{
+		NodeToNodeFragmentsTransfer *fragmentsTransfer = lfirst(transferCell);
+		uint32 targetNodeId = fragmentsTransfer->nodes.targetNodeId;
+		bool foundTargetNode = false;
+
+		foreach(transferListCell, targetNodeTransferLists)
+		{
+			List *transferList = lfirst(transferListCell);
+			NodeToNodeFragmentsTransfer *firstTransfer = linitial(transferList);
+
+			if (firstTransfer->nodes.targetNodeId == targetNodeId)
+			{
+				lfirst(transferListCell) = lappend(transferList, fragmentsTransfer);
+				foundTargetNode = true;
+				break;
+			}
+		}
+
+		if (!foundTargetNode)
+		{
+			targetNodeTransferLists = lappend(targetNodeTransferLists,
+											  list_make1(fragmentsTransfer));
+		}
+	}
+
+	foreach(transferListCell, targetNodeTransferLists)
+	{
+		List *transferList = lfirst(transferListCell);
+		NodeToNodeFragmentsTransfer *firstTransfer = linitial(transferList);
+		WorkerNode *workerNode =
+			LookupNodeByNodeId(firstTransfer->nodes.targetNodeId);
+
+		ShardPlacement *targetPlacement = CitusMakeNode(ShardPlacement);
+		targetPlacement->nodeName = workerNode->workerName;
+		targetPlacement->nodePort = workerNode->workerPort;
+		targetPlacement->nodeId = workerNode->nodeId;
+		targetPlacement->groupId = workerNode->groupId;
+
+		Task *fetchTask = CreateBasicTask(INVALID_JOB_ID, taskId, SELECT_TASK,
+										  QueryStringForFragmentsTransfer(
+											  transferList));
+		fetchTask->taskPlacementList = list_make1(targetPlacement);
+
+		fetchTaskList = lappend(fetchTaskList, fetchTask);
+		taskId++;
+	}
+
+	return fetchTaskList;
+}
+
+
+/*
+ * QueryStringForFragmentsTransfer returns a query which fetches the
+ * fragments of the given transfers, which all have the same target node,
+ * from their source nodes.
+ */
+static char *
+QueryStringForFragmentsTransfer(List *fragmentListTransfers)
+{
+	StringInfo queryString = makeStringInfo();
+	StringInfo fragmentNamesArrayString = makeStringInfo();
+	StringInfo nodeNamesArrayString = makeStringInfo();
+	StringInfo nodePortsArrayString = makeStringInfo();
+	int fragmentCount = 0;
+	ListCell *transferCell = NULL;
+
+	appendStringInfoString(fragmentNamesArrayString, "ARRAY[");
+	appendStringInfoString(nodeNamesArrayString, "ARRAY[");
+	appendStringInfoString(nodePortsArrayString, "ARRAY[");
+
+	foreach(transferCell, fragmentListTransfers)
+	{
+		NodeToNodeFragmentsTransfer *fragmentsTransfer = lfirst(transferCell);
+		WorkerNode *sourceNode =
+			LookupNodeByNodeId(fragmentsTransfer->nodes.sourceNodeId);
+		char *sourceNodeName = quote_literal_cstr(sourceNode->workerName);
+		ListCell *fragmentCell = NULL;
+
+		foreach(fragmentCell, fragmentsTransfer->fragmentList)
+		{
+			DistributedResultFragment *fragment = lfirst(fragmentCell);
+
+			if (fragmentCount > 0)
+			{
+				appendStringInfoString(fragmentNamesArrayString, ",");
+				appendStringInfoString(nodeNamesArrayString, ",");
+				appendStringInfoString(nodePortsArrayString, ",");
+			}
+
+			appendStringInfoString(fragmentNamesArrayString,
+								   quote_literal_cstr(fragment->resultId));
+			appendStringInfoString(nodeNamesArrayString, sourceNodeName);
+			appendStringInfo(nodePortsArrayString, "%d", sourceNode->workerPort);
+
+			fragmentCount++;
+		}
+	}
+
+	appendStringInfoString(fragmentNamesArrayString, "]::text[]");
+	appendStringInfoString(nodeNamesArrayString, "]::text[]");
+	appendStringInfoString(nodePortsArrayString, "]::int[]");
+
+	appendStringInfo(queryString,
+					 "SELECT bytes FROM fetch_intermediate_results_from_nodes(%s,%s,%s) "
+					 "bytes",
+					 fragmentNamesArrayString->data,
+					 nodeNamesArrayString->data,
+					 nodePortsArrayString->data);
+
+	return queryString->data;
+}
+
+
+/*
+ * ExecuteSelectTasksIntoTupleStore executes the given tasks in remote
+ * transaction blocks, since both worker_partition_query_result and
+ * fetch_intermediate_results_from_nodes require one, and returns the rows they
+ * produced in a tuple store.
+ */
+static Tuplestorestate *
+ExecuteSelectTasksIntoTupleStore(List *taskList, TupleDesc resultDescriptor)
+{
+	bool hasReturning = true;
+	int targetPoolSize = MaxAdaptiveExecutorPoolSize;
+	bool randomAccess = true;
+	bool interTransactions = false;
+	TransactionProperties xactProperties = {
+		.errorOnAnyFailure = true,
+		.useRemoteTransactionBlocks = TRANSACTION_BLOCKS_REQUIRED,
+		.requires2PC = false
+	};
+
+	Tuplestorestate *resultStore = tuplestore_begin_heap(randomAccess, interTransactions,
+														 work_mem);
+
+	ExecuteTaskListExtended(ROW_MODIFY_READONLY, taskList, resultDescriptor,
+							resultStore, hasReturning, targetPoolSize,
+							&xactProperties);
+
+	return resultStore;
+}
@@ -11,12 +11,15 @@
 #include "postgres.h"
 #include "miscadmin.h"
 
+#include "distributed/citus_custom_scan.h"
 #include "distributed/citus_ruleutils.h"
 #include "distributed/commands/multi_copy.h"
 #include "distributed/distributed_execution_locks.h"
 #include "distributed/insert_select_executor.h"
 #include "distributed/insert_select_planner.h"
+#include "distributed/intermediate_results.h"
 #include "distributed/local_executor.h"
+#include "distributed/metadata_cache.h"
 #include "distributed/multi_executor.h"
 #include "distributed/multi_partitioning_utils.h"
 #include "distributed/multi_physical_planner.h"
@@ -26,12 +29,14 @@
 #include "distributed/recursive_planning.h"
 #include "distributed/relation_access_tracking.h"
 #include "distributed/resource_lock.h"
+#include "distributed/subplan_execution.h"
 #include "distributed/transaction_management.h"
 #include "executor/executor.h"
 #include "nodes/execnodes.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
 #include "nodes/parsenodes.h"
+#include "nodes/params.h"
 #include "nodes/plannodes.h"
 #include "parser/parse_coerce.h"
 #include "parser/parse_relation.h"
@@ -44,6 +49,9 @@
 #include "utils/snapmgr.h"
 
 
+/* Config variables managed via guc.c */
+bool EnableRepartitionedInsertSelect = false;
+
 /* depth of current insert/select executor. */
 static int insertSelectExecutorLevel = 0;
 
@@ -63,6 +71,18 @@ static HTAB * ExecuteSelectIntoColocatedIntermediateResults(Oid targetRelationId
 static List * BuildColumnNameListFromTargetList(Oid targetRelationId,
 												List *insertTargetList);
 static int PartitionColumnIndexFromColumnList(Oid relationId, List *columnNameList);
+static bool IsSupportedRedistributionTarget(Oid targetRelationId);
+static int RedistributionPartitionColumnIndex(Oid targetRelationId,
+											  List *insertTargetList);
+static bool IsRedistributablePlan(Plan *selectPlan);
+static void ExecuteRepartitionedInsertSelect(CitusScanState *scanState,
+											 Query *insertSelectQuery,
+											 PlannedStmt *selectPlan,
+											 int partitionColumnIndex);
+static List * RedistributedInsertSelectTaskList(Query *insertSelectQuery,
+												DistTableCacheEntry *targetRelation,
+												List **redistributedResults,
+												bool useBinaryFormat);
 
 
 /*
@@ -114,20 +134,9 @@ CoordinatorInsertSelectExecScanInternal(CustomScanState *node)
 		Oid targetRelationId = insertRte->relid;
 		char *intermediateResultIdPrefix = distributedPlan->intermediateResultIdPrefix;
 		bool hasReturning = distributedPlan->hasReturning;
+		ParamListInfo paramListInfo = executorState->es_param_list_info;
 		HTAB *shardStateHash = NULL;
 
-		ereport(DEBUG1, (errmsg("Collecting INSERT ... SELECT results on coordinator")));
-
-
-		/*
-		 * INSERT .. SELECT via coordinator consists of two steps, a SELECT is
-		 * followd by a COPY. If the SELECT is executed locally, then the COPY
-		 * would fail since Citus currently doesn't know how to handle COPY
-		 * locally. So, to prevent the command fail, we simply disable local
-		 * execution.
-		 */
-		DisableLocalExecution();
-
 		/* select query to execute */
 		Query *selectQuery = BuildSelectForInsertSelect(insertSelectQuery);
 
@@ -144,6 +153,42 @@ CoordinatorInsertSelectExecScanInternal(CustomScanState *node)
 			LockPartitionRelations(targetRelationId, RowExclusiveLock);
 		}
 
+		/* fragments are created over connections, which local execution forbids */
+		if (distributedPlan->insertSelectMethod == INSERT_SELECT_REPARTITION &&
+			!LocalExecutionHappened)
+		{
+			int partitionColumnIndex =
+				RedistributionPartitionColumnIndex(targetRelationId,
+												   insertSelectQuery->targetList);
+			PlannedStmt *selectPlan = PlanRedistributedSelect(selectQuery,
+															  paramListInfo);
+
+			ereport(DEBUG1, (errmsg("performing repartitioned INSERT ... SELECT")));
+
+			ExecuteRepartitionedInsertSelect(scanState, insertSelectQuery, selectPlan,
+											 partitionColumnIndex);
+
+			scanState->finishedRemoteScan = true;
+
+			return ReturnTupleFromTuplestore(scanState);
+		}
+
+		ereport(DEBUG1, (errmsg("Collecting INSERT ... SELECT results on coordinator")));
+
+		/*
+		 * INSERT .. SELECT via coordinator consists of two steps, a SELECT is
+		 * followd by a COPY. The COPY inserts into local placements directly
+		 * when the local execution rules allow it, but COPY into intermediate
+		 * results always goes over connections. If the SELECT is executed
+		 * locally in the latter cases, the COPY would fail. So, to prevent the
+		 * command fail, we disable local execution for them.
+		 */
+		if (insertSelectQuery->onConflict || hasReturning ||
+			!ShouldUseLocalCopy(targetRelationId))
+		{
+			DisableLocalExecution();
+		}
+
 		if (insertSelectQuery->onConflict || hasReturning)
 		{
 			/*
@@ -589,6 +634,333 @@ PartitionColumnIndexFromColumnList(Oid relationId, List *columnNameList)
 }
 
 
+/*
+ * InsertSelectMethodForQuery decides at planning time whether the results of
+ * the SELECT part of an INSERT ... SELECT via the coordinator can be
+ * repartitioned directly between the workers and inserted into the target
+ * relation without passing through the coordinator. The decision is stored
+ * in the DistributedPlan, such that the SELECT does not have to be planned
+ * again for it on every execution.
+ */
+InsertSelectMethod
+InsertSelectMethodForQuery(Query *insertSelectQuery, ParamListInfo boundParams)
+{
+	RangeTblEntry *insertRte = ExtractResultRelationRTE(insertSelectQuery);
+	Oid targetRelationId = insertRte->relid;
+
+	if (!EnableRepartitionedInsertSelect)
+	{
+		return INSERT_SELECT_VIA_COORDINATOR;
+	}
+
+	if (!IsSupportedRedistributionTarget(targetRelationId))
+	{
+		return INSERT_SELECT_VIA_COORDINATOR;
+	}
+
+	/* compare the target lists in the same order as the executor does */
+	Query *reorderedQuery = copyObject(insertSelectQuery);
+	RangeTblEntry *reorderedInsertRte = ExtractResultRelationRTE(reorderedQuery);
+	RangeTblEntry *selectRte = ExtractSelectRangeTableEntry(reorderedQuery);
+	Query *selectQuery = BuildSelectForInsertSelect(reorderedQuery);
+
+	selectRte->subquery = selectQuery;
+	ReorderInsertSelectTargetLists(reorderedQuery, reorderedInsertRte, selectRte);
+
+	int partitionColumnIndex =
+		RedistributionPartitionColumnIndex(targetRelationId, reorderedQuery->targetList);
+	if (partitionColumnIndex < 0)
+	{
+		return INSERT_SELECT_VIA_COORDINATOR;
+	}
+
+	PlannedStmt *selectPlan = PlanRedistributedSelect(selectQuery, boundParams);
+	if (!IsRedistributablePlan(selectPlan->planTree))
+	{
+		return INSERT_SELECT_VIA_COORDINATOR;
+	}
+
+	return INSERT_SELECT_REPARTITION;
+}
+
+
+/*
+ * PlanRedistributedSelect plans the SELECT part of an INSERT ... SELECT whose
+ * results are repartitioned on the workers. The task queries of the SELECT
+ * are wrapped into other queries on the workers, so we resolve the parameters
+ * before planning to make sure that none of them ends up in the task query
+ * strings.
+ */
+PlannedStmt *
+PlanRedistributedSelect(Query *selectQuery, ParamListInfo paramListInfo)
+{
+	int cursorOptions = CURSOR_OPT_PARALLEL_OK;
+
+	Query *selectQueryCopy = copyObject(selectQuery);
+	if (paramListInfo != NULL)
+	{
+		ParamListInfo boundParams = copyParamList(paramListInfo);
+
+		selectQueryCopy = (Query *) ResolveExternalParams((Node *) selectQueryCopy,
+														  boundParams);
+	}
+
+	return pg_plan_query(selectQueryCopy, cursorOptions, NULL);
+}
+
+
+/*
+ * IsSupportedRedistributionTarget returns whether the rows of an INSERT ... SELECT
+ * into the given relation can be partitioned on the workers, which requires
+ * the target to have well-defined, non-overlapping shard intervals.
+ */
+static bool
+IsSupportedRedistributionTarget(Oid targetRelationId)
+{
+	DistTableCacheEntry *tableEntry = DistributedTableCacheEntry(targetRelationId);
+
+	if (tableEntry->partitionMethod != DISTRIBUTE_BY_HASH &&
+		tableEntry->partitionMethod != DISTRIBUTE_BY_RANGE)
+	{
+		return false;
+	}
+
+	if (tableEntry->hasUninitializedShardInterval ||
+		tableEntry->hasOverlappingShardInterval)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * RedistributionPartitionColumnIndex returns the position of the partition
+ * column of the target relation in the given (reordered) insert target list,
+ * or -1 if the partition column is not inserted into or the SELECT produces a
+ * different type for it. In the latter case, the worker would hash the value
+ * with the wrong type.
+ */
+static int
+RedistributionPartitionColumnIndex(Oid targetRelationId, List *insertTargetList)
+{
+	Var *partitionColumn = PartitionColumn(targetRelationId, 0);
+	ListCell *insertTargetCell = NULL;
+	int targetEntryIndex = 0;
+
+	foreach(insertTargetCell, insertTargetList)
+	{
+		TargetEntry *insertTargetEntry = (TargetEntry *) lfirst(insertTargetCell);
+
+		if (insertTargetEntry->resno == partitionColumn->varattno)
+		{
+			Oid insertColumnType = exprType((Node *) insertTargetEntry->expr);
+
+			if (insertColumnType != partitionColumn->vartype)
+			{
+				return -1;
+			}
+
+			return targetEntryIndex;
+		}
+
+		targetEntryIndex++;
+	}
+
+	return -1;
+}
+
+
+/*
+ * IsRedistributablePlan returns whether the given plan of a SELECT is a
+ * multi-shard query whose output is exactly the output of its tasks. Only
+ * then can the task results be partitioned on the workers without any
+ * further processing on the coordinator.
+ */
+static bool
+IsRedistributablePlan(Plan *selectPlan)
+{
+	if (!IsTaskResultPassthroughPlan(selectPlan))
+	{
+		return false;
+	}
+
+	DistributedPlan *distSelectPlan = GetDistributedPlan((CustomScan *) selectPlan);
+
+	/* single shard queries are cheap enough to pull through the coordinator */
+	if (list_length(distSelectPlan->workerJob->taskList) <= 1)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * ExecuteRepartitionedInsertSelect executes the tasks of the given SELECT plan
+ * such that every task partitions its results into fragments by the shard
+ * intervals of the target relation, moves the fragments to the nodes that
+ * hold the corresponding target shards and then inserts each shard's
+ * fragments into that shard. Rows never pass through the coordinator, except
+ * for RETURNING.
+ */
+static void
+ExecuteRepartitionedInsertSelect(CitusScanState *scanState, Query *insertSelectQuery,
+								 PlannedStmt *selectPlan, int partitionColumnIndex)
+{
+	EState *executorState = ScanStateGetExecutorState(scanState);
+	DistributedPlan *distributedPlan = scanState->distributedPlan;
+	char *intermediateResultIdPrefix = distributedPlan->intermediateResultIdPrefix;
+	bool hasReturning = distributedPlan->hasReturning;
+	RangeTblEntry *insertRte = ExtractResultRelationRTE(insertSelectQuery);
+	RangeTblEntry *selectRte = ExtractSelectRangeTableEntry(insertSelectQuery);
+	DistTableCacheEntry *targetRelation = DistributedTableCacheEntry(insertRte->relid);
+
+	CustomScan *selectScan = (CustomScan *) selectPlan->planTree;
+	DistributedPlan *distSelectPlan = GetDistributedPlan(selectScan);
+	List *selectTaskList = distSelectPlan->workerJob->taskList;
+
+	/* the fragments are written and read in the same format */
+	bool useBinaryFormat =
+		CanUseBinaryCopyFormatForTargetList(selectRte->subquery->targetList);
+
+	/* the fragments are written and moved over connections */
+	DisableLocalExecution();
+
+	ExecuteSubPlans(distSelectPlan);
+
+	List **redistributedResults = RedistributeTaskListResults(intermediateResultIdPrefix,
+															  selectTaskList,
+															  partitionColumnIndex,
+															  targetRelation,
+															  useBinaryFormat);
+
+	List *taskList = RedistributedInsertSelectTaskList(insertSelectQuery,
+													   targetRelation,
+													   redistributedResults,
+													   useBinaryFormat);
+
+	if (taskList != NIL)
+	{
+		TupleDesc tupleDescriptor = ScanStateGetTupleDescriptor(scanState);
+		bool randomAccess = true;
+		bool interTransactions = false;
+
+		Assert(scanState->tuplestorestate == NULL);
+		scanState->tuplestorestate =
+			tuplestore_begin_heap(randomAccess, interTransactions, work_mem);
+
+		uint64 rowsInserted = ExecuteTaskListIntoTupleStore(ROW_MODIFY_COMMUTATIVE,
+															taskList,
+															tupleDescriptor,
+															scanState->tuplestorestate,
+															hasReturning);
+
+		executorState->es_processed = rowsInserted;
+
+		if (SortReturning && hasReturning)
+		{
+			SortTupleStore(scanState);
+		}
+	}
+
+	XactModificationLevel = XACT_MODIFICATION_DATA;
+}
+
+
+/*
+ * RedistributedInsertSelectTaskList generates a list of tasks that insert the
+ * redistributed fragments of each target shard into that shard. Shards that
+ * did not receive any fragments do not get a task.
+ */
+static List *
+RedistributedInsertSelectTaskList(Query *insertSelectQuery,
+								  DistTableCacheEntry *targetRelation,
+								  List **redistributedResults, bool useBinaryFormat)
+{
+	List *taskList = NIL;
+
+	/*
+	 * Make a copy of the INSERT ... SELECT. We'll repeatedly replace the
+	 * subquery of insertResultQuery for different fragments and then
+	 * deparse it.
+	 */
+	Query *insertResultQuery = copyObject(insertSelectQuery);
+	RangeTblEntry *insertRte = ExtractResultRelationRTE(insertResultQuery);
+	RangeTblEntry *selectRte = ExtractSelectRangeTableEntry(insertResultQuery);
+
+	Oid targetRelationId = targetRelation->relationId;
+	int shardCount = targetRelation->shardIntervalArrayLength;
+	uint32 taskIdIndex = 1;
+	uint64 jobId = INVALID_JOB_ID;
+
+	for (int shardOffset = 0; shardOffset < shardCount; shardOffset++)
+	{
+		ShardInterval *targetShardInterval =
+			targetRelation->sortedShardIntervalArray[shardOffset];
+		List *resultIdList = redistributedResults[shardOffset];
+		uint64 shardId = targetShardInterval->shardId;
+		List *columnAliasList = NIL;
+		StringInfo queryString = makeStringInfo();
+
+		/* no rows were routed to this shard */
+		if (resultIdList == NIL)
+		{
+			continue;
+		}
+
+		/*
+		 * Generate the query on the fragments. Unlike the COPY in the other
+		 * INSERT ... SELECT paths, the fragments hold the values with the types
+		 * of the SELECT, so we read them as such and leave the conversion to
+		 * the column types to the INSERT on the worker.
+		 */
+		Query *fragmentSetQuery =
+			BuildReadIntermediateResultsArrayQuery(insertSelectQuery->targetList,
+												   columnAliasList, resultIdList,
+												   useBinaryFormat);
+
+		/* put the fragment query in the INSERT..SELECT */
+		selectRte->subquery = fragmentSetQuery;
+
+		/* setting an alias simplifies deparsing of RETURNING */
+		if (insertRte->alias == NULL)
+		{
+			Alias *alias = makeAlias(CITUS_TABLE_ALIAS, NIL);
+			insertRte->alias = alias;
+		}
+
+		/* CTEs have already been converted to intermediate results */
+		insertResultQuery->cteList = NIL;
+		deparse_shard_query(insertResultQuery, targetRelationId, shardId, queryString);
+		ereport(DEBUG2, (errmsg("distributed statement: %s", queryString->data)));
+
+		LockShardDistributionMetadata(shardId, ShareLock);
+		List *insertShardPlacementList = FinalizedShardPlacementList(shardId);
+
+		RelationShard *relationShard = CitusMakeNode(RelationShard);
+		relationShard->relationId = targetShardInterval->relationId;
+		relationShard->shardId = targetShardInterval->shardId;
+
+		Task *modifyTask = CreateBasicTask(jobId, taskIdIndex, MODIFY_TASK,
+										   queryString->data);
+		modifyTask->dependentTaskList = NIL;
+		modifyTask->anchorShardId = shardId;
+		modifyTask->taskPlacementList = insertShardPlacementList;
+		modifyTask->relationShardList = list_make1(relationShard);
+		modifyTask->replicationModel = targetRelation->replicationModel;
+
+		taskList = lappend(taskList, modifyTask);
+
+		taskIdIndex++;
+	}
+
+	return taskList;
+}
+
+
 /* ExecutingInsertSelect returns true if we are executing an INSERT ...SELECT query */
 bool
 ExecutingInsertSelect(void)
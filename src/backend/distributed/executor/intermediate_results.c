@@ -18,14 +18,17 @@
 
 #include "catalog/pg_enum.h"
 #include "commands/copy.h"
+#include "commands/defrem.h"
 #include "distributed/commands/multi_copy.h"
 #include "distributed/connection_management.h"
 #include "distributed/intermediate_results.h"
 #include "distributed/master_metadata_utility.h"
+#include "distributed/memutils.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_client_executor.h"
 #include "distributed/multi_executor.h"
 #include "distributed/remote_commands.h"
+#include "distributed/remote_transaction.h"
 #include "distributed/transmit.h"
 #include "distributed/transaction_identifier.h"
 #include "distributed/tuplestore.h"
@@ -35,6 +38,7 @@
 #include "nodes/parsenodes.h"
 #include "nodes/primnodes.h"
 #include "storage/fd.h"
+#include "storage/latch.h"
 #include "tcop/tcopprot.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
@@ -44,6 +48,60 @@
 
 static bool CreatedResultsDirectory = false;
 
+/* number of nodes to which a node sends an intermediate result, 0 to send to all */
+int IntermediateResultRelayFanout = 0;
+
+/*
+ * Connections over which this node relays intermediate results to other
+ * nodes. They stay open until the end of the transaction, since closing
+ * them removes the results on the other nodes.
+ */
+static List *ResultRelayConnectionList = NIL;
+
+
+/*
+ * ResultRelayTarget is a node to which an intermediate result is sent, along
+ * with the nodes to which that node relays the result.
+ */
+typedef struct ResultRelayTarget
+{
+	NodeAddress *nodeAddress;
+	List *relayNodeList;
+} ResultRelayTarget;
+
+
+/* state of fetching the intermediate results of a single node */
+typedef enum NodeResultFetchState
+{
+	RESULT_FETCH_STARTING_COPY,
+	RESULT_FETCH_RECEIVING,
+	RESULT_FETCH_DONE
+} NodeResultFetchState;
+
+
+/*
+ * NodeResultFetch represents fetching a list of intermediate results from a
+ * single node into local files.
+ */
+typedef struct NodeResultFetch
+{
+	char *nodeName;
+	int nodePort;
+
+	/* results to fetch, and the one that is currently being fetched */
+	List *resultIdList;
+	ListCell *currentResultCell;
+
+	MultiConnection *connection;
+	NodeResultFetchState state;
+	int waitEventSetIndex;
+
+	/* file of the current result */
+	FileCompat fileCompat;
+
+	uint64 bytesReceived;
+} NodeResultFetch;
+
 
 /* CopyDestReceiver can be used to stream results into a distributed table */
 typedef struct RemoteFileDestReceiver
@@ -66,6 +124,9 @@ typedef struct RemoteFileDestReceiver
 	List *initialNodeList;
 	List *connectionList;
 
+	/* number of nodes to send data to, the others receive it from them */
+	int relayFanout;
+
 	/* whether to write to a local file */
 	bool writeLocalFile;
 	FileCompat fileCompat;
@@ -74,6 +135,9 @@ typedef struct RemoteFileDestReceiver
 	CopyOutState copyOutState;
 	FmgrInfo *columnOutputFunctions;
 
+	/* buffers rows when writing in the columnar format, NULL for COPY formats */
+	ColumnarResultWriter *columnarWriter;
+
 	/* number of tuples sent */
 	uint64 tuplesSent;
 } RemoteFileDestReceiver;
@@ -81,7 +145,17 @@ typedef struct RemoteFileDestReceiver
 
 static void RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 										  TupleDesc inputTupleDescriptor);
-static StringInfo ConstructCopyResultStatement(const char *resultId);
+static List * WorkerNodeAddressList(List *workerNodeList);
+static List * ResultRelayTargetList(List *nodeAddressList, int relayFanout);
+static void StartCopyResultOverConnections(const char *resultId, List *connectionList,
+										   List *relayTargetList, int relayFanout);
+static StringInfo ConstructCopyResultStatement(const char *resultId,
+											   List *relayNodeList, int relayFanout);
+static char * NodeAddressListString(List *nodeAddressList);
+static List * ParseNodeAddressListString(char *nodeAddressListString);
+static List * StartResultRelay(const char *resultId, List *relayNodeList,
+							   int relayFanout);
+static void RelayCopyData(StringInfo copyData, void *connectionList);
 static void WriteToLocalFile(StringInfo copyData, FileCompat *fileCompat);
 static bool RemoteFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest);
 static void BroadcastCopyData(StringInfo dataBuffer, List *connectionList);
@@ -95,7 +169,10 @@ static void ReadIntermediateResultsIntoFuncOutput(FunctionCallInfo fcinfo,
 												  char *copyFormat,
 												  Datum *resultIdArray,
 												  int resultCount);
-static uint64 FetchRemoteIntermediateResult(MultiConnection *connection, char *resultId);
+static int64 FetchIntermediateResultsFromNodes(List *resultFetchList);
+static void StartNodeResultFetchCopy(NodeResultFetch *resultFetch);
+static void ProcessNodeResultFetch(NodeResultFetch *resultFetch);
+static int NodeResultFetchWaitFlags(NodeResultFetch *resultFetch);
 static CopyStatus CopyDataFromConnection(MultiConnection *connection,
 										 FileCompat *fileCompat,
 										 uint64 *bytesReceived);
@@ -106,6 +183,7 @@ PG_FUNCTION_INFO_V1(read_intermediate_result_array);
 PG_FUNCTION_INFO_V1(broadcast_intermediate_result);
 PG_FUNCTION_INFO_V1(create_intermediate_result);
 PG_FUNCTION_INFO_V1(fetch_intermediate_results);
+PG_FUNCTION_INFO_V1(fetch_intermediate_results_from_nodes);
 
 
 /*
@@ -216,6 +294,7 @@ CreateRemoteFileDestReceiver(char *resultId, EState *executorState,
 	resultDest->initialNodeList = initialNodeList;
 	resultDest->memoryContext = CurrentMemoryContext;
 	resultDest->writeLocalFile = writeLocalFile;
+	resultDest->relayFanout = IntermediateResultRelayFanout;
 
 	return (DestReceiver *) resultDest;
 }
@@ -225,6 +304,10 @@ CreateRemoteFileDestReceiver(char *resultId, EState *executorState,
  * RemoteFileDestReceiverStartup implements the rStartup interface of
  * RemoteFileDestReceiver. It opens connections to the nodes in initialNodeList,
  * and sends the COPY command on all connections.
+ *
+ * When the result goes to more nodes than the relay fanout, we only connect to
+ * relayFanout of the nodes, and those relay the data to the remaining nodes
+ * (see ResultRelayTargetList).
  */
 static void
 RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
@@ -238,9 +321,9 @@ RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 	const char *nullPrintCharacter = "\\N";
 
 	List *initialNodeList = resultDest->initialNodeList;
-	ListCell *initialNodeCell = NULL;
+	int relayFanout = resultDest->relayFanout;
 	List *connectionList = NIL;
-	ListCell *connectionCell = NULL;
+	ListCell *relayTargetCell = NULL;
 
 	resultDest->tupleDescriptor = inputTupleDescriptor;
 
@@ -257,6 +340,14 @@ RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 	resultDest->columnOutputFunctions = ColumnOutputFunctions(inputTupleDescriptor,
 															  copyOutState->binary);
 
+	if (ColumnarIntermediateResults)
+	{
+		resultDest->columnarWriter =
+			CreateColumnarResultWriter(inputTupleDescriptor,
+									   resultDest->columnOutputFunctions,
+									   copyOutState->binary);
+	}
+
 	if (resultDest->writeLocalFile)
 	{
 		const int fileFlags = (O_APPEND | O_CREAT | O_RDWR | O_TRUNC | PG_BINARY);
@@ -272,11 +363,14 @@ RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 																			 fileMode));
 	}
 
-	foreach(initialNodeCell, initialNodeList)
+	List *relayTargetList =
+		ResultRelayTargetList(WorkerNodeAddressList(initialNodeList), relayFanout);
+
+	foreach(relayTargetCell, relayTargetList)
 	{
-		WorkerNode *workerNode = (WorkerNode *) lfirst(initialNodeCell);
-		char *nodeName = workerNode->workerName;
-		int nodePort = workerNode->workerPort;
+		ResultRelayTarget *relayTarget = (ResultRelayTarget *) lfirst(relayTargetCell);
+		char *nodeName = relayTarget->nodeAddress->nodeName;
+		int nodePort = relayTarget->nodeAddress->nodePort;
 
 		/*
 		 * We prefer to use a connection that is not associcated with
@@ -298,11 +392,142 @@ RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 	/* must open transaction blocks to use intermediate results */
 	RemoteTransactionsBeginIfNecessary(connectionList);
 
-	foreach(connectionCell, connectionList)
+	StartCopyResultOverConnections(resultId, connectionList, relayTargetList,
+								   relayFanout);
+
+	if (resultDest->columnarWriter != NULL || copyOutState->binary)
+	{
+		/* send headers when using the columnar format or binary encoding */
+		resetStringInfo(copyOutState->fe_msgbuf);
+
+		if (resultDest->columnarWriter != NULL)
+		{
+			AppendColumnarResultHeader(resultDest->columnarWriter,
+									   copyOutState->fe_msgbuf);
+		}
+		else
+		{
+			AppendCopyBinaryHeaders(copyOutState);
+		}
+
+		BroadcastCopyData(copyOutState->fe_msgbuf, connectionList);
+
+		if (resultDest->writeLocalFile)
+		{
+			WriteToLocalFile(copyOutState->fe_msgbuf, &resultDest->fileCompat);
+		}
+	}
+
+	resultDest->connectionList = connectionList;
+}
+
+
+/*
+ * WorkerNodeAddressList returns the addresses of the given worker nodes.
+ */
+static List *
+WorkerNodeAddressList(List *workerNodeList)
+{
+	List *nodeAddressList = NIL;
+	ListCell *workerNodeCell = NULL;
+
+	foreach(workerNodeCell, workerNodeList)
+	{
+		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+		NodeAddress *nodeAddress = (NodeAddress *) palloc0(sizeof(NodeAddress));
+
+		nodeAddress->nodeName = workerNode->workerName;
+		nodeAddress->nodePort = workerNode->workerPort;
+
+		nodeAddressList = lappend(nodeAddressList, nodeAddress);
+	}
+
+	return nodeAddressList;
+}
+
+
+/*
+ * ResultRelayTargetList returns the nodes to which an intermediate result that
+ * needs to end up on all the given nodes should be sent. If there are no more
+ * nodes than relayFanout, or relayFanout is 0, that is all of the nodes.
+ *
+ * Otherwise, the nodes are split into relayFanout groups of (almost) the same
+ * size and the result is only sent to the first node of each group, which
+ * relays the data to the other nodes of its group while writing it to its own
+ * file, splitting them in the same way. The nodes therefore form a tree in
+ * which no node sends the data more than relayFanout times, at the expense of
+ * a few hops of latency.
+ */
+static List *
+ResultRelayTargetList(List *nodeAddressList, int relayFanout)
+{
+	List *relayTargetList = NIL;
+	ListCell *nodeAddressCell = NULL;
+	int nodeCount = list_length(nodeAddressList);
+	int nodeIndex = 0;
+	ResultRelayTarget *relayTarget = NULL;
+
+	if (nodeCount == 0)
+	{
+		return NIL;
+	}
+
+	if (relayFanout <= 0 || nodeCount <= relayFanout)
+	{
+		/* send to all nodes directly */
+		relayFanout = nodeCount;
+	}
+
+	int groupSize = (nodeCount + relayFanout - 1) / relayFanout;
+
+	foreach(nodeAddressCell, nodeAddressList)
+	{
+		NodeAddress *nodeAddress = (NodeAddress *) lfirst(nodeAddressCell);
+
+		if (nodeIndex % groupSize == 0)
+		{
+			/* first node of a group, send the data to it */
+			relayTarget = (ResultRelayTarget *) palloc0(sizeof(ResultRelayTarget));
+			relayTarget->nodeAddress = nodeAddress;
+			relayTarget->relayNodeList = NIL;
+
+			relayTargetList = lappend(relayTargetList, relayTarget);
+		}
+		else
+		{
+			/* the first node of the group relays the data to this node */
+			relayTarget->relayNodeList = lappend(relayTarget->relayNodeList,
+												 nodeAddress);
+		}
+
+		nodeIndex++;
+	}
+
+	return relayTargetList;
+}
+
+
+/*
+ * StartCopyResultOverConnections sends the COPY command for the given result to
+ * each connection, along with the nodes the node at the same position in
+ * relayTargetList should relay the data to, and waits for the nodes to accept
+ * the data.
+ */
+static void
+StartCopyResultOverConnections(const char *resultId, List *connectionList,
+							   List *relayTargetList, int relayFanout)
+{
+	ListCell *connectionCell = NULL;
+	ListCell *relayTargetCell = NULL;
+
+	forboth(connectionCell, connectionList, relayTargetCell, relayTargetList)
 	{
 		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		ResultRelayTarget *relayTarget = (ResultRelayTarget *) lfirst(relayTargetCell);
 
-		StringInfo copyCommand = ConstructCopyResultStatement(resultId);
+		StringInfo copyCommand = ConstructCopyResultStatement(resultId,
+															  relayTarget->relayNodeList,
+															  relayFanout);
 
 		bool querySent = SendRemoteCommand(connection, copyCommand->data);
 		if (!querySent)
@@ -324,37 +549,92 @@ RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 
 		PQclear(result);
 	}
+}
+
+
+/*
+ * ConstructCopyResultStatement constructs the text of a COPY statement
+ * for copying into a result file. If relayNodeList is not empty, the
+ * receiving node relays the data to those nodes.
+ */
+static StringInfo
+ConstructCopyResultStatement(const char *resultId, List *relayNodeList,
+							 int relayFanout)
+{
+	StringInfo command = makeStringInfo();
+
+	appendStringInfo(command, "COPY \"%s\" FROM STDIN WITH (format result", resultId);
 
-	if (copyOutState->binary)
+	if (relayNodeList != NIL)
 	{
-		/* send headers when using binary encoding */
-		resetStringInfo(copyOutState->fe_msgbuf);
-		AppendCopyBinaryHeaders(copyOutState);
-		BroadcastCopyData(copyOutState->fe_msgbuf, connectionList);
+		appendStringInfo(command, ", relay_fanout %d, relay_nodes %s", relayFanout,
+						 quote_literal_cstr(NodeAddressListString(relayNodeList)));
+	}
 
-		if (resultDest->writeLocalFile)
+	appendStringInfoString(command, ")");
+
+	return command;
+}
+
+
+/*
+ * NodeAddressListString returns the given node addresses in the form of
+ * host:port,host:port,...
+ */
+static char *
+NodeAddressListString(List *nodeAddressList)
+{
+	StringInfo nodeAddressListString = makeStringInfo();
+	ListCell *nodeAddressCell = NULL;
+
+	foreach(nodeAddressCell, nodeAddressList)
+	{
+		NodeAddress *nodeAddress = (NodeAddress *) lfirst(nodeAddressCell);
+
+		if (nodeAddressListString->len > 0)
 		{
-			WriteToLocalFile(copyOutState->fe_msgbuf, &resultDest->fileCompat);
+			appendStringInfoChar(nodeAddressListString, ',');
 		}
+
+		appendStringInfo(nodeAddressListString, "%s:%d", nodeAddress->nodeName,
+						 nodeAddress->nodePort);
 	}
 
-	resultDest->connectionList = connectionList;
+	return nodeAddressListString->data;
 }
 
 
 /*
- * ConstructCopyResultStatement constructs the text of a COPY statement
- * for copying into a result file.
+ * ParseNodeAddressListString parses a string created by NodeAddressListString
+ * into a list of node addresses. Host names may contain colons (IPv6), so the
+ * port starts after the last colon of an address.
  */
-static StringInfo
-ConstructCopyResultStatement(const char *resultId)
+static List *
+ParseNodeAddressListString(char *nodeAddressListString)
 {
-	StringInfo command = makeStringInfo();
+	List *nodeAddressList = NIL;
+	char *savePointer = NULL;
 
-	appendStringInfo(command, "COPY \"%s\" FROM STDIN WITH (format result)",
-					 resultId);
+	char *addressString = strtok_r(nodeAddressListString, ",", &savePointer);
+	while (addressString != NULL)
+	{
+		char *portSeparator = strrchr(addressString, ':');
+		if (portSeparator == NULL || portSeparator == addressString)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("invalid relay node \"%s\"", addressString)));
+		}
 
-	return command;
+		NodeAddress *nodeAddress = (NodeAddress *) palloc0(sizeof(NodeAddress));
+		nodeAddress->nodeName = pnstrdup(addressString, portSeparator - addressString);
+		nodeAddress->nodePort = pg_atoi(portSeparator + 1, sizeof(int32), 0);
+
+		nodeAddressList = lappend(nodeAddressList, nodeAddress);
+
+		addressString = strtok_r(NULL, ",", &savePointer);
+	}
+
+	return nodeAddressList;
 }
 
 
@@ -387,17 +667,33 @@ RemoteFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 
 	resetStringInfo(copyData);
 
-	/* construct row in COPY format */
-	AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
-					  copyOutState, columnOutputFunctions, NULL);
-
-	/* send row to nodes */
-	BroadcastCopyData(copyData, connectionList);
+	if (resultDest->columnarWriter != NULL)
+	{
+		/* buffer the row, and construct a block once enough rows are buffered */
+		bool blockFull = AppendColumnarResultRow(resultDest->columnarWriter,
+												 columnValues, columnNulls);
+		if (blockFull)
+		{
+			AppendColumnarResultBlock(resultDest->columnarWriter, copyData);
+		}
+	}
+	else
+	{
+		/* construct row in COPY format */
+		AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
+						  copyOutState, columnOutputFunctions, NULL);
+	}
 
-	/* write to local file (if applicable) */
-	if (resultDest->writeLocalFile)
+	if (copyData->len > 0)
 	{
-		WriteToLocalFile(copyOutState->fe_msgbuf, &resultDest->fileCompat);
+		/* send row or block to nodes */
+		BroadcastCopyData(copyData, connectionList);
+
+		/* write to local file (if applicable) */
+		if (resultDest->writeLocalFile)
+		{
+			WriteToLocalFile(copyOutState->fe_msgbuf, &resultDest->fileCompat);
+		}
 	}
 
 	MemoryContextSwitchTo(oldContext);
@@ -440,11 +736,24 @@ RemoteFileDestReceiverShutdown(DestReceiver *destReceiver)
 	List *connectionList = resultDest->connectionList;
 	CopyOutState copyOutState = resultDest->copyOutState;
 
-	if (copyOutState->binary)
+	if (resultDest->columnarWriter != NULL || copyOutState->binary)
 	{
-		/* send footers when using binary encoding */
+		/*
+		 * Send footers when using the columnar format or binary encoding. In
+		 * the columnar format, this also sends the rows of the last block.
+		 */
 		resetStringInfo(copyOutState->fe_msgbuf);
-		AppendCopyBinaryFooters(copyOutState);
+
+		if (resultDest->columnarWriter != NULL)
+		{
+			AppendColumnarResultFooter(resultDest->columnarWriter,
+									   copyOutState->fe_msgbuf);
+		}
+		else
+		{
+			AppendCopyBinaryFooters(copyOutState);
+		}
+
 		BroadcastCopyData(copyOutState->fe_msgbuf, connectionList);
 
 		if (resultDest->writeLocalFile)
@@ -535,17 +844,135 @@ SendQueryResultViaCopy(const char *resultId)
  * The command is followed by the raw copy data stream, which is
  * redirected to a file.
  *
+ * If the relay_nodes option is given, the data is also relayed to
+ * those nodes while it is received, in the same way the coordinator
+ * broadcasts it (see ResultRelayTargetList).
+ *
  * File names are automatically prefixed with the user OID. Users
  * are only allowed to read query results from their own directory.
  */
 void
-ReceiveQueryResultViaCopy(const char *resultId)
+ReceiveQueryResultViaCopy(const char *resultId, List *copyOptionList)
 {
+	List *relayNodeList = NIL;
+	int relayFanout = 0;
+	ListCell *optionCell = NULL;
+
+	foreach(optionCell, copyOptionList)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+
+		if (strncmp(option->defname, "relay_nodes", NAMEDATALEN) == 0)
+		{
+			relayNodeList = ParseNodeAddressListString(pstrdup(defGetString(option)));
+		}
+		else if (strncmp(option->defname, "relay_fanout", NAMEDATALEN) == 0)
+		{
+			relayFanout = defGetInt32(option);
+		}
+	}
+
 	CreateIntermediateResultsDirectory();
 
 	const char *resultFileName = QueryResultFileName(resultId);
 
-	RedirectCopyDataToRegularFile(resultFileName);
+	if (relayNodeList == NIL)
+	{
+		RedirectCopyDataToRegularFile(resultFileName);
+		return;
+	}
+
+	List *connectionList = StartResultRelay(resultId, relayNodeList, relayFanout);
+
+	RedirectCopyDataToRegularFileAndForward(resultFileName, RelayCopyData,
+											connectionList);
+
+	/* close the COPY input */
+	EndRemoteCopy(0, connectionList);
+}
+
+
+/*
+ * StartResultRelay opens connections to the nodes to which this node relays
+ * an intermediate result and sends them the COPY command.
+ *
+ * The nodes write the result into the directory of the distributed transaction
+ * that this node is part of, so we begin a transaction with its identifier on
+ * each connection. The transactions are not coordinated by this node, since a
+ * worker cannot coordinate a transaction that its coordinator may prepare.
+ * Instead, the connections stay open until this node's transaction ends and are
+ * closed by CloseResultRelayConnections, which aborts the transactions on the
+ * other nodes and thereby removes their results.
+ */
+static List *
+StartResultRelay(const char *resultId, List *relayNodeList, int relayFanout)
+{
+	List *connectionList = NIL;
+	ListCell *relayTargetCell = NULL;
+
+	List *relayTargetList = ResultRelayTargetList(relayNodeList, relayFanout);
+
+	foreach(relayTargetCell, relayTargetList)
+	{
+		ResultRelayTarget *relayTarget = (ResultRelayTarget *) lfirst(relayTargetCell);
+		int flags = FORCE_NEW_CONNECTION;
+
+		MultiConnection *connection =
+			StartNodeConnection(flags, relayTarget->nodeAddress->nodeName,
+								relayTarget->nodeAddress->nodePort);
+		ClaimConnectionExclusively(connection);
+		MarkRemoteTransactionCritical(connection);
+
+		/* remember the connection right away, such that we close it on errors */
+		MemoryContext oldContext = MemoryContextSwitchTo(TopTransactionContext);
+		ResultRelayConnectionList = lappend(ResultRelayConnectionList, connection);
+		MemoryContextSwitchTo(oldContext);
+
+		connectionList = lappend(connectionList, connection);
+	}
+
+	FinishConnectionListEstablishment(connectionList);
+
+	RemoteTransactionListBegin(connectionList);
+
+	StartCopyResultOverConnections(resultId, connectionList, relayTargetList,
+								   relayFanout);
+
+	return connectionList;
+}
+
+
+/*
+ * RelayCopyData sends a chunk of copy data that this node received to the
+ * nodes it relays an intermediate result to.
+ */
+static void
+RelayCopyData(StringInfo copyData, void *connectionList)
+{
+	BroadcastCopyData(copyData, (List *) connectionList);
+}
+
+
+/*
+ * CloseResultRelayConnections closes the connections over which this node
+ * relayed intermediate results in the current transaction, which ends the
+ * transactions on the other nodes and removes the results there. It is called
+ * at the end of the transaction.
+ */
+void
+CloseResultRelayConnections(void)
+{
+	ListCell *connectionCell = NULL;
+
+	foreach(connectionCell, ResultRelayConnectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+		CloseConnection(connection);
+	}
+
+	/* the list itself lives in the transaction's memory context */
+	ResultRelayConnectionList = NIL;
 }
 
 
@@ -782,7 +1209,17 @@ ReadIntermediateResultsIntoFuncOutput(FunctionCallInfo fcinfo, char *copyFormat,
 							errmsg("result \"%s\" does not exist", resultId)));
 		}
 
-		ReadFileIntoTupleStore(resultFileName, copyFormat, tupleDescriptor, tupleStore);
+		/* results in the columnar format are detected regardless of copyFormat */
+		if (IsColumnarResultFile(resultFileName))
+		{
+			ReadColumnarResultFileIntoTupleStore(resultFileName, tupleDescriptor,
+												 tupleStore);
+		}
+		else
+		{
+			ReadFileIntoTupleStore(resultFileName, copyFormat, tupleDescriptor,
+								   tupleStore);
+		}
 	}
 
 	tuplestore_donestoring(tupleStore);
@@ -804,17 +1241,124 @@ fetch_intermediate_results(PG_FUNCTION_ARGS)
 	char *remoteHost = text_to_cstring(remoteHostText);
 	int remotePort = PG_GETARG_INT32(2);
 
-	int connectionFlags = 0;
-	int resultIndex = 0;
-	int64 totalBytesWritten = 0L;
+	CheckCitusVersion(ERROR);
+
+	if (resultCount == 0)
+	{
+		PG_RETURN_INT64(0);
+	}
+
+	NodeResultFetch *resultFetch = palloc0(sizeof(NodeResultFetch));
+	resultFetch->nodeName = remoteHost;
+	resultFetch->nodePort = remotePort;
+
+	for (int resultIndex = 0; resultIndex < resultCount; resultIndex++)
+	{
+		char *resultId = TextDatumGetCString(resultIdArray[resultIndex]);
+
+		resultFetch->resultIdList = lappend(resultFetch->resultIdList, resultId);
+	}
+
+	int64 totalBytesWritten = FetchIntermediateResultsFromNodes(list_make1(resultFetch));
+
+	PG_RETURN_INT64(totalBytesWritten);
+}
+
+
+/*
+ * fetch_intermediate_results_from_nodes fetches a set of intermediate results
+ * from a set of remote nodes and writes them to local intermediate results with
+ * the same IDs. The i-th result is fetched from the node with the i-th node name
+ * and port. The results of different nodes are fetched concurrently.
+ */
+Datum
+fetch_intermediate_results_from_nodes(PG_FUNCTION_ARGS)
+{
+	ArrayType *resultIdObject = PG_GETARG_ARRAYTYPE_P(0);
+	Datum *resultIdArray = DeconstructArrayObject(resultIdObject);
+	int32 resultCount = ArrayObjectCount(resultIdObject);
+	ArrayType *nodeNameObject = PG_GETARG_ARRAYTYPE_P(1);
+	Datum *nodeNameArray = DeconstructArrayObject(nodeNameObject);
+	int32 nodeNameCount = ArrayObjectCount(nodeNameObject);
+	ArrayType *nodePortObject = PG_GETARG_ARRAYTYPE_P(2);
+	Datum *nodePortArray = DeconstructArrayObject(nodePortObject);
+	int32 nodePortCount = ArrayObjectCount(nodePortObject);
+	List *resultFetchList = NIL;
 
 	CheckCitusVersion(ERROR);
 
+	if (nodeNameCount != resultCount || nodePortCount != resultCount)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("result ids, node names and node ports must have the "
+							   "same number of elements")));
+	}
+
 	if (resultCount == 0)
 	{
 		PG_RETURN_INT64(0);
 	}
 
+	for (int resultIndex = 0; resultIndex < resultCount; resultIndex++)
+	{
+		char *resultId = TextDatumGetCString(resultIdArray[resultIndex]);
+		char *nodeName = TextDatumGetCString(nodeNameArray[resultIndex]);
+		int nodePort = DatumGetInt32(nodePortArray[resultIndex]);
+		NodeResultFetch *resultFetch = NULL;
+		ListCell *resultFetchCell = NULL;
+
+		/* results from the same node are fetched one by one over one connection */
+		foreach(resultFetchCell, resultFetchList)
+		{
+			NodeResultFetch *existingFetch = (NodeResultFetch *) lfirst(resultFetchCell);
+
+			if (strcmp(existingFetch->nodeName, nodeName) == 0 &&
+				existingFetch->nodePort == nodePort)
+			{
+				resultFetch = existingFetch;
+				break;
+			}
+		}
+
+		if (resultFetch == NULL)
+		{
+			resultFetch = palloc0(sizeof(NodeResultFetch));
+			resultFetch->nodeName = nodeName;
+			resultFetch->nodePort = nodePort;
+
+			resultFetchList = lappend(resultFetchList, resultFetch);
+		}
+
+		resultFetch->resultIdList = lappend(resultFetch->resultIdList, resultId);
+	}
+
+	int64 totalBytesWritten = FetchIntermediateResultsFromNodes(resultFetchList);
+
+	PG_RETURN_INT64(totalBytesWritten);
+}
+
+
+/*
+ * FetchIntermediateResultsFromNodes fetches the results of the given fetches
+ * into local intermediate results and returns the number of bytes written.
+ *
+ * Each node gets a connection on which the COPY commands for its results run
+ * one after another, while the connections to different nodes are driven by
+ * a single wait event set, such that the transfers overlap.
+ *
+ * The remote transactions that are needed to read the results of the current
+ * distributed transaction are committed at the end and are not part of the
+ * coordinated transaction, since this node might be a participant of a 2PC
+ * transaction. The connections stay in the connection cache.
+ */
+static int64
+FetchIntermediateResultsFromNodes(List *resultFetchList)
+{
+	List *connectionList = NIL;
+	ListCell *resultFetchCell = NULL;
+	int64 totalBytesWritten = 0;
+	int pendingFetchCount = list_length(resultFetchList);
+
 	if (!IsMultiStatementTransaction())
 	{
 		ereport(ERROR, (errmsg("fetch_intermediate_results can only be used in a "
@@ -829,50 +1373,142 @@ fetch_intermediate_results(PG_FUNCTION_ARGS)
 	 */
 	UseCoordinatedTransaction();
 
-	MultiConnection *connection = GetNodeConnection(connectionFlags, remoteHost,
-													remotePort);
+	CreateIntermediateResultsDirectory();
 
-	if (PQstatus(connection->pgConn) != CONNECTION_OK)
+	foreach(resultFetchCell, resultFetchList)
 	{
-		ereport(ERROR, (errmsg("cannot connect to %s:%d to fetch intermediate "
-							   "results",
-							   remoteHost, remotePort)));
+		NodeResultFetch *resultFetch = (NodeResultFetch *) lfirst(resultFetchCell);
+
+		/*
+		 * We need a connection that is not in a transaction, and that we do not
+		 * use to access any data, since we commit its remote transaction early.
+		 */
+		int connectionFlags = OUTSIDE_TRANSACTION | REQUIRE_SIDECHANNEL;
+
+		MultiConnection *connection = StartNodeConnection(connectionFlags,
+														  resultFetch->nodeName,
+														  resultFetch->nodePort);
+
+		resultFetch->connection = connection;
+		connectionList = lappend(connectionList, connection);
 	}
 
-	RemoteTransactionBegin(connection);
+	FinishConnectionListEstablishment(connectionList);
 
-	for (resultIndex = 0; resultIndex < resultCount; resultIndex++)
+	foreach(resultFetchCell, resultFetchList)
 	{
-		char *resultId = TextDatumGetCString(resultIdArray[resultIndex]);
+		NodeResultFetch *resultFetch = (NodeResultFetch *) lfirst(resultFetchCell);
 
-		totalBytesWritten += FetchRemoteIntermediateResult(connection, resultId);
+		if (PQstatus(resultFetch->connection->pgConn) != CONNECTION_OK)
+		{
+			ereport(ERROR, (errmsg("cannot connect to %s:%d to fetch intermediate "
+								   "results",
+								   resultFetch->nodeName, resultFetch->nodePort)));
+		}
 	}
 
-	RemoteTransactionCommit(connection);
-	CloseConnection(connection);
+	RemoteTransactionListBegin(connectionList);
 
-	PG_RETURN_INT64(totalBytesWritten);
+	/* additional 2 is for postmaster and latch */
+	int eventSetSize = list_length(resultFetchList) + 2;
+	WaitEvent *events = palloc0(eventSetSize * sizeof(WaitEvent));
+	WaitEventSet *waitEventSet = CreateWaitEventSet(CurrentMemoryContext, eventSetSize);
+	EnsureReleaseResource((MemoryContextCallbackFunction) (&FreeWaitEventSet),
+						  waitEventSet);
+
+	foreach(resultFetchCell, resultFetchList)
+	{
+		NodeResultFetch *resultFetch = (NodeResultFetch *) lfirst(resultFetchCell);
+		int socket = PQsocket(resultFetch->connection->pgConn);
+
+		resultFetch->currentResultCell = list_head(resultFetch->resultIdList);
+		StartNodeResultFetchCopy(resultFetch);
+
+		resultFetch->waitEventSetIndex =
+			AddWaitEventToSet(waitEventSet, NodeResultFetchWaitFlags(resultFetch),
+							  socket, NULL, (void *) resultFetch);
+	}
+
+	AddWaitEventToSet(waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
+	AddWaitEventToSet(waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+
+	while (pendingFetchCount > 0)
+	{
+		long timeout = -1;
+
+		int eventCount = WaitEventSetWait(waitEventSet, timeout, events, eventSetSize,
+										  PG_WAIT_EXTENSION);
+
+		for (int eventIndex = 0; eventIndex < eventCount; eventIndex++)
+		{
+			WaitEvent *event = &events[eventIndex];
+
+			if (event->events & WL_POSTMASTER_DEATH)
+			{
+				ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+			}
+
+			if (event->events & WL_LATCH_SET)
+			{
+				ResetLatch(MyLatch);
+				CHECK_FOR_INTERRUPTS();
+				continue;
+			}
+
+			NodeResultFetch *resultFetch = (NodeResultFetch *) event->user_data;
+			if (resultFetch->state == RESULT_FETCH_DONE)
+			{
+				/* drain the socket, to not wake up again for the same input */
+				PQconsumeInput(resultFetch->connection->pgConn);
+				continue;
+			}
+
+			ProcessNodeResultFetch(resultFetch);
+
+			if (resultFetch->state == RESULT_FETCH_DONE)
+			{
+				pendingFetchCount--;
+			}
+
+			ModifyWaitEvent(waitEventSet, resultFetch->waitEventSetIndex,
+							NodeResultFetchWaitFlags(resultFetch), NULL);
+		}
+	}
+
+	RemoteTransactionListCommit(connectionList);
+
+	foreach(resultFetchCell, resultFetchList)
+	{
+		NodeResultFetch *resultFetch = (NodeResultFetch *) lfirst(resultFetchCell);
+		MultiConnection *connection = resultFetch->connection;
+
+		totalBytesWritten += resultFetch->bytesReceived;
+
+		if (connection->remoteTransaction.transactionFailed)
+		{
+			/* we do not know the state of the connection after a failed commit */
+			CloseConnection(connection);
+			continue;
+		}
+
+		/* keep the connection in the cache for subsequent fetches */
+		DetachRemoteTransaction(connection);
+	}
+
+	return totalBytesWritten;
 }
 
 
 /*
- * FetchRemoteIntermediateResult fetches a remote intermediate result over
- * the given connection.
+ * StartNodeResultFetchCopy sends the COPY command for the current result of
+ * the given fetch.
  */
-static uint64
-FetchRemoteIntermediateResult(MultiConnection *connection, char *resultId)
+static void
+StartNodeResultFetchCopy(NodeResultFetch *resultFetch)
 {
-	uint64 totalBytesWritten = 0;
-
+	MultiConnection *connection = resultFetch->connection;
+	char *resultId = (char *) lfirst(resultFetch->currentResultCell);
 	StringInfo copyCommand = makeStringInfo();
-	const int fileFlags = (O_APPEND | O_CREAT | O_RDWR | O_TRUNC | PG_BINARY);
-	const int fileMode = (S_IRUSR | S_IWUSR);
-
-	PGconn *pgConn = connection->pgConn;
-	int socket = PQsocket(pgConn);
-	bool raiseErrors = true;
-
-	CreateIntermediateResultsDirectory();
 
 	appendStringInfo(copyCommand, "COPY \"%s\" TO STDOUT WITH (format result)",
 					 resultId);
@@ -882,54 +1518,110 @@ FetchRemoteIntermediateResult(MultiConnection *connection, char *resultId)
 		ReportConnectionError(connection, ERROR);
 	}
 
-	PGresult *result = GetRemoteCommandResult(connection, raiseErrors);
-	if (PQresultStatus(result) != PGRES_COPY_OUT)
-	{
-		ReportResultError(connection, result, ERROR);
-	}
+	resultFetch->state = RESULT_FETCH_STARTING_COPY;
+}
 
-	PQclear(result);
 
-	char *localPath = QueryResultFileName(resultId);
-	File fileDesc = FileOpenForTransmit(localPath, fileFlags, fileMode);
-	FileCompat fileCompat = FileCompatFromFileStart(fileDesc);
+/*
+ * ProcessNodeResultFetch makes as much progress on the given fetch as possible
+ * without blocking. When the COPY of a result finishes, it starts the COPY of
+ * the next result of the node, and it sets the state of the fetch to
+ * RESULT_FETCH_DONE after the last one.
+ */
+static void
+ProcessNodeResultFetch(NodeResultFetch *resultFetch)
+{
+	MultiConnection *connection = resultFetch->connection;
+	PGconn *pgConn = connection->pgConn;
 
-	while (true)
+	while (resultFetch->state != RESULT_FETCH_DONE)
 	{
-		int waitFlags = WL_SOCKET_READABLE;
+		char *resultId = (char *) lfirst(resultFetch->currentResultCell);
+
+		if (PQflush(pgConn) == -1)
+		{
+			ReportConnectionError(connection, ERROR);
+		}
 
-		CopyStatus copyStatus = CopyDataFromConnection(connection, &fileCompat,
-													   &totalBytesWritten);
+		if (resultFetch->state == RESULT_FETCH_STARTING_COPY)
+		{
+			const int fileFlags = (O_APPEND | O_CREAT | O_RDWR | O_TRUNC | PG_BINARY);
+			const int fileMode = (S_IRUSR | S_IWUSR);
+
+			if (PQconsumeInput(pgConn) == 0)
+			{
+				ReportConnectionError(connection, ERROR);
+			}
+
+			if (PQisBusy(pgConn))
+			{
+				/* wait until the response to the COPY command arrives */
+				return;
+			}
+
+			PGresult *result = PQgetResult(pgConn);
+			if (PQresultStatus(result) != PGRES_COPY_OUT)
+			{
+				ReportResultError(connection, result, ERROR);
+			}
+
+			PQclear(result);
+
+			char *localPath = QueryResultFileName(resultId);
+			File fileDesc = FileOpenForTransmit(localPath, fileFlags, fileMode);
+
+			resultFetch->fileCompat = FileCompatFromFileStart(fileDesc);
+			resultFetch->state = RESULT_FETCH_RECEIVING;
+		}
+
+		CopyStatus copyStatus = CopyDataFromConnection(connection,
+													   &resultFetch->fileCompat,
+													   &resultFetch->bytesReceived);
 		if (copyStatus == CLIENT_COPY_FAILED)
 		{
 			ereport(ERROR, (errmsg("failed to read result \"%s\" from node %s:%d",
 								   resultId, connection->hostname, connection->port)));
 		}
-		else if (copyStatus == CLIENT_COPY_DONE)
+		else if (copyStatus == CLIENT_COPY_MORE)
 		{
-			break;
+			/* wait for more data */
+			return;
 		}
 
-		Assert(copyStatus == CLIENT_COPY_MORE);
+		Assert(copyStatus == CLIENT_COPY_DONE);
 
-		int rc = WaitLatchOrSocket(MyLatch, waitFlags, socket, 0, PG_WAIT_EXTENSION);
-		if (rc & WL_POSTMASTER_DEATH)
+		FileClose(resultFetch->fileCompat.fd);
+
+		resultFetch->currentResultCell = lnext(resultFetch->currentResultCell);
+		if (resultFetch->currentResultCell == NULL)
 		{
-			ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+			resultFetch->state = RESULT_FETCH_DONE;
 		}
-
-		if (rc & WL_LATCH_SET)
+		else
 		{
-			ResetLatch(MyLatch);
-			CHECK_FOR_INTERRUPTS();
+			StartNodeResultFetchCopy(resultFetch);
 		}
 	}
+}
 
-	FileClose(fileDesc);
 
-	ClearResults(connection, raiseErrors);
+/*
+ * NodeResultFetchWaitFlags returns the events to wait for on the connection
+ * of the given fetch.
+ */
+static int
+NodeResultFetchWaitFlags(NodeResultFetch *resultFetch)
+{
+	int waitFlags = WL_SOCKET_READABLE;
 
-	return totalBytesWritten;
+	if (resultFetch->state != RESULT_FETCH_DONE &&
+		PQflush(resultFetch->connection->pgConn) == 1)
+	{
+		/* the COPY command has not been sent entirely */
+		waitFlags |= WL_SOCKET_WRITEABLE;
+	}
+
+	return waitFlags;
 }
 
 
@@ -72,7 +72,11 @@
 #include "postgres.h"
 #include "miscadmin.h"
 
+#include "access/heapam.h"
+#include "catalog/namespace.h"
 #include "distributed/citus_custom_scan.h"
+#include "distributed/citus_nodefuncs.h"
+#include "distributed/deparse_shard_query.h"
 #include "distributed/local_executor.h"
 #include "distributed/multi_executor.h"
 #include "distributed/master_protocol.h"
@@ -87,7 +91,10 @@
 #else
 #include "optimizer/planner.h"
 #endif
+#include "nodes/nodeFuncs.h"
 #include "nodes/params.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
 #include "utils/snapmgr.h"
 
 
@@ -104,6 +111,9 @@ static void SplitLocalAndRemotePlacements(List *taskPlacementList,
 static uint64 ExecuteLocalTaskPlan(CitusScanState *scanState, PlannedStmt *taskPlan,
 								   char *queryString);
 static bool TaskAccessesLocalNode(Task *task);
+static Query * LocalShardQueryTree(Task *task);
+static bool ReplaceShardsWithLocalRelations(Node *node, void *context);
+static bool ShardColumnsMatchRelation(Relation shardRelation, Relation relation);
 static void LogLocalCommand(const char *command);
 
 static void ExtractParametersForLocalExecution(ParamListInfo paramListInfo,
@@ -142,9 +152,18 @@ ExecuteLocalTaskList(CitusScanState *scanState, List *taskList)
 	foreach(taskCell, taskList)
 	{
 		Task *task = (Task *) lfirst(taskCell);
+		char *shardQueryString = NULL;
 
-		const char *shardQueryString = task->queryString;
-		Query *shardQuery = ParseQueryString(shardQueryString, parameterTypes, numParams);
+		/*
+		 * Plan the query tree of the task directly if the planner kept one,
+		 * rather than deparsing it only to parse it again.
+		 */
+		Query *shardQuery = LocalShardQueryTree(task);
+		if (shardQuery == NULL)
+		{
+			shardQueryString = TaskQueryString(task);
+			shardQuery = ParseQueryString(shardQueryString, parameterTypes, numParams);
+		}
 
 		/*
 		 * We should not consider using CURSOR_OPT_FORCE_DISTRIBUTED in case of
@@ -164,16 +183,187 @@ ExecuteLocalTaskList(CitusScanState *scanState, List *taskList)
 		 */
 		PlannedStmt *localPlan = planner(shardQuery, cursorOptions, paramListInfo);
 
-		LogLocalCommand(shardQueryString);
+		if (LogRemoteCommands || LogLocalCommands)
+		{
+			LogLocalCommand(TaskQueryString(task));
+		}
+
+		/* without a query string, the task is part of the original query */
+		if (shardQueryString == NULL)
+		{
+			shardQueryString = (char *) executorState->es_sourceText;
+		}
 
 		totalRowsProcessed +=
-			ExecuteLocalTaskPlan(scanState, localPlan, task->queryString);
+			ExecuteLocalTaskPlan(scanState, localPlan, shardQueryString);
 	}
 
 	return totalRowsProcessed;
 }
 
 
+/*
+ * LocalShardQueryTree returns a copy of the query tree of the given task, in
+ * which the shards are replaced by the local shard relations, such that it can
+ * be planned directly. The function returns NULL if the task does not have a
+ * query tree or if the tree cannot be planned locally, in which case the query
+ * string of the task should be parsed instead.
+ */
+static Query *
+LocalShardQueryTree(Task *task)
+{
+	/* once the task has a query string, that is the query it executes */
+	if (task->shardQuery == NULL || task->queryString != NULL)
+	{
+		return NULL;
+	}
+
+	/* the planner scribbles on the query tree */
+	Query *shardQuery = copyObject(task->shardQuery);
+
+	if (ReplaceShardsWithLocalRelations((Node *) shardQuery, NULL))
+	{
+		return NULL;
+	}
+
+	return shardQuery;
+}
+
+
+/*
+ * ReplaceShardsWithLocalRelations walks over the query tree and turns the range
+ * table entries of shards back into relation range table entries of the local
+ * shard relations, which it locks. The walker returns true if it finds a range
+ * table entry that cannot be planned like that, such as a shard that does not
+ * exist on this node, a shard whose columns differ from the ones of its
+ * distributed table, or a pruned relation.
+ */
+static bool
+ReplaceShardsWithLocalRelations(Node *node, void *context)
+{
+	char *shardSchemaName = NULL;
+	char *shardName = NULL;
+
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, Query))
+	{
+		return query_tree_walker((Query *) node, ReplaceShardsWithLocalRelations,
+								 context, QTW_EXAMINE_RTES_BEFORE);
+	}
+
+	if (!IsA(node, RangeTblEntry))
+	{
+		return expression_tree_walker(node, ReplaceShardsWithLocalRelations, context);
+	}
+
+	RangeTblEntry *rangeTableEntry = (RangeTblEntry *) node;
+
+	/* see ConvertRteToSubqueryWithEmptyResult() */
+	if (rangeTableEntry->rtekind == RTE_SUBQUERY && OidIsValid(rangeTableEntry->relid))
+	{
+		return true;
+	}
+
+	if (GetRangeTblKind(rangeTableEntry) != CITUS_RTE_SHARD)
+	{
+		return false;
+	}
+
+	ExtractRangeTblExtraData(rangeTableEntry, NULL, &shardSchemaName, &shardName,
+							 NULL);
+
+	Oid shardSchemaId = get_rel_namespace(rangeTableEntry->relid);
+	if (shardSchemaName != NULL)
+	{
+		shardSchemaId = get_namespace_oid(shardSchemaName, false);
+	}
+
+	Oid shardRelationId = get_relname_relid(shardName, shardSchemaId);
+	if (!OidIsValid(shardRelationId))
+	{
+		return true;
+	}
+
+#if PG_VERSION_NUM >= 120000
+	LOCKMODE lockMode = rangeTableEntry->rellockmode;
+#else
+
+	/* the executor takes stronger locks for row marks itself */
+	LOCKMODE lockMode = AccessShareLock;
+#endif
+
+	Relation shardRelation = heap_open(shardRelationId, lockMode);
+	Relation relation = heap_open(rangeTableEntry->relid, NoLock);
+
+	bool columnsMatch = ShardColumnsMatchRelation(shardRelation, relation);
+	char shardRelationKind = shardRelation->rd_rel->relkind;
+
+	heap_close(relation, NoLock);
+	heap_close(shardRelation, NoLock);
+
+	if (!columnsMatch)
+	{
+		return true;
+	}
+
+	rangeTableEntry->rtekind = RTE_RELATION;
+	rangeTableEntry->relid = shardRelationId;
+	rangeTableEntry->relkind = shardRelationKind;
+	rangeTableEntry->functions = NIL;
+
+	return false;
+}
+
+
+/*
+ * ShardColumnsMatchRelation returns whether the columns of the given shard
+ * relation have the same numbers and types as the ones of the given relation,
+ * such that the column references of a query on the relation also apply to
+ * the shard.
+ */
+static bool
+ShardColumnsMatchRelation(Relation shardRelation, Relation relation)
+{
+	TupleDesc shardTupleDescriptor = RelationGetDescr(shardRelation);
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+
+	if (shardTupleDescriptor->natts != tupleDescriptor->natts)
+	{
+		return false;
+	}
+
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute shardAttributeForm = TupleDescAttr(shardTupleDescriptor,
+															 columnIndex);
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (shardAttributeForm->attisdropped != attributeForm->attisdropped)
+		{
+			return false;
+		}
+
+		if (attributeForm->attisdropped)
+		{
+			continue;
+		}
+
+		if (shardAttributeForm->atttypid != attributeForm->atttypid ||
+			shardAttributeForm->atttypmod != attributeForm->atttypmod ||
+			shardAttributeForm->attcollation != attributeForm->attcollation)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
 /*
  * ExtractParametersForLocalExecution extracts parameter types and values from
  * the given ParamListInfo structure, and fills parameter type and value arrays.
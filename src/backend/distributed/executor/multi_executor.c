@@ -64,6 +64,13 @@ bool SortReturning = false;
  */
 int ExecutorLevel = 0;
 
+/*
+ * Whether the innermost ExecutorRun call reads all the rows of the plan in one
+ * go, which is not the case for cursors. Streaming executions rely on this to
+ * give their connections back before ExecutorRun returns.
+ */
+bool ExecutorRunFetchesAllRows = false;
+
 
 /* local function forward declarations */
 static Relation StubRelation(TupleDesc tupleDescriptor);
@@ -122,10 +129,12 @@ CitusExecutorRun(QueryDesc *queryDesc,
 				 ScanDirection direction, uint64 count, bool execute_once)
 {
 	DestReceiver *dest = queryDesc->dest;
+	bool savedExecutorRunFetchesAllRows = ExecutorRunFetchesAllRows;
 
 	PG_TRY();
 	{
 		ExecutorLevel++;
+		ExecutorRunFetchesAllRows = (count == 0 && execute_once);
 
 		if (CitusHasBeenLoaded())
 		{
@@ -178,10 +187,12 @@ CitusExecutorRun(QueryDesc *queryDesc,
 		}
 
 		ExecutorLevel--;
+		ExecutorRunFetchesAllRows = savedExecutorRunFetchesAllRows;
 	}
 	PG_CATCH();
 	{
 		ExecutorLevel--;
+		ExecutorRunFetchesAllRows = savedExecutorRunFetchesAllRows;
 
 		PG_RE_THROW();
 	}
@@ -36,8 +36,6 @@ bool BinaryMasterCopyFormat = false; /* copy data from workers in binary format
 bool EnableRepartitionJoins = false;
 
 
-static bool HasReplicatedDistributedTable(List *relationOids);
-
 /*
  * JobExecutorType selects the executor type for the given distributedPlan using the task
  * executor type config value. The function then checks if the given distributedPlan needs
@@ -140,7 +138,7 @@ JobExecutorType(DistributedPlan *distributedPlan)
  * - not a reference table
  * - has replication factor > 1
  */
-static bool
+bool
 HasReplicatedDistributedTable(List *relationOids)
 {
 	ListCell *oidCell = NULL;
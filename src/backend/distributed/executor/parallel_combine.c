@@ -0,0 +1,426 @@
+/*-------------------------------------------------------------------------
+ *
+ * parallel_combine.c
+ *
+ * For multi-shard GROUP BY queries, the coordinator combines the partial
+ * aggregates of all groups that the workers return. With many groups, that
+ * takes long in a single backend. When citus.max_parallel_combine_workers is
+ * set, the planner puts a Gather node on top of the master aggregate and the
+ * custom scan becomes parallel aware.
+ *
+ * The coordinator backend still executes the distributed query, when the
+ * Gather node sets up the parallel workers. It then splits the rows by the
+ * hash of the group by columns into one shared tuple store per participant.
+ * Each participant, including the coordinator backend, claims partitions
+ * until none is left and feeds their rows into its copy of the aggregate.
+ * Since the groups of different partitions are disjoint, the Gather node
+ * only needs to collect the combined groups.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "distributed/citus_custom_scan.h"
+#include "distributed/multi_executor.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/parallel_combine.h"
+#include "optimizer/tlist.h"
+#include "port/atomics.h"
+#include "storage/dsm.h"
+#include "storage/sharedfileset.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/sharedtuplestore.h"
+#if PG_VERSION_NUM >= 120000
+#include "optimizer/optimizer.h"
+#endif
+
+
+/*
+ * ParallelCombineShared is the state of a parallel combine in the dynamic
+ * shared memory of the Gather node. It is followed by the shared tuple store
+ * of each partition.
+ */
+typedef struct ParallelCombineShared
+{
+	/* next partition that a participant can claim */
+	pg_atomic_uint32 nextPartitionIndex;
+
+	/* number of partitions, 0 if the coordinator did not split the rows */
+	int partitionCount;
+
+	/* segment that the shared file set belongs to */
+	dsm_handle segmentHandle;
+
+	/* files of the shared tuple stores */
+	SharedFileSet fileSet;
+} ParallelCombineShared;
+
+
+/*
+ * ParallelCombineState is the state of a parallel combine in one participant.
+ */
+typedef struct ParallelCombineState
+{
+	ParallelCombineShared *shared;
+
+	/* accessors of the partitions, created when first claimed in workers */
+	SharedTuplestoreAccessor **partitions;
+
+	/* partition whose rows the participant is reading, if any */
+	SharedTuplestoreAccessor *currentPartition;
+} ParallelCombineState;
+
+
+static SharedTuplestore * PartitionTupleStore(ParallelCombineShared *shared,
+											  int partitionIndex);
+static void PartitionTaskResults(CitusScanState *scanState,
+								 ParallelCombineState *combineState);
+static SharedTuplestoreAccessor * ClaimNextPartition(ParallelCombineState *combineState);
+
+
+/*
+ * EstimateParallelCombine returns the size of the shared state of a parallel
+ * combine with a partition for each worker of the given parallel context and
+ * one for the coordinator backend.
+ */
+Size
+EstimateParallelCombine(CitusScanState *scanState, ParallelContext *pcxt)
+{
+	int partitionCount = pcxt->nworkers + 1;
+
+	return add_size(MAXALIGN(sizeof(ParallelCombineShared)),
+					mul_size(partitionCount, MAXALIGN(sts_estimate(1))));
+}
+
+
+/*
+ * PartitionTupleStore returns the shared tuple store of the given partition.
+ */
+static SharedTuplestore *
+PartitionTupleStore(ParallelCombineShared *shared, int partitionIndex)
+{
+	char *partitionArea = (char *) shared + MAXALIGN(sizeof(ParallelCombineShared));
+
+	return (SharedTuplestore *) (partitionArea +
+								 partitionIndex * MAXALIGN(sts_estimate(1)));
+}
+
+
+/*
+ * InitializeParallelCombine is called by the Gather node in the coordinator
+ * backend before it launches the workers. It executes the distributed query
+ * and splits the rows into the partitions that the participants combine.
+ */
+void
+InitializeParallelCombine(CitusScanState *scanState, ParallelContext *pcxt,
+						  void *coordinate)
+{
+	ParallelCombineShared *shared = (ParallelCombineShared *) coordinate;
+
+	pg_atomic_init_u32(&shared->nextPartitionIndex, 0);
+	shared->partitionCount = 0;
+
+	if (!scanState->finishedRemoteScan)
+	{
+		AdaptiveExecutor(scanState);
+
+		scanState->finishedRemoteScan = true;
+	}
+
+	/*
+	 * Without a dynamic shared memory segment there are no workers, and the
+	 * aggregate in this backend reads the rows from the tuple store as usual.
+	 */
+	if (pcxt->seg == NULL)
+	{
+		return;
+	}
+
+	int partitionCount = pcxt->nworkers + 1;
+
+	shared->partitionCount = partitionCount;
+	shared->segmentHandle = dsm_segment_handle(pcxt->seg);
+	SharedFileSetInit(&shared->fileSet, pcxt->seg);
+
+	ParallelCombineState *combineState = palloc0(sizeof(ParallelCombineState));
+	combineState->shared = shared;
+	combineState->partitions =
+		palloc0(partitionCount * sizeof(SharedTuplestoreAccessor *));
+
+	for (int partitionIndex = 0; partitionIndex < partitionCount; partitionIndex++)
+	{
+		char partitionName[NAMEDATALEN];
+
+		snprintf(partitionName, NAMEDATALEN, "citus_combine.%d", partitionIndex);
+
+		combineState->partitions[partitionIndex] =
+			sts_initialize(PartitionTupleStore(shared, partitionIndex), 1, 0, 0, 0,
+						   &shared->fileSet, partitionName);
+	}
+
+	PartitionTaskResults(scanState, combineState);
+
+	for (int partitionIndex = 0; partitionIndex < partitionCount; partitionIndex++)
+	{
+		sts_end_write(combineState->partitions[partitionIndex]);
+	}
+
+	/* all rows are in the partitions now */
+	tuplestore_end(scanState->tuplestorestate);
+	scanState->tuplestorestate = NULL;
+
+	scanState->parallelCombineState = combineState;
+}
+
+
+/*
+ * PartitionTaskResults moves the rows from the tuple store of the scan into
+ * the partitions, based on the hash of their group by columns. We use the
+ * hash functions of the equality operators of the group by clauses, which
+ * are the ones the aggregate uses to find the groups.
+ */
+static void
+PartitionTaskResults(CitusScanState *scanState, ParallelCombineState *combineState)
+{
+	Query *masterQuery = scanState->distributedPlan->masterQuery;
+	List *groupClauseList = masterQuery->groupClause;
+	int groupColumnCount = list_length(groupClauseList);
+	uint64 partitionCount = combineState->shared->partitionCount;
+	ListCell *groupClauseCell = NULL;
+	int groupColumnIndex = 0;
+
+	AttrNumber *groupColumnNumbers = palloc0(groupColumnCount * sizeof(AttrNumber));
+	Oid *groupCollations = palloc0(groupColumnCount * sizeof(Oid));
+	FmgrInfo *hashFunctions = palloc0(groupColumnCount * sizeof(FmgrInfo));
+
+	foreach(groupClauseCell, groupClauseList)
+	{
+		SortGroupClause *groupClause = (SortGroupClause *) lfirst(groupClauseCell);
+		TargetEntry *groupTargetEntry =
+			get_sortgroupclause_tle(groupClause, masterQuery->targetList);
+		Var *groupColumn = (Var *) groupTargetEntry->expr;
+		Oid leftHashFunctionId = InvalidOid;
+		Oid rightHashFunctionId = InvalidOid;
+
+		if (!get_op_hash_functions(groupClause->eqop, &leftHashFunctionId,
+								   &rightHashFunctionId))
+		{
+			ereport(ERROR, (errmsg("could not find hash function for hash operator %u",
+								   groupClause->eqop)));
+		}
+
+		fmgr_info(leftHashFunctionId, &hashFunctions[groupColumnIndex]);
+		groupColumnNumbers[groupColumnIndex] = groupColumn->varattno;
+		groupCollations[groupColumnIndex] = groupColumn->varcollid;
+
+		groupColumnIndex++;
+	}
+
+	MemoryContext hashContext = AllocSetContextCreate(CurrentMemoryContext,
+													  "Parallel Combine Hash Context",
+													  ALLOCSET_DEFAULT_SIZES);
+
+	while (true)
+	{
+		TupleTableSlot *slot = ReturnTupleFromTuplestore(scanState);
+		uint32 hashKey = 0;
+
+		if (TupIsNull(slot))
+		{
+			break;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+
+		MemoryContext oldContext = MemoryContextSwitchTo(hashContext);
+
+		/* combine the hashes the same way as TupleHashTableHash */
+		for (groupColumnIndex = 0; groupColumnIndex < groupColumnCount;
+			 groupColumnIndex++)
+		{
+			bool isNull = false;
+			Datum value = slot_getattr(slot, groupColumnNumbers[groupColumnIndex],
+									   &isNull);
+
+			hashKey = (hashKey << 1) | ((hashKey & 0x80000000) ? 1 : 0);
+
+			if (!isNull)
+			{
+				Datum columnHash = FunctionCall1Coll(&hashFunctions[groupColumnIndex],
+													 groupCollations[groupColumnIndex],
+													 value);
+				hashKey ^= DatumGetUInt32(columnHash);
+			}
+		}
+
+		MemoryContextSwitchTo(oldContext);
+		MemoryContextReset(hashContext);
+
+		/*
+		 * We pick the partition by the high bits of the hash, such that the
+		 * hash tables of the aggregates still see all values of the low bits.
+		 */
+		int partitionIndex = (int) (((uint64) hashKey * partitionCount) >> 32);
+
+#if PG_VERSION_NUM >= 120000
+		bool shouldFree = false;
+		MinimalTuple tuple = ExecFetchSlotMinimalTuple(slot, &shouldFree);
+#else
+		MinimalTuple tuple = ExecFetchSlotMinimalTuple(slot);
+#endif
+
+		sts_puttuple(combineState->partitions[partitionIndex], NULL, tuple);
+
+#if PG_VERSION_NUM >= 120000
+		if (shouldFree)
+		{
+			pfree(tuple);
+		}
+#endif
+	}
+
+	MemoryContextDelete(hashContext);
+}
+
+
+/*
+ * ReinitializeParallelCombine is called by the Gather node in the coordinator
+ * backend when it is rescanned, to let the participants read the partitions
+ * once more.
+ */
+void
+ReinitializeParallelCombine(CitusScanState *scanState, void *coordinate)
+{
+	ParallelCombineState *combineState = scanState->parallelCombineState;
+
+	if (combineState == NULL)
+	{
+		return;
+	}
+
+	ParallelCombineShared *shared = combineState->shared;
+
+	ShutdownParallelCombine(scanState);
+
+	for (int partitionIndex = 0; partitionIndex < shared->partitionCount;
+		 partitionIndex++)
+	{
+		sts_reinitialize(combineState->partitions[partitionIndex]);
+	}
+
+	pg_atomic_write_u32(&shared->nextPartitionIndex, 0);
+}
+
+
+/*
+ * AttachParallelCombine is called in the parallel workers, to read the rows
+ * from the partitions instead of executing the distributed query.
+ */
+void
+AttachParallelCombine(CitusScanState *scanState, void *coordinate)
+{
+	ParallelCombineShared *shared = (ParallelCombineShared *) coordinate;
+
+	ParallelCombineState *combineState = palloc0(sizeof(ParallelCombineState));
+	combineState->shared = shared;
+
+	if (shared->partitionCount > 0)
+	{
+		dsm_segment *segment = dsm_find_mapping(shared->segmentHandle);
+
+		SharedFileSetAttach(&shared->fileSet, segment);
+
+		combineState->partitions =
+			palloc0(shared->partitionCount * sizeof(SharedTuplestoreAccessor *));
+	}
+
+	/* the coordinator backend already executed the distributed query */
+	scanState->finishedRemoteScan = true;
+	scanState->parallelCombineState = combineState;
+}
+
+
+/*
+ * ReturnTupleFromParallelCombine returns the next row of the partitions that
+ * this participant claimed, or NULL if no partitions are left.
+ */
+TupleTableSlot *
+ReturnTupleFromParallelCombine(CitusScanState *scanState)
+{
+	ParallelCombineState *combineState = scanState->parallelCombineState;
+	TupleTableSlot *resultSlot = scanState->customScanState.ss.ps.ps_ResultTupleSlot;
+
+	while (true)
+	{
+		if (combineState->currentPartition == NULL)
+		{
+			combineState->currentPartition = ClaimNextPartition(combineState);
+
+			if (combineState->currentPartition == NULL)
+			{
+				return ExecClearTuple(resultSlot);
+			}
+
+			sts_begin_parallel_scan(combineState->currentPartition);
+		}
+
+		MinimalTuple tuple = sts_parallel_scan_next(combineState->currentPartition,
+													NULL);
+		if (tuple != NULL)
+		{
+			return ExecStoreMinimalTuple(tuple, resultSlot, false);
+		}
+
+		sts_end_parallel_scan(combineState->currentPartition);
+		combineState->currentPartition = NULL;
+	}
+}
+
+
+/*
+ * ClaimNextPartition returns the accessor of the next partition that no
+ * other participant claimed yet, or NULL if there is none.
+ */
+static SharedTuplestoreAccessor *
+ClaimNextPartition(ParallelCombineState *combineState)
+{
+	ParallelCombineShared *shared = combineState->shared;
+
+	uint32 partitionIndex = pg_atomic_fetch_add_u32(&shared->nextPartitionIndex, 1);
+	if (partitionIndex >= (uint32) shared->partitionCount)
+	{
+		return NULL;
+	}
+
+	if (combineState->partitions[partitionIndex] == NULL)
+	{
+		combineState->partitions[partitionIndex] =
+			sts_attach(PartitionTupleStore(shared, partitionIndex), 0,
+					   &shared->fileSet);
+	}
+
+	return combineState->partitions[partitionIndex];
+}
+
+
+/*
+ * ShutdownParallelCombine closes the partition that the participant is
+ * reading, before the Gather node releases the shared memory and files.
+ */
+void
+ShutdownParallelCombine(CitusScanState *scanState)
+{
+	ParallelCombineState *combineState = scanState->parallelCombineState;
+
+	if (combineState == NULL || combineState->currentPartition == NULL)
+	{
+		return;
+	}
+
+	sts_end_parallel_scan(combineState->currentPartition);
+	combineState->currentPartition = NULL;
+}
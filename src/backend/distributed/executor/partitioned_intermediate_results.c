@@ -49,6 +49,9 @@ typedef struct PartitionedResultDestReceiver
 	/* use binary copy or just text copy format? */
 	bool binaryCopy;
 
+	/* write the files in the columnar format? */
+	bool columnarFormat;
+
 	/* used for deciding which partition a shard belongs to. */
 	DistTableCacheEntry *shardSearchInfo;
 
@@ -83,6 +86,8 @@ static PartitionedResultDestReceiver * CreatePartitionedResultDestReceiver(char
 																		   TupleDesc
 																		   tupleDescriptor,
 																		   bool binaryCopy,
+																		   bool
+																		   columnarFormat,
 																		   DistTableCacheEntry
 																		   *
 																		   shardSearchInfo,
@@ -134,6 +139,7 @@ worker_partition_query_result(PG_FUNCTION_ARGS)
 	int32 maxValuesCount = ArrayObjectCount(maxValuesArray);
 
 	bool binaryCopy = PG_GETARG_BOOL(6);
+	bool columnarFormat = PG_GETARG_BOOL(7);
 
 	CheckCitusVersion(ERROR);
 
@@ -204,7 +210,8 @@ worker_partition_query_result(PG_FUNCTION_ARGS)
 	PartitionedResultDestReceiver *dest =
 		CreatePartitionedResultDestReceiver(resultIdPrefixString, partitionColumnIndex,
 											partitionCount, tupleDescriptor, binaryCopy,
-											shardSearchInfo, tupleContext);
+											columnarFormat, shardSearchInfo,
+											tupleContext);
 
 	/* execute the query */
 	PortalRun(portal, FETCH_ALL, false, true, (DestReceiver *) dest,
@@ -364,7 +371,8 @@ QueryTupleShardSearchInfo(ArrayType *minValuesArray, ArrayType *maxValuesArray,
 static PartitionedResultDestReceiver *
 CreatePartitionedResultDestReceiver(char *resultIdPrefix, int partitionColumnIndex,
 									int partitionCount, TupleDesc tupleDescriptor,
-									bool binaryCopy, DistTableCacheEntry *shardSearchInfo,
+									bool binaryCopy, bool columnarFormat,
+									DistTableCacheEntry *shardSearchInfo,
 									MemoryContext perTupleContext)
 {
 	PartitionedResultDestReceiver *resultDest =
@@ -385,6 +393,7 @@ CreatePartitionedResultDestReceiver(char *resultIdPrefix, int partitionColumnInd
 	resultDest->shardSearchInfo = shardSearchInfo;
 	resultDest->tupleDescriptor = tupleDescriptor;
 	resultDest->binaryCopy = binaryCopy;
+	resultDest->columnarFormat = columnarFormat;
 	resultDest->partitionDestReceivers =
 		(DestReceiver **) palloc0(partitionCount * sizeof(DestReceiver *));
 
@@ -460,7 +469,8 @@ PartitionedResultDestReceiverReceive(TupleTableSlot *slot, DestReceiver *copyDes
 		char *filePath = QueryResultFileName(resultId->data);
 
 		partitionDest = CreateFileDestReceiver(filePath, partitionedDest->perTupleContext,
-											   partitionedDest->binaryCopy);
+											   partitionedDest->binaryCopy,
+											   partitionedDest->columnarFormat);
 		partitionedDest->partitionDestReceivers[partitionIndex] = partitionDest;
 		partitionDest->rStartup(partitionDest, 0, partitionedDest->tupleDescriptor);
 	}
@@ -0,0 +1,279 @@
+/*-------------------------------------------------------------------------
+ *
+ * sorted_merge.c
+ *
+ * When the workers already sort the results of the tasks of a distributed
+ * query by the ORDER BY of the query, the coordinator does not need to sort
+ * all of the rows again. Instead, the adaptive executor writes the results of
+ * each task into a separate tuple store and the custom scan merges them, by
+ * always returning the smallest of the current rows of the tasks.
+ *
+ * The merge is lazy, so a LIMIT on top of the custom scan only compares as
+ * many rows as it needs, and the rows are returned without waiting for a
+ * sort of the whole result.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "distributed/citus_custom_scan.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/sorted_merge.h"
+#include "distributed/version_compat.h"
+#include "executor/tuptable.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/tlist.h"
+#if PG_VERSION_NUM >= 120000
+#include "optimizer/optimizer.h"
+#endif
+
+
+/* a tuple store should not use less memory than this, in kilobytes */
+#define MIN_TASK_TUPLE_STORE_MEMORY 64
+
+
+static void BuildSortKeys(SortedMergeState *mergeState, Query *masterQuery);
+static void InitializeSortedMerge(SortedMergeState *mergeState);
+static bool FetchNextTaskRow(SortedMergeState *mergeState, int taskIndex);
+static int CompareTaskRows(Datum leftTaskIndex, Datum rightTaskIndex, void *arg);
+
+
+/*
+ * CreateSortedMergeState creates the tuple stores that the given number of
+ * tasks write their results into, and prepares for merging them in the order
+ * of the master query of the scan.
+ */
+SortedMergeState *
+CreateSortedMergeState(CitusScanState *scanState, int taskCount)
+{
+	DistributedPlan *distributedPlan = scanState->distributedPlan;
+	TupleDesc tupleDescriptor = ScanStateGetTupleDescriptor(scanState);
+	bool randomAccess = false;
+	bool interTransactions = false;
+
+	/* the task results together should fit into work_mem as usual */
+	int taskTupleStoreMemory = Max(work_mem / Max(taskCount, 1),
+								   MIN_TASK_TUPLE_STORE_MEMORY);
+
+	SortedMergeState *mergeState = palloc0(sizeof(SortedMergeState));
+	mergeState->taskCount = taskCount;
+	mergeState->tupleStores = palloc0(taskCount * sizeof(Tuplestorestate *));
+	mergeState->taskSlots = palloc0(taskCount * sizeof(TupleTableSlot *));
+	mergeState->lastTaskIndex = -1;
+
+	for (int taskIndex = 0; taskIndex < taskCount; taskIndex++)
+	{
+		mergeState->tupleStores[taskIndex] =
+			tuplestore_begin_heap(randomAccess, interTransactions, taskTupleStoreMemory);
+		mergeState->taskSlots[taskIndex] =
+			MakeSingleTupleTableSlotCompat(tupleDescriptor, &TTSOpsMinimalTuple);
+	}
+
+	BuildSortKeys(mergeState, distributedPlan->masterQuery);
+
+	mergeState->taskHeap = binaryheap_allocate(Max(taskCount, 1), CompareTaskRows,
+											   mergeState);
+
+	return mergeState;
+}
+
+
+/*
+ * BuildSortKeys prepares the sort support for the sort clauses of the master
+ * query. The planner only merges the task results when the sort clauses refer
+ * to plain columns of the scan, so the result number of the target entry is
+ * also the column number in the rows of the tasks.
+ */
+static void
+BuildSortKeys(SortedMergeState *mergeState, Query *masterQuery)
+{
+	List *sortClauseList = masterQuery->sortClause;
+	ListCell *sortClauseCell = NULL;
+	int sortKeyIndex = 0;
+
+	mergeState->sortKeyCount = list_length(sortClauseList);
+	mergeState->sortKeys = palloc0(mergeState->sortKeyCount * sizeof(SortSupportData));
+
+	foreach(sortClauseCell, sortClauseList)
+	{
+		SortGroupClause *sortClause = (SortGroupClause *) lfirst(sortClauseCell);
+		TargetEntry *targetEntry = get_sortgroupclause_tle(sortClause,
+														   masterQuery->targetList);
+		SortSupport sortKey = &mergeState->sortKeys[sortKeyIndex];
+
+		sortKey->ssup_cxt = CurrentMemoryContext;
+		sortKey->ssup_collation = exprCollation((Node *) targetEntry->expr);
+		sortKey->ssup_nulls_first = sortClause->nulls_first;
+		sortKey->ssup_attno = targetEntry->resno;
+
+		PrepareSortSupportFromOrderingOp(sortClause->sortop, sortKey);
+
+		sortKeyIndex++;
+	}
+}
+
+
+/*
+ * ReturnTupleFromSortedMerge returns the next row of the merged task results
+ * in the result slot of the scan, or NULL if all rows are returned.
+ */
+TupleTableSlot *
+ReturnTupleFromSortedMerge(CitusScanState *scanState)
+{
+	SortedMergeState *mergeState = scanState->sortedMergeState;
+	TupleTableSlot *resultSlot = scanState->customScanState.ss.ps.ps_ResultTupleSlot;
+
+	if (!mergeState->initialized)
+	{
+		InitializeSortedMerge(mergeState);
+	}
+	else if (mergeState->lastTaskIndex >= 0)
+	{
+		/* the task that had the smallest row moves on to its next row */
+		if (FetchNextTaskRow(mergeState, mergeState->lastTaskIndex))
+		{
+			binaryheap_replace_first(mergeState->taskHeap,
+									 Int32GetDatum(mergeState->lastTaskIndex));
+		}
+		else
+		{
+			binaryheap_remove_first(mergeState->taskHeap);
+		}
+
+		mergeState->lastTaskIndex = -1;
+	}
+
+	if (binaryheap_empty(mergeState->taskHeap))
+	{
+		return ExecClearTuple(resultSlot);
+	}
+
+	int taskIndex = DatumGetInt32(binaryheap_first(mergeState->taskHeap));
+	mergeState->lastTaskIndex = taskIndex;
+
+	return ExecCopySlot(resultSlot, mergeState->taskSlots[taskIndex]);
+}
+
+
+/*
+ * InitializeSortedMerge reads the first row of each task and puts the tasks
+ * that returned any rows into the heap.
+ */
+static void
+InitializeSortedMerge(SortedMergeState *mergeState)
+{
+	for (int taskIndex = 0; taskIndex < mergeState->taskCount; taskIndex++)
+	{
+		if (FetchNextTaskRow(mergeState, taskIndex))
+		{
+			binaryheap_add_unordered(mergeState->taskHeap, Int32GetDatum(taskIndex));
+		}
+	}
+
+	binaryheap_build(mergeState->taskHeap);
+
+	mergeState->initialized = true;
+}
+
+
+/*
+ * FetchNextTaskRow reads the next row of the given task into its slot and
+ * returns whether there was one.
+ */
+static bool
+FetchNextTaskRow(SortedMergeState *mergeState, int taskIndex)
+{
+	Tuplestorestate *tupleStore = mergeState->tupleStores[taskIndex];
+	TupleTableSlot *taskSlot = mergeState->taskSlots[taskIndex];
+	bool forwardScanDirection = true;
+	bool copyTuple = false;
+
+	return tuplestore_gettupleslot(tupleStore, forwardScanDirection, copyTuple,
+								   taskSlot);
+}
+
+
+/*
+ * CompareTaskRows compares the current rows of the given tasks. The binary
+ * heap keeps the largest element on top, hence we invert the result to get
+ * the smallest row first.
+ */
+static int
+CompareTaskRows(Datum leftTaskIndex, Datum rightTaskIndex, void *arg)
+{
+	SortedMergeState *mergeState = (SortedMergeState *) arg;
+	TupleTableSlot *leftSlot = mergeState->taskSlots[DatumGetInt32(leftTaskIndex)];
+	TupleTableSlot *rightSlot = mergeState->taskSlots[DatumGetInt32(rightTaskIndex)];
+
+	for (int sortKeyIndex = 0; sortKeyIndex < mergeState->sortKeyCount; sortKeyIndex++)
+	{
+		SortSupport sortKey = &mergeState->sortKeys[sortKeyIndex];
+		AttrNumber columnNumber = sortKey->ssup_attno;
+		bool leftIsNull = false;
+		bool rightIsNull = false;
+
+		Datum leftValue = slot_getattr(leftSlot, columnNumber, &leftIsNull);
+		Datum rightValue = slot_getattr(rightSlot, columnNumber, &rightIsNull);
+
+		int compare = ApplySortComparator(leftValue, leftIsNull, rightValue,
+										  rightIsNull, sortKey);
+		if (compare != 0)
+		{
+			return (compare > 0) ? -1 : 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * MergeSortedTaskResults merges all task results into the tuple store of the
+ * scan at once and drops the merge state. We use it when the scan needs to
+ * move backwards or rewind, which the merge does not support.
+ */
+void
+MergeSortedTaskResults(CitusScanState *scanState)
+{
+	Tuplestorestate *tupleStore = scanState->tuplestorestate;
+
+	while (true)
+	{
+		TupleTableSlot *slot = ReturnTupleFromSortedMerge(scanState);
+
+		if (TupIsNull(slot))
+		{
+			break;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+
+		tuplestore_puttupleslot(tupleStore, slot);
+	}
+
+	EndSortedMerge(scanState);
+}
+
+
+/*
+ * EndSortedMerge releases the tuple stores and slots of the merge of the
+ * given scan.
+ */
+void
+EndSortedMerge(CitusScanState *scanState)
+{
+	SortedMergeState *mergeState = scanState->sortedMergeState;
+
+	for (int taskIndex = 0; taskIndex < mergeState->taskCount; taskIndex++)
+	{
+		ExecDropSingleTupleTableSlot(mergeState->taskSlots[taskIndex]);
+		tuplestore_end(mergeState->tupleStores[taskIndex]);
+	}
+
+	binaryheap_free(mergeState->taskHeap);
+
+	scanState->sortedMergeState = NULL;
+}
@@ -10,8 +10,11 @@
 
 #include "postgres.h"
 
+#include "distributed/adaptive_executor.h"
+#include "distributed/citus_custom_scan.h"
 #include "distributed/intermediate_result_pruning.h"
 #include "distributed/intermediate_results.h"
+#include "distributed/local_executor.h"
 #include "distributed/multi_executor.h"
 #include "distributed/multi_physical_planner.h"
 #include "distributed/recursive_planning.h"
@@ -22,19 +25,36 @@
 
 
 int MaxIntermediateResult = 1048576; /* maximum size in KB the intermediate result can grow to */
+int MaxConcurrentSubPlans = 1; /* maximum number of subplans executed at once */
 /* when this is true, we enforce intermediate result size limit in all executors */
 int SubPlanLevel = 0;
 
 
+static void ExecuteSubPlan(DistributedSubPlan *subPlan, uint64 planId,
+						   HTAB *intermediateResultsHash);
+static bool CanExecuteSubPlanConcurrently(DistributedSubPlan *subPlan);
+static void ExecuteConcurrentSubPlans(List *subPlanList, uint64 planId,
+									  HTAB *intermediateResultsHash);
+static List * SubPlanExecutionWaves(List *subPlanList, uint64 planId);
+static void ExecuteSubPlanBatch(List *subPlanList, uint64 planId,
+								HTAB *intermediateResultsHash);
+static DestReceiver * CreateSubPlanDestReceiver(char *resultId, EState *estate,
+												HTAB *intermediateResultsHash);
+
+
 /*
  * ExecuteSubPlans executes a list of subplans from a distributed plan
- * by sequentially executing each plan from the top.
+ * by executing each plan from the top. Subplans that can be executed
+ * concurrently (see CanExecuteSubPlanConcurrently) are collected and
+ * executed together, ordered by their dependencies on each other, before
+ * the next subplan that cannot.
  */
 void
 ExecuteSubPlans(DistributedPlan *distributedPlan)
 {
 	uint64 planId = distributedPlan->planId;
 	List *subPlanList = distributedPlan->subPlanList;
+	List *concurrentSubPlanList = NIL;
 	ListCell *subPlanCell = NULL;
 
 	if (subPlanList == NIL)
@@ -58,47 +78,286 @@ ExecuteSubPlans(DistributedPlan *distributedPlan)
 	foreach(subPlanCell, subPlanList)
 	{
 		DistributedSubPlan *subPlan = (DistributedSubPlan *) lfirst(subPlanCell);
-		PlannedStmt *plannedStmt = subPlan->plan;
-		uint32 subPlanId = subPlan->subPlanId;
-		ParamListInfo params = NULL;
-		bool writeLocalFile = false;
-		char *resultId = GenerateResultId(planId, subPlanId);
-		List *workerNodeList =
-			FindAllWorkerNodesUsingSubplan(intermediateResultsHash, resultId);
-
-		/*
-		 * Write intermediate results to local file only if there is no worker
-		 * node that receives them.
-		 *
-		 * This could happen in two cases:
-		 * (a) Subquery in the having
-		 * (b) The intermediate result is not used, such as RETURNING of a
-		 *     modifying CTE is not used
-		 *
-		 * For SELECT, Postgres/Citus is clever enough to not execute the CTE
-		 * if it is not used at all, but for modifications we have to execute
-		 * the queries.
-		 */
-		if (workerNodeList == NIL)
+
+		if (MaxConcurrentSubPlans > 1 && CanExecuteSubPlanConcurrently(subPlan))
+		{
+			concurrentSubPlanList = lappend(concurrentSubPlanList, subPlan);
+			continue;
+		}
+
+		/* the other subplans keep their place in the order of execution */
+		ExecuteConcurrentSubPlans(concurrentSubPlanList, planId,
+								  intermediateResultsHash);
+		concurrentSubPlanList = NIL;
+
+		ExecuteSubPlan(subPlan, planId, intermediateResultsHash);
+	}
+
+	ExecuteConcurrentSubPlans(concurrentSubPlanList, planId, intermediateResultsHash);
+}
+
+
+/*
+ * ExecuteSubPlan executes a single subplan and writes its result into an
+ * intermediate result on the nodes that use it.
+ */
+static void
+ExecuteSubPlan(DistributedSubPlan *subPlan, uint64 planId,
+			   HTAB *intermediateResultsHash)
+{
+	PlannedStmt *plannedStmt = subPlan->plan;
+	ParamListInfo params = NULL;
+	char *resultId = GenerateResultId(planId, subPlan->subPlanId);
+
+	SubPlanLevel++;
+	EState *estate = CreateExecutorState();
+	DestReceiver *copyDest = CreateSubPlanDestReceiver(resultId, estate,
+													   intermediateResultsHash);
+
+	ExecutePlanIntoDestReceiver(plannedStmt, params, copyDest);
+
+	SubPlanLevel--;
+	FreeExecutorState(estate);
+}
+
+
+/*
+ * CanExecuteSubPlanConcurrently returns whether the given subplan can share a
+ * distributed execution with other subplans. That is the case for read-only
+ * plans whose rows do not need any processing on the coordinator, such that
+ * they can be written into the intermediate result as they arrive.
+ */
+static bool
+CanExecuteSubPlanConcurrently(DistributedSubPlan *subPlan)
+{
+	Plan *planTree = subPlan->plan->planTree;
+
+	if (!IsTaskResultPassthroughPlan(planTree))
+	{
+		return false;
+	}
+
+	DistributedPlan *distributedPlan = GetDistributedPlan((CustomScan *) planTree);
+	Job *workerJob = distributedPlan->workerJob;
+
+	if (distributedPlan->subPlanList != NIL)
+	{
+		return false;
+	}
+
+	/* preserve the order of the rows in the intermediate result */
+	if (distributedPlan->sortedMerge)
+	{
+		return false;
+	}
+
+	/* a shared execution only runs tasks remotely */
+	if (ShouldExecuteTasksLocally(workerJob->taskList))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * ExecuteConcurrentSubPlans executes the given subplans, which can all be
+ * executed concurrently, in waves. Each subplan runs in a later wave than
+ * the subplans whose results it reads, and each wave runs in batches of at
+ * most citus.max_concurrent_subplans subplans.
+ */
+static void
+ExecuteConcurrentSubPlans(List *subPlanList, uint64 planId,
+						  HTAB *intermediateResultsHash)
+{
+	List *waveList = SubPlanExecutionWaves(subPlanList, planId);
+	ListCell *waveCell = NULL;
+
+	foreach(waveCell, waveList)
+	{
+		List *waveSubPlanList = (List *) lfirst(waveCell);
+		List *batchSubPlanList = NIL;
+		ListCell *subPlanCell = NULL;
+
+		foreach(subPlanCell, waveSubPlanList)
 		{
-			writeLocalFile = true;
+			DistributedSubPlan *subPlan = (DistributedSubPlan *) lfirst(subPlanCell);
+
+			batchSubPlanList = lappend(batchSubPlanList, subPlan);
 
-			if ((LogIntermediateResults && IsLoggableLevel(DEBUG1)) ||
-				IsLoggableLevel(DEBUG4))
+			if (list_length(batchSubPlanList) == MaxConcurrentSubPlans)
 			{
-				elog(DEBUG1, "Subplan %s will be written to local file", resultId);
+				ExecuteSubPlanBatch(batchSubPlanList, planId, intermediateResultsHash);
+				batchSubPlanList = NIL;
 			}
 		}
 
-		SubPlanLevel++;
-		EState *estate = CreateExecutorState();
-		DestReceiver *copyDest = CreateRemoteFileDestReceiver(resultId, estate,
-															  workerNodeList,
-															  writeLocalFile);
+		if (batchSubPlanList != NIL)
+		{
+			ExecuteSubPlanBatch(batchSubPlanList, planId, intermediateResultsHash);
+		}
+	}
+}
 
-		ExecutePlanIntoDestReceiver(plannedStmt, params, copyDest);
 
-		SubPlanLevel--;
-		FreeExecutorState(estate);
+/*
+ * SubPlanExecutionWaves builds the dependency graph between the given
+ * subplans, which are in the order in which the planner created them, and
+ * returns a list of waves. Each wave is a list of subplans that only read
+ * the results of subplans in earlier waves, hence the subplans of a wave
+ * can be executed concurrently.
+ */
+static List *
+SubPlanExecutionWaves(List *subPlanList, uint64 planId)
+{
+	int subPlanCount = list_length(subPlanList);
+	int *waveIndexArray = palloc0(subPlanCount * sizeof(int));
+	Value **resultIdArray = palloc0(subPlanCount * sizeof(Value *));
+	List *waveList = NIL;
+	ListCell *subPlanCell = NULL;
+	int subPlanIndex = 0;
+
+	foreach(subPlanCell, subPlanList)
+	{
+		DistributedSubPlan *subPlan = (DistributedSubPlan *) lfirst(subPlanCell);
+		CustomScan *customScan = (CustomScan *) subPlan->plan->planTree;
+		DistributedPlan *distributedPlan = GetDistributedPlan(customScan);
+		Query *jobQuery = distributedPlan->workerJob->jobQuery;
+		List *usedSubPlanList = FindSubPlansUsedInNode((Node *) jobQuery);
+		int waveIndex = 0;
+
+		resultIdArray[subPlanIndex] =
+			makeString(GenerateResultId(planId, subPlan->subPlanId));
+
+		/* a subplan runs after the earlier subplans whose results it reads */
+		for (int earlierIndex = 0; earlierIndex < subPlanIndex; earlierIndex++)
+		{
+			if (waveIndexArray[earlierIndex] >= waveIndex &&
+				list_member(usedSubPlanList, resultIdArray[earlierIndex]))
+			{
+				waveIndex = waveIndexArray[earlierIndex] + 1;
+			}
+		}
+
+		waveIndexArray[subPlanIndex] = waveIndex;
+
+		if (waveIndex == list_length(waveList))
+		{
+			waveList = lappend(waveList, NIL);
+		}
+
+		ListCell *waveCell = list_nth_cell(waveList, waveIndex);
+		lfirst(waveCell) = lappend((List *) lfirst(waveCell), subPlan);
+
+		subPlanIndex++;
+	}
+
+	return waveList;
+}
+
+
+/*
+ * ExecuteSubPlanBatch executes the given subplans in a single distributed
+ * execution, which writes the rows of each subplan into its intermediate
+ * result as they arrive.
+ */
+static void
+ExecuteSubPlanBatch(List *subPlanList, uint64 planId, HTAB *intermediateResultsHash)
+{
+	List *distributedPlanList = NIL;
+	List *tupleDescriptorList = NIL;
+	List *destReceiverList = NIL;
+	ListCell *subPlanCell = NULL;
+	ListCell *destReceiverCell = NULL;
+
+	if (list_length(subPlanList) == 1)
+	{
+		/* nothing to run concurrently with */
+		ExecuteSubPlan((DistributedSubPlan *) linitial(subPlanList), planId,
+					   intermediateResultsHash);
+		return;
 	}
+
+	SubPlanLevel++;
+	EState *estate = CreateExecutorState();
+
+	foreach(subPlanCell, subPlanList)
+	{
+		DistributedSubPlan *subPlan = (DistributedSubPlan *) lfirst(subPlanCell);
+		PlannedStmt *plannedStmt = subPlan->plan;
+		Plan *planTree = plannedStmt->planTree;
+		char *resultId = GenerateResultId(planId, subPlan->subPlanId);
+
+		/* we do not go through ExecutorStart, so check permissions here */
+		ExecCheckRTPerms(plannedStmt->rtable, true);
+
+#if PG_VERSION_NUM >= 120000
+		TupleDesc tupleDescriptor = ExecCleanTypeFromTL(planTree->targetlist);
+#else
+		TupleDesc tupleDescriptor = ExecCleanTypeFromTL(planTree->targetlist, false);
+#endif
+
+		DestReceiver *copyDest = CreateSubPlanDestReceiver(resultId, estate,
+														   intermediateResultsHash);
+		copyDest->rStartup(copyDest, CMD_SELECT, tupleDescriptor);
+
+		distributedPlanList = lappend(distributedPlanList,
+									  GetDistributedPlan((CustomScan *) planTree));
+		tupleDescriptorList = lappend(tupleDescriptorList, tupleDescriptor);
+		destReceiverList = lappend(destReceiverList, copyDest);
+	}
+
+	ExecuteDistributedPlansIntoDestReceivers(distributedPlanList, tupleDescriptorList,
+											 destReceiverList);
+
+	foreach(destReceiverCell, destReceiverList)
+	{
+		DestReceiver *copyDest = (DestReceiver *) lfirst(destReceiverCell);
+
+		copyDest->rShutdown(copyDest);
+	}
+
+	SubPlanLevel--;
+	FreeExecutorState(estate);
+}
+
+
+/*
+ * CreateSubPlanDestReceiver creates the DestReceiver that writes the result
+ * of a subplan to the worker nodes that use it.
+ */
+static DestReceiver *
+CreateSubPlanDestReceiver(char *resultId, EState *estate, HTAB *intermediateResultsHash)
+{
+	bool writeLocalFile = false;
+	List *workerNodeList =
+		FindAllWorkerNodesUsingSubplan(intermediateResultsHash, resultId);
+
+	/*
+	 * Write intermediate results to local file only if there is no worker
+	 * node that receives them.
+	 *
+	 * This could happen in two cases:
+	 * (a) Subquery in the having
+	 * (b) The intermediate result is not used, such as RETURNING of a
+	 *     modifying CTE is not used
+	 *
+	 * For SELECT, Postgres/Citus is clever enough to not execute the CTE
+	 * if it is not used at all, but for modifications we have to execute
+	 * the queries.
+	 */
+	if (workerNodeList == NIL)
+	{
+		writeLocalFile = true;
+
+		if ((LogIntermediateResults && IsLoggableLevel(DEBUG1)) ||
+			IsLoggableLevel(DEBUG4))
+		{
+			elog(DEBUG1, "Subplan %s will be written to local file", resultId);
+		}
+	}
+
+	return CreateRemoteFileDestReceiver(resultId, estate, workerNodeList,
+										writeLocalFile);
 }
@@ -32,6 +32,7 @@
 #include "distributed/colocation_utils.h"
 #include "distributed/connection_management.h"
 #include "distributed/citus_ruleutils.h"
+#include "distributed/distributed_plan_cache.h"
 #include "distributed/function_utils.h"
 #include "distributed/foreign_key_relationship.h"
 #include "distributed/master_metadata_utility.h"
@@ -44,7 +45,9 @@
 #include "distributed/pg_dist_partition.h"
 #include "distributed/pg_dist_shard.h"
 #include "distributed/pg_dist_placement.h"
+#include "distributed/prepared_statement_cache.h"
 #include "distributed/shared_library_init.h"
+#include "distributed/shared_metadata_cache.h"
 #include "distributed/shardinterval_utils.h"
 #include "distributed/version_compat.h"
 #include "distributed/worker_manager.h"
@@ -218,9 +221,11 @@ static List * LookupDistShardTuples(Oid relationId);
 static void GetPartitionTypeInputInfo(char *partitionKeyString, char partitionMethod,
 									  Oid *columnTypeId, int32 *columnTypeMod,
 									  Oid *intervalTypeId, int32 *intervalTypeMod);
-static ShardInterval * TupleToShardInterval(HeapTuple heapTuple,
-											TupleDesc tupleDescriptor, Oid intervalTypeId,
-											int32 intervalTypeMod);
+static List * LoadShardMetadataRows(Oid relationId);
+static ShardInterval * ShardMetadataRowToShardInterval(Oid relationId,
+													   ShardMetadataRow *shardRow,
+													   Oid intervalTypeId,
+													   int32 intervalTypeMod);
 static void CachedNamespaceLookup(const char *nspname, Oid *cachedOid);
 static void CachedRelationLookup(const char *relationName, Oid *cachedOid);
 static void CachedRelationNamespaceLookup(const char *relationName, Oid relnamespace,
@@ -1100,6 +1105,7 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 {
 	ShardInterval **shardIntervalArray = NULL;
 	ShardInterval **sortedShardIntervalArray = NULL;
+	ShardMetadataRow **shardRowArray = NULL;
 	FmgrInfo *shardIntervalCompareFunction = NULL;
 	FmgrInfo *shardColumnCompareFunction = NULL;
 	Oid columnTypeId = InvalidOid;
@@ -1114,13 +1120,11 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 							  &intervalTypeId,
 							  &intervalTypeMod);
 
-	List *distShardTupleList = LookupDistShardTuples(cacheEntry->relationId);
-	int shardIntervalArrayLength = list_length(distShardTupleList);
+	List *shardRowList = LoadShardMetadataRows(cacheEntry->relationId);
+	int shardIntervalArrayLength = list_length(shardRowList);
 	if (shardIntervalArrayLength > 0)
 	{
-		Relation distShardRelation = heap_open(DistShardRelationId(), AccessShareLock);
-		TupleDesc distShardTupleDesc = RelationGetDescr(distShardRelation);
-		ListCell *distShardTupleCell = NULL;
+		ListCell *shardRowCell = NULL;
 		int arrayIndex = 0;
 
 		shardIntervalArray = MemoryContextAllocZero(MetadataCacheMemoryContext,
@@ -1136,13 +1140,14 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 								   shardIntervalArrayLength *
 								   sizeof(int));
 
-		foreach(distShardTupleCell, distShardTupleList)
+		shardRowArray = palloc0(shardIntervalArrayLength * sizeof(ShardMetadataRow *));
+
+		foreach(shardRowCell, shardRowList)
 		{
-			HeapTuple shardTuple = lfirst(distShardTupleCell);
-			ShardInterval *shardInterval = TupleToShardInterval(shardTuple,
-																distShardTupleDesc,
-																intervalTypeId,
-																intervalTypeMod);
+			ShardMetadataRow *shardRow = (ShardMetadataRow *) lfirst(shardRowCell);
+			ShardInterval *shardInterval =
+				ShardMetadataRowToShardInterval(cacheEntry->relationId, shardRow,
+												intervalTypeId, intervalTypeMod);
 			MemoryContext oldContext = MemoryContextSwitchTo(MetadataCacheMemoryContext);
 
 			ShardInterval *newShardInterval = (ShardInterval *) palloc0(
@@ -1152,13 +1157,16 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 
 			MemoryContextSwitchTo(oldContext);
 
-			heap_freetuple(shardTuple);
+			/*
+			 * Sorting reorders the shard intervals, temporarily use the shard
+			 * index to find the row of the shard afterwards.
+			 */
+			newShardInterval->shardIndex = arrayIndex;
+			shardRowArray[arrayIndex] = shardRow;
 
 			arrayIndex++;
 		}
 
-		heap_close(distShardRelation, AccessShareLock);
-
 		ShardInterval *firstShardInterval = shardIntervalArray[0];
 		bool foundInCache = false;
 		ShardCacheEntry *shardEntry = hash_search(DistShardCacheHash,
@@ -1273,6 +1281,7 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 	for (int shardIndex = 0; shardIndex < shardIntervalArrayLength; shardIndex++)
 	{
 		ShardInterval *shardInterval = sortedShardIntervalArray[shardIndex];
+		ShardMetadataRow *shardRow = shardRowArray[shardInterval->shardIndex];
 		bool foundInCache = false;
 		ListCell *placementCell = NULL;
 		int placementOffset = 0;
@@ -1298,8 +1307,7 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 		shardEntry->shardIndex = shardIndex;
 		shardEntry->tableEntry = cacheEntry;
 
-		/* build list of shard placements */
-		List *placementList = BuildShardPlacementList(shardInterval);
+		List *placementList = shardRow->placementList;
 		int numberOfPlacements = list_length(placementList);
 
 		/* and copy that list into the cache entry */
@@ -3359,6 +3367,8 @@ InvalidateDistRelationCacheCallback(Datum argument, Oid relationId)
 	{
 		InvalidateDistTableCache();
 		InvalidateDistObjectCache();
+		InvalidatePreparedStatementCaches();
+		InvalidateDistributedPlanCache();
 	}
 	else
 	{
@@ -3371,6 +3381,10 @@ InvalidateDistRelationCacheCallback(Datum argument, Oid relationId)
 		if (foundInCache)
 		{
 			cacheEntry->isValid = false;
+
+			/* statements prepared on workers may refer to the changed table */
+			InvalidatePreparedStatementCaches();
+			InvalidateDistributedPlanCache();
 		}
 
 		/*
@@ -3547,6 +3561,9 @@ InvalidateNodeRelationCacheCallback(Datum argument, Oid relationId)
 	if (relationId == InvalidOid || relationId == MetadataCache.distNodeRelationId)
 	{
 		workerNodeHashValid = false;
+
+		/* cached plans contain the placements of the shards on the nodes */
+		InvalidateDistributedPlanCache();
 	}
 }
 
@@ -3598,6 +3615,77 @@ LookupDistPartitionTuple(Relation pgDistPartition, Oid relationId)
 }
 
 
+/*
+ * LoadShardMetadataRows returns the pg_dist_shard rows of the given relation,
+ * each together with the pg_dist_placement rows of the shard. The rows are
+ * copied from the shared metadata cache if possible. Otherwise they are read
+ * from the catalogs and stored in the shared metadata cache, such that other
+ * backends do not need to read them as well.
+ */
+static List *
+LoadShardMetadataRows(Oid relationId)
+{
+	List *shardRowList = NIL;
+	SharedMetadataVersion metadataVersion;
+
+	if (LookupSharedShardMetadata(relationId, &shardRowList, &metadataVersion))
+	{
+		return shardRowList;
+	}
+
+	List *distShardTupleList = LookupDistShardTuples(relationId);
+	if (distShardTupleList != NIL)
+	{
+		Relation distShardRelation = heap_open(DistShardRelationId(), AccessShareLock);
+		TupleDesc distShardTupleDesc = RelationGetDescr(distShardRelation);
+		ListCell *distShardTupleCell = NULL;
+
+		foreach(distShardTupleCell, distShardTupleList)
+		{
+			HeapTuple shardTuple = lfirst(distShardTupleCell);
+			Datum datumArray[Natts_pg_dist_shard];
+			bool isNullArray[Natts_pg_dist_shard];
+
+			/*
+			 * We use heap_deform_tuple() instead of heap_getattr() to expand tuple
+			 * to contain missing values when ALTER TABLE ADD COLUMN happens.
+			 */
+			heap_deform_tuple(shardTuple, distShardTupleDesc, datumArray, isNullArray);
+
+			ShardMetadataRow *shardRow = palloc0(sizeof(ShardMetadataRow));
+			shardRow->shardId =
+				DatumGetInt64(datumArray[Anum_pg_dist_shard_shardid - 1]);
+			shardRow->storageType =
+				DatumGetChar(datumArray[Anum_pg_dist_shard_shardstorage - 1]);
+
+			if (!isNullArray[Anum_pg_dist_shard_shardminvalue - 1])
+			{
+				shardRow->minValue =
+					TextDatumGetCString(datumArray[Anum_pg_dist_shard_shardminvalue - 1]);
+			}
+
+			if (!isNullArray[Anum_pg_dist_shard_shardmaxvalue - 1])
+			{
+				shardRow->maxValue =
+					TextDatumGetCString(datumArray[Anum_pg_dist_shard_shardmaxvalue - 1]);
+			}
+
+			shardRow->placementList = BuildShardPlacementList(shardRow->shardId);
+
+			shardRowList = lappend(shardRowList, shardRow);
+
+			heap_freetuple(shardTuple);
+		}
+
+		heap_close(distShardRelation, AccessShareLock);
+	}
+
+	StoreSharedShardMetadata(relationId, shardRowList, metadataVersion);
+
+	return shardRowList;
+}
+
+
 /*
  * LookupDistShardTuples returns a list of all dist_shard tuples for the
  * specified relation.
@@ -3779,22 +3867,43 @@ GetIntervalTypeInfo(char partitionMethod, Var *partitionColumn,
 
 
 /*
- * TupleToShardInterval transforms the specified dist_shard tuple into a new
- * ShardInterval using the provided descriptor and partition type information.
+ * ShardMetadataRowToShardInterval transforms the specified pg_dist_shard row
+ * into a new ShardInterval using the provided partition type information.
  */
 static ShardInterval *
-TupleToShardInterval(HeapTuple heapTuple, TupleDesc tupleDescriptor, Oid
-					 intervalTypeId,
-					 int32 intervalTypeMod)
+ShardMetadataRowToShardInterval(Oid relationId, ShardMetadataRow *shardRow,
+								Oid intervalTypeId, int32 intervalTypeMod)
 {
 	Datum datumArray[Natts_pg_dist_shard];
 	bool isNullArray[Natts_pg_dist_shard];
 
-	/*
-	 * We use heap_deform_tuple() instead of heap_getattr() to expand tuple
-	 * to contain missing values when ALTER TABLE ADD COLUMN happens.
-	 */
-	heap_deform_tuple(heapTuple, tupleDescriptor, datumArray, isNullArray);
+	memset(datumArray, 0, sizeof(datumArray));
+	memset(isNullArray, false, sizeof(isNullArray));
+
+	datumArray[Anum_pg_dist_shard_logicalrelid - 1] = ObjectIdGetDatum(relationId);
+	datumArray[Anum_pg_dist_shard_shardid - 1] = Int64GetDatum(shardRow->shardId);
+	datumArray[Anum_pg_dist_shard_shardstorage - 1] =
+		CharGetDatum(shardRow->storageType);
+
+	if (shardRow->minValue != NULL)
+	{
+		datumArray[Anum_pg_dist_shard_shardminvalue - 1] =
+			CStringGetTextDatum(shardRow->minValue);
+	}
+	else
+	{
+		isNullArray[Anum_pg_dist_shard_shardminvalue - 1] = true;
+	}
+
+	if (shardRow->maxValue != NULL)
+	{
+		datumArray[Anum_pg_dist_shard_shardmaxvalue - 1] =
+			CStringGetTextDatum(shardRow->maxValue);
+	}
+	else
+	{
+		isNullArray[Anum_pg_dist_shard_shardmaxvalue - 1] = true;
+	}
 
 	ShardInterval *shardInterval =
 		DeformedDistShardTupleToShardInterval(datumArray, isNullArray,
@@ -3940,6 +4049,9 @@ CitusInvalidateRelcacheByRelid(Oid relationId)
 {
 	HeapTuple classTuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relationId));
 
+	/* other backends may have the old metadata in the shared metadata cache */
+	RecordSharedMetadataChange(relationId);
+
 	if (HeapTupleIsValid(classTuple))
 	{
 		CacheInvalidateRelcacheByTuple(classTuple);
@@ -0,0 +1,1080 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_metadata_cache.c
+ *   Keeps the pg_dist_shard and pg_dist_placement rows of distributed tables
+ *   in a dynamic shared memory area, such that a backend that (re)builds its
+ *   DistTableCacheEntry for a table can copy the rows from there instead of
+ *   scanning the catalogs once for the table and once for every shard.
+ *
+ *   Without this, every backend rebuilds its cache entries from the catalogs
+ *   after the metadata of a table changed, e.g. once a shard was moved. With
+ *   many backends and tables that have many shards that causes a burst of
+ *   catalog scans, only one backend per table now needs to do them.
+ *
+ *   Each relation has a version that a backend increments as soon as its
+ *   transaction changes the metadata of the relation. The rows of a relation
+ *   are stored together with the version that was read before the catalogs
+ *   were scanned, and are only handed out while the version did not change
+ *   since. While a transaction that changed metadata is in progress, rows are
+ *   neither handed out nor stored, since its changes become visible to other
+ *   backends at an unknown point during its commit.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "access/twophase.h"
+#include "access/xact.h"
+#include "distributed/citus_nodes.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/shared_metadata_cache.h"
+#include "distributed/tuplestore.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/dsa.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+
+
+#define SHARED_METADATA_CACHE_STATS_COLUMNS 5
+
+/* maximum number of relations for which we keep a version and rows */
+#define MAX_SHARED_METADATA_RELATIONS 8192
+
+
+/*
+ * SharedMetadataCacheControlData contains the lock that protects the hash of
+ * relations and the dynamic shared memory area in which the rows are stored,
+ * as well as the counters for citus_shared_metadata_cache_stats.
+ */
+typedef struct SharedMetadataCacheControlData
+{
+	int trancheId;
+	char *lockTrancheName;
+	LWLock lock;
+
+	/* tranche of the locks of the dynamic shared memory area */
+	int areaTrancheId;
+	char *areaTrancheName;
+
+	/* the area is created by the first backend that stores rows */
+	bool areaCreated;
+	dsa_handle areaHandle;
+
+	/* incremented when the rows of all relations may have become stale */
+	uint64 globalVersion;
+
+	/* number of relations with rows, and the memory they use */
+	int64 cachedRelationCount;
+	int64 memoryUsed;
+
+	/*
+	 * Number of transactions that changed the metadata and did not end yet.
+	 * Until they did, the cache is not used.
+	 */
+	int changingTransactionCount;
+
+	/*
+	 * Number of prepared transactions that changed the metadata, their global
+	 * transaction ids follow the control data. Until they are committed or
+	 * rolled back, the cache is not used.
+	 */
+	int inDoubtCount;
+
+	pg_atomic_uint64 hitCount;
+	pg_atomic_uint64 rebuildCount;
+	pg_atomic_uint64 invalidationCount;
+} SharedMetadataCacheControlData;
+
+
+/* relations are identified by their database and oid */
+typedef struct SharedMetadataCacheKey
+{
+	Oid databaseId;
+	Oid relationId;
+} SharedMetadataCacheKey;
+
+
+/* version of the metadata of a relation and the rows stored for it, if any */
+typedef struct SharedMetadataCacheEntry
+{
+	SharedMetadataCacheKey key;
+	uint64 relationVersion;
+
+	/* serialized rows and the version they were read at */
+	dsa_pointer rows;
+	Size rowsSize;
+	SharedMetadataVersion rowsVersion;
+} SharedMetadataCacheEntry;
+
+
+/*
+ * The serialized rows of a relation consist of this header, followed by the
+ * shard rows, the placement rows and the min/max values of the shards.
+ */
+typedef struct SerializedShardMetadata
+{
+	int32 shardCount;
+	int32 placementCount;
+	Size shardRowOffset;
+	Size placementRowOffset;
+	Size stringOffset;
+} SerializedShardMetadata;
+
+
+/* shard row, the offsets of the min/max values are -1 if they are NULL */
+typedef struct SerializedShardRow
+{
+	uint64 shardId;
+	int32 minValueOffset;
+	int32 maxValueOffset;
+	int32 placementCount;
+	char storageType;
+} SerializedShardRow;
+
+
+/* placement row, placements follow each other in the order of their shards */
+typedef struct SerializedPlacementRow
+{
+	uint64 placementId;
+	uint64 shardLength;
+	uint32 shardState;
+	int32 groupId;
+} SerializedPlacementRow;
+
+
+/*
+ * Size of the dynamic shared memory area in megabytes, 0 disables the shared
+ * metadata cache.
+ */
+int SharedMetadataCacheSize = 0;
+
+
+static SharedMetadataCacheControlData *MetadataCacheSharedState = NULL;
+static HTAB *SharedMetadataCacheHash = NULL;
+static char (*InDoubtGids)[GIDSIZE] = NULL;
+static dsa_area *SharedMetadataArea = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* relations whose metadata the current transaction changed */
+static List *PendingMetadataChanges = NIL;
+
+/* global transaction id of PREPARE TRANSACTION and COMMIT/ROLLBACK PREPARED */
+static char PreparingGid[GIDSIZE] = "";
+static char FinishingGid[GIDSIZE] = "";
+
+
+static bool SharedMetadataCacheEnabled(void);
+static void AttachSharedMetadataArea(void);
+static void BumpRelationVersion(Oid relationId);
+static void BumpGlobalVersion(void);
+static void FreeEntryRows(SharedMetadataCacheEntry *cacheEntry);
+static void FreeAllEntryRows(void);
+static bool RemoveInDoubtGid(const char *gid);
+static char * SerializeShardMetadata(List *shardRowList, Size *serializedSize);
+static int32 SerializeString(char *stringArea, int32 *stringAreaUsed, char *string);
+static List * DeserializeShardMetadata(char *serializedRows);
+static size_t SharedMetadataCacheShmemSize(void);
+static void SharedMetadataCacheShmemInit(void);
+
+
+PG_FUNCTION_INFO_V1(citus_shared_metadata_cache_stats);
+
+
+/*
+ * citus_shared_metadata_cache_stats returns the number of relations whose
+ * rows are in the shared metadata cache, the memory they use, and how often
+ * backends could use the cache or had to read the catalogs.
+ */
+Datum
+citus_shared_metadata_cache_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+	Datum values[SHARED_METADATA_CACHE_STATS_COLUMNS];
+	bool isNulls[SHARED_METADATA_CACHE_STATS_COLUMNS];
+
+	CheckCitusVersion(ERROR);
+	Tuplestorestate *tupleStore = SetupTuplestore(fcinfo, &tupleDescriptor);
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	if (SharedMetadataCacheEnabled())
+	{
+		LWLockAcquire(&MetadataCacheSharedState->lock, LW_SHARED);
+
+		values[0] = Int64GetDatum(MetadataCacheSharedState->cachedRelationCount);
+		values[1] = Int64GetDatum(MetadataCacheSharedState->memoryUsed);
+
+		LWLockRelease(&MetadataCacheSharedState->lock);
+
+		values[2] = Int64GetDatum((int64) pg_atomic_read_u64(
+									  &MetadataCacheSharedState->hitCount));
+		values[3] = Int64GetDatum((int64) pg_atomic_read_u64(
+									  &MetadataCacheSharedState->rebuildCount));
+		values[4] = Int64GetDatum((int64) pg_atomic_read_u64(
+									  &MetadataCacheSharedState->invalidationCount));
+	}
+	else
+	{
+		for (int columnIndex = 0; columnIndex < SHARED_METADATA_CACHE_STATS_COLUMNS;
+			 columnIndex++)
+		{
+			values[columnIndex] = Int64GetDatum(0);
+		}
+	}
+
+	tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * LookupSharedShardMetadata copies the shard and placement rows of the given
+ * relation from the shared metadata cache into shardRowList and returns true,
+ * if they are in the cache and up to date.
+ *
+ * Otherwise, it returns false and sets metadataVersion to the version that
+ * rows which the caller reads from the catalogs afterwards should be passed
+ * to StoreSharedShardMetadata with.
+ */
+bool
+LookupSharedShardMetadata(Oid relationId, List **shardRowList,
+						  SharedMetadataVersion *metadataVersion)
+{
+	SharedMetadataCacheKey cacheKey;
+	bool entryFound = false;
+	char *serializedRows = NULL;
+
+	memset(metadataVersion, 0, sizeof(SharedMetadataVersion));
+
+	/* the current transaction might see uncommitted changes, so keep out */
+	if (!SharedMetadataCacheEnabled() || PendingMetadataChanges != NIL)
+	{
+		return false;
+	}
+
+	AttachSharedMetadataArea();
+
+	memset(&cacheKey, 0, sizeof(cacheKey));
+	cacheKey.databaseId = MyDatabaseId;
+	cacheKey.relationId = relationId;
+
+	LWLockAcquire(&MetadataCacheSharedState->lock, LW_SHARED);
+
+	if (MetadataCacheSharedState->inDoubtCount > 0 ||
+		MetadataCacheSharedState->changingTransactionCount > 0)
+	{
+		LWLockRelease(&MetadataCacheSharedState->lock);
+
+		return false;
+	}
+
+	SharedMetadataCacheEntry *cacheEntry =
+		hash_search(SharedMetadataCacheHash, &cacheKey, HASH_FIND, &entryFound);
+
+	metadataVersion->globalVersion = MetadataCacheSharedState->globalVersion;
+	metadataVersion->relationVersion = entryFound ? cacheEntry->relationVersion : 0;
+
+	if (entryFound && DsaPointerIsValid(cacheEntry->rows) &&
+		cacheEntry->rowsVersion.globalVersion == metadataVersion->globalVersion &&
+		cacheEntry->rowsVersion.relationVersion == metadataVersion->relationVersion)
+	{
+		/* copy the rows, such that we can deserialize them without the lock */
+		serializedRows = palloc(cacheEntry->rowsSize);
+		memcpy(serializedRows, dsa_get_address(SharedMetadataArea, cacheEntry->rows),
+			   cacheEntry->rowsSize);
+	}
+
+	LWLockRelease(&MetadataCacheSharedState->lock);
+
+	if (serializedRows != NULL)
+	{
+		*shardRowList = DeserializeShardMetadata(serializedRows);
+		pfree(serializedRows);
+
+		pg_atomic_fetch_add_u64(&MetadataCacheSharedState->hitCount, 1);
+
+		return true;
+	}
+
+	pg_atomic_fetch_add_u64(&MetadataCacheSharedState->rebuildCount, 1);
+
+	/*
+	 * The catalog snapshot might have been taken before a change that bumped
+	 * the version we just read was committed. Make sure the catalog scans of
+	 * the caller see the change.
+	 */
+	InvalidateCatalogSnapshot();
+
+	return false;
+}
+
+
+/*
+ * StoreSharedShardMetadata stores the shard and placement rows of the given
+ * relation in the shared metadata cache, unless the metadata of the relation
+ * changed since the given version was obtained from LookupSharedShardMetadata.
+ * Rows are not stored if the memory of the cache is used up, since the cache
+ * is only an optimization.
+ */
+void
+StoreSharedShardMetadata(Oid relationId, List *shardRowList,
+						 SharedMetadataVersion metadataVersion)
+{
+	SharedMetadataCacheKey cacheKey;
+	bool entryFound = false;
+	Size serializedSize = 0;
+
+	/* version 0 means that the rows should not be shared */
+	if (!SharedMetadataCacheEnabled() || PendingMetadataChanges != NIL ||
+		metadataVersion.globalVersion == 0)
+	{
+		return;
+	}
+
+	char *serializedRows = SerializeShardMetadata(shardRowList, &serializedSize);
+
+	memset(&cacheKey, 0, sizeof(cacheKey));
+	cacheKey.databaseId = MyDatabaseId;
+	cacheKey.relationId = relationId;
+
+	LWLockAcquire(&MetadataCacheSharedState->lock, LW_EXCLUSIVE);
+
+	SharedMetadataCacheEntry *cacheEntry =
+		hash_search(SharedMetadataCacheHash, &cacheKey, HASH_ENTER_NULL, &entryFound);
+	if (cacheEntry == NULL)
+	{
+		LWLockRelease(&MetadataCacheSharedState->lock);
+		pfree(serializedRows);
+
+		return;
+	}
+
+	if (!entryFound)
+	{
+		cacheEntry->relationVersion = 0;
+		cacheEntry->rows = InvalidDsaPointer;
+		cacheEntry->rowsSize = 0;
+	}
+
+	/* the metadata changed while the caller read it, or is being changed */
+	if (MetadataCacheSharedState->inDoubtCount > 0 ||
+		MetadataCacheSharedState->changingTransactionCount > 0 ||
+		MetadataCacheSharedState->globalVersion != metadataVersion.globalVersion ||
+		cacheEntry->relationVersion != metadataVersion.relationVersion)
+	{
+		LWLockRelease(&MetadataCacheSharedState->lock);
+		pfree(serializedRows);
+
+		return;
+	}
+
+	dsa_pointer rows = dsa_allocate_extended(SharedMetadataArea, serializedSize,
+											 DSA_ALLOC_NO_OOM);
+	if (!DsaPointerIsValid(rows))
+	{
+		/* start over rather than tracking which relations are used least */
+		FreeAllEntryRows();
+
+		rows = dsa_allocate_extended(SharedMetadataArea, serializedSize,
+									 DSA_ALLOC_NO_OOM);
+		if (!DsaPointerIsValid(rows))
+		{
+			LWLockRelease(&MetadataCacheSharedState->lock);
+			pfree(serializedRows);
+
+			return;
+		}
+	}
+
+	memcpy(dsa_get_address(SharedMetadataArea, rows), serializedRows, serializedSize);
+
+	FreeEntryRows(cacheEntry);
+
+	cacheEntry->rows = rows;
+	cacheEntry->rowsSize = serializedSize;
+	cacheEntry->rowsVersion = metadataVersion;
+
+	MetadataCacheSharedState->cachedRelationCount++;
+	MetadataCacheSharedState->memoryUsed += serializedSize;
+
+	LWLockRelease(&MetadataCacheSharedState->lock);
+
+	pfree(serializedRows);
+}
+
+
+/*
+ * RecordSharedMetadataChange is called when the current transaction changes
+ * the metadata of the given relation. It increments the version of the
+ * relation right away, such that rows that other backends read before the
+ * change are not stored after it became visible. Until the transaction ends,
+ * the cache is not used by any backend, since rows read while it commits
+ * might or might not contain its changes.
+ */
+void
+RecordSharedMetadataChange(Oid relationId)
+{
+	if (!SharedMetadataCacheEnabled() ||
+		list_member_oid(PendingMetadataChanges, relationId))
+	{
+		return;
+	}
+
+	/* freeing the rows of the relation requires the area */
+	AttachSharedMetadataArea();
+
+	bool firstChange = PendingMetadataChanges == NIL;
+
+	/* remember the change first, the end of the transaction relies on it */
+	MemoryContext oldContext = MemoryContextSwitchTo(TopTransactionContext);
+
+	PendingMetadataChanges = lappend_oid(PendingMetadataChanges, relationId);
+
+	MemoryContextSwitchTo(oldContext);
+
+	LWLockAcquire(&MetadataCacheSharedState->lock, LW_EXCLUSIVE);
+
+	if (firstChange)
+	{
+		MetadataCacheSharedState->changingTransactionCount++;
+	}
+
+	BumpRelationVersion(relationId);
+
+	LWLockRelease(&MetadataCacheSharedState->lock);
+}
+
+
+/*
+ * SharedMetadataCacheTransactionStmt remembers the global transaction id of
+ * PREPARE TRANSACTION, COMMIT PREPARED and ROLLBACK PREPARED, which the
+ * transaction callbacks do not get to see.
+ */
+void
+SharedMetadataCacheTransactionStmt(TransactionStmt *transactionStmt)
+{
+	if (!SharedMetadataCacheEnabled())
+	{
+		return;
+	}
+
+	switch (transactionStmt->kind)
+	{
+		case TRANS_STMT_PREPARE:
+		{
+			strlcpy(PreparingGid, transactionStmt->gid, GIDSIZE);
+			break;
+		}
+
+		case TRANS_STMT_COMMIT_PREPARED:
+		case TRANS_STMT_ROLLBACK_PREPARED:
+		{
+			strlcpy(FinishingGid, transactionStmt->gid, GIDSIZE);
+
+			/* attach now, since the commit callback must not throw errors */
+			AttachSharedMetadataArea();
+			break;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+}
+
+
+/*
+ * SharedMetadataCacheCommit lets other backends use the cache again once the
+ * metadata changes of the transaction are visible to them. The versions of the
+ * changed relations were already incremented when the changes were made. It
+ * is called on XACT_EVENT_COMMIT and therefore must not throw errors.
+ */
+void
+SharedMetadataCacheCommit(void)
+{
+	if (!SharedMetadataCacheEnabled())
+	{
+		return;
+	}
+
+	/*
+	 * Reading inDoubtCount without the lock is fine, the prepared transaction
+	 * we finished was registered before PREPARE TRANSACTION returned.
+	 */
+	bool finishedInDoubt = FinishingGid[0] != '\0' &&
+						   MetadataCacheSharedState->inDoubtCount > 0;
+
+	if (PendingMetadataChanges != NIL || finishedInDoubt)
+	{
+		LWLockAcquire(&MetadataCacheSharedState->lock, LW_EXCLUSIVE);
+
+		if (PendingMetadataChanges != NIL)
+		{
+			MetadataCacheSharedState->changingTransactionCount--;
+		}
+
+		/* we do not know which relations the prepared transaction changed */
+		if (finishedInDoubt && RemoveInDoubtGid(FinishingGid))
+		{
+			BumpGlobalVersion();
+		}
+
+		LWLockRelease(&MetadataCacheSharedState->lock);
+	}
+
+	PendingMetadataChanges = NIL;
+	PreparingGid[0] = '\0';
+	FinishingGid[0] = '\0';
+}
+
+
+/*
+ * SharedMetadataCachePrepare is called on XACT_EVENT_PREPARE. Changes made by
+ * a prepared transaction only become visible once COMMIT PREPARED is run,
+ * possibly by another backend. Until then, the cache is not used at all.
+ */
+void
+SharedMetadataCachePrepare(void)
+{
+	if (!SharedMetadataCacheEnabled())
+	{
+		return;
+	}
+
+	if (PendingMetadataChanges != NIL)
+	{
+		LWLockAcquire(&MetadataCacheSharedState->lock, LW_EXCLUSIVE);
+
+		/* there cannot be more prepared transactions than max_prepared_xacts */
+		if (MetadataCacheSharedState->inDoubtCount < max_prepared_xacts)
+		{
+			int gidIndex = MetadataCacheSharedState->inDoubtCount;
+
+			strlcpy(InDoubtGids[gidIndex], PreparingGid,
+					GIDSIZE);
+			MetadataCacheSharedState->inDoubtCount++;
+		}
+
+		BumpGlobalVersion();
+
+		/* the prepared transaction keeps the cache disabled from now on */
+		MetadataCacheSharedState->changingTransactionCount--;
+
+		LWLockRelease(&MetadataCacheSharedState->lock);
+	}
+
+	PendingMetadataChanges = NIL;
+	PreparingGid[0] = '\0';
+	FinishingGid[0] = '\0';
+}
+
+
+/*
+ * SharedMetadataCacheAbort forgets about the changes of the transaction, which
+ * were never visible to other backends, and lets them use the cache again.
+ */
+void
+SharedMetadataCacheAbort(void)
+{
+	if (SharedMetadataCacheEnabled() && PendingMetadataChanges != NIL)
+	{
+		LWLockAcquire(&MetadataCacheSharedState->lock, LW_EXCLUSIVE);
+		MetadataCacheSharedState->changingTransactionCount--;
+		LWLockRelease(&MetadataCacheSharedState->lock);
+	}
+
+	PendingMetadataChanges = NIL;
+	PreparingGid[0] = '\0';
+	FinishingGid[0] = '\0';
+}
+
+
+/*
+ * SharedMetadataCacheEnabled returns whether the shared metadata cache was
+ * set up at server start.
+ */
+static bool
+SharedMetadataCacheEnabled(void)
+{
+	return SharedMetadataCacheSize > 0 && MetadataCacheSharedState != NULL;
+}
+
+
+/*
+ * AttachSharedMetadataArea makes sure that the backend has the dynamic shared
+ * memory area that contains the rows mapped, creating the area if no backend
+ * did so yet. The mapping is kept until the backend exits.
+ */
+static void
+AttachSharedMetadataArea(void)
+{
+	if (SharedMetadataArea != NULL)
+	{
+		return;
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+	LWLockAcquire(&MetadataCacheSharedState->lock, LW_EXCLUSIVE);
+
+	if (!MetadataCacheSharedState->areaCreated)
+	{
+		dsa_area *area = dsa_create(MetadataCacheSharedState->areaTrancheId);
+
+		dsa_set_size_limit(area, (Size) SharedMetadataCacheSize * 1024 * 1024);
+
+		/* keep the area around when all backends detached */
+		dsa_pin(area);
+
+		MetadataCacheSharedState->areaHandle = dsa_get_handle(area);
+		MetadataCacheSharedState->areaCreated = true;
+
+		SharedMetadataArea = area;
+	}
+	else
+	{
+		SharedMetadataArea = dsa_attach(MetadataCacheSharedState->areaHandle);
+	}
+
+	dsa_pin_mapping(SharedMetadataArea);
+
+	LWLockRelease(&MetadataCacheSharedState->lock);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * BumpRelationVersion increments the version of the given relation and frees
+ * its rows. The caller should hold the lock in exclusive mode.
+ */
+static void
+BumpRelationVersion(Oid relationId)
+{
+	SharedMetadataCacheKey cacheKey;
+	bool entryFound = false;
+
+	memset(&cacheKey, 0, sizeof(cacheKey));
+	cacheKey.databaseId = MyDatabaseId;
+	cacheKey.relationId = relationId;
+
+	SharedMetadataCacheEntry *cacheEntry =
+		hash_search(SharedMetadataCacheHash, &cacheKey, HASH_ENTER_NULL, &entryFound);
+	if (cacheEntry == NULL)
+	{
+		/* cannot track another relation, so start over */
+		BumpGlobalVersion();
+		return;
+	}
+
+	if (!entryFound)
+	{
+		cacheEntry->relationVersion = 0;
+		cacheEntry->rows = InvalidDsaPointer;
+		cacheEntry->rowsSize = 0;
+	}
+
+	cacheEntry->relationVersion++;
+	FreeEntryRows(cacheEntry);
+
+	pg_atomic_fetch_add_u64(&MetadataCacheSharedState->invalidationCount, 1);
+}
+
+
+/*
+ * BumpGlobalVersion increments the global version, which makes the rows of
+ * all relations stale, and frees all rows. Since versions consist of both the
+ * global and the relation version, the relations can be forgotten entirely.
+ * The caller should hold the lock in exclusive mode.
+ */
+static void
+BumpGlobalVersion(void)
+{
+	HASH_SEQ_STATUS status;
+	SharedMetadataCacheEntry *cacheEntry = NULL;
+
+	MetadataCacheSharedState->globalVersion++;
+
+	hash_seq_init(&status, SharedMetadataCacheHash);
+	while ((cacheEntry = (SharedMetadataCacheEntry *) hash_seq_search(&status)) != 0)
+	{
+		FreeEntryRows(cacheEntry);
+		hash_search(SharedMetadataCacheHash, &cacheEntry->key, HASH_REMOVE, NULL);
+	}
+
+	pg_atomic_fetch_add_u64(&MetadataCacheSharedState->invalidationCount, 1);
+}
+
+
+/*
+ * FreeEntryRows frees the rows stored for a relation, if any. The caller
+ * should hold the lock in exclusive mode.
+ */
+static void
+FreeEntryRows(SharedMetadataCacheEntry *cacheEntry)
+{
+	if (!DsaPointerIsValid(cacheEntry->rows))
+	{
+		return;
+	}
+
+	dsa_free(SharedMetadataArea, cacheEntry->rows);
+
+	MetadataCacheSharedState->cachedRelationCount--;
+	MetadataCacheSharedState->memoryUsed -= cacheEntry->rowsSize;
+
+	cacheEntry->rows = InvalidDsaPointer;
+	cacheEntry->rowsSize = 0;
+}
+
+
+/*
+ * FreeAllEntryRows frees the rows of all relations, but keeps their versions.
+ * The caller should hold the lock in exclusive mode.
+ */
+static void
+FreeAllEntryRows(void)
+{
+	HASH_SEQ_STATUS status;
+	SharedMetadataCacheEntry *cacheEntry = NULL;
+
+	hash_seq_init(&status, SharedMetadataCacheHash);
+	while ((cacheEntry = (SharedMetadataCacheEntry *) hash_seq_search(&status)) != 0)
+	{
+		FreeEntryRows(cacheEntry);
+	}
+}
+
+
+/*
+ * RemoveInDoubtGid removes the given global transaction id from the prepared
+ * transactions that changed the metadata, and returns whether it was there.
+ * The caller should hold the lock in exclusive mode.
+ */
+static bool
+RemoveInDoubtGid(const char *gid)
+{
+	int inDoubtCount = MetadataCacheSharedState->inDoubtCount;
+
+	for (int gidIndex = 0; gidIndex < inDoubtCount; gidIndex++)
+	{
+		if (strcmp(InDoubtGids[gidIndex], gid) != 0)
+		{
+			continue;
+		}
+
+		/* move the last one into the free slot */
+		strlcpy(InDoubtGids[gidIndex],
+				InDoubtGids[inDoubtCount - 1], GIDSIZE);
+		MetadataCacheSharedState->inDoubtCount--;
+
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * SerializeShardMetadata serializes the given shard rows into a single chunk
+ * of memory, such that they can be stored in the dynamic shared memory area.
+ */
+static char *
+SerializeShardMetadata(List *shardRowList, Size *serializedSize)
+{
+	int shardCount = list_length(shardRowList);
+	int placementCount = 0;
+	Size stringSize = 0;
+	ListCell *shardRowCell = NULL;
+	int shardIndex = 0;
+	int placementIndex = 0;
+	int32 stringAreaUsed = 0;
+
+	foreach(shardRowCell, shardRowList)
+	{
+		ShardMetadataRow *shardRow = (ShardMetadataRow *) lfirst(shardRowCell);
+
+		placementCount += list_length(shardRow->placementList);
+
+		if (shardRow->minValue != NULL)
+		{
+			stringSize += strlen(shardRow->minValue) + 1;
+		}
+
+		if (shardRow->maxValue != NULL)
+		{
+			stringSize += strlen(shardRow->maxValue) + 1;
+		}
+	}
+
+	Size shardRowOffset = MAXALIGN(sizeof(SerializedShardMetadata));
+	Size placementRowOffset =
+		shardRowOffset + MAXALIGN(shardCount * sizeof(SerializedShardRow));
+	Size stringOffset =
+		placementRowOffset + placementCount * sizeof(SerializedPlacementRow);
+
+	*serializedSize = stringOffset + stringSize;
+
+	char *serializedRows = palloc0(*serializedSize);
+	SerializedShardMetadata *header = (SerializedShardMetadata *) serializedRows;
+	SerializedShardRow *shardRowArray =
+		(SerializedShardRow *) (serializedRows + shardRowOffset);
+	SerializedPlacementRow *placementRowArray =
+		(SerializedPlacementRow *) (serializedRows + placementRowOffset);
+	char *stringArea = serializedRows + stringOffset;
+
+	header->shardCount = shardCount;
+	header->placementCount = placementCount;
+	header->shardRowOffset = shardRowOffset;
+	header->placementRowOffset = placementRowOffset;
+	header->stringOffset = stringOffset;
+
+	foreach(shardRowCell, shardRowList)
+	{
+		ShardMetadataRow *shardRow = (ShardMetadataRow *) lfirst(shardRowCell);
+		SerializedShardRow *serializedShardRow = &shardRowArray[shardIndex];
+		ListCell *placementCell = NULL;
+
+		serializedShardRow->shardId = shardRow->shardId;
+		serializedShardRow->storageType = shardRow->storageType;
+		serializedShardRow->placementCount = list_length(shardRow->placementList);
+		serializedShardRow->minValueOffset =
+			SerializeString(stringArea, &stringAreaUsed, shardRow->minValue);
+		serializedShardRow->maxValueOffset =
+			SerializeString(stringArea, &stringAreaUsed, shardRow->maxValue);
+
+		foreach(placementCell, shardRow->placementList)
+		{
+			GroupShardPlacement *placement =
+				(GroupShardPlacement *) lfirst(placementCell);
+			SerializedPlacementRow *serializedPlacementRow =
+				&placementRowArray[placementIndex];
+
+			serializedPlacementRow->placementId = placement->placementId;
+			serializedPlacementRow->shardLength = placement->shardLength;
+			serializedPlacementRow->shardState = placement->shardState;
+			serializedPlacementRow->groupId = placement->groupId;
+
+			placementIndex++;
+		}
+
+		shardIndex++;
+	}
+
+	return serializedRows;
+}
+
+
+/*
+ * SerializeString copies the given string into the string area and returns
+ * its offset, or -1 if the string is NULL.
+ */
+static int32
+SerializeString(char *stringArea, int32 *stringAreaUsed, char *string)
+{
+	if (string == NULL)
+	{
+		return -1;
+	}
+
+	int32 stringOffset = *stringAreaUsed;
+	Size stringLength = strlen(string) + 1;
+
+	memcpy(stringArea + stringOffset, string, stringLength);
+	*stringAreaUsed += stringLength;
+
+	return stringOffset;
+}
+
+
+/*
+ * DeserializeShardMetadata builds the list of shard rows from their serialized
+ * form in the current memory context.
+ */
+static List *
+DeserializeShardMetadata(char *serializedRows)
+{
+	SerializedShardMetadata *header = (SerializedShardMetadata *) serializedRows;
+	SerializedShardRow *shardRowArray =
+		(SerializedShardRow *) (serializedRows + header->shardRowOffset);
+	SerializedPlacementRow *placementRowArray =
+		(SerializedPlacementRow *) (serializedRows + header->placementRowOffset);
+	char *stringArea = serializedRows + header->stringOffset;
+	List *shardRowList = NIL;
+	int placementIndex = 0;
+
+	for (int shardIndex = 0; shardIndex < header->shardCount; shardIndex++)
+	{
+		SerializedShardRow *serializedShardRow = &shardRowArray[shardIndex];
+		ShardMetadataRow *shardRow = palloc0(sizeof(ShardMetadataRow));
+
+		shardRow->shardId = serializedShardRow->shardId;
+		shardRow->storageType = serializedShardRow->storageType;
+
+		if (serializedShardRow->minValueOffset >= 0)
+		{
+			shardRow->minValue =
+				pstrdup(stringArea + serializedShardRow->minValueOffset);
+		}
+
+		if (serializedShardRow->maxValueOffset >= 0)
+		{
+			shardRow->maxValue =
+				pstrdup(stringArea + serializedShardRow->maxValueOffset);
+		}
+
+		for (int shardPlacementIndex = 0;
+			 shardPlacementIndex < serializedShardRow->placementCount;
+			 shardPlacementIndex++)
+		{
+			SerializedPlacementRow *serializedPlacementRow =
+				&placementRowArray[placementIndex];
+			GroupShardPlacement *placement = CitusMakeNode(GroupShardPlacement);
+
+			placement->placementId = serializedPlacementRow->placementId;
+			placement->shardId = shardRow->shardId;
+			placement->shardLength = serializedPlacementRow->shardLength;
+			placement->shardState = serializedPlacementRow->shardState;
+			placement->groupId = serializedPlacementRow->groupId;
+
+			shardRow->placementList = lappend(shardRow->placementList, placement);
+
+			placementIndex++;
+		}
+
+		shardRowList = lappend(shardRowList, shardRow);
+	}
+
+	return shardRowList;
+}
+
+
+/*
+ * InitializeSharedMetadataCache, called at server start, requests the shared
+ * memory for the shared metadata cache if it is enabled.
+ */
+void
+InitializeSharedMetadataCache(void)
+{
+	if (SharedMetadataCacheSize <= 0)
+	{
+		return;
+	}
+
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(SharedMetadataCacheShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = SharedMetadataCacheShmemInit;
+}
+
+
+/*
+ * SharedMetadataCacheShmemSize computes how much shared memory is required.
+ * The rows themselves are stored in a dynamic shared memory area, which is
+ * created on first use.
+ */
+static size_t
+SharedMetadataCacheShmemSize(void)
+{
+	Size size = 0;
+
+	size = add_size(size, sizeof(SharedMetadataCacheControlData));
+	size = add_size(size, mul_size(max_prepared_xacts, GIDSIZE));
+
+	Size hashSize = hash_estimate_size(MAX_SHARED_METADATA_RELATIONS,
+									   sizeof(SharedMetadataCacheEntry));
+	size = add_size(size, hashSize);
+
+	return size;
+}
+
+
+/*
+ * SharedMetadataCacheShmemInit initializes the requested shared memory for
+ * the shared metadata cache.
+ */
+static void
+SharedMetadataCacheShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	Size controlSize = add_size(sizeof(SharedMetadataCacheControlData),
+								mul_size(max_prepared_xacts, GIDSIZE));
+
+	MetadataCacheSharedState =
+		(SharedMetadataCacheControlData *) ShmemInitStruct("Shared Metadata Cache Data",
+														   controlSize,
+														   &alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		memset(MetadataCacheSharedState, 0, controlSize);
+
+		MetadataCacheSharedState->trancheId = LWLockNewTrancheId();
+		MetadataCacheSharedState->lockTrancheName = "Shared Metadata Cache";
+		LWLockRegisterTranche(MetadataCacheSharedState->trancheId,
+							  MetadataCacheSharedState->lockTrancheName);
+
+		LWLockInitialize(&MetadataCacheSharedState->lock,
+						 MetadataCacheSharedState->trancheId);
+
+		MetadataCacheSharedState->areaTrancheId = LWLockNewTrancheId();
+		MetadataCacheSharedState->areaTrancheName = "Shared Metadata Cache Area";
+		LWLockRegisterTranche(MetadataCacheSharedState->areaTrancheId,
+							  MetadataCacheSharedState->areaTrancheName);
+
+		MetadataCacheSharedState->areaCreated = false;
+		MetadataCacheSharedState->globalVersion = 1;
+
+		pg_atomic_init_u64(&MetadataCacheSharedState->hitCount, 0);
+		pg_atomic_init_u64(&MetadataCacheSharedState->rebuildCount, 0);
+		pg_atomic_init_u64(&MetadataCacheSharedState->invalidationCount, 0);
+	}
+
+	InDoubtGids = (char (*)[GIDSIZE]) ((char *) MetadataCacheSharedState +
+									   sizeof(SharedMetadataCacheControlData));
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(SharedMetadataCacheKey);
+	hashInfo.entrysize = sizeof(SharedMetadataCacheEntry);
+	hashInfo.hash = tag_hash;
+	int hashFlags = (HASH_ELEM | HASH_FUNCTION);
+
+	SharedMetadataCacheHash = ShmemInitHash("Shared Metadata Cache Hash",
+											MAX_SHARED_METADATA_RELATIONS,
+											MAX_SHARED_METADATA_RELATIONS,
+											&hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
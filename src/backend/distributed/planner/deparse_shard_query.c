@@ -29,12 +29,20 @@
 #include "nodes/pg_list.h"
 #include "parser/parsetree.h"
 #include "storage/lock.h"
+#include "utils/builtins.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 
 
+/* whether to fill in the query strings of similar tasks from a template */
+bool EnableTaskQueryTemplates = true;
+
+
 static void UpdateTaskQueryString(Query *query, Oid distributedTableId,
 								  RangeTblEntry *valuesRTE, Task *task);
+static RelationShard * FindRelationShard(Oid relationId, List *relationShardList);
+static bool RelationShardListFitsTemplate(List *relationShardList);
 static void ConvertRteToSubqueryWithEmptyResult(RangeTblEntry *rte);
 
 
@@ -49,11 +57,43 @@ RebuildQueryStrings(Query *originalQuery, List *taskList)
 	Oid relationId = ((RangeTblEntry *) linitial(originalQuery->rtable))->relid;
 	RangeTblEntry *valuesRTE = ExtractDistributedInsertValuesRTE(originalQuery);
 
+	/*
+	 * The queries of the tasks of a multi-shard UPDATE or DELETE only differ
+	 * in their shard names, so we deparse the query once into a template for
+	 * the first task and fill in the shard names of the other tasks.
+	 */
+	bool buildTaskQueryTemplate = EnableTaskQueryTemplates &&
+								  UpdateOrDeleteQuery(originalQuery) &&
+								  list_length(taskList) > 1;
+	char *taskQueryTemplate = NULL;
+
 	foreach(taskCell, taskList)
 	{
 		Task *task = (Task *) lfirst(taskCell);
 		Query *query = originalQuery;
 
+		if (taskQueryTemplate != NULL &&
+			TaskQueryTemplateFits(taskQueryTemplate, task->relationShardList))
+		{
+			if (IsLoggableLevel(DEBUG4))
+			{
+				char *queryString = TaskQueryString(task);
+
+				ereport(DEBUG4, (errmsg("query before rebuilding: %s",
+										queryString == NULL ? "(null)" :
+										ApplyLogRedaction(queryString))));
+			}
+
+			SetTaskQueryTemplate(task, taskQueryTemplate);
+
+			if (IsLoggableLevel(DEBUG4))
+			{
+				ereport(DEBUG4, (errmsg("query after rebuilding:  %s",
+										ApplyLogRedaction(TaskQueryString(task)))));
+			}
+			continue;
+		}
+
 		if (UpdateOrDeleteQuery(query) && list_length(taskList))
 		{
 			query = copyObject(originalQuery);
@@ -104,12 +144,23 @@ RebuildQueryStrings(Query *originalQuery, List *taskList)
 			}
 		}
 
-		ereport(DEBUG4, (errmsg("query before rebuilding: %s",
-								task->queryString == NULL ? "(null)" :
-								ApplyLogRedaction(task->queryString))));
+		if (IsLoggableLevel(DEBUG4))
+		{
+			char *queryString = TaskQueryString(task);
+
+			ereport(DEBUG4, (errmsg("query before rebuilding: %s",
+									queryString == NULL ? "(null)" :
+									ApplyLogRedaction(queryString))));
+		}
 
 		UpdateTaskQueryString(query, relationId, valuesRTE, task);
 
+		if (buildTaskQueryTemplate)
+		{
+			taskQueryTemplate = DeparseTaskQueryTemplate(query, task->relationShardList);
+			buildTaskQueryTemplate = false;
+		}
+
 		ereport(DEBUG4, (errmsg("query after rebuilding:  %s",
 								ApplyLogRedaction(task->queryString))));
 	}
@@ -163,6 +214,239 @@ UpdateTaskQueryString(Query *query, Oid distributedTableId, RangeTblEntry *value
 	}
 
 	task->queryString = queryString->data;
+	task->queryTemplate = NULL;
+	task->shardQuery = NULL;
+}
+
+
+/*
+ * SetTaskQueryTemplate makes the query string of the given task be filled in
+ * from the given template when it is first needed, rather than building it
+ * now. The shards of the task should fit the template, which the caller can
+ * check using TaskQueryTemplateFits().
+ */
+void
+SetTaskQueryTemplate(Task *task, char *queryTemplate)
+{
+	Assert(TaskQueryTemplateFits(queryTemplate, task->relationShardList));
+
+	task->queryString = NULL;
+	task->queryTemplate = queryTemplate;
+	task->shardQuery = NULL;
+}
+
+
+/*
+ * TaskQueryString returns the query string of the given task. If the planner
+ * only gave the task a template or a query tree, the query string is built
+ * from it on the first call and kept in the task, in the memory context of
+ * the task, since the task may be part of a cached plan.
+ */
+char *
+TaskQueryString(Task *task)
+{
+	if (task->queryString != NULL)
+	{
+		return task->queryString;
+	}
+
+	if (task->queryTemplate == NULL && task->shardQuery == NULL)
+	{
+		return NULL;
+	}
+
+	MemoryContext taskContext = GetMemoryChunkContext(task);
+	MemoryContext oldContext = MemoryContextSwitchTo(taskContext);
+
+	if (task->queryTemplate != NULL)
+	{
+		task->queryString = FillTaskQueryTemplate(task->queryTemplate,
+												  task->relationShardList);
+		Assert(task->queryString != NULL);
+	}
+	else
+	{
+		StringInfo queryString = makeStringInfo();
+
+		pg_get_query_def(task->shardQuery, queryString);
+		task->queryString = queryString->data;
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	return task->queryString;
+}
+
+
+/*
+ * DeparseTaskQueryTemplate deparses a task query, whose relations have been
+ * updated to the shards in the given relation shard list, into a template in
+ * which the shard names are left as slots. The query strings of other tasks
+ * that only differ in their shards can then be built by FillTaskQueryTemplate,
+ * which is much cheaper than updating the shard names and deparsing again.
+ *
+ * The function returns NULL if the query cannot be turned into a template,
+ * either because the shard of a relation is not unique, or because the query
+ * itself contains the byte that delimits the slots.
+ */
+char *
+DeparseTaskQueryTemplate(Query *query, List *relationShardList)
+{
+	StringInfo queryTemplate = makeStringInfo();
+	int markerCount = 0;
+
+	if (!RelationShardListFitsTemplate(relationShardList))
+	{
+		return NULL;
+	}
+
+	int slotCount = pg_get_query_template_def(query, queryTemplate);
+
+	for (int byteIndex = 0; byteIndex < queryTemplate->len; byteIndex++)
+	{
+		if (queryTemplate->data[byteIndex] == SHARD_NAME_SLOT_MARKER)
+		{
+			markerCount++;
+		}
+	}
+
+	if (markerCount != 2 * slotCount)
+	{
+		return NULL;
+	}
+
+	return queryTemplate->data;
+}
+
+
+/*
+ * FillTaskQueryTemplate builds the query string of a task from a template
+ * created by DeparseTaskQueryTemplate, by writing the names of the shards in
+ * the given relation shard list into the slots of their relations. The
+ * function returns NULL if the shards of the task do not fit the template.
+ */
+char *
+FillTaskQueryTemplate(char *queryTemplate, List *relationShardList)
+{
+	StringInfo queryString = makeStringInfo();
+	char *templateCursor = queryTemplate;
+
+	if (!RelationShardListFitsTemplate(relationShardList))
+	{
+		return NULL;
+	}
+
+	char *slotStart = strchr(templateCursor, SHARD_NAME_SLOT_MARKER);
+	while (slotStart != NULL)
+	{
+		char *slotEnd = NULL;
+
+		appendBinaryStringInfo(queryString, templateCursor, slotStart - templateCursor);
+
+		Oid relationId = (Oid) strtoul(slotStart + 1, &slotEnd, 10);
+		Assert(*slotEnd == SHARD_NAME_SLOT_MARKER);
+
+		RelationShard *relationShard = FindRelationShard(relationId, relationShardList);
+		if (relationShard == NULL)
+		{
+			return NULL;
+		}
+
+		char *shardName = get_rel_name(relationId);
+		AppendShardIdToName(&shardName, relationShard->shardId);
+
+		appendStringInfoString(queryString, quote_identifier(shardName));
+
+		templateCursor = slotEnd + 1;
+		slotStart = strchr(templateCursor, SHARD_NAME_SLOT_MARKER);
+	}
+
+	appendStringInfoString(queryString, templateCursor);
+
+	return queryString->data;
+}
+
+
+/*
+ * TaskQueryTemplateFits returns whether the shard names of a task with the
+ * given relation shard list can be filled in from the given template, without
+ * actually building the query string.
+ */
+bool
+TaskQueryTemplateFits(char *queryTemplate, List *relationShardList)
+{
+	if (!RelationShardListFitsTemplate(relationShardList))
+	{
+		return false;
+	}
+
+	char *slotStart = strchr(queryTemplate, SHARD_NAME_SLOT_MARKER);
+	while (slotStart != NULL)
+	{
+		char *slotEnd = NULL;
+
+		Oid relationId = (Oid) strtoul(slotStart + 1, &slotEnd, 10);
+		Assert(*slotEnd == SHARD_NAME_SLOT_MARKER);
+
+		if (FindRelationShard(relationId, relationShardList) == NULL)
+		{
+			return false;
+		}
+
+		slotStart = strchr(slotEnd + 1, SHARD_NAME_SLOT_MARKER);
+	}
+
+	return true;
+}
+
+
+/*
+ * FindRelationShard returns the relation shard of the given relation in the
+ * given relation shard list, or NULL if there is none.
+ */
+static RelationShard *
+FindRelationShard(Oid relationId, List *relationShardList)
+{
+	ListCell *relationShardCell = NULL;
+
+	foreach(relationShardCell, relationShardList)
+	{
+		RelationShard *relationShard = (RelationShard *) lfirst(relationShardCell);
+		if (relationShard->relationId == relationId)
+		{
+			return relationShard;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * RelationShardListFitsTemplate returns whether the shard names of a task with
+ * the given relation shard list can be filled in from a template. Since slots
+ * only identify the relation, each relation needs to have a single, valid
+ * shard.
+ */
+static bool
+RelationShardListFitsTemplate(List *relationShardList)
+{
+	ListCell *relationShardCell = NULL;
+
+	foreach(relationShardCell, relationShardList)
+	{
+		RelationShard *relationShard = (RelationShard *) lfirst(relationShardCell);
+		RelationShard *firstRelationShard =
+			FindRelationShard(relationShard->relationId, relationShardList);
+
+		if (relationShard->shardId == INVALID_SHARD_ID ||
+			relationShard->shardId != firstRelationShard->shardId)
+		{
+			return false;
+		}
+	}
+
+	return true;
 }
 
 
@@ -0,0 +1,636 @@
+/*-------------------------------------------------------------------------
+ *
+ * distributed_plan_cache.c
+ *	  Keeps the distributed plans of parameterized multi-shard queries.
+ *
+ * Postgres plans a prepared statement with the parameter values on every
+ * execution when no generic plan can be used, which is always the case for
+ * multi-shard queries with parameters, since the distributed planner resolves
+ * the parameters into the query before it cuts it into task queries. For
+ * simple SELECT queries on co-located tables, we instead plan the query once
+ * without the parameter values, such that the task queries refer to the
+ * parameters and get their values from the executor. The plan is kept per
+ * backend, keyed by a hash of the query tree and the parameter types, and
+ * later executions only prune the tasks using the parameter values.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "access/hash.h"
+#include "distributed/citus_ruleutils.h"
+#include "distributed/colocation_utils.h"
+#include "distributed/distributed_plan_cache.h"
+#include "distributed/distributed_planner.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/multi_server_executor.h"
+#include "distributed/pg_dist_partition.h"
+#include "distributed/shard_pruning.h"
+#include "distributed/tuplestore.h"
+#include "lib/stringinfo.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/bitmapset.h"
+#include "optimizer/clauses.h"
+#if PG_VERSION_NUM >= 120000
+#include "optimizer/optimizer.h"
+#endif
+#include "optimizer/restrictinfo.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+#define PLAN_CACHE_STATS_COLUMNS 7
+
+
+/*
+ * DeferredPruningRestriction contains the restrictions on a distributed table
+ * that refer to parameters, which are used to prune the tasks of a cached plan.
+ */
+typedef struct DeferredPruningRestriction
+{
+	Oid relationId;
+	Index rangeTableIndex;
+	List *clauseList;
+} DeferredPruningRestriction;
+
+
+/* config variable managed via guc.c, 0 disables the cache */
+int MaxCachedDistributedPlans = 0;
+
+/* cached plans, keyed by query id */
+static HTAB *DistributedPlanCache = NULL;
+static MemoryContext DistributedPlanCacheContext = NULL;
+
+/*
+ * DistributedPlanCacheGeneration is incremented when the plans become stale,
+ * the cache is dropped when the next query looks it up.
+ */
+static uint64 DistributedPlanCacheGeneration = 0;
+static uint64 CachedPlansGeneration = 0;
+
+
+static bool ContainsExternParamWalker(Node *node, void *context);
+static bool CoLocatedRangeTable(List *rangeTableList);
+static void CreateDistributedPlanCache(void);
+static char * QueryCacheKey(Query *originalQuery, ParamListInfo boundParams);
+static List * DeferredPruningRestrictionList(PlannerRestrictionContext *
+											 plannerRestrictionContext);
+static bool PruneCachedPlanTasks(DistributedPlan *distributedPlan,
+								 List *deferredPruningList,
+								 ParamListInfo boundParams);
+static void StorePlanCacheStats(Tuplestorestate *tupleStore, TupleDesc tupleDescriptor);
+
+
+PG_FUNCTION_INFO_V1(citus_plan_cache_stats);
+
+
+/*
+ * citus_plan_cache_stats returns the queries of the current session that the
+ * distributed plan cache keeps track of, along with how often they were
+ * planned and how long planning took.
+ */
+Datum
+citus_plan_cache_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+
+	CheckCitusVersion(ERROR);
+	Tuplestorestate *tupleStore = SetupTuplestore(fcinfo, &tupleDescriptor);
+
+	StorePlanCacheStats(tupleStore, tupleDescriptor);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * StorePlanCacheStats adds a row for each entry in the distributed plan cache
+ * to the given tuple store.
+ */
+static void
+StorePlanCacheStats(Tuplestorestate *tupleStore, TupleDesc tupleDescriptor)
+{
+	Datum values[PLAN_CACHE_STATS_COLUMNS];
+	bool isNulls[PLAN_CACHE_STATS_COLUMNS];
+	HASH_SEQ_STATUS status;
+	DistributedPlanCacheEntry *cacheEntry = NULL;
+
+	if (DistributedPlanCache == NULL)
+	{
+		return;
+	}
+
+	hash_seq_init(&status, DistributedPlanCache);
+	while ((cacheEntry = (DistributedPlanCacheEntry *) hash_seq_search(&status)) != 0)
+	{
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = Int64GetDatum(cacheEntry->queryId);
+		values[1] = PointerGetDatum(cstring_to_text(cacheEntry->queryString));
+		values[2] = BoolGetDatum(cacheEntry->state == PLAN_CACHE_ENTRY_CACHED);
+		values[3] = Int64GetDatum(cacheEntry->calls);
+		values[4] = Int64GetDatum(cacheEntry->cacheHits);
+		values[5] = Float8GetDatum(cacheEntry->totalPlanningTime);
+
+		if (cacheEntry->calls > 0)
+		{
+			values[6] = Float8GetDatum(cacheEntry->totalPlanningTime /
+									   cacheEntry->calls);
+		}
+		else
+		{
+			isNulls[6] = true;
+		}
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+	}
+}
+
+
+/*
+ * DistributedPlanCacheable returns whether the plan of the given query could
+ * be kept in the distributed plan cache. That is the case for SELECT queries
+ * on co-located distributed tables and reference tables, without subqueries,
+ * CTEs or set operations, that only use parameters in their filters.
+ */
+bool
+DistributedPlanCacheable(Query *originalQuery, ParamListInfo boundParams)
+{
+	if (MaxCachedDistributedPlans <= 0)
+	{
+		return false;
+	}
+
+	if (boundParams == NULL || boundParams->numParams == 0)
+	{
+		return false;
+	}
+
+	/* other executors and task assignment policies need a plan per execution */
+	if (TaskExecutorType != MULTI_EXECUTOR_ADAPTIVE ||
+		TaskAssignmentPolicy != TASK_ASSIGNMENT_GREEDY)
+	{
+		return false;
+	}
+
+	if (originalQuery->commandType != CMD_SELECT ||
+		originalQuery->utilityStmt != NULL ||
+		originalQuery->cteList != NIL ||
+		originalQuery->hasSubLinks ||
+		originalQuery->hasTargetSRFs ||
+		originalQuery->setOperations != NULL ||
+		originalQuery->rowMarks != NIL)
+	{
+		return false;
+	}
+
+	/* parameters elsewhere would end up in the query on the coordinator */
+	if (ContainsExternParamWalker((Node *) originalQuery->targetList, NULL) ||
+		ContainsExternParamWalker(originalQuery->havingQual, NULL) ||
+		ContainsExternParamWalker(originalQuery->limitCount, NULL) ||
+		ContainsExternParamWalker(originalQuery->limitOffset, NULL))
+	{
+		return false;
+	}
+
+	return CoLocatedRangeTable(originalQuery->rtable);
+}
+
+
+/*
+ * ContainsExternParamWalker returns whether the given expression refers to a
+ * parameter of the query.
+ */
+static bool
+ContainsExternParamWalker(Node *node, void *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, Param))
+	{
+		Param *param = (Param *) node;
+
+		return param->paramkind == PARAM_EXTERN;
+	}
+
+	return expression_tree_walker(node, ContainsExternParamWalker, context);
+}
+
+
+/*
+ * CoLocatedRangeTable returns whether the range table only consists of joins,
+ * reference tables and at least one hash-distributed table, where all
+ * hash-distributed tables are co-located.
+ */
+static bool
+CoLocatedRangeTable(List *rangeTableList)
+{
+	ListCell *rangeTableCell = NULL;
+	uint32 colocationId = INVALID_COLOCATION_ID;
+	bool hasHashDistributedTable = false;
+
+	foreach(rangeTableCell, rangeTableList)
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+
+		if (rangeTableEntry->rtekind == RTE_JOIN)
+		{
+			continue;
+		}
+
+		if (rangeTableEntry->rtekind != RTE_RELATION ||
+			!IsDistributedTable(rangeTableEntry->relid))
+		{
+			return false;
+		}
+
+		char partitionMethod = PartitionMethod(rangeTableEntry->relid);
+		if (partitionMethod == DISTRIBUTE_BY_NONE)
+		{
+			continue;
+		}
+		else if (partitionMethod != DISTRIBUTE_BY_HASH)
+		{
+			return false;
+		}
+
+		uint32 tableColocationId = TableColocationId(rangeTableEntry->relid);
+		if (hasHashDistributedTable && tableColocationId != colocationId)
+		{
+			return false;
+		}
+
+		colocationId = tableColocationId;
+		hasHashDistributedTable = true;
+	}
+
+	return hasHashDistributedTable;
+}
+
+
+/*
+ * LookupDistributedPlanCacheEntry returns the cache entry for the given
+ * query, which is created if it does not exist yet. It returns NULL if the
+ * query collides with a different query that is already in the cache.
+ */
+DistributedPlanCacheEntry *
+LookupDistributedPlanCacheEntry(Query *originalQuery, ParamListInfo boundParams)
+{
+	bool found = false;
+
+	if (DistributedPlanCache == NULL ||
+		CachedPlansGeneration != DistributedPlanCacheGeneration)
+	{
+		CreateDistributedPlanCache();
+	}
+
+	char *queryKey = QueryCacheKey(originalQuery, boundParams);
+	uint64 queryId = DatumGetUInt64(hash_any_extended((unsigned char *) queryKey,
+													  strlen(queryKey), 0));
+
+	DistributedPlanCacheEntry *cacheEntry =
+		hash_search(DistributedPlanCache, &queryId, HASH_FIND, &found);
+	if (found)
+	{
+		if (strcmp(cacheEntry->queryKey, queryKey) != 0)
+		{
+			return NULL;
+		}
+
+		return cacheEntry;
+	}
+
+	if (hash_get_num_entries(DistributedPlanCache) >= MaxCachedDistributedPlans)
+	{
+		/* start over rather than tracking which plans are used least */
+		CreateDistributedPlanCache();
+	}
+
+	StringInfo queryString = makeStringInfo();
+	pg_get_query_def(originalQuery, queryString);
+
+	MemoryContext oldContext = MemoryContextSwitchTo(DistributedPlanCacheContext);
+
+	cacheEntry = hash_search(DistributedPlanCache, &queryId, HASH_ENTER, &found);
+	cacheEntry->queryKey = pstrdup(queryKey);
+	cacheEntry->queryString = pstrdup(queryString->data);
+	cacheEntry->state = PLAN_CACHE_ENTRY_NEW;
+	cacheEntry->localPlan = NULL;
+	cacheEntry->distributedPlan = NULL;
+	cacheEntry->deferredPruningList = NIL;
+	cacheEntry->calls = 0;
+	cacheEntry->cacheHits = 0;
+	cacheEntry->totalPlanningTime = 0.0;
+
+	MemoryContextSwitchTo(oldContext);
+
+	return cacheEntry;
+}
+
+
+/*
+ * CreateDistributedPlanCache drops all cached plans and creates an empty
+ * cache.
+ */
+static void
+CreateDistributedPlanCache(void)
+{
+	HASHCTL info;
+
+	if (DistributedPlanCacheContext == NULL)
+	{
+		DistributedPlanCacheContext =
+			AllocSetContextCreateExtended(CacheMemoryContext,
+										  "Distributed Plan Cache",
+										  ALLOCSET_DEFAULT_MINSIZE,
+										  ALLOCSET_DEFAULT_INITSIZE,
+										  ALLOCSET_DEFAULT_MAXSIZE);
+	}
+	else
+	{
+		MemoryContextReset(DistributedPlanCacheContext);
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(uint64);
+	info.entrysize = sizeof(DistributedPlanCacheEntry);
+	info.hash = tag_hash;
+	info.hcxt = DistributedPlanCacheContext;
+	uint32 hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	DistributedPlanCache = hash_create("Distributed Plan Cache Hash", 32, &info,
+									   hashFlags);
+	CachedPlansGeneration = DistributedPlanCacheGeneration;
+}
+
+
+/*
+ * QueryCacheKey returns a string that identifies the given query tree and the
+ * types of its parameters. Repeated executions of a prepared statement produce
+ * the same query tree, including the locations of its tokens.
+ */
+static char *
+QueryCacheKey(Query *originalQuery, ParamListInfo boundParams)
+{
+	StringInfo queryKey = makeStringInfo();
+
+	appendStringInfoString(queryKey, nodeToString(originalQuery));
+
+	for (int paramIndex = 0; paramIndex < boundParams->numParams; paramIndex++)
+	{
+		appendStringInfo(queryKey, " %u", boundParams->params[paramIndex].ptype);
+	}
+
+	return queryKey->data;
+}
+
+
+/*
+ * StoreDistributedPlanTemplate keeps the given plan, which was created without
+ * parameter values, in the cache entry if it can be used for any parameter
+ * values. Otherwise, it remembers that the query is not cacheable.
+ */
+void
+StoreDistributedPlanTemplate(DistributedPlanCacheEntry *cacheEntry,
+							 PlannedStmt *localPlan, DistributedPlan *distributedPlan,
+							 PlannerRestrictionContext *plannerRestrictionContext)
+{
+	Job *workerJob = distributedPlan->workerJob;
+
+	cacheEntry->state = PLAN_CACHE_ENTRY_NOT_CACHEABLE;
+
+	if (distributedPlan->planningError != NULL ||
+		distributedPlan->subPlanList != NIL ||
+		workerJob == NULL ||
+		workerJob->dependentJobList != NIL ||
+		workerJob->taskList == NIL)
+	{
+		return;
+	}
+
+	List *deferredPruningList =
+		DeferredPruningRestrictionList(plannerRestrictionContext);
+
+	MemoryContext oldContext = MemoryContextSwitchTo(DistributedPlanCacheContext);
+
+	cacheEntry->localPlan = copyObject(localPlan);
+	cacheEntry->distributedPlan = copyObject(distributedPlan);
+	cacheEntry->deferredPruningList = NIL;
+
+	ListCell *restrictionCell = NULL;
+	foreach(restrictionCell, deferredPruningList)
+	{
+		DeferredPruningRestriction *restriction = lfirst(restrictionCell);
+		DeferredPruningRestriction *restrictionCopy =
+			palloc0(sizeof(DeferredPruningRestriction));
+
+		restrictionCopy->relationId = restriction->relationId;
+		restrictionCopy->rangeTableIndex = restriction->rangeTableIndex;
+		restrictionCopy->clauseList = copyObject(restriction->clauseList);
+
+		cacheEntry->deferredPruningList =
+			lappend(cacheEntry->deferredPruningList, restrictionCopy);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	cacheEntry->state = PLAN_CACHE_ENTRY_CACHED;
+}
+
+
+/*
+ * DeferredPruningRestrictionList returns the restrictions on hash-distributed
+ * tables that refer to parameters. The plan was created without pruning on
+ * them, so they are used to prune the tasks once the parameter values are
+ * known.
+ */
+static List *
+DeferredPruningRestrictionList(PlannerRestrictionContext *plannerRestrictionContext)
+{
+	List *deferredPruningList = NIL;
+	ListCell *relationRestrictionCell = NULL;
+	RelationRestrictionContext *relationRestrictionContext =
+		plannerRestrictionContext->relationRestrictionContext;
+
+	foreach(relationRestrictionCell, relationRestrictionContext->relationRestrictionList)
+	{
+		RelationRestriction *relationRestriction = lfirst(relationRestrictionCell);
+		Oid relationId = relationRestriction->relationId;
+
+		if (!relationRestriction->distributedRelation ||
+			PartitionMethod(relationId) != DISTRIBUTE_BY_HASH)
+		{
+			continue;
+		}
+
+		List *baseRestrictionList = relationRestriction->relOptInfo->baserestrictinfo;
+		List *clauseList = extract_actual_clauses(baseRestrictionList, false);
+
+		if (!ContainsExternParamWalker((Node *) clauseList, NULL))
+		{
+			continue;
+		}
+
+		DeferredPruningRestriction *restriction =
+			palloc0(sizeof(DeferredPruningRestriction));
+		restriction->relationId = relationId;
+		restriction->rangeTableIndex = relationRestriction->index;
+		restriction->clauseList = clauseList;
+
+		deferredPruningList = lappend(deferredPruningList, restriction);
+	}
+
+	return deferredPruningList;
+}
+
+
+/*
+ * DistributedPlanFromCache returns a copy of the cached plan, of which the
+ * tasks are pruned using the given parameter values. It returns NULL if all
+ * tasks are pruned, in which case the query is planned as usual.
+ */
+DistributedPlan *
+DistributedPlanFromCache(DistributedPlanCacheEntry *cacheEntry,
+						 ParamListInfo boundParams)
+{
+	Assert(cacheEntry->state == PLAN_CACHE_ENTRY_CACHED);
+
+	DistributedPlan *distributedPlan = copyObject(cacheEntry->distributedPlan);
+
+	if (!PruneCachedPlanTasks(distributedPlan, cacheEntry->deferredPruningList,
+							  boundParams))
+	{
+		return NULL;
+	}
+
+	return distributedPlan;
+}
+
+
+/*
+ * PruneCachedPlanTasks removes the tasks of the plan that the deferred
+ * pruning restrictions exclude for the given parameter values. Since all
+ * hash-distributed tables are co-located, a task is kept if the shard index
+ * of its anchor shard remains for all restrictions. It returns false if no
+ * tasks remain.
+ */
+static bool
+PruneCachedPlanTasks(DistributedPlan *distributedPlan, List *deferredPruningList,
+					 ParamListInfo boundParams)
+{
+	Job *workerJob = distributedPlan->workerJob;
+	Bitmapset *remainingShardIndexes = NULL;
+	ListCell *restrictionCell = NULL;
+	ListCell *taskCell = NULL;
+	List *prunedTaskList = NIL;
+
+	if (deferredPruningList == NIL)
+	{
+		return true;
+	}
+
+	/* force evaluation of bound params */
+	boundParams = copyParamList(boundParams);
+
+	foreach(restrictionCell, deferredPruningList)
+	{
+		DeferredPruningRestriction *restriction = lfirst(restrictionCell);
+		Bitmapset *shardIndexes = NULL;
+		ListCell *shardIntervalCell = NULL;
+
+		Node *clauses = ResolveExternalParams(
+			(Node *) copyObject(restriction->clauseList), boundParams);
+
+		/* fold e.g. arrays of parameters into constants that allow pruning */
+		List *clauseList = (List *) eval_const_expressions(NULL, clauses);
+		List *shardIntervalList = PruneShards(restriction->relationId,
+											  restriction->rangeTableIndex,
+											  clauseList, NULL);
+
+		foreach(shardIntervalCell, shardIntervalList)
+		{
+			ShardInterval *shardInterval = lfirst(shardIntervalCell);
+
+			shardIndexes = bms_add_member(shardIndexes, shardInterval->shardIndex);
+		}
+
+		if (restrictionCell == list_head(deferredPruningList))
+		{
+			remainingShardIndexes = shardIndexes;
+		}
+		else
+		{
+			remainingShardIndexes = bms_int_members(remainingShardIndexes,
+													shardIndexes);
+		}
+	}
+
+	foreach(taskCell, workerJob->taskList)
+	{
+		Task *task = lfirst(taskCell);
+		ShardInterval *anchorShardInterval = LoadShardInterval(task->anchorShardId);
+
+		if (PartitionMethod(anchorShardInterval->relationId) != DISTRIBUTE_BY_HASH ||
+			bms_is_member(anchorShardInterval->shardIndex, remainingShardIndexes))
+		{
+			prunedTaskList = lappend(prunedTaskList, task);
+		}
+	}
+
+	if (prunedTaskList == NIL)
+	{
+		return false;
+	}
+
+	workerJob->taskList = prunedTaskList;
+
+	return true;
+}
+
+
+/*
+ * RecordDistributedPlanningTime adds the time since planningStart to the
+ * planning statistics of the cache entry.
+ */
+void
+RecordDistributedPlanningTime(DistributedPlanCacheEntry *cacheEntry,
+							  instr_time planningStart, bool cacheHit)
+{
+	instr_time planningDuration;
+
+	INSTR_TIME_SET_CURRENT(planningDuration);
+	INSTR_TIME_SUBTRACT(planningDuration, planningStart);
+
+	cacheEntry->calls++;
+	cacheEntry->totalPlanningTime += INSTR_TIME_GET_MILLISEC(planningDuration);
+
+	if (cacheHit)
+	{
+		cacheEntry->cacheHits++;
+	}
+}
+
+
+/*
+ * InvalidateDistributedPlanCache makes the cached plans be dropped before the
+ * next query looks up the cache.
+ */
+void
+InvalidateDistributedPlanCache(void)
+{
+	DistributedPlanCacheGeneration++;
+}
@@ -19,6 +19,8 @@
 #include "catalog/pg_type.h"
 #include "distributed/citus_nodefuncs.h"
 #include "distributed/citus_nodes.h"
+#include "distributed/connection_management.h"
+#include "distributed/distributed_plan_cache.h"
 #include "distributed/function_call_delegation.h"
 #include "distributed/insert_select_planner.h"
 #include "distributed/intermediate_result_pruning.h"
@@ -36,6 +38,7 @@
 #include "distributed/multi_router_planner.h"
 #include "distributed/query_utils.h"
 #include "distributed/recursive_planning.h"
+#include "distributed/shared_connection_stats.h"
 #include "distributed/shardinterval_utils.h"
 #include "distributed/version_compat.h"
 #include "distributed/worker_shard_visibility.h"
@@ -71,6 +74,7 @@ static bool ListContainsDistributedTableRTE(List *rangeTableList);
 static bool IsUpdateOrDelete(Query *query);
 static PlannedStmt * CreateDistributedPlannedStmt(uint64 planId, PlannedStmt *localPlan,
 												  Query *originalQuery, Query *query,
+												  int cursorOptions,
 												  ParamListInfo boundParams,
 												  PlannerRestrictionContext *
 												  plannerRestrictionContext);
@@ -88,11 +92,21 @@ static int AssignRTEIdentities(List *rangeTableList, int rteIdCounter);
 static void AssignRTEIdentity(RangeTblEntry *rangeTableEntry, int rteIdentifier);
 static void AdjustPartitioningForDistributedPlanning(List *rangeTableList,
 													 bool setPartitionedTablesInherited);
+static PlannedStmt * PlanFromDistributedPlanCache(DistributedPlanCacheEntry *cacheEntry,
+												  Query *originalQuery, Query *query,
+												  int cursorOptions,
+												  ParamListInfo boundParams,
+												  int rteIdCounter,
+												  PlannerRestrictionContext *
+												  plannerRestrictionContext);
+static List * PlacementsToPrewarm(DistributedPlan *distributedPlan);
 static PlannedStmt * FinalizePlan(PlannedStmt *localPlan,
-								  DistributedPlan *distributedPlan);
+								  DistributedPlan *distributedPlan,
+								  int cursorOptions);
 static PlannedStmt * FinalizeNonRouterPlan(PlannedStmt *localPlan,
 										   DistributedPlan *distributedPlan,
-										   CustomScan *customScan);
+										   CustomScan *customScan,
+										   int cursorOptions);
 static PlannedStmt * FinalizeRouterPlan(PlannedStmt *localPlan, CustomScan *customScan);
 static int32 BlessRecordExpressionList(List *exprs);
 static void CheckNodeIsDumpable(Node *node);
@@ -128,6 +142,11 @@ distributed_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 	bool setPartitionedTablesInherited = false;
 	List *rangeTableList = ExtractRangeTableEntryList(parse);
 	int rteIdCounter = 1;
+	DistributedPlanCacheEntry *planCacheEntry = NULL;
+	bool planFromCache = false;
+	instr_time planningStart;
+
+	INSTR_TIME_SET_ZERO(planningStart);
 
 	if (cursorOptions & CURSOR_OPT_FORCE_DISTRIBUTED)
 	{
@@ -171,6 +190,9 @@ distributed_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 									"table.")));
 		}
 
+		/* the latency of the first distributed query includes planning */
+		MarkFirstDistributedQueryStart();
+
 		/*
 		 * standard_planner scribbles on it's input, but for deparsing we need the
 		 * unmodified form. Note that we keep RTE_RELATIONs with their identities
@@ -206,6 +228,30 @@ distributed_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 		 */
 		PlannerLevel++;
 
+		bool fastPathRouterQuery =
+			needsDistributedPlanning && FastPathRouterQuery(originalQuery);
+
+		/*
+		 * Multi-shard queries with parameters are otherwise planned again on
+		 * every execution, try to use a plan that works for any parameter
+		 * values instead. Plans of nested queries are not cached.
+		 */
+		if (needsDistributedPlanning && !fastPathRouterQuery && PlannerLevel == 1 &&
+			DistributedPlanCacheable(originalQuery, boundParams))
+		{
+			INSTR_TIME_SET_CURRENT(planningStart);
+
+			planCacheEntry = LookupDistributedPlanCacheEntry(originalQuery, boundParams);
+			if (planCacheEntry != NULL)
+			{
+				result = PlanFromDistributedPlanCache(planCacheEntry, originalQuery,
+													  parse, cursorOptions, boundParams,
+													  rteIdCounter,
+													  plannerRestrictionContext);
+				planFromCache = result != NULL;
+			}
+		}
+
 		/*
 		 * For trivial queries, we're skipping the standard_planner() in
 		 * order to eliminate its overhead.
@@ -215,7 +261,11 @@ distributed_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 		 * transformations made by postgres' planner.
 		 */
 
-		if (needsDistributedPlanning && FastPathRouterQuery(originalQuery))
+		if (planFromCache)
+		{
+			/* the plan was taken from the distributed plan cache */
+		}
+		else if (fastPathRouterQuery)
 		{
 			result = FastPathPlanner(originalQuery, parse, boundParams);
 		}
@@ -233,10 +283,14 @@ distributed_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 
 		if (needsDistributedPlanning)
 		{
-			uint64 planId = NextPlanId++;
+			if (!planFromCache)
+			{
+				uint64 planId = NextPlanId++;
 
-			result = CreateDistributedPlannedStmt(planId, result, originalQuery, parse,
-												  boundParams, plannerRestrictionContext);
+				result = CreateDistributedPlannedStmt(planId, result, originalQuery,
+													  parse, cursorOptions, boundParams,
+													  plannerRestrictionContext);
+			}
 
 			setPartitionedTablesInherited = true;
 			AdjustPartitioningForDistributedPlanning(rangeTableList,
@@ -249,7 +303,7 @@ distributed_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 																	  &hasExternParam);
 			if (delegatePlan != NULL)
 			{
-				result = FinalizePlan(result, delegatePlan);
+				result = FinalizePlan(result, delegatePlan, cursorOptions);
 			}
 			else if (hasExternParam)
 			{
@@ -277,6 +331,11 @@ distributed_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 	/* remove the context from the context list */
 	PopPlannerRestrictionContext();
 
+	if (planCacheEntry != NULL)
+	{
+		RecordDistributedPlanningTime(planCacheEntry, planningStart, planFromCache);
+	}
+
 	/*
 	 * In some cases, for example; parameterized SQL functions, we may miss that
 	 * there is a need for distributed planning. Such cases only become clear after
@@ -556,7 +615,7 @@ IsModifyDistributedPlan(DistributedPlan *distributedPlan)
  */
 static PlannedStmt *
 CreateDistributedPlannedStmt(uint64 planId, PlannedStmt *localPlan, Query *originalQuery,
-							 Query *query, ParamListInfo boundParams,
+							 Query *query, int cursorOptions, ParamListInfo boundParams,
 							 PlannerRestrictionContext *plannerRestrictionContext)
 {
 	bool hasUnresolvedParams = false;
@@ -618,7 +677,7 @@ CreateDistributedPlannedStmt(uint64 planId, PlannedStmt *localPlan, Query *origi
 	distributedPlan->planId = planId;
 
 	/* create final plan by combining local plan with distributed plan */
-	PlannedStmt *resultPlan = FinalizePlan(localPlan, distributedPlan);
+	PlannedStmt *resultPlan = FinalizePlan(localPlan, distributedPlan, cursorOptions);
 
 	/*
 	 * As explained above, force planning costs to be unrealistically high if
@@ -640,6 +699,74 @@ CreateDistributedPlannedStmt(uint64 planId, PlannedStmt *localPlan, Query *origi
 }
 
 
+/*
+ * PlanFromDistributedPlanCache returns a plan for the query based on the plan
+ * in the distributed plan cache, of which the tasks are pruned using the
+ * parameter values. If the entry is new, the plan is first created without the
+ * parameter values, such that the task queries refer to the parameters.
+ *
+ * The function returns NULL if the cached plan cannot be used, in which case
+ * the query should be planned as usual.
+ */
+static PlannedStmt *
+PlanFromDistributedPlanCache(DistributedPlanCacheEntry *cacheEntry, Query *originalQuery,
+							 Query *query, int cursorOptions, ParamListInfo boundParams,
+							 int rteIdCounter,
+							 PlannerRestrictionContext *plannerRestrictionContext)
+{
+	if (cacheEntry->state == PLAN_CACHE_ENTRY_NEW)
+	{
+		/* standard_planner and recursive planning scribble on their input */
+		Query *templateOriginalQuery = copyObject(originalQuery);
+		Query *templateQuery = copyObject(query);
+		JoinRestrictionContext *joinRestrictionContext = NULL;
+		uint64 planId = NextPlanId++;
+
+		PlannedStmt *localPlan = standard_planner(templateQuery, cursorOptions, NULL);
+
+		/* may've inlined new relation rtes */
+		AssignRTEIdentities(ExtractRangeTableEntryList(templateQuery), rteIdCounter);
+
+		joinRestrictionContext = plannerRestrictionContext->joinRestrictionContext;
+		plannerRestrictionContext->joinRestrictionContext =
+			RemoveDuplicateJoinRestrictions(joinRestrictionContext);
+
+		DistributedPlan *distributedPlan =
+			CreateDistributedPlan(planId, templateOriginalQuery, templateQuery, NULL,
+								  false, plannerRestrictionContext);
+
+		if (distributedPlan != NULL)
+		{
+			StoreDistributedPlanTemplate(cacheEntry, localPlan, distributedPlan,
+										 plannerRestrictionContext);
+		}
+		else
+		{
+			cacheEntry->state = PLAN_CACHE_ENTRY_NOT_CACHEABLE;
+		}
+
+		/* the restrictions are about the template, not about the query */
+		ResetPlannerRestrictionContext(plannerRestrictionContext);
+	}
+
+	if (cacheEntry->state != PLAN_CACHE_ENTRY_CACHED)
+	{
+		return NULL;
+	}
+
+	DistributedPlan *distributedPlan = DistributedPlanFromCache(cacheEntry, boundParams);
+	if (distributedPlan == NULL)
+	{
+		return NULL;
+	}
+
+	distributedPlan->planId = NextPlanId++;
+
+	return FinalizePlan(copyObject(cacheEntry->localPlan), distributedPlan,
+						cursorOptions);
+}
+
+
 /*
  * CreateDistributedPlan generates a distributed plan for a query.
  * It goes through 3 steps:
@@ -678,7 +805,8 @@ CreateDistributedPlan(uint64 planId, Query *originalQuery, Query *query, ParamLi
 			}
 
 			distributedPlan =
-				CreateInsertSelectPlan(planId, originalQuery, plannerRestrictionContext);
+				CreateInsertSelectPlan(planId, originalQuery, boundParams,
+									   plannerRestrictionContext);
 		}
 		else
 		{
@@ -1061,12 +1189,55 @@ GetDistributedPlan(CustomScan *customScan)
 }
 
 
+/*
+ * PlacementsToPrewarm returns the shard placements whose nodes the given plan
+ * connects to. Read-only tasks only use one of their placements, so only the
+ * first one is returned for them.
+ */
+static List *
+PlacementsToPrewarm(DistributedPlan *distributedPlan)
+{
+	List *placementList = NIL;
+	ListCell *taskCell = NULL;
+
+	if (distributedPlan->workerJob == NULL)
+	{
+		return NIL;
+	}
+
+	foreach(taskCell, distributedPlan->workerJob->taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		if (task->taskPlacementList == NIL)
+		{
+			continue;
+		}
+
+		if (ReadOnlyTask(task->taskType))
+		{
+			placementList = lappend(placementList,
+									linitial(task->taskPlacementList));
+		}
+		else
+		{
+			placementList = list_concat(placementList,
+										list_copy(task->taskPlacementList));
+		}
+	}
+
+	return placementList;
+}
+
+
 /*
  * FinalizePlan combines local plan with distributed plan and creates a plan
- * which can be run by the PostgreSQL executor.
+ * which can be run by the PostgreSQL executor. The cursor options of the
+ * planner call determine whether the plan may use parallel workers.
  */
 static PlannedStmt *
-FinalizePlan(PlannedStmt *localPlan, DistributedPlan *distributedPlan)
+FinalizePlan(PlannedStmt *localPlan, DistributedPlan *distributedPlan,
+			 int cursorOptions)
 {
 	PlannedStmt *finalPlan = NULL;
 	CustomScan *customScan = makeNode(CustomScan);
@@ -1118,6 +1289,16 @@ FinalizePlan(PlannedStmt *localPlan, DistributedPlan *distributedPlan)
 		}
 	}
 
+	/*
+	 * The first distributed query of a session may start connecting to the
+	 * nodes it accesses, such that they set up their backends while the
+	 * executor starts up.
+	 */
+	if (PrewarmConnections && executorType == MULTI_EXECUTOR_ADAPTIVE)
+	{
+		PrewarmWorkerConnections(PlacementsToPrewarm(distributedPlan));
+	}
+
 	distributedPlan->relationIdList = localPlan->relationOids;
 	distributedPlan->queryId = localPlan->queryId;
 
@@ -1128,7 +1309,8 @@ FinalizePlan(PlannedStmt *localPlan, DistributedPlan *distributedPlan)
 
 	if (distributedPlan->masterQuery)
 	{
-		finalPlan = FinalizeNonRouterPlan(localPlan, distributedPlan, customScan);
+		finalPlan = FinalizeNonRouterPlan(localPlan, distributedPlan, customScan,
+										  cursorOptions);
 	}
 	else
 	{
@@ -1146,9 +1328,10 @@ FinalizePlan(PlannedStmt *localPlan, DistributedPlan *distributedPlan)
  */
 static PlannedStmt *
 FinalizeNonRouterPlan(PlannedStmt *localPlan, DistributedPlan *distributedPlan,
-					  CustomScan *customScan)
+					  CustomScan *customScan, int cursorOptions)
 {
-	PlannedStmt *finalPlan = MasterNodeSelectPlan(distributedPlan, customScan);
+	PlannedStmt *finalPlan = MasterNodeSelectPlan(distributedPlan, customScan,
+												  cursorOptions);
 	finalPlan->queryId = localPlan->queryId;
 	finalPlan->utilityStmt = localPlan->utilityStmt;
 
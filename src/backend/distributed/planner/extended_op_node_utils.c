@@ -14,13 +14,17 @@
 #include "distributed/listutils.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_logical_optimizer.h"
+#include "distributed/multi_master_planner.h"
+#include "distributed/multi_server_executor.h"
 #include "distributed/pg_dist_partition.h"
 #if PG_VERSION_NUM >= 120000
 #include "optimizer/optimizer.h"
 #else
 #include "optimizer/var.h"
 #endif
+#include "optimizer/clauses.h"
 #include "optimizer/restrictinfo.h"
+#include "optimizer/tlist.h"
 #include "nodes/nodeFuncs.h"
 #include "nodes/pg_list.h"
 
@@ -34,6 +38,7 @@ static bool PartitionColumnInTableList(Var *column, List *tableNodeList);
 static bool ShouldPullDistinctColumn(bool repartitionSubquery,
 									 bool groupedByDisjointPartitionColumn,
 									 bool hasNonPartitionColumnDistinctAgg);
+static bool CanMergeSortedTaskResults(MultiExtendedOp *extendedOpNode);
 
 
 /*
@@ -68,6 +73,8 @@ BuildExtendedOpNodeProperties(MultiExtendedOp *extendedOpNode)
 	 */
 	bool pushDownWindowFunctions = extendedOpNode->hasWindowFuncs;
 
+	bool sortedMerge = CanMergeSortedTaskResults(extendedOpNode);
+
 	extendedOpNodeProperties.groupedByDisjointPartitionColumn =
 		groupedByDisjointPartitionColumn;
 	extendedOpNodeProperties.repartitionSubquery = repartitionSubquery;
@@ -75,11 +82,75 @@ BuildExtendedOpNodeProperties(MultiExtendedOp *extendedOpNode)
 		hasNonPartitionColumnDistinctAgg;
 	extendedOpNodeProperties.pullDistinctColumns = pullDistinctColumns;
 	extendedOpNodeProperties.pushDownWindowFunctions = pushDownWindowFunctions;
+	extendedOpNodeProperties.sortedMerge = sortedMerge;
 
 	return extendedOpNodeProperties;
 }
 
 
+/*
+ * CanMergeSortedTaskResults returns whether the ORDER BY of the given extended
+ * op node can be satisfied by merging the sorted results of the tasks on the
+ * coordinator, instead of sorting all of them. The worker query then sorts by
+ * the same clauses, and the master query does not sort. That is the case when
+ * the coordinator does not group, aggregate or otherwise process the rows
+ * between the remote scan and the sort, and all sort clauses are columns the
+ * workers return.
+ */
+static bool
+CanMergeSortedTaskResults(MultiExtendedOp *extendedOpNode)
+{
+	ListCell *sortClauseCell = NULL;
+
+	if (!EnableSortedMerge || extendedOpNode->sortClauseList == NIL)
+	{
+		return false;
+	}
+
+	/* only the adaptive executor keeps the task results apart */
+	if (TaskExecutorType != MULTI_EXECUTOR_ADAPTIVE)
+	{
+		return false;
+	}
+
+	/* only the extended op node at the top of the plan runs on the coordinator */
+	if (!CitusIsA(ParentNode((MultiNode *) extendedOpNode), MultiTreeRoot))
+	{
+		return false;
+	}
+
+	/* there should be no other plan nodes between the sort and the remote scan */
+	if (extendedOpNode->groupClauseList != NIL ||
+		extendedOpNode->distinctClause != NIL ||
+		extendedOpNode->hasWindowFuncs ||
+		contain_agg_clause((Node *) extendedOpNode->targetList) ||
+		contain_agg_clause(extendedOpNode->havingQual))
+	{
+		return false;
+	}
+
+	/*
+	 * The remote scan returns the non-junk worker columns as they are, and the
+	 * executor compares the rows by the columns of the sort clauses. Since the
+	 * coordinator neither groups nor aggregates, the master target list then
+	 * consists of the columns of the remote scan in the same order.
+	 */
+	foreach(sortClauseCell, extendedOpNode->sortClauseList)
+	{
+		SortGroupClause *sortClause = (SortGroupClause *) lfirst(sortClauseCell);
+		TargetEntry *targetEntry =
+			get_sortgroupclause_tle(sortClause, extendedOpNode->targetList);
+
+		if (targetEntry->resjunk)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
 /*
  * GroupedByPartitionColumn returns true if a GROUP BY in the opNode contains
  * the partition column of the underlying relation, which is determined by
@@ -16,6 +16,7 @@
 #include "distributed/colocation_utils.h"
 #include "distributed/errormessage.h"
 #include "distributed/log_utils.h"
+#include "distributed/insert_select_executor.h"
 #include "distributed/insert_select_planner.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_executor.h"
@@ -68,7 +69,8 @@ static DeferredErrorMessage * InsertPartitionColumnMatchesSelect(Query *query,
 																 subqueryRte,
 																 Oid *
 																 selectPartitionColumnTableId);
-static DistributedPlan * CreateCoordinatorInsertSelectPlan(uint64 planId, Query *parse);
+static DistributedPlan * CreateCoordinatorInsertSelectPlan(uint64 planId, Query *parse,
+														   ParamListInfo boundParams);
 static DeferredErrorMessage * CoordinatorInsertSelectSupported(Query *insertSelectQuery);
 static bool CheckInsertSelectQuery(Query *query);
 
@@ -176,7 +178,7 @@ CheckInsertSelectQuery(Query *query)
  * plan for evaluating the SELECT on the coordinator.
  */
 DistributedPlan *
-CreateInsertSelectPlan(uint64 planId, Query *originalQuery,
+CreateInsertSelectPlan(uint64 planId, Query *originalQuery, ParamListInfo boundParams,
 					   PlannerRestrictionContext *plannerRestrictionContext)
 {
 	DeferredErrorMessage *deferredError = ErrorIfOnConflictNotSupported(originalQuery);
@@ -194,7 +196,8 @@ CreateInsertSelectPlan(uint64 planId, Query *originalQuery,
 		RaiseDeferredError(distributedPlan->planningError, DEBUG1);
 
 		/* if INSERT..SELECT cannot be distributed, pull to coordinator */
-		distributedPlan = CreateCoordinatorInsertSelectPlan(planId, originalQuery);
+		distributedPlan = CreateCoordinatorInsertSelectPlan(planId, originalQuery,
+															boundParams);
 	}
 
 	return distributedPlan;
@@ -1100,9 +1103,12 @@ InsertPartitionColumnMatchesSelect(Query *query, RangeTblEntry *insertRte,
 /*
  * CreateCoordinatorInsertSelectPlan creates a query plan for a SELECT into a
  * distributed table. The query plan can also be executed on a worker in MX.
+ * Whether the SELECT results are repartitioned on the workers is decided here
+ * once, rather than on every execution.
  */
 static DistributedPlan *
-CreateCoordinatorInsertSelectPlan(uint64 planId, Query *parse)
+CreateCoordinatorInsertSelectPlan(uint64 planId, Query *parse,
+								  ParamListInfo boundParams)
 {
 	Query *insertSelectQuery = copyObject(parse);
 
@@ -1124,6 +1130,8 @@ CreateCoordinatorInsertSelectPlan(uint64 planId, Query *parse)
 	distributedPlan->hasReturning = insertSelectQuery->returningList != NIL;
 	distributedPlan->intermediateResultIdPrefix = InsertSelectResultIdPrefix(planId);
 	distributedPlan->targetRelationId = targetRelationId;
+	distributedPlan->insertSelectMethod = InsertSelectMethodForQuery(insertSelectQuery,
+																	 boundParams);
 
 	return distributedPlan;
 }
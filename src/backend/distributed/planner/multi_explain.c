@@ -22,6 +22,7 @@
 #include "optimizer/cost.h"
 #include "distributed/citus_nodefuncs.h"
 #include "distributed/connection_management.h"
+#include "distributed/deparse_shard_query.h"
 #include "distributed/insert_select_planner.h"
 #include "distributed/insert_select_executor.h"
 #include "distributed/listutils.h"
@@ -150,10 +151,29 @@ CoordinatorInsertSelectExplainScan(CustomScanState *node, List *ancestors,
 							   "... SELECT commands via the coordinator")));
 	}
 
+	bool repartition = distributedPlan->insertSelectMethod == INSERT_SELECT_REPARTITION;
+
+	ExplainPropertyText("INSERT/SELECT method", repartition ?
+						"repartition" : "pull to coordinator", es);
+
 	ExplainOpenGroup("Select Query", "Select Query", false, es);
 
-	/* explain the inner SELECT query */
-	ExplainOneQuery(query, 0, into, es, queryString, params, NULL);
+	if (repartition)
+	{
+		PlannedStmt *selectPlan = PlanRedistributedSelect(query, params);
+		instr_time planduration;
+
+		/* the planning time is not separated from the top-level plan */
+		INSTR_TIME_SET_CURRENT(planduration);
+		INSTR_TIME_SUBTRACT(planduration, planduration);
+
+		ExplainOnePlan(selectPlan, into, es, queryString, params, NULL, &planduration);
+	}
+	else
+	{
+		/* explain the inner SELECT query */
+		ExplainOneQuery(query, 0, into, es, queryString, params, NULL);
+	}
 
 	ExplainCloseGroup("Select Query", "Select Query", false, es);
 }
@@ -380,7 +400,7 @@ RemoteExplain(Task *task, ExplainState *es)
 
 	RemoteExplainPlan *remotePlan = (RemoteExplainPlan *) palloc0(
 		sizeof(RemoteExplainPlan));
-	StringInfo explainQuery = BuildRemoteExplainQuery(task->queryString, es);
+	StringInfo explainQuery = BuildRemoteExplainQuery(TaskQueryString(task), es);
 
 	/*
 	 * Use a coordinated transaction to ensure that we open a transaction block
@@ -146,6 +146,7 @@ typedef struct OrderByLimitReference
 	bool hasOrderByAggregate;
 	bool canApproximate;
 	bool hasDistinctOn;
+	bool sortedMerge;
 } OrderByLimitReference;
 
 
@@ -232,6 +233,7 @@ static void ProcessLimitOrderByForWorkerQuery(OrderByLimitReference orderByLimit
 											  QueryTargetList *queryTargetList);
 static OrderByLimitReference BuildOrderByLimitReference(bool hasDistinctOn, bool
 														groupedByDisjointPartitionColumn,
+														bool sortedMerge,
 														List *groupClause,
 														List *sortClauseList,
 														List *targetList);
@@ -255,7 +257,6 @@ static Oid AggregateArgumentType(Aggref *aggregate);
 static bool AggregateEnabledCustom(Aggref *aggregateExpression);
 static Oid CitusFunctionOidWithSignature(char *functionName, int numargs, Oid *argtypes);
 static Oid WorkerPartialAggOid(void);
-static Oid CoordCombineAggOid(void);
 static Oid AggregateFunctionOid(const char *functionName, Oid inputType);
 static Oid TypeOid(Oid schemaId, const char *typeName);
 static SortGroupClause * CreateSortGroupClause(Var *column);
@@ -1443,6 +1444,7 @@ MasterExtendedOpNode(MultiExtendedOp *originalOpNode,
 	masterExtendedOpNode->limitCount = originalOpNode->limitCount;
 	masterExtendedOpNode->limitOffset = originalOpNode->limitOffset;
 	masterExtendedOpNode->havingQual = newHavingQual;
+	masterExtendedOpNode->sortedMerge = extendedOpNodeProperties->sortedMerge;
 
 	return masterExtendedOpNode;
 }
@@ -2147,6 +2149,7 @@ WorkerExtendedOpNode(MultiExtendedOp *originalOpNode,
 		OrderByLimitReference limitOrderByReference =
 			BuildOrderByLimitReference(hasDistinctOn,
 									   groupedByDisjointPartitionColumn,
+									   extendedOpNodeProperties->sortedMerge,
 									   originalGroupClauseList,
 									   originalSortClauseList,
 									   originalTargetEntryList);
@@ -2532,7 +2535,8 @@ ProcessLimitOrderByForWorkerQuery(OrderByLimitReference orderByLimitReference,
  */
 static OrderByLimitReference
 BuildOrderByLimitReference(bool hasDistinctOn, bool groupedByDisjointPartitionColumn,
-						   List *groupClause, List *sortClauseList, List *targetList)
+						   bool sortedMerge, List *groupClause, List *sortClauseList,
+						   List *targetList)
 {
 	OrderByLimitReference limitOrderByReference;
 
@@ -2545,6 +2549,7 @@ BuildOrderByLimitReference(bool hasDistinctOn, bool groupedByDisjointPartitionCo
 		CanPushDownLimitApproximate(sortClauseList, targetList);
 	limitOrderByReference.hasOrderByAggregate =
 		HasOrderByAggregate(sortClauseList, targetList);
+	limitOrderByReference.sortedMerge = sortedMerge;
 
 	return limitOrderByReference;
 }
@@ -3186,7 +3191,7 @@ WorkerPartialAggOid()
 /*
  * CoordCombineAggOid looks up oid of pg_catalog.coord_combine_agg
  */
-static Oid
+Oid
 CoordCombineAggOid()
 {
 	Oid argtypes[] = {
@@ -4097,6 +4102,10 @@ WorkerLimitCount(Node *limitCount, Node *limitOffset, OrderByLimitReference
  * checks if we need to add any sorting and grouping clauses to the sort list we
  * push down for the limit. If we do, the function adds these clauses and
  * returns them. Otherwise, the function returns null.
+ *
+ * We also push down the order by clauses of queries without a limit if the
+ * coordinator merges the sorted task results instead of sorting all the rows
+ * (see CanMergeSortedTaskResults), and only then.
  */
 static List *
 WorkerSortClauseList(Node *limitCount, List *groupClauseList, List *sortClauseList,
@@ -4105,7 +4114,8 @@ WorkerSortClauseList(Node *limitCount, List *groupClauseList, List *sortClauseLi
 	List *workerSortClauseList = NIL;
 
 	/* if no limit node and no hasDistinctOn, no need to push down sort clauses */
-	if (limitCount == NULL && !orderByLimitReference.hasDistinctOn)
+	if (limitCount == NULL && !orderByLimitReference.hasDistinctOn &&
+		!orderByLimitReference.sortedMerge)
 	{
 		return NIL;
 	}
@@ -12,9 +12,13 @@
  */
 
 #include "postgres.h"
+#include "miscadmin.h"
 
+#include "access/parallel.h"
+#include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
 #include "commands/extension.h"
+#include "distributed/citus_custom_scan.h"
 #include "distributed/citus_ruleutils.h"
 #include "distributed/function_utils.h"
 #include "distributed/listutils.h"
@@ -46,9 +50,23 @@
 #include "utils/lsyscache.h"
 
 
+/* GUC, determining whether task results are merged rather than sorted */
+bool EnableSortedMerge = false;
+
+/* GUC, number of parallel workers that combine the aggregates on the coordinator */
+int MaxParallelCombineWorkers = 0;
+
+
 static List * MasterTargetList(List *workerTargetList);
+static bool CanCombineAggregatesInParallel(DistributedPlan *distributedPlan,
+										   CustomScan *remoteScan, int cursorOptions);
+static bool ParallelUnsafeFunctionWalker(Node *node, void *context);
+static bool ParallelUnsafeFunctionChecker(Oid functionId, void *context);
 static PlannedStmt * BuildSelectStatement(Query *masterQuery, List *masterTargetList,
-										  CustomScan *remoteScan);
+										  CustomScan *remoteScan, bool sortedMerge,
+										  bool parallelCombine);
+static Plan * BuildParallelCombinePlan(PlannerInfo *root, Agg *aggregationPlan,
+									   CustomScan *remoteScan);
 static Agg * BuildAggregatePlan(PlannerInfo *root, Query *masterQuery, Plan *subPlan);
 static bool HasDistinctAggregate(Query *masterQuery);
 static bool UseGroupAggregateWithHLL(Query *masterQuery);
@@ -65,10 +83,12 @@ static void FinalizeStatement(PlannerInfo *root, PlannedStmt *stmt, Plan *topLev
  * structure in the multi plan, and builds the final select plan to execute on
  * the tuples returned by remote scan on the master node. Note that this select
  * plan is executed after result files are retrieved from worker nodes and
- * filled into the tuple store inside provided custom scan.
+ * filled into the tuple store inside provided custom scan. The cursor options
+ * of the planner call determine whether parallel workers may be used.
  */
 PlannedStmt *
-MasterNodeSelectPlan(DistributedPlan *distributedPlan, CustomScan *remoteScan)
+MasterNodeSelectPlan(DistributedPlan *distributedPlan, CustomScan *remoteScan,
+					 int cursorOptions)
 {
 	Query *masterQuery = distributedPlan->masterQuery;
 
@@ -76,13 +96,156 @@ MasterNodeSelectPlan(DistributedPlan *distributedPlan, CustomScan *remoteScan)
 	List *workerTargetList = workerJob->jobQuery->targetList;
 	List *masterTargetList = MasterTargetList(workerTargetList);
 
+	bool parallelCombine = CanCombineAggregatesInParallel(distributedPlan, remoteScan,
+														  cursorOptions);
+
 	PlannedStmt *masterSelectPlan = BuildSelectStatement(masterQuery, masterTargetList,
-														 remoteScan);
+														 remoteScan,
+														 distributedPlan->sortedMerge,
+														 parallelCombine);
 
 	return masterSelectPlan;
 }
 
 
+/*
+ * CanCombineAggregatesInParallel returns whether the grouped aggregates of the
+ * master query can be combined by parallel workers on the coordinator. The
+ * custom scan then splits the task results by the hash of the group by
+ * columns, such that each worker combines a distinct set of groups.
+ *
+ * Since the coordinator runs the distributed execution in parallel mode, we
+ * only do that for read-only queries that do not need to execute subplans or
+ * repartition jobs first. Like standard_planner, we also only use parallel
+ * workers when the caller allows them and max_parallel_workers_per_gather is
+ * not 0.
+ */
+static bool
+CanCombineAggregatesInParallel(DistributedPlan *distributedPlan, CustomScan *remoteScan,
+							   int cursorOptions)
+{
+	Query *masterQuery = distributedPlan->masterQuery;
+	Job *workerJob = distributedPlan->workerJob;
+	ListCell *groupClauseCell = NULL;
+
+	if (MaxParallelCombineWorkers <= 0 || masterQuery->groupClause == NIL)
+	{
+		return false;
+	}
+
+	if ((cursorOptions & CURSOR_OPT_PARALLEL_OK) == 0 ||
+		max_parallel_workers_per_gather <= 0 ||
+		!IsUnderPostmaster || IsParallelWorker())
+	{
+		return false;
+	}
+
+	if (remoteScan->methods != &AdaptiveExecutorCustomScanMethods)
+	{
+		return false;
+	}
+
+	if (distributedPlan->modLevel != ROW_MODIFY_READONLY ||
+		distributedPlan->subPlanList != NIL ||
+		workerJob->dependentJobList != NIL)
+	{
+		return false;
+	}
+
+	if (masterQuery->groupingSets != NIL || masterQuery->hasWindowFuncs ||
+		masterQuery->hasTargetSRFs)
+	{
+		return false;
+	}
+
+	/* the scan computes the hash of the group by columns of its rows */
+	foreach(groupClauseCell, masterQuery->groupClause)
+	{
+		SortGroupClause *groupClause = (SortGroupClause *) lfirst(groupClauseCell);
+		TargetEntry *groupTargetEntry =
+			get_sortgroupclause_tle(groupClause, masterQuery->targetList);
+
+		if (!IsA(groupTargetEntry->expr, Var) || !groupClause->hashable)
+		{
+			return false;
+		}
+	}
+
+	if (ParallelUnsafeFunctionWalker((Node *) masterQuery->targetList, NULL) ||
+		ParallelUnsafeFunctionWalker(masterQuery->havingQual, NULL))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * ParallelUnsafeFunctionWalker returns true if the given expression calls a
+ * function that is not parallel safe, or contains a sublink or a parameter.
+ */
+static bool
+ParallelUnsafeFunctionWalker(Node *node, void *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, SubLink) || IsA(node, SubPlan) || IsA(node, Param))
+	{
+		return true;
+	}
+
+	if (check_functions_in_node(node, ParallelUnsafeFunctionChecker, context))
+	{
+		return true;
+	}
+
+	if (IsA(node, Aggref))
+	{
+		Aggref *aggregate = (Aggref *) node;
+
+		if (aggregate->aggfnoid == CoordCombineAggOid())
+		{
+			/*
+			 * coord_combine_agg only combines the partial results of its first
+			 * argument within the backend that runs it, hence it is as safe as
+			 * the aggregate it combines.
+			 */
+			TargetEntry *aggregateOidEntry = linitial(aggregate->args);
+			Const *aggregateOid = (Const *) aggregateOidEntry->expr;
+
+			if (!IsA(aggregateOid, Const) ||
+				func_parallel(DatumGetObjectId(aggregateOid->constvalue)) !=
+				PROPARALLEL_SAFE)
+			{
+				return true;
+			}
+		}
+	}
+
+	return expression_tree_walker(node, ParallelUnsafeFunctionWalker, context);
+}
+
+
+/*
+ * ParallelUnsafeFunctionChecker returns true if the given function is not
+ * marked as parallel safe. coord_combine_agg itself is checked by the caller.
+ */
+static bool
+ParallelUnsafeFunctionChecker(Oid functionId, void *context)
+{
+	if (functionId == CoordCombineAggOid())
+	{
+		return false;
+	}
+
+	return func_parallel(functionId) != PROPARALLEL_SAFE;
+}
+
+
 /*
  * MasterTargetList uses the given worker target list's expressions, and creates
  * a target list for the master node. This master target list keeps the
@@ -138,7 +301,8 @@ MasterTargetList(List *workerTargetList)
  * and limit plans on top of the scan statement if necessary.
  */
 static PlannedStmt *
-BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *remoteScan)
+BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *remoteScan,
+					 bool sortedMerge, bool parallelCombine)
 {
 	/* top level select query should have only one range table entry */
 	Assert(list_length(masterQuery->rtable) == 1);
@@ -173,6 +337,14 @@ BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *rem
 
 		aggregationPlan = BuildAggregatePlan(root, masterQuery, &remoteScan->scan.plan);
 		topLevelPlan = (Plan *) aggregationPlan;
+
+		/* only hashed aggregates can combine a subset of the groups each */
+		if (parallelCombine && aggregationPlan->aggstrategy == AGG_HASHED &&
+			root->glob->subplans == NIL)
+		{
+			topLevelPlan = BuildParallelCombinePlan(root, aggregationPlan, remoteScan);
+		}
+
 		selectStatement->planTree = topLevelPlan;
 	}
 	else
@@ -229,8 +401,11 @@ BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *rem
 		topLevelPlan = distinctPlan;
 	}
 
-	/* (4) add a sorting plan if needed */
-	if (sortClauseList)
+	/*
+	 * (4) add a sorting plan if needed, unless the remote scan merges the
+	 * sorted task results
+	 */
+	if (sortClauseList && !sortedMerge)
 	{
 		Sort *sortPlan = make_sort_from_sortclauses(sortClauseList, topLevelPlan);
 
@@ -460,6 +635,44 @@ BuildAggregatePlan(PlannerInfo *root, Query *masterQuery, Plan *subPlan)
 }
 
 
+/*
+ * BuildParallelCombinePlan puts a gather node on top of the given aggregate,
+ * such that parallel workers run the aggregate next to the coordinator
+ * backend. The remote scan is parallel aware, and each participant reads the
+ * rows of different groups from it. As for other gather nodes, the number of
+ * workers is limited by max_parallel_workers_per_gather.
+ */
+static Plan *
+BuildParallelCombinePlan(PlannerInfo *root, Agg *aggregationPlan, CustomScan *remoteScan)
+{
+	Gather *gatherPlan = makeNode(Gather);
+
+	remoteScan->scan.plan.parallel_aware = true;
+	remoteScan->scan.plan.parallel_safe = true;
+	aggregationPlan->plan.parallel_safe = true;
+
+	gatherPlan->plan.targetlist = aggregationPlan->plan.targetlist;
+	gatherPlan->plan.qual = NIL;
+	gatherPlan->plan.lefttree = (Plan *) aggregationPlan;
+	gatherPlan->plan.righttree = NULL;
+	gatherPlan->num_workers = Min(MaxParallelCombineWorkers,
+								  max_parallel_workers_per_gather);
+	gatherPlan->rescan_param = -1;
+	gatherPlan->single_copy = false;
+	gatherPlan->invisible = false;
+	gatherPlan->initParam = NULL;
+
+	/* just for reproducible costs between different PostgreSQL versions */
+	gatherPlan->plan.startup_cost = 0;
+	gatherPlan->plan.total_cost = 0;
+	gatherPlan->plan.plan_rows = 0;
+
+	root->glob->parallelModeNeeded = true;
+
+	return (Plan *) gatherPlan;
+}
+
+
 /*
  * HasDistinctAggregate returns true if the query has a distinct
  * aggregate in its target list or in having clause.
@@ -43,6 +43,7 @@
 #include "distributed/multi_logical_optimizer.h"
 #include "distributed/multi_logical_planner.h"
 #include "distributed/multi_physical_planner.h"
+#include "distributed/multi_server_executor.h"
 #include "distributed/log_utils.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/pg_dist_shard.h"
@@ -80,6 +81,9 @@
 int TaskAssignmentPolicy = TASK_ASSIGNMENT_GREEDY;
 bool EnableUniqueJobIds = true;
 
+/* whether merge tasks stream map outputs into their tables when possible */
+bool EnableRepartitionExchange = false;
+
 
 /*
  * OperatorCache is used for caching operator identifiers for given typeId,
@@ -142,7 +146,8 @@ static Task * QueryPushdownTaskCreate(Query *originalQuery, int shardIndex,
 									  RelationRestrictionContext *restrictionContext,
 									  uint32 taskId,
 									  TaskType taskType,
-									  bool modifyRequiresMasterEvaluation);
+									  bool modifyRequiresMasterEvaluation,
+									  char **taskQueryTemplate);
 static bool ShardIntervalsEqual(FmgrInfo *comparisonFunction,
 								Oid collation,
 								ShardInterval *firstInterval,
@@ -199,8 +204,12 @@ static StringInfo CreateMapQueryString(MapMergeJob *mapMergeJob, Task *filterTas
 static char * ColumnName(Var *column, List *rangeTableList);
 static StringInfo SplitPointArrayString(ArrayType *splitPointObject,
 										Oid columnType, int32 columnTypeMod);
+static bool UseRepartitionExchange(PlannerRestrictionContext *plannerRestrictionContext);
+static void MapOutputSourceArrayStrings(List *mapTaskList, StringInfo mapTaskIdArray,
+										StringInfo nodeNameArray,
+										StringInfo nodePortArray);
 static List * MergeTaskList(MapMergeJob *mapMergeJob, List *mapTaskList,
-							uint32 taskIdIndex);
+							uint32 taskIdIndex, bool useRepartitionExchange);
 static StringInfo ColumnNameArrayString(uint32 columnCount, uint64 generatingJobId);
 static StringInfo ColumnTypeArrayString(List *targetEntryList);
 static StringInfo MergeTableQueryString(uint32 taskIdIndex, List *targetEntryList);
@@ -231,9 +240,22 @@ CreatePhysicalDistributedPlan(MultiTreeRoot *multiTree,
 	List *masterDependentJobList = list_make1(workerJob);
 	Query *masterQuery = BuildJobQuery((MultiNode *) multiTree, masterDependentJobList);
 
+	/* the logical optimizer already decided whether the workers sort for a merge */
+	bool sortedMerge = false;
+	List *extendedOpNodeList = FindNodesOfType((MultiNode *) multiTree,
+											   T_MultiExtendedOp);
+	if (extendedOpNodeList != NIL)
+	{
+		MultiExtendedOp *masterExtendedOpNode =
+			(MultiExtendedOp *) linitial(extendedOpNodeList);
+
+		sortedMerge = masterExtendedOpNode->sortedMerge;
+	}
+
 	DistributedPlan *distributedPlan = CitusMakeNode(DistributedPlan);
 	distributedPlan->workerJob = workerJob;
 	distributedPlan->masterQuery = masterQuery;
+	distributedPlan->sortedMerge = sortedMerge;
 	distributedPlan->routerExecutable = DistributedPlanRouterExecutable(distributedPlan);
 	distributedPlan->modLevel = ROW_MODIFY_READONLY;
 
@@ -2023,6 +2045,8 @@ BuildJobTreeTaskList(Job *jobTree, PlannerRestrictionContext *plannerRestriction
 		jobStack = list_union_ptr(jobStack, job->dependentJobList);
 	}
 
+	bool useRepartitionExchange = UseRepartitionExchange(plannerRestrictionContext);
+
 	/*
 	 * We walk the job list in reverse order to visit jobs bottom up. This way,
 	 * we can create dependencies between tasks bottom up, and assign them to
@@ -2083,7 +2107,8 @@ BuildJobTreeTaskList(Job *jobTree, PlannerRestrictionContext *plannerRestriction
 			uint32 taskIdIndex = TaskListHighestTaskId(assignedSqlTaskList) + 1;
 
 			List *mapTaskList = MapTaskList(mapMergeJob, assignedSqlTaskList);
-			List *mergeTaskList = MergeTaskList(mapMergeJob, mapTaskList, taskIdIndex);
+			List *mergeTaskList = MergeTaskList(mapMergeJob, mapTaskList, taskIdIndex,
+												useRepartitionExchange);
 
 			mapMergeJob->mapTaskList = mapTaskList;
 			mapMergeJob->mergeTaskList = mergeTaskList;
@@ -2098,6 +2123,50 @@ BuildJobTreeTaskList(Job *jobTree, PlannerRestrictionContext *plannerRestriction
 }
 
 
+/*
+ * UseRepartitionExchange returns whether the merge tasks of the query should
+ * stream the partition files of their map tasks into their tables, rather
+ * than depending on map output fetch tasks that copy them to disk first. Only
+ * the adaptive executor can run such merge tasks, so we do not use them for
+ * queries that JobExecutorType sends to the task tracker executor.
+ */
+static bool
+UseRepartitionExchange(PlannerRestrictionContext *plannerRestrictionContext)
+{
+	List *relationIdList = NIL;
+	ListCell *relationRestrictionCell = NULL;
+
+	if (!EnableRepartitionExchange)
+	{
+		return false;
+	}
+
+	if (TaskExecutorType != MULTI_EXECUTOR_ADAPTIVE || !EnableRepartitionJoins)
+	{
+		return false;
+	}
+
+	if (plannerRestrictionContext == NULL)
+	{
+		return false;
+	}
+
+	RelationRestrictionContext *relationRestrictionContext =
+		plannerRestrictionContext->relationRestrictionContext;
+
+	foreach(relationRestrictionCell, relationRestrictionContext->relationRestrictionList)
+	{
+		RelationRestriction *relationRestriction =
+			(RelationRestriction *) lfirst(relationRestrictionCell);
+
+		relationIdList = list_append_unique_oid(relationIdList,
+												relationRestriction->relationId);
+	}
+
+	return !HasReplicatedDistributedTable(relationIdList);
+}
+
+
 /*
  * QueryPushdownSqlTaskList creates a list of SQL tasks to execute the given subquery
  * pushdown job. For this, it is being checked whether the query is router
@@ -2182,6 +2251,18 @@ QueryPushdownSqlTaskList(Query *query, uint64 jobId,
 		}
 	}
 
+	/*
+	 * The query strings of the tasks only differ in their shard names, so the
+	 * first task deparses the query into a template as well, and the other
+	 * tasks fill in their shard names instead of deparsing.
+	 */
+	char *taskQueryTemplate = NULL;
+	char **taskQueryTemplatePointer = NULL;
+	if (EnableTaskQueryTemplates)
+	{
+		taskQueryTemplatePointer = &taskQueryTemplate;
+	}
+
 	/*
 	 * To avoid iterating through all shards indexes we keep the minimum and maximum
 	 * offsets of shards that were not pruned away. This optimisation is primarily
@@ -2205,10 +2286,17 @@ QueryPushdownSqlTaskList(Query *query, uint64 jobId,
 													 relationRestrictionContext,
 													 taskIdIndex,
 													 taskType,
-													 modifyRequiresMasterEvaluation);
+													 modifyRequiresMasterEvaluation,
+													 taskQueryTemplatePointer);
 		subqueryTask->jobId = jobId;
 		sqlTaskList = lappend(sqlTaskList, subqueryTask);
 
+		if (taskQueryTemplate == NULL)
+		{
+			/* the first task could not build a template, deparse each task */
+			taskQueryTemplatePointer = NULL;
+		}
+
 		++taskIdIndex;
 	}
 
@@ -2339,15 +2427,19 @@ ErrorIfUnsupportedShardDistribution(Query *query)
 /*
  * SubqueryTaskCreate creates a sql task by replacing the target
  * shardInterval's boundary value.
+ *
+ * If taskQueryTemplate points to a template, the task refers to the template
+ * and its query string is only filled in when it is needed. If it points to
+ * NULL, the function deparses the query string and also stores a template for
+ * the next tasks in it.
  */
 static Task *
 QueryPushdownTaskCreate(Query *originalQuery, int shardIndex,
 						RelationRestrictionContext *restrictionContext, uint32 taskId,
-						TaskType taskType, bool modifyRequiresMasterEvaluation)
+						TaskType taskType, bool modifyRequiresMasterEvaluation,
+						char **taskQueryTemplate)
 {
-	Query *taskQuery = copyObject(originalQuery);
-
-	StringInfo queryString = makeStringInfo();
+	char *queryString = NULL;
 	ListCell *restrictionCell = NULL;
 	List *taskShardList = NIL;
 	List *relationShardList = NIL;
@@ -2424,38 +2516,69 @@ QueryPushdownTaskCreate(Query *originalQuery, int shardIndex,
 							   "shards in the query")));
 	}
 
-	/*
-	 * Augment the relations in the query with the shard IDs.
-	 */
-	UpdateRelationToShardNames((Node *) taskQuery, relationShardList);
-
-	/*
-	 * Ands are made implicit during shard pruning, as predicate comparison and
-	 * refutation depend on it being so. We need to make them explicit again so
-	 * that the query string is generated as (...) AND (...) as opposed to
-	 * (...), (...).
-	 */
-	if (taskQuery->jointree->quals != NULL && IsA(taskQuery->jointree->quals, List))
-	{
-		taskQuery->jointree->quals = (Node *) make_ands_explicit(
-			(List *) taskQuery->jointree->quals);
-	}
-
 	Task *subqueryTask = CreateBasicTask(jobId, taskId, taskType, NULL);
 
+	subqueryTask->relationShardList = relationShardList;
+
 	if ((taskType == MODIFY_TASK && !modifyRequiresMasterEvaluation) ||
 		taskType == SELECT_TASK)
 	{
-		pg_get_query_def(taskQuery, queryString);
-		ereport(DEBUG4, (errmsg("distributed statement: %s",
-								ApplyLogRedaction(queryString->data))));
-		subqueryTask->queryString = queryString->data;
+		if (taskQueryTemplate != NULL && *taskQueryTemplate != NULL &&
+			TaskQueryTemplateFits(*taskQueryTemplate, relationShardList))
+		{
+			/* the query string is only filled in when the task is executed */
+			SetTaskQueryTemplate(subqueryTask, *taskQueryTemplate);
+		}
+		else
+		{
+			Query *taskQuery = copyObject(originalQuery);
+			StringInfo taskQueryString = makeStringInfo();
+
+			/*
+			 * Augment the relations in the query with the shard IDs.
+			 */
+			UpdateRelationToShardNames((Node *) taskQuery, relationShardList);
+
+			/*
+			 * Ands are made implicit during shard pruning, as predicate comparison
+			 * and refutation depend on it being so. We need to make them explicit
+			 * again so that the query string is generated as (...) AND (...) as
+			 * opposed to (...), (...).
+			 */
+			if (taskQuery->jointree->quals != NULL &&
+				IsA(taskQuery->jointree->quals, List))
+			{
+				taskQuery->jointree->quals = (Node *) make_ands_explicit(
+					(List *) taskQuery->jointree->quals);
+			}
+
+			pg_get_query_def(taskQuery, taskQueryString);
+			queryString = taskQueryString->data;
+
+			if (taskQueryTemplate != NULL && *taskQueryTemplate == NULL)
+			{
+				*taskQueryTemplate = DeparseTaskQueryTemplate(taskQuery,
+															  relationShardList);
+
+				Assert(*taskQueryTemplate == NULL ||
+					   strcmp(FillTaskQueryTemplate(*taskQueryTemplate,
+													relationShardList),
+							  queryString) == 0);
+			}
+
+			subqueryTask->queryString = queryString;
+		}
+
+		if (IsLoggableLevel(DEBUG4))
+		{
+			ereport(DEBUG4, (errmsg("distributed statement: %s",
+									ApplyLogRedaction(TaskQueryString(subqueryTask)))));
+		}
 	}
 
 	subqueryTask->dependentTaskList = NULL;
 	subqueryTask->anchorShardId = anchorShardId;
 	subqueryTask->taskPlacementList = selectPlacementList;
-	subqueryTask->relationShardList = relationShardList;
 
 	return subqueryTask;
 }
@@ -2713,10 +2836,20 @@ SqlTaskList(Job *job)
 	List *fragmentCombinationList = FragmentCombinationList(rangeTableFragmentsList,
 															jobQuery, dependentJobList);
 
+	/*
+	 * When the tasks only read shards, their query strings only differ in the
+	 * shard names. We then deparse the query of the first task into a template
+	 * as well, from which the query strings of the other tasks are filled in
+	 * when they are needed.
+	 */
+	bool buildTaskQueryTemplate = EnableTaskQueryTemplates && dependentJobList == NIL;
+	char *taskQueryTemplate = NULL;
+
 	ListCell *fragmentCombinationCell = NULL;
 	foreach(fragmentCombinationCell, fragmentCombinationList)
 	{
 		List *fragmentCombination = (List *) lfirst(fragmentCombinationCell);
+		char *sqlQueryString = NULL;
 
 		/* create tasks to fetch fragments required for the sql task */
 		List *dataFetchTaskList = DataFetchTaskList(jobId, taskIdIndex,
@@ -2724,25 +2857,56 @@ SqlTaskList(Job *job)
 		int32 dataFetchTaskCount = list_length(dataFetchTaskList);
 		taskIdIndex += dataFetchTaskCount;
 
-		/* update range table entries with fragment aliases (in place) */
-		Query *taskQuery = copyObject(jobQuery);
-		List *fragmentRangeTableList = taskQuery->rtable;
-		UpdateRangeTableAlias(fragmentRangeTableList, fragmentCombination);
+		List *relationShardList = BuildRelationShardList(rangeTableList,
+														 fragmentCombination);
+
+		bool useTaskQueryTemplate =
+			taskQueryTemplate != NULL &&
+			TaskQueryTemplateFits(taskQueryTemplate, relationShardList);
 
-		/* transform the updated task query to a SQL query string */
-		StringInfo sqlQueryString = makeStringInfo();
-		pg_get_query_def(taskQuery, sqlQueryString);
+		if (!useTaskQueryTemplate)
+		{
+			/* update range table entries with fragment aliases (in place) */
+			Query *taskQuery = copyObject(jobQuery);
+			List *fragmentRangeTableList = taskQuery->rtable;
+			UpdateRangeTableAlias(fragmentRangeTableList, fragmentCombination);
+
+			/* transform the updated task query to a SQL query string */
+			StringInfo taskQueryString = makeStringInfo();
+			pg_get_query_def(taskQuery, taskQueryString);
+			sqlQueryString = taskQueryString->data;
+
+			if (buildTaskQueryTemplate)
+			{
+				taskQueryTemplate = DeparseTaskQueryTemplate(taskQuery,
+															 relationShardList);
+				buildTaskQueryTemplate = false;
+
+				Assert(taskQueryTemplate == NULL ||
+					   strcmp(FillTaskQueryTemplate(taskQueryTemplate,
+													relationShardList),
+							  sqlQueryString) == 0);
+			}
+		}
 
 		Task *sqlTask = CreateBasicTask(jobId, taskIdIndex, SELECT_TASK,
-										sqlQueryString->data);
+										sqlQueryString);
 		sqlTask->dependentTaskList = dataFetchTaskList;
-		sqlTask->relationShardList = BuildRelationShardList(fragmentRangeTableList,
-															fragmentCombination);
+		sqlTask->relationShardList = relationShardList;
+
+		if (useTaskQueryTemplate)
+		{
+			/* the query string is only filled in when the task is executed */
+			SetTaskQueryTemplate(sqlTask, taskQueryTemplate);
+		}
 
 		/* log the query string we generated */
-		ereport(DEBUG4, (errmsg("generated sql query for task %d", sqlTask->taskId),
-						 errdetail("query string: \"%s\"",
-								   ApplyLogRedaction(sqlQueryString->data))));
+		if (IsLoggableLevel(DEBUG4))
+		{
+			ereport(DEBUG4, (errmsg("generated sql query for task %d", sqlTask->taskId),
+							 errdetail("query string: \"%s\"",
+									   ApplyLogRedaction(TaskQueryString(sqlTask)))));
+		}
 
 		sqlTask->anchorShardId = INVALID_SHARD_ID;
 		if (anchorRangeTableBasedAssignment)
@@ -4220,7 +4384,7 @@ CreateMapQueryString(MapMergeJob *mapMergeJob, Task *filterTask,
 
 	/* wrap repartition query string around filter query string */
 	StringInfo mapQueryString = makeStringInfo();
-	char *filterQueryString = filterTask->queryString;
+	char *filterQueryString = TaskQueryString(filterTask);
 	char *filterQueryEscapedText = quote_literal_cstr(filterQueryString);
 	PartitionType partitionType = mapMergeJob->partitionType;
 
@@ -4412,13 +4576,21 @@ SplitPointArrayString(ArrayType *splitPointObject, Oid columnType, int32 columnT
  * MergeTaskList creates a list of merge tasks for the given MapMerge job. While
  * doing this, the function also establishes dependencies between each merge
  * task and its downstream map task dependencies by creating "map fetch" tasks.
+ *
+ * If useRepartitionExchange is set and the merge tasks do not run a reduce
+ * query, the merge tasks instead stream the map outputs into their tables
+ * themselves, and directly depend on the map tasks.
  */
 static List *
-MergeTaskList(MapMergeJob *mapMergeJob, List *mapTaskList, uint32 taskIdIndex)
+MergeTaskList(MapMergeJob *mapMergeJob, List *mapTaskList, uint32 taskIdIndex,
+			  bool useRepartitionExchange)
 {
 	List *mergeTaskList = NIL;
 	uint64 jobId = mapMergeJob->job.jobId;
 	uint32 partitionCount = mapMergeJob->partitionCount;
+	StringInfo mapTaskIdArray = makeStringInfo();
+	StringInfo nodeNameArray = makeStringInfo();
+	StringInfo nodePortArray = makeStringInfo();
 
 	/* build column name and column type arrays (table schema) */
 	Query *filterQuery = mapMergeJob->job.jobQuery;
@@ -4430,6 +4602,15 @@ MergeTaskList(MapMergeJob *mapMergeJob, List *mapTaskList, uint32 taskIdIndex)
 		return NIL;
 	}
 
+	/* merge tasks that run a reduce query still read fetched partition files */
+	bool streamMapOutputs = useRepartitionExchange &&
+							mapMergeJob->reduceQuery == NULL;
+	if (streamMapOutputs)
+	{
+		MapOutputSourceArrayStrings(mapTaskList, mapTaskIdArray, nodeNameArray,
+									nodePortArray);
+	}
+
 	/*
 	 * XXX: We currently ignore the 0th partition bucket that range partitioning
 	 * generates. This bucket holds all values less than the minimum value or
@@ -4465,8 +4646,19 @@ MergeTaskList(MapMergeJob *mapMergeJob, List *mapTaskList, uint32 taskIdIndex)
 			StringInfo columnTypes = ColumnTypeArrayString(targetEntryList);
 
 			StringInfo mergeQueryString = makeStringInfo();
-			appendStringInfo(mergeQueryString, MERGE_FILES_INTO_TABLE_COMMAND,
-							 jobId, taskIdIndex, columnNames->data, columnTypes->data);
+			if (streamMapOutputs)
+			{
+				appendStringInfo(mergeQueryString, MERGE_MAP_OUTPUTS_INTO_TABLE_COMMAND,
+								 jobId, taskIdIndex, columnNames->data,
+								 columnTypes->data, partitionId, mapTaskIdArray->data,
+								 nodeNameArray->data, nodePortArray->data);
+			}
+			else
+			{
+				appendStringInfo(mergeQueryString, MERGE_FILES_INTO_TABLE_COMMAND,
+								 jobId, taskIdIndex, columnNames->data,
+								 columnTypes->data);
+			}
 
 			/* create merge task */
 			mergeTask = CreateBasicTask(jobId, mergeTaskId, MERGE_TASK,
@@ -4494,8 +4686,12 @@ MergeTaskList(MapMergeJob *mapMergeJob, List *mapTaskList, uint32 taskIdIndex)
 		mergeTask->partitionId = partitionId;
 		taskIdIndex++;
 
-		/* create tasks to fetch map outputs to this merge task */
-		foreach(mapTaskCell, mapTaskList)
+		/*
+		 * Create tasks to fetch map outputs to this merge task, unless the merge
+		 * task streams the map outputs itself.
+		 */
+		List *fetchedMapTaskList = streamMapOutputs ? NIL : mapTaskList;
+		foreach(mapTaskCell, fetchedMapTaskList)
 		{
 			Task *mapTask = (Task *) lfirst(mapTaskCell);
 
@@ -4529,8 +4725,15 @@ MergeTaskList(MapMergeJob *mapMergeJob, List *mapTaskList, uint32 taskIdIndex)
 			mapOutputFetchTaskList = lappend(mapOutputFetchTaskList, mapOutputFetchTask);
 		}
 
-		/* merge task depends on completion of fetch tasks */
-		mergeTask->dependentTaskList = mapOutputFetchTaskList;
+		/* merge task depends on completion of fetch tasks, or of the map tasks */
+		if (streamMapOutputs)
+		{
+			mergeTask->dependentTaskList = list_copy(mapTaskList);
+		}
+		else
+		{
+			mergeTask->dependentTaskList = mapOutputFetchTaskList;
+		}
 
 		/* if single repartitioned, each merge task represents an interval */
 		if (mapMergeJob->partitionType == RANGE_PARTITION_TYPE)
@@ -4557,6 +4760,49 @@ MergeTaskList(MapMergeJob *mapMergeJob, List *mapTaskList, uint32 taskIdIndex)
 }
 
 
+/*
+ * MapOutputSourceArrayStrings builds the array string representations of the
+ * task ids of the given map tasks, and of the names and ports of the nodes
+ * from which their outputs are fetched. Like map output fetch tasks, we use
+ * the first placement of each map task.
+ */
+static void
+MapOutputSourceArrayStrings(List *mapTaskList, StringInfo mapTaskIdArray,
+							StringInfo nodeNameArray, StringInfo nodePortArray)
+{
+	ListCell *mapTaskCell = NULL;
+	bool firstMapTask = true;
+
+	appendStringInfoString(mapTaskIdArray, "ARRAY[");
+	appendStringInfoString(nodeNameArray, "ARRAY[");
+	appendStringInfoString(nodePortArray, "ARRAY[");
+
+	foreach(mapTaskCell, mapTaskList)
+	{
+		Task *mapTask = (Task *) lfirst(mapTaskCell);
+		ShardPlacement *mapTaskPlacement = linitial(mapTask->taskPlacementList);
+
+		if (!firstMapTask)
+		{
+			appendStringInfoString(mapTaskIdArray, ",");
+			appendStringInfoString(nodeNameArray, ",");
+			appendStringInfoString(nodePortArray, ",");
+		}
+
+		appendStringInfo(mapTaskIdArray, "%u", mapTask->taskId);
+		appendStringInfoString(nodeNameArray,
+							   quote_literal_cstr(mapTaskPlacement->nodeName));
+		appendStringInfo(nodePortArray, "%u", mapTaskPlacement->nodePort);
+
+		firstMapTask = false;
+	}
+
+	appendStringInfoString(mapTaskIdArray, "]::integer[]");
+	appendStringInfoString(nodeNameArray, "]::text[]");
+	appendStringInfoString(nodePortArray, "]::integer[]");
+}
+
+
 /*
  * ColumnNameArrayString creates a list of column names for a merged table, and
  * outputs this list of column names in their (array) string representation.
@@ -1583,6 +1583,8 @@ CreateTask(TaskType taskType)
 	task->jobId = INVALID_JOB_ID;
 	task->taskId = INVALID_TASK_ID;
 	task->queryString = NULL;
+	task->queryTemplate = NULL;
+	task->shardQuery = NULL;
 	task->anchorShardId = INVALID_SHARD_ID;
 	task->taskPlacementList = NIL;
 	task->dependentTaskList = NIL;
@@ -1816,6 +1818,10 @@ RemoveCoordinatorPlacement(List *placementList)
 /*
  * SingleShardSelectTaskList generates a task for single shard select query
  * and returns it as a list.
+ *
+ * The task keeps the query, whose relations have been updated to shards, and
+ * its query string is only deparsed when it is sent to a worker. When the
+ * task is executed locally, the local executor plans the query instead.
  */
 static List *
 SingleShardSelectTaskList(Query *query, uint64 jobId, List *relationShardList,
@@ -1823,13 +1829,11 @@ SingleShardSelectTaskList(Query *query, uint64 jobId, List *relationShardList,
 						  uint64 shardId)
 {
 	Task *task = CreateTask(SELECT_TASK);
-	StringInfo queryString = makeStringInfo();
 	List *relationRowLockList = NIL;
 
 	RowLocksOnRelations((Node *) query, &relationRowLockList);
-	pg_get_query_def(query, queryString);
 
-	task->queryString = queryString->data;
+	task->shardQuery = query;
 	task->anchorShardId = shardId;
 	task->jobId = jobId;
 	task->taskPlacementList = placementList;
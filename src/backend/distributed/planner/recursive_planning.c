@@ -59,6 +59,7 @@
 #include "distributed/commands/multi_copy.h"
 #include "distributed/distributed_planner.h"
 #include "distributed/errormessage.h"
+#include "distributed/listutils.h"
 #include "distributed/log_utils.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_logical_planner.h"
@@ -176,6 +177,10 @@ static bool ContainsReferencesToOuterQueryWalker(Node *node,
 static void WrapFunctionsInSubqueries(Query *query);
 static void TransformFunctionRTE(RangeTblEntry *rangeTblEntry);
 static bool ShouldTransformRTE(RangeTblEntry *rangeTableEntry);
+static Query * BuildReadIntermediateResultsQuery(List *targetEntryList,
+												 List *columnAliasList,
+												 Const *resultIdConst, Oid functionOid,
+												 bool useBinaryCopyFormat);
 
 /*
  * GenerateSubplansForSubqueriesAndCTEs is a wrapper around RecursivelyPlanSubqueriesAndCTEs.
@@ -1541,6 +1546,81 @@ ShouldTransformRTE(RangeTblEntry *rangeTableEntry)
  */
 Query *
 BuildSubPlanResultQuery(List *targetEntryList, List *columnAliasList, char *resultId)
+{
+	Oid functionOid = CitusReadIntermediateResultFuncId();
+	bool useBinaryCopyFormat = CanUseBinaryCopyFormatForTargetList(targetEntryList);
+
+	Const *resultIdConst = makeNode(Const);
+	resultIdConst->consttype = TEXTOID;
+	resultIdConst->consttypmod = -1;
+	resultIdConst->constlen = -1;
+	resultIdConst->constvalue = CStringGetTextDatum(resultId);
+	resultIdConst->constbyval = false;
+	resultIdConst->constisnull = false;
+	resultIdConst->location = -1;
+
+	return BuildReadIntermediateResultsQuery(targetEntryList, columnAliasList,
+											 resultIdConst, functionOid,
+											 useBinaryCopyFormat);
+}
+
+
+/*
+ * BuildReadIntermediateResultsArrayQuery returns a query of the form:
+ *
+ * SELECT
+ *   <target list>
+ * FROM
+ *   read_intermediate_results(ARRAY['<resultId>', ...]::text[], '<copy format'>)
+ *   AS res (<column definition list>);
+ *
+ * The caller decides on the copy format, since it has to match the format in
+ * which the results were written.
+ */
+Query *
+BuildReadIntermediateResultsArrayQuery(List *targetEntryList, List *columnAliasList,
+									   List *resultIdList, bool useBinaryCopyFormat)
+{
+	Oid functionOid = CitusReadIntermediateResultArrayFuncId();
+	int resultIdCount = list_length(resultIdList);
+	Datum *resultIdArray = palloc0(resultIdCount * sizeof(Datum));
+	ListCell *resultIdCell = NULL;
+	int resultIdIndex = 0;
+
+	foreach(resultIdCell, resultIdList)
+	{
+		char *resultId = (char *) lfirst(resultIdCell);
+
+		resultIdArray[resultIdIndex++] = CStringGetTextDatum(resultId);
+	}
+
+	ArrayType *resultIdArrayObject = DatumArrayToArrayType(resultIdArray, resultIdCount,
+														   TEXTOID);
+
+	Const *resultIdConst = makeNode(Const);
+	resultIdConst->consttype = TEXTARRAYOID;
+	resultIdConst->consttypmod = -1;
+	resultIdConst->constlen = -1;
+	resultIdConst->constvalue = PointerGetDatum(resultIdArrayObject);
+	resultIdConst->constbyval = false;
+	resultIdConst->constisnull = false;
+	resultIdConst->location = -1;
+
+	return BuildReadIntermediateResultsQuery(targetEntryList, columnAliasList,
+											 resultIdConst, functionOid,
+											 useBinaryCopyFormat);
+}
+
+
+/*
+ * BuildReadIntermediateResultsQuery is the common code for generating
+ * queries to read from result files. It is used by
+ * BuildReadIntermediateResultsArrayQuery and BuildSubPlanResultQuery.
+ */
+static Query *
+BuildReadIntermediateResultsQuery(List *targetEntryList, List *columnAliasList,
+								  Const *resultIdConst, Oid functionOid,
+								  bool useBinaryCopyFormat)
 {
 	List *funcColNames = NIL;
 	List *funcColTypes = NIL;
@@ -1549,7 +1629,6 @@ BuildSubPlanResultQuery(List *targetEntryList, List *columnAliasList, char *resu
 	ListCell *targetEntryCell = NULL;
 	List *targetList = NIL;
 	int columnNumber = 1;
-	bool useBinaryCopyFormat = true;
 	Oid copyFormatId = BinaryCopyFormatId();
 	int columnAliasCount = list_length(columnAliasList);
 
@@ -1608,23 +1687,9 @@ BuildSubPlanResultQuery(List *targetEntryList, List *columnAliasList, char *resu
 
 		targetList = lappend(targetList, newTargetEntry);
 
-		if (useBinaryCopyFormat && !CanUseBinaryCopyFormatForType(columnType))
-		{
-			useBinaryCopyFormat = false;
-		}
-
 		columnNumber++;
 	}
 
-	Const *resultIdConst = makeNode(Const);
-	resultIdConst->consttype = TEXTOID;
-	resultIdConst->consttypmod = -1;
-	resultIdConst->constlen = -1;
-	resultIdConst->constvalue = CStringGetTextDatum(resultId);
-	resultIdConst->constbyval = false;
-	resultIdConst->constisnull = false;
-	resultIdConst->location = -1;
-
 	/* build the citus_copy_format parameter for the call to read_intermediate_result */
 	if (!useBinaryCopyFormat)
 	{
@@ -1642,7 +1707,7 @@ BuildSubPlanResultQuery(List *targetEntryList, List *columnAliasList, char *resu
 
 	/* build the call to read_intermediate_result */
 	FuncExpr *funcExpr = makeNode(FuncExpr);
-	funcExpr->funcid = CitusReadIntermediateResultFuncId();
+	funcExpr->funcid = functionOid;
 	funcExpr->funcretset = true;
 	funcExpr->funcvariadic = false;
 	funcExpr->funcformat = 0;
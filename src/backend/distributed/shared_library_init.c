@@ -30,8 +30,12 @@
 #include "distributed/commands/multi_copy.h"
 #include "distributed/commands/utility_hook.h"
 #include "distributed/connection_management.h"
+#include "distributed/deparse_shard_query.h"
 #include "distributed/distributed_deadlock_detection.h"
+#include "distributed/distributed_plan_cache.h"
+#include "distributed/insert_select_executor.h"
 #include "distributed/intermediate_result_pruning.h"
+#include "distributed/intermediate_results.h"
 #include "distributed/local_executor.h"
 #include "distributed/maintenanced.h"
 #include "distributed/master_metadata_utility.h"
@@ -42,18 +46,22 @@
 #include "distributed/multi_explain.h"
 #include "distributed/multi_join_order.h"
 #include "distributed/multi_logical_optimizer.h"
+#include "distributed/multi_master_planner.h"
 #include "distributed/distributed_planner.h"
 #include "distributed/multi_router_planner.h"
 #include "distributed/multi_server_executor.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/placement_connection.h"
+#include "distributed/prepared_statement_cache.h"
 #include "distributed/relation_access_tracking.h"
 #include "distributed/run_from_same_connection.h"
 #include "distributed/query_pushdown_planning.h"
 #include "distributed/time_constants.h"
 #include "distributed/query_stats.h"
 #include "distributed/remote_commands.h"
+#include "distributed/shared_connection_stats.h"
 #include "distributed/shared_library_init.h"
+#include "distributed/shared_metadata_cache.h"
 #include "distributed/statistics_collection.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/task_tracker.h"
@@ -64,6 +72,7 @@
 #include "distributed/worker_shard_visibility.h"
 #include "distributed/adaptive_executor.h"
 #include "port/atomics.h"
+#include "postmaster/bgworker.h"
 #include "postmaster/postmaster.h"
 #include "optimizer/planner.h"
 #include "optimizer/paths.h"
@@ -247,6 +256,8 @@ _PG_init(void)
 	InitializeTransactionManagement();
 	InitializeBackendManagement();
 	InitializeConnectionManagement();
+	InitializeSharedConnectionStats();
+	InitializeSharedMetadataCache();
 	InitPlacementConnectionManagement();
 	InitializeCitusQueryStats();
 
@@ -418,6 +429,36 @@ RegisterCitusConfigVariables(void)
 		GUC_STANDARD,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_copy_passthrough",
+		gettext_noop("Enables passing COPY rows to the shards without parsing them."),
+		gettext_noop("When enabled, COPY into a hash-distributed table in text or "
+					 "csv format only parses the distribution column of each row "
+					 "on the coordinator to find its shard, and sends the other "
+					 "fields to the workers as they are. Values of the other "
+					 "columns are then only validated by the workers."),
+		&EnableCopyPassthrough,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_repartitioned_insert_select",
+		gettext_noop("Enables repartitioning the results of INSERT ... SELECT on "
+					 "the workers."),
+		gettext_noop("When enabled, an INSERT ... SELECT that cannot be pushed down "
+					 "partitions the results of the SELECT tasks on the workers "
+					 "by the shards of the target table, moves the partitions "
+					 "directly between the workers, and inserts them into the "
+					 "target shards, instead of pulling all rows through the "
+					 "coordinator."),
+		&EnableRepartitionedInsertSelect,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.expire_cached_shards",
 		gettext_noop("This GUC variable has been deprecated."),
@@ -460,6 +501,23 @@ RegisterCitusConfigVariables(void)
 		GUC_NO_SHOW_ALL,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.max_cached_distributed_plans",
+		gettext_noop("Sets the maximum number of distributed plans of parameterized "
+					 "queries to keep per session. Setting to 0 disables the "
+					 "distributed plan cache."),
+		gettext_noop("Multi-shard SELECT queries with parameters are otherwise "
+					 "planned again on every execution. When enabled, simple "
+					 "queries on co-located tables are planned once without the "
+					 "parameter values, and later executions only prune the "
+					 "tasks using the parameter values. Once the limit is "
+					 "reached, all cached plans are dropped."),
+		&MaxCachedDistributedPlans,
+		0, 0, INT_MAX,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.override_table_visibility",
 		gettext_noop("Enables replacing occurencens of pg_catalog.pg_table_visible() "
@@ -699,6 +757,122 @@ RegisterCitusConfigVariables(void)
 		GUC_UNIT_MS | GUC_NO_SHOW_ALL,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_binary_protocol",
+		gettext_noop("Enables requesting the results of SELECT queries from the "
+					 "workers in binary format"),
+		gettext_noop("When enabled, the adaptive executor asks the workers to send "
+					 "the results of read-only tasks in PostgreSQL's binary format "
+					 "and decodes them with the receive functions of the column "
+					 "types, which avoids the cost of the type input functions on "
+					 "the coordinator. If any of the result columns cannot be sent "
+					 "in binary format, the text format is used."),
+		&EnableBinaryProtocol,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.executor_fetch_batch_size",
+		gettext_noop("Sets the number of rows the executor fetches from a worker "
+					 "at once"),
+		gettext_noop("When libpq supports chunked mode (PostgreSQL 17 and later), "
+					 "libpq returns up to this many rows of a task in a single "
+					 "result, which saves an allocation per row. With an older "
+					 "libpq, rows are still fetched one at a time and the setting "
+					 "only makes the executor clean up after this many rows "
+					 "instead of after each of them."),
+		&ExecutorFetchBatchSize,
+		1, 1, 1000000,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_streaming_execution",
+		gettext_noop("Enables returning rows of multi-shard SELECTs while "
+					 "they arrive"),
+		gettext_noop("By default, the adaptive executor writes all the rows it "
+					 "receives from the workers into a tuple store before "
+					 "returning the first row. When enabled, read-only queries "
+					 "outside of transaction blocks that do not sort, group or "
+					 "aggregate on the coordinator return rows as soon as a "
+					 "worker sends them, and the executor stops reading from "
+					 "the workers while the rows are being consumed."),
+		&EnableStreamingExecution,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_early_limit_termination",
+		gettext_noop("Enables stopping multi-shard SELECTs with a LIMIT once "
+					 "enough rows arrived"),
+		gettext_noop("When enabled, read-only queries outside of transaction "
+					 "blocks that only apply a LIMIT on the coordinator stop "
+					 "starting new tasks and cancel the running ones as soon as "
+					 "the workers returned as many rows as the LIMIT and OFFSET "
+					 "require, instead of running all the tasks to completion."),
+		&EnableEarlyLimitTermination,
+		true,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_coalesced_tasks",
+		gettext_noop("Sets the maximum number of tasks the executor sends to a "
+					 "worker in a single request"),
+		gettext_noop("By default, the adaptive executor sends the command of each "
+					 "task separately and waits for its results before sending the "
+					 "next command over the same connection, which costs a network "
+					 "round trip per task. When set to a value larger than 1, the "
+					 "executor sends the commands of up to this many ready SELECT "
+					 "and DML tasks without parameters to a worker at once, and "
+					 "receives their results one after the other."),
+		&MaxCoalescedTasks,
+		1, 1, 1024,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_sorted_merge",
+		gettext_noop("Enables merging the sorted results of the tasks of "
+					 "multi-shard SELECTs with an ORDER BY"),
+		gettext_noop("By default, the coordinator sorts all the rows of a "
+					 "multi-shard query with an ORDER BY after receiving them. "
+					 "When enabled, queries that do not group or aggregate on "
+					 "the coordinator push the ORDER BY down to the workers, and "
+					 "the coordinator merges the sorted results of the tasks "
+					 "while returning the rows."),
+		&EnableSortedMerge,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_parallel_combine_workers",
+		gettext_noop("Sets the number of parallel workers that combine the "
+					 "aggregates of multi-shard GROUP BY queries on the "
+					 "coordinator"),
+		gettext_noop("By default, the coordinator backend combines the partial "
+					 "aggregates of all groups that the workers return. When set "
+					 "to a value larger than 0, read-only queries whose GROUP BY "
+					 "can be hashed split the rows by group between the "
+					 "coordinator backend and up to this many parallel workers, "
+					 "which combine the aggregates of their groups at the same "
+					 "time. The number of workers is also limited by "
+					 "max_parallel_workers."),
+		&MaxParallelCombineWorkers,
+		0, 0, MAX_PARALLEL_WORKER_LIMIT,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.enable_deadlock_prevention",
 		gettext_noop("Avoids deadlocks by preventing concurrent multi-shard commands"),
@@ -815,6 +989,24 @@ RegisterCitusConfigVariables(void)
 		GUC_UNIT_KB | GUC_STANDARD,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.shared_metadata_cache_size",
+		gettext_noop("Sets the amount of shared memory used to cache the shard "
+					 "metadata of distributed tables for all backends. Setting "
+					 "to 0 disables the shared metadata cache."),
+		gettext_noop("Backends otherwise read the shards and placements of a "
+					 "distributed table from the catalogs each time they build "
+					 "their metadata cache entry for it, e.g. after the metadata "
+					 "of the table changed. When enabled, only the first backend "
+					 "reads the catalogs and the others copy the rows from shared "
+					 "memory. Once the memory is used up, all cached rows are "
+					 "dropped."),
+		&SharedMetadataCacheSize,
+		0, 0, INT_MAX / 1024,
+		PGC_POSTMASTER,
+		GUC_UNIT_MB | GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.sort_returning",
 		gettext_noop("Sorts the RETURNING clause to get consistent test output"),
@@ -840,6 +1032,57 @@ RegisterCitusConfigVariables(void)
 		GUC_UNIT_KB | GUC_STANDARD,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.max_concurrent_subplans",
+		gettext_noop("Sets the maximum number of CTEs and complex subqueries of a "
+					 "query that are executed concurrently."),
+		gettext_noop("Subplans that do not depend on each other and return the rows "
+					 "of their tasks without processing them on the coordinator can "
+					 "run in a single distributed execution, which writes their "
+					 "intermediate results as the rows arrive. Each concurrently "
+					 "executed subplan keeps its own connections and buffers for "
+					 "writing the intermediate result, so this setting bounds the "
+					 "memory used on the coordinator. A value of 1 executes the "
+					 "subplans one after another."),
+		&MaxConcurrentSubPlans,
+		1, 1, INT_MAX,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.intermediate_result_relay_fanout",
+		gettext_noop("Sets the number of nodes to which the coordinator sends an "
+					 "intermediate result, which relay it to the other nodes."),
+		gettext_noop("By default, the coordinator sends the intermediate results of "
+					 "CTEs and complex subqueries to every node that needs them, "
+					 "which makes its network bandwidth the bottleneck for large "
+					 "results on large clusters. When set to a positive value and a "
+					 "result goes to more nodes than that, the coordinator only sends "
+					 "it to that many nodes, which forward it to the other nodes "
+					 "while writing it, in a tree in which each node sends the result "
+					 "at most that many times. 0 sends results to all nodes directly."),
+		&IntermediateResultRelayFanout,
+		0, 0, INT_MAX,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.columnar_intermediate_results",
+		gettext_noop("Writes intermediate results in a compressed columnar format."),
+		gettext_noop("When enabled, the results of CTEs and complex subqueries and "
+					 "the results that are repartitioned by INSERT ... SELECT are "
+					 "written in blocks that store the values of each column "
+					 "together and are compressed with pglz. This reduces the size "
+					 "of the results that are sent over the network and written to "
+					 "disk, at the cost of CPU time for compression."),
+		&ColumnarIntermediateResults,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.max_adaptive_executor_pool_size",
 		gettext_noop("Sets the maximum number of connections per worker node used by "
@@ -913,6 +1156,53 @@ RegisterCitusConfigVariables(void)
 		GUC_STANDARD,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.max_shared_pool_size",
+		gettext_noop("Sets the maximum number of connections allowed per worker node "
+					 "across all the backends from this node. Setting to -1 disables "
+					 "connections throttling. Setting to 0 makes it auto-adjust, meaning "
+					 "equal to max_connections on the coordinator."),
+		gettext_noop("As a rule of thumb, the value should be at most equal to the "
+					 "max_connections on the remote nodes. Once the limit is reached, "
+					 "multi-shard queries run their remaining tasks over the "
+					 "connections they already have instead of opening new ones."),
+		&MaxSharedPoolSize,
+		0, -1, INT_MAX,
+		PGC_SIGHUP,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.prewarm_connections",
+		gettext_noop("Starts connecting to the workers a session's first "
+					 "distributed query accesses once it is planned."),
+		gettext_noop("When enabled, the first distributed query of a session starts "
+					 "connecting to the nodes of its shard placements right after "
+					 "planning, such that connection establishment overlaps with "
+					 "the startup of the executor, e.g. with running subplans. "
+					 "Other workers are not connected to."),
+		&PrewarmConnections,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_cached_statements_per_connection",
+		gettext_noop("Sets the maximum number of statements to keep prepared on "
+					 "each connection to a worker. Setting to 0 disables caching "
+					 "prepared statements."),
+		gettext_noop("Queries with parameters are prepared on the worker the "
+					 "second time they are sent over a connection, such that "
+					 "subsequent executions with the same shard query skip parsing "
+					 "and planning on the worker. Once the limit is reached, all "
+					 "statements on the connection are deallocated."),
+		&MaxCachedStatementsPerConnection,
+		0, 0, INT_MAX,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.max_assign_task_batch_size",
 		gettext_noop("Sets the maximum number of tasks to assign per round."),
@@ -968,6 +1258,21 @@ RegisterCitusConfigVariables(void)
 		GUC_UNIT_KB | GUC_STANDARD,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.repartition_exchange_buffer_size",
+		gettext_noop("Sets the memory a merge task uses to buffer streamed map "
+					 "outputs."),
+		gettext_noop("When citus.enable_repartition_exchange is on, merge tasks "
+					 "receive the outputs of their map tasks concurrently and "
+					 "keep them in memory until they are copied into the merge "
+					 "table. Once the buffered outputs exceed this size, they "
+					 "are spilled to temporary files."),
+		&RepartitionExchangeBufferSize,
+		16384, 0, (INT_MAX / 1024), /* result stored in int variable */
+		PGC_USERSET,
+		GUC_UNIT_KB | GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.large_table_shard_count",
 		gettext_noop("This variable has been deprecated."),
@@ -1093,6 +1398,37 @@ RegisterCitusConfigVariables(void)
 		GUC_STANDARD,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_task_query_templates",
+		gettext_noop("Enables building the query strings of multi-shard queries "
+					 "from a template."),
+		gettext_noop("The query strings of the tasks of a multi-shard query only "
+					 "differ in their shard names. When enabled, the query is "
+					 "deparsed once into a template, and the shard names of each "
+					 "task are filled in, instead of deparsing the query for "
+					 "every shard."),
+		&EnableTaskQueryTemplates,
+		true,
+		PGC_USERSET,
+		GUC_NO_SHOW_ALL,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_repartition_exchange",
+		gettext_noop("Enables streaming the partition files of map tasks into "
+					 "the merge tables of repartition joins."),
+		gettext_noop("Map tasks always write their outputs to partition files. "
+					 "When enabled, the adaptive executor does not fetch these "
+					 "files into files on the nodes that run the merge tasks. "
+					 "Instead, each merge task streams the partition files of "
+					 "all its map tasks into its table, over one connection "
+					 "per node on which map tasks ran."),
+		&EnableRepartitionExchange,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomEnumVariable(
 		"citus.shard_placement_policy",
 		gettext_noop("Sets the policy to use when choosing nodes for shard placement."),
@@ -1,6 +1,8 @@
 #include "udfs/read_intermediate_results/9.2-1.sql"
 #include "udfs/fetch_intermediate_results/9.2-1.sql"
+#include "udfs/fetch_intermediate_results_from_nodes/9.2-1.sql"
 #include "udfs/worker_partition_query_result/9.2-1.sql"
+#include "udfs/worker_merge_map_outputs_into_table/9.2-1.sql"
 
 ALTER TABLE pg_catalog.pg_dist_colocation ADD distributioncolumncollation oid;
 UPDATE pg_catalog.pg_dist_colocation dc SET distributioncolumncollation = t.typcollation
@@ -83,3 +85,11 @@ CREATE TRIGGER pg_dist_rebalance_strategy_enterprise_check_trigger
 
 #include "udfs/citus_prepare_pg_upgrade/9.2-1.sql"
 #include "udfs/citus_finish_pg_upgrade/9.2-1.sql"
+
+#include "udfs/citus_remote_connection_stats/9.2-1.sql"
+#include "udfs/citus_connection_latency_histogram/9.2-1.sql"
+#include "udfs/citus_plan_cache_stats/9.2-1.sql"
+#include "udfs/citus_shared_metadata_cache_stats/9.2-1.sql"
+#include "udfs/citus_executor_event_loop_stats/9.2-1.sql"
+#include "udfs/citus_executor_task_stats/9.2-1.sql"
+#include "udfs/citus_prepared_statement_cache_stats/9.2-1.sql"
@@ -0,0 +1,25 @@
+CREATE OR REPLACE FUNCTION pg_catalog.citus_connection_latency_histogram(
+    OUT metric text,
+    OUT upper_bound_ms float8,
+    OUT count bigint)
+RETURNS SETOF RECORD
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$citus_connection_latency_histogram$$;
+COMMENT ON FUNCTION pg_catalog.citus_connection_latency_histogram(
+    OUT metric text,
+    OUT upper_bound_ms float8,
+    OUT count bigint)
+IS 'returns histograms of connection establishment and first query in session latencies on this node';
+
+CREATE VIEW citus.citus_connection_latency_histogram AS
+SELECT * FROM pg_catalog.citus_connection_latency_histogram();
+ALTER VIEW citus.citus_connection_latency_histogram SET SCHEMA pg_catalog;
+GRANT SELECT ON pg_catalog.citus_connection_latency_histogram TO PUBLIC;
+
+CREATE OR REPLACE FUNCTION pg_catalog.citus_reset_connection_latency_histogram()
+RETURNS void
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$citus_reset_connection_latency_histogram$$;
+COMMENT ON FUNCTION pg_catalog.citus_reset_connection_latency_histogram()
+IS 'resets the connection latency histograms on this node';
+REVOKE ALL ON FUNCTION pg_catalog.citus_reset_connection_latency_histogram() FROM PUBLIC;
@@ -0,0 +1,19 @@
+CREATE OR REPLACE FUNCTION pg_catalog.citus_executor_event_loop_stats(
+    OUT loop_iterations bigint,
+    OUT wait_event_set_rebuilds bigint,
+    OUT wait_event_additions bigint,
+    OUT wait_event_modifications bigint)
+RETURNS SETOF RECORD
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$citus_executor_event_loop_stats$$;
+COMMENT ON FUNCTION pg_catalog.citus_executor_event_loop_stats(
+    OUT loop_iterations bigint,
+    OUT wait_event_set_rebuilds bigint,
+    OUT wait_event_additions bigint,
+    OUT wait_event_modifications bigint)
+IS 'returns how often the adaptive executor ran its event loop in the current session, and how often it rebuilt or incrementally updated its wait event set';
+
+CREATE VIEW citus.citus_executor_event_loop_stats AS
+SELECT * FROM pg_catalog.citus_executor_event_loop_stats();
+ALTER VIEW citus.citus_executor_event_loop_stats SET SCHEMA pg_catalog;
+GRANT SELECT ON pg_catalog.citus_executor_event_loop_stats TO PUBLIC;
@@ -0,0 +1,17 @@
+CREATE OR REPLACE FUNCTION pg_catalog.citus_executor_task_stats(
+    OUT dependency_ordered_tasks bigint,
+    OUT early_task_starts bigint,
+    OUT coalesced_tasks bigint)
+RETURNS SETOF RECORD
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$citus_executor_task_stats$$;
+COMMENT ON FUNCTION pg_catalog.citus_executor_task_stats(
+    OUT dependency_ordered_tasks bigint,
+    OUT early_task_starts bigint,
+    OUT coalesced_tasks bigint)
+IS 'returns how many tasks the adaptive executor ran in dependency order in the current session, how many of them started while unrelated tasks were still running, and how many tasks were sent along with the command of another task';
+
+CREATE VIEW citus.citus_executor_task_stats AS
+SELECT * FROM pg_catalog.citus_executor_task_stats();
+ALTER VIEW citus.citus_executor_task_stats SET SCHEMA pg_catalog;
+GRANT SELECT ON pg_catalog.citus_executor_task_stats TO PUBLIC;
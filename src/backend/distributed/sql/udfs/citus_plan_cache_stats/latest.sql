@@ -0,0 +1,25 @@
+CREATE OR REPLACE FUNCTION pg_catalog.citus_plan_cache_stats(
+    OUT queryid bigint,
+    OUT query text,
+    OUT cached bool,
+    OUT calls bigint,
+    OUT cache_hits bigint,
+    OUT total_plan_time float8,
+    OUT mean_plan_time float8)
+RETURNS SETOF RECORD
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$citus_plan_cache_stats$$;
+COMMENT ON FUNCTION pg_catalog.citus_plan_cache_stats(
+    OUT queryid bigint,
+    OUT query text,
+    OUT cached bool,
+    OUT calls bigint,
+    OUT cache_hits bigint,
+    OUT total_plan_time float8,
+    OUT mean_plan_time float8)
+IS 'returns planning statistics of the parameterized queries in the distributed plan cache of the current session';
+
+CREATE VIEW citus.citus_plan_cache_stats AS
+SELECT * FROM pg_catalog.citus_plan_cache_stats();
+ALTER VIEW citus.citus_plan_cache_stats SET SCHEMA pg_catalog;
+GRANT SELECT ON pg_catalog.citus_plan_cache_stats TO PUBLIC;
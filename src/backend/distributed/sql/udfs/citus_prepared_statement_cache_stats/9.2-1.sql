@@ -0,0 +1,15 @@
+CREATE OR REPLACE FUNCTION pg_catalog.citus_prepared_statement_cache_stats(
+    OUT statements_prepared bigint,
+    OUT prepared_statement_executions bigint)
+RETURNS SETOF RECORD
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$citus_prepared_statement_cache_stats$$;
+COMMENT ON FUNCTION pg_catalog.citus_prepared_statement_cache_stats(
+    OUT statements_prepared bigint,
+    OUT prepared_statement_executions bigint)
+IS 'returns how many statements were prepared on the connections to the workers in the current session, and how often they were executed';
+
+CREATE VIEW citus.citus_prepared_statement_cache_stats AS
+SELECT * FROM pg_catalog.citus_prepared_statement_cache_stats();
+ALTER VIEW citus.citus_prepared_statement_cache_stats SET SCHEMA pg_catalog;
+GRANT SELECT ON pg_catalog.citus_prepared_statement_cache_stats TO PUBLIC;
@@ -0,0 +1,17 @@
+CREATE OR REPLACE FUNCTION pg_catalog.citus_remote_connection_stats(
+    OUT hostname text,
+    OUT port int,
+    OUT connection_count_to_node int)
+RETURNS SETOF RECORD
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$citus_remote_connection_stats$$;
+COMMENT ON FUNCTION pg_catalog.citus_remote_connection_stats(
+    OUT hostname text,
+    OUT port int,
+    OUT connection_count_to_node int)
+IS 'returns the number of connections that all backends on this node have open to each worker node';
+
+CREATE VIEW citus.citus_remote_connection_stats AS
+SELECT * FROM pg_catalog.citus_remote_connection_stats();
+ALTER VIEW citus.citus_remote_connection_stats SET SCHEMA pg_catalog;
+GRANT SELECT ON pg_catalog.citus_remote_connection_stats TO PUBLIC;
@@ -0,0 +1,21 @@
+CREATE OR REPLACE FUNCTION pg_catalog.citus_shared_metadata_cache_stats(
+    OUT cached_relations bigint,
+    OUT memory_bytes bigint,
+    OUT hits bigint,
+    OUT rebuilds bigint,
+    OUT invalidations bigint)
+RETURNS SETOF RECORD
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$citus_shared_metadata_cache_stats$$;
+COMMENT ON FUNCTION pg_catalog.citus_shared_metadata_cache_stats(
+    OUT cached_relations bigint,
+    OUT memory_bytes bigint,
+    OUT hits bigint,
+    OUT rebuilds bigint,
+    OUT invalidations bigint)
+IS 'returns the memory usage of the shard metadata cache that is shared by all backends on this node, and how often backends used it or read the catalogs';
+
+CREATE VIEW citus.citus_shared_metadata_cache_stats AS
+SELECT * FROM pg_catalog.citus_shared_metadata_cache_stats();
+ALTER VIEW citus.citus_shared_metadata_cache_stats SET SCHEMA pg_catalog;
+GRANT SELECT ON pg_catalog.citus_shared_metadata_cache_stats TO PUBLIC;
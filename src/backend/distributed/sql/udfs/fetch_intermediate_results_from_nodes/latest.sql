@@ -0,0 +1,9 @@
+CREATE OR REPLACE FUNCTION pg_catalog.fetch_intermediate_results_from_nodes(
+    result_ids text[],
+    node_names text[],
+    node_ports int[])
+RETURNS bigint
+LANGUAGE C STRICT VOLATILE
+AS 'MODULE_PATHNAME', $$fetch_intermediate_results_from_nodes$$;
+COMMENT ON FUNCTION pg_catalog.fetch_intermediate_results_from_nodes(text[],text[],int[])
+IS 'fetch intermediate results from the nodes at the same positions in the node arrays. returns number of bytes read.';
@@ -0,0 +1,16 @@
+CREATE FUNCTION pg_catalog.worker_merge_map_outputs_into_table(
+    job_id bigint,
+    task_id integer,
+    column_names text[],
+    column_types text[],
+    partition_id integer,
+    map_task_ids integer[],
+    node_names text[],
+    node_ports integer[])
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_merge_map_outputs_into_table$$;
+COMMENT ON FUNCTION pg_catalog.worker_merge_map_outputs_into_table(bigint, integer, text[], text[],
+                                                                   integer, integer[], text[],
+                                                                   integer[])
+    IS 'stream the partition files of map tasks from remote nodes into a table';
@@ -6,11 +6,12 @@ CREATE OR REPLACE FUNCTION pg_catalog.worker_partition_query_result(
     partition_min_values text[],
     partition_max_values text[],
     binaryCopy boolean,
+    columnar_format boolean DEFAULT false,
     OUT partition_index int,
     OUT rows_written bigint,
     OUT bytes_written bigint)
 RETURNS SETOF record
 LANGUAGE C STRICT VOLATILE
 AS 'MODULE_PATHNAME', $$worker_partition_query_result$$;
-COMMENT ON FUNCTION pg_catalog.worker_partition_query_result(text, text, int, citus.distribution_type, text[], text[], boolean)
+COMMENT ON FUNCTION pg_catalog.worker_partition_query_result(text, text, int, citus.distribution_type, text[], text[], boolean, boolean)
 IS 'execute a query and partitions its results in set of local result files';
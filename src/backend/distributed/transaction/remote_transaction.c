@@ -337,6 +337,34 @@ RemoteTransactionCommit(MultiConnection *connection)
 }
 
 
+/*
+ * RemoteTransactionListCommit sends COMMIT over all connections in the
+ * given connection list and waits for all of them to finish.
+ */
+void
+RemoteTransactionListCommit(List *connectionList)
+{
+	ListCell *connectionCell = NULL;
+	bool raiseInterrupts = true;
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+		StartRemoteTransactionCommit(connection);
+	}
+
+	WaitForAllConnections(connectionList, raiseInterrupts);
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+		FinishRemoteTransactionCommit(connection);
+	}
+}
+
+
 /*
  * StartRemoteTransactionAbort initiates abortin the transaction in a
  * non-blocking manner.
@@ -769,6 +797,26 @@ CloseRemoteTransaction(struct MultiConnection *connection)
 }
 
 
+/*
+ * DetachRemoteTransaction removes a connection whose remote transaction was
+ * committed or aborted before the end of the main transaction from the list
+ * of in-progress transactions, and resets its state. This allows the
+ * connection to be reused for another remote transaction within the same
+ * main transaction, and keeps it out of the coordinated commit.
+ */
+void
+DetachRemoteTransaction(struct MultiConnection *connection)
+{
+	RemoteTransaction *transaction = &connection->remoteTransaction;
+
+	Assert(transaction->transactionState == REMOTE_TRANS_COMMITTED ||
+		   transaction->transactionState == REMOTE_TRANS_ABORTED);
+
+	CloseRemoteTransaction(connection);
+	ResetRemoteTransaction(connection);
+}
+
+
 /*
  * ResetRemoteTransaction resets the state of the transaction after the end of
  * the main transaction, if the connection is being reused.
@@ -28,6 +28,7 @@
 #include "distributed/multi_executor.h"
 #include "distributed/transaction_management.h"
 #include "distributed/placement_connection.h"
+#include "distributed/shared_metadata_cache.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/version_compat.h"
 #include "utils/hsearch.h"
@@ -130,7 +131,17 @@ UseCoordinatedTransaction(void)
 
 	CurrentCoordinatedTransactionState = COORD_TRANS_STARTED;
 
-	AssignDistributedTransactionId();
+	/*
+	 * If assign_distributed_transaction_id() has been called, we should reuse
+	 * that identifier, such that intermediate results end up in the directory
+	 * of the distributed transaction (e.g. in fetch_intermediate_results on a
+	 * worker) and distributed deadlock detection works properly.
+	 */
+	DistributedTransactionId *transactionId = GetCurrentDistributedTransactionId();
+	if (transactionId->transactionNumber == 0)
+	{
+		AssignDistributedTransactionId();
+	}
 }
 
 
@@ -216,6 +227,7 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 			 * callbacks still can perform work if needed.
 			 */
 			ResetShardPlacementTransactionState();
+			SharedMetadataCacheCommit();
 
 			if (CurrentCoordinatedTransactionState == COORD_TRANS_PREPARED)
 			{
@@ -268,8 +280,10 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 				 */
 				AtEOXact_Files(false);
 				SwallowErrors(RemoveIntermediateResultsDirectory);
+				SwallowErrors(CloseResultRelayConnections);
 			}
 			ResetShardPlacementTransactionState();
+			SharedMetadataCacheAbort();
 
 			/* handles both already prepared and open transactions */
 			if (CurrentCoordinatedTransactionState > COORD_TRANS_IDLE)
@@ -341,6 +355,10 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 			 * ids on the worker nodes.
 			 */
 			RemoveIntermediateResultsDirectory();
+			CloseResultRelayConnections();
+
+			/* metadata changes only become visible on COMMIT PREPARED */
+			SharedMetadataCachePrepare();
 
 			UnSetDistributedTransactionId();
 			break;
@@ -357,6 +375,16 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 			 */
 			RemoveIntermediateResultsDirectory();
 
+			/*
+			 * Results relayed to other nodes are no longer needed either. Close
+			 * the connections before the remote transactions are committed, since
+			 * they are not part of the coordinated transaction.
+			 */
+			CloseResultRelayConnections();
+
+			/* let the session cache the connections it started ahead of time */
+			FinishPrewarmedConnections();
+
 			/* nothing further to do if there's no managed remote xacts */
 			if (CurrentCoordinatedTransactionState == COORD_TRANS_NONE)
 			{
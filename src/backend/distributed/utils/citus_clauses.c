@@ -26,8 +26,25 @@
 #include "utils/lsyscache.h"
 
 
+/*
+ * MasterEvaluationContext is passed down while evaluating the expressions of a
+ * query on the master.
+ */
+typedef struct MasterEvaluationContext
+{
+	PlanState *planState;
+
+	/* whether to replace external parameters by their values */
+	bool evaluateParameters;
+} MasterEvaluationContext;
+
+
 /* private function declarations */
+static Node * PartiallyEvaluateExpressionMutator(Node *expression,
+												 MasterEvaluationContext *context);
 static bool IsVarNode(Node *node);
+static bool IsExternParamNode(Node *node);
+static bool ExternParamReferenceWalker(Node *node, Bitmapset **parameterSet);
 static Expr * citus_evaluate_expr(Expr *expr, Oid result_type, int32 result_typmod,
 								  Oid result_collation, PlanState *planState);
 static bool CitusIsVolatileFunctionIdChecker(Oid func_id, void *context);
@@ -57,6 +74,46 @@ ExecuteMasterEvaluableFunctions(Query *query, PlanState *planState)
 }
 
 
+/*
+ * ExecuteMasterEvaluableFunctionsKeepingParameters evaluates the expressions
+ * that contain functions which cannot be evaluated on the workers, but leaves
+ * the external parameters outside of those expressions in place, such that the
+ * query can be sent to the workers along with the parameter values.
+ */
+void
+ExecuteMasterEvaluableFunctionsKeepingParameters(Query *query, PlanState *planState)
+{
+	MasterEvaluationContext context;
+	context.planState = planState;
+	context.evaluateParameters = false;
+
+	PartiallyEvaluateExpressionMutator((Node *) query, &context);
+}
+
+
+/*
+ * QueryReferencesAllParameters returns whether every one of the given number
+ * of external parameters is referenced by the query.
+ */
+bool
+QueryReferencesAllParameters(Query *query, int parameterCount)
+{
+	Bitmapset *parameterSet = NULL;
+
+	ExternParamReferenceWalker((Node *) query, &parameterSet);
+
+	for (int parameterId = 1; parameterId <= parameterCount; parameterId++)
+	{
+		if (!bms_is_member(parameterId, parameterSet))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
 /*
  * PartiallyEvaluateExpression descend into an expression tree to evaluate
  * expressions that can be resolved to a constant on the master. Expressions
@@ -65,6 +122,23 @@ ExecuteMasterEvaluableFunctions(Query *query, PlanState *planState)
  */
 Node *
 PartiallyEvaluateExpression(Node *expression, PlanState *planState)
+{
+	MasterEvaluationContext context;
+	context.planState = planState;
+	context.evaluateParameters = true;
+
+	return PartiallyEvaluateExpressionMutator(expression, &context);
+}
+
+
+/*
+ * PartiallyEvaluateExpressionMutator implements PartiallyEvaluateExpression.
+ * Unless the context asks to evaluate parameters, external parameters and the
+ * expressions that contain them are skipped as well, except for calls to
+ * mutable functions, which are always evaluated on the master.
+ */
+static Node *
+PartiallyEvaluateExpressionMutator(Node *expression, MasterEvaluationContext *context)
 {
 	if (expression == NULL || IsA(expression, Const))
 	{
@@ -81,6 +155,11 @@ PartiallyEvaluateExpression(Node *expression, PlanState *planState)
 				/* ExecInitExpr cannot handle PARAM_SUBLINK */
 				return expression;
 			}
+
+			if (param->paramkind == PARAM_EXTERN && !context->evaluateParameters)
+			{
+				return expression;
+			}
 		}
 
 		/* fallthrough */
@@ -96,32 +175,39 @@ PartiallyEvaluateExpression(Node *expression, PlanState *planState)
 		case T_RelabelType:
 		case T_CoerceToDomain:
 		{
-			if (FindNodeCheck(expression, IsVarNode))
+			bool keepExpression = FindNodeCheck(expression, IsVarNode);
+			if (!keepExpression && !context->evaluateParameters &&
+				!CitusIsMutableFunction(expression))
+			{
+				keepExpression = FindNodeCheck(expression, IsExternParamNode);
+			}
+
+			if (keepExpression)
 			{
 				return (Node *) expression_tree_mutator(expression,
-														PartiallyEvaluateExpression,
-														planState);
+														PartiallyEvaluateExpressionMutator,
+														context);
 			}
 
 			return (Node *) citus_evaluate_expr((Expr *) expression,
 												exprType(expression),
 												exprTypmod(expression),
 												exprCollation(expression),
-												planState);
+												context->planState);
 		}
 
 		case T_Query:
 		{
 			return (Node *) query_tree_mutator((Query *) expression,
-											   PartiallyEvaluateExpression,
-											   planState, QTW_DONT_COPY_QUERY);
+											   PartiallyEvaluateExpressionMutator,
+											   context, QTW_DONT_COPY_QUERY);
 		}
 
 		default:
 		{
 			return (Node *) expression_tree_mutator(expression,
-													PartiallyEvaluateExpression,
-													planState);
+													PartiallyEvaluateExpressionMutator,
+													context);
 		}
 	}
 
@@ -139,6 +225,45 @@ IsVarNode(Node *node)
 }
 
 
+/*
+ * IsExternParamNode returns whether a node is a reference to an external
+ * parameter.
+ */
+static bool
+IsExternParamNode(Node *node)
+{
+	return IsA(node, Param) && ((Param *) node)->paramkind == PARAM_EXTERN;
+}
+
+
+/*
+ * ExternParamReferenceWalker adds the ids of the external parameters that are
+ * referenced in the given expression tree to the parameter set.
+ */
+static bool
+ExternParamReferenceWalker(Node *node, Bitmapset **parameterSet)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsExternParamNode(node))
+	{
+		*parameterSet = bms_add_member(*parameterSet, ((Param *) node)->paramid);
+		return false;
+	}
+
+	if (IsA(node, Query))
+	{
+		return query_tree_walker((Query *) node, ExternParamReferenceWalker,
+								 parameterSet, 0);
+	}
+
+	return expression_tree_walker(node, ExternParamReferenceWalker, parameterSet);
+}
+
+
 /*
  * a copy of pg's evaluate_expr, pre-evaluate a constant expression
  *
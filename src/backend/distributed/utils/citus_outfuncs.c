@@ -187,10 +187,12 @@ OutDistributedPlan(OUTFUNC_ARGS)
 
 	WRITE_NODE_FIELD(workerJob);
 	WRITE_NODE_FIELD(masterQuery);
+	WRITE_BOOL_FIELD(sortedMerge);
 	WRITE_UINT64_FIELD(queryId);
 	WRITE_NODE_FIELD(relationIdList);
 	WRITE_OID_FIELD(targetRelationId);
 	WRITE_NODE_FIELD(insertSelectQuery);
+	WRITE_ENUM_FIELD(insertSelectMethod, InsertSelectMethod);
 	WRITE_STRING_FIELD(intermediateResultIdPrefix);
 
 	WRITE_NODE_FIELD(subPlanList);
@@ -311,6 +313,7 @@ OutMultiExtendedOp(OUTFUNC_ARGS)
 	WRITE_NODE_FIELD(havingQual);
 	WRITE_BOOL_FIELD(hasDistinctOn);
 	WRITE_NODE_FIELD(distinctClause);
+	WRITE_BOOL_FIELD(sortedMerge);
 
 	OutMultiUnaryNodeFields(str, (const MultiUnaryNode *) node);
 }
@@ -463,6 +466,8 @@ OutTask(OUTFUNC_ARGS)
 	WRITE_UINT64_FIELD(jobId);
 	WRITE_UINT_FIELD(taskId);
 	WRITE_STRING_FIELD(queryString);
+	WRITE_STRING_FIELD(queryTemplate);
+	WRITE_NODE_FIELD(shardQuery);
 	WRITE_UINT64_FIELD(anchorShardId);
 	WRITE_NODE_FIELD(taskPlacementList);
 	WRITE_NODE_FIELD(dependentTaskList);
@@ -215,10 +215,12 @@ ReadDistributedPlan(READFUNC_ARGS)
 
 	READ_NODE_FIELD(workerJob);
 	READ_NODE_FIELD(masterQuery);
+	READ_BOOL_FIELD(sortedMerge);
 	READ_UINT64_FIELD(queryId);
 	READ_NODE_FIELD(relationIdList);
 	READ_OID_FIELD(targetRelationId);
 	READ_NODE_FIELD(insertSelectQuery);
+	READ_ENUM_FIELD(insertSelectMethod, InsertSelectMethod);
 	READ_STRING_FIELD(intermediateResultIdPrefix);
 
 	READ_NODE_FIELD(subPlanList);
@@ -377,6 +379,8 @@ ReadTask(READFUNC_ARGS)
 	READ_UINT64_FIELD(jobId);
 	READ_UINT_FIELD(taskId);
 	READ_STRING_FIELD(queryString);
+	READ_STRING_FIELD(queryTemplate);
+	READ_NODE_FIELD(shardQuery);
 	READ_UINT64_FIELD(anchorShardId);
 	READ_NODE_FIELD(taskPlacementList);
 	READ_NODE_FIELD(dependentTaskList);
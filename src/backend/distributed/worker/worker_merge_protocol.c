@@ -47,6 +47,7 @@
 
 /* Local functions forward declarations */
 static List * ArrayObjectToCStringList(ArrayType *arrayObject);
+static StringInfo MergeTableSchemaName(uint64 jobId);
 static void CreateTaskTable(StringInfo schemaName, StringInfo relationName,
 							List *columnNameList, List *columnTypeList);
 static void CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
@@ -55,6 +56,7 @@ static void CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relatio
 
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(worker_merge_files_into_table);
+PG_FUNCTION_INFO_V1(worker_merge_map_outputs_into_table);
 PG_FUNCTION_INFO_V1(worker_merge_files_and_run_query);
 PG_FUNCTION_INFO_V1(worker_cleanup_job_schema_cache);
 PG_FUNCTION_INFO_V1(worker_create_schema);
@@ -122,7 +124,6 @@ worker_merge_files_into_table(PG_FUNCTION_ARGS)
 	ArrayType *columnNameObject = PG_GETARG_ARRAYTYPE_P(2);
 	ArrayType *columnTypeObject = PG_GETARG_ARRAYTYPE_P(3);
 
-	StringInfo jobSchemaName = JobSchemaName(jobId);
 	StringInfo taskTableName = TaskTableName(taskId);
 	StringInfo taskDirectoryName = TaskDirectoryName(jobId, taskId);
 	Oid savedUserId = InvalidOid;
@@ -141,33 +142,7 @@ worker_merge_files_into_table(PG_FUNCTION_ARGS)
 							   " do not match", columnNameCount, columnTypeCount)));
 	}
 
-	/*
-	 * If the schema for the job isn't already created by the task tracker
-	 * protocol, we fall to using the default 'public' schema.
-	 */
-	bool schemaExists = JobSchemaExists(jobSchemaName);
-	if (!schemaExists)
-	{
-		/*
-		 * For testing purposes, we allow merging into a table in the public schema,
-		 * but only when running as superuser.
-		 */
-
-		if (!superuser())
-		{
-			ereport(ERROR, (errmsg("job schema does not exist"),
-							errdetail("must be superuser to use public schema")));
-		}
-
-		resetStringInfo(jobSchemaName);
-		appendStringInfoString(jobSchemaName, "public");
-	}
-	else
-	{
-		Oid schemaId = get_namespace_oid(jobSchemaName->data, false);
-
-		EnsureSchemaOwner(schemaId);
-	}
+	StringInfo jobSchemaName = MergeTableSchemaName(jobId);
 
 	/* create the task table and copy files into the table */
 	List *columnNameList = ArrayObjectToCStringList(columnNameObject);
@@ -187,6 +162,83 @@ worker_merge_files_into_table(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * worker_merge_map_outputs_into_table creates a task table within the job's
+ * schema like worker_merge_files_into_table, but instead of copying the files
+ * in its task directory into the table, it streams the partition files of the
+ * given map tasks directly from the nodes at the same positions in the node
+ * arrays into the table. This avoids writing the fetched partition files to
+ * disk on this node and reading them back.
+ */
+Datum
+worker_merge_map_outputs_into_table(PG_FUNCTION_ARGS)
+{
+	uint64 jobId = PG_GETARG_INT64(0);
+	uint32 taskId = PG_GETARG_UINT32(1);
+	ArrayType *columnNameObject = PG_GETARG_ARRAYTYPE_P(2);
+	ArrayType *columnTypeObject = PG_GETARG_ARRAYTYPE_P(3);
+	uint32 partitionId = PG_GETARG_UINT32(4);
+	ArrayType *mapTaskIdObject = PG_GETARG_ARRAYTYPE_P(5);
+	ArrayType *nodeNameObject = PG_GETARG_ARRAYTYPE_P(6);
+	ArrayType *nodePortObject = PG_GETARG_ARRAYTYPE_P(7);
+
+	StringInfo taskTableName = TaskTableName(taskId);
+	List *mapTaskIdList = NIL;
+	List *nodePortList = NIL;
+
+	/* we should have the same number of column names and types */
+	int32 columnNameCount = ArrayObjectCount(columnNameObject);
+	int32 columnTypeCount = ArrayObjectCount(columnTypeObject);
+
+	/* and the same number of map tasks, node names, and node ports */
+	int32 mapTaskCount = ArrayObjectCount(mapTaskIdObject);
+	int32 nodeNameCount = ArrayObjectCount(nodeNameObject);
+	int32 nodePortCount = ArrayObjectCount(nodePortObject);
+
+	CheckCitusVersion(ERROR);
+
+	if (columnNameCount != columnTypeCount)
+	{
+		ereport(ERROR, (errmsg("column name array size: %d and type array size: %d"
+							   " do not match", columnNameCount, columnTypeCount)));
+	}
+
+	if (mapTaskCount != nodeNameCount || mapTaskCount != nodePortCount)
+	{
+		ereport(ERROR, (errmsg("map task array size: %d, node name array size: %d "
+							   "and node port array size: %d do not match",
+							   mapTaskCount, nodeNameCount, nodePortCount)));
+	}
+
+	StringInfo jobSchemaName = MergeTableSchemaName(jobId);
+
+	/* create the task table */
+	List *columnNameList = ArrayObjectToCStringList(columnNameObject);
+	List *columnTypeList = ArrayObjectToCStringList(columnTypeObject);
+
+	CreateTaskTable(jobSchemaName, taskTableName, columnNameList, columnTypeList);
+
+	/* and stream the partition files of the map tasks into the table */
+	Datum *mapTaskIdArray = DeconstructArrayObject(mapTaskIdObject);
+	Datum *nodePortArray = DeconstructArrayObject(nodePortObject);
+	List *nodeNameList = ArrayObjectToCStringList(nodeNameObject);
+
+	for (int mapTaskIndex = 0; mapTaskIndex < mapTaskCount; mapTaskIndex++)
+	{
+		mapTaskIdList = lappend_int(mapTaskIdList,
+									DatumGetInt32(mapTaskIdArray[mapTaskIndex]));
+		nodePortList = lappend_int(nodePortList,
+								   DatumGetInt32(nodePortArray[mapTaskIndex]));
+	}
+
+	RangeVar *relation = makeRangeVar(jobSchemaName->data, taskTableName->data, -1);
+	CopyMapOutputsIntoTable(relation, jobId, partitionId, mapTaskIdList, nodeNameList,
+							nodePortList);
+
+	PG_RETURN_VOID();
+}
+
+
 /*
  * worker_merge_files_and_run_query creates a merge task table within the job's
  * schema, which should have already been created by the task tracker protocol.
@@ -451,6 +503,45 @@ RemoveJobSchema(StringInfo schemaName)
 }
 
 
+/*
+ * MergeTableSchemaName returns the name of the schema in which merge tasks of
+ * the given job create their tables. If the schema for the job isn't already
+ * created by the task tracker protocol, we fall to using the default 'public'
+ * schema.
+ */
+static StringInfo
+MergeTableSchemaName(uint64 jobId)
+{
+	StringInfo jobSchemaName = JobSchemaName(jobId);
+
+	bool schemaExists = JobSchemaExists(jobSchemaName);
+	if (!schemaExists)
+	{
+		/*
+		 * For testing purposes, we allow merging into a table in the public schema,
+		 * but only when running as superuser.
+		 */
+
+		if (!superuser())
+		{
+			ereport(ERROR, (errmsg("job schema does not exist"),
+							errdetail("must be superuser to use public schema")));
+		}
+
+		resetStringInfo(jobSchemaName);
+		appendStringInfoString(jobSchemaName, "public");
+	}
+	else
+	{
+		Oid schemaId = get_namespace_oid(jobSchemaName->data, false);
+
+		EnsureSchemaOwner(schemaId);
+	}
+
+	return jobSchemaName;
+}
+
+
 /* Creates a simple table that only defines columns, in the given schema. */
 static void
 CreateTaskTable(StringInfo schemaName, StringInfo relationName,
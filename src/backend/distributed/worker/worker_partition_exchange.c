@@ -0,0 +1,680 @@
+/*-------------------------------------------------------------------------
+ *
+ * worker_partition_exchange.c
+ *
+ * Routines for streaming the partition files of map tasks from the nodes on
+ * which they were written into the table of a merge task. Unlike fetching
+ * the partition files into the merge task's directory first, the received
+ * data is copied into the table from memory, and is only written to
+ * temporary files when more data than the configured buffer size arrives
+ * before the table can consume it. Each node gets a single connection, over
+ * which the partition files of its map tasks are transmitted one after
+ * another. The connections to different nodes are read concurrently.
+ *
+ * This only removes the copy of the map outputs on the merge side. Map tasks
+ * still write a partition file for every merge task to disk. A merge task
+ * needs the outputs of all map tasks, so it only starts once all of them
+ * finished, and the partition files are what keeps the outputs until then.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "libpq-fe.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#if PG_VERSION_NUM >= 120000
+#include "access/table.h"
+#endif
+#include "access/heapam.h"
+#include "access/xact.h"
+#include "commands/copy.h"
+#include "distributed/connection_management.h"
+#include "distributed/memutils.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/remote_commands.h"
+#include "distributed/version_compat.h"
+#include "distributed/worker_protocol.h"
+#include "nodes/makefuncs.h"
+#include "storage/buffile.h"
+#include "storage/latch.h"
+#include "utils/builtins.h"
+#include "utils/rel.h"
+
+
+/* amount of received map output to keep in memory per merge task, in KB */
+int RepartitionExchangeBufferSize = 16384;
+
+
+/* state of the transfer of a single partition file */
+typedef enum MapOutputStreamState
+{
+	MAP_OUTPUT_QUEUED,
+	MAP_OUTPUT_STARTING,
+	MAP_OUTPUT_RECEIVING,
+	MAP_OUTPUT_DONE
+} MapOutputStreamState;
+
+
+/*
+ * MapOutputStream represents the transfer of the partition file of a map task
+ * from the node on which the map task ran.
+ */
+typedef struct MapOutputStream
+{
+	uint32 mapTaskId;
+	MapOutputStreamState state;
+
+	/* received data that is not yet copied into the table */
+	StringInfo buffer;
+	int bufferOffset;
+
+	/* received data that did not fit in memory, which precedes the buffer */
+	BufFile *spillFile;
+} MapOutputStream;
+
+
+/*
+ * MapOutputSource represents a node on which map tasks ran, and the connection
+ * over which the partition files of these map tasks are transmitted.
+ */
+typedef struct MapOutputSource
+{
+	char *nodeName;
+	int nodePort;
+	MultiConnection *connection;
+
+	/* streams of the map tasks that ran on the node, in transmit order */
+	List *streamList;
+
+	/* stream whose partition file is transmitted, NULL once all are done */
+	ListCell *currentStreamCell;
+} MapOutputSource;
+
+
+/*
+ * PartitionExchange contains the state of streaming all map outputs of a
+ * partition into the merge table.
+ */
+typedef struct PartitionExchange
+{
+	uint64 jobId;
+	uint32 partitionId;
+
+	/* user on whose behalf the partition files are transmitted */
+	char *userName;
+
+	List *sourceList;
+
+	/* streams of all map tasks, in the order they are copied into the table */
+	List *streamList;
+
+	/* stream whose data is currently copied into the table */
+	MapOutputStream *currentStream;
+
+	/* number of received bytes in the buffers of all streams */
+	uint64 bufferedBytes;
+
+	WaitEventSet *waitEventSet;
+	WaitEvent *events;
+	int eventSetSize;
+} PartitionExchange;
+
+
+/*
+ * The COPY data source callback does not take any arguments, so we keep the
+ * exchange that is being copied into a table in a global variable.
+ */
+static PartitionExchange *CurrentPartitionExchange = NULL;
+
+
+/* Local functions forward declarations */
+static PartitionExchange * StartPartitionExchange(uint64 jobId, uint32 partitionId,
+												  List *mapTaskIdList,
+												  List *nodeNameList,
+												  List *nodePortList);
+static List * MapOutputSourceList(List *mapTaskIdList, List *nodeNameList,
+								  List *nodePortList);
+static List * MapOutputStreamsInTransmitOrder(List *sourceList);
+static void StartMapOutputTransmit(PartitionExchange *exchange,
+								   MapOutputSource *source);
+static int ReadPartitionExchangeData(void *outbuf, int minread, int maxread);
+static int ReadReceivedMapOutput(PartitionExchange *exchange, MapOutputStream *stream,
+								 char *outbuf, int maxread);
+static void WaitForMapOutputs(PartitionExchange *exchange);
+static void ReceiveMapOutputs(PartitionExchange *exchange, MapOutputSource *source);
+static void SpillMapOutputs(PartitionExchange *exchange);
+
+
+/*
+ * CopyMapOutputsIntoTable streams the partition files with the given partition
+ * id of the given map tasks from the nodes at the same positions in the node
+ * lists, and copies them into the given relation. The partition files of
+ * different nodes are received concurrently, and are copied into the relation
+ * one after another. The function returns the number of copied rows.
+ */
+uint64
+CopyMapOutputsIntoTable(RangeVar *relation, uint64 jobId, uint32 partitionId,
+						List *mapTaskIdList, List *nodeNameList, List *nodePortList)
+{
+	uint64 copiedRowTotal = 0;
+	List *copyOptions = NIL;
+	ListCell *streamCell = NULL;
+	ListCell *sourceCell = NULL;
+
+	if (mapTaskIdList == NIL)
+	{
+		return 0;
+	}
+
+	if (BinaryWorkerCopyFormat)
+	{
+		DefElem *copyOption = makeDefElem("format", (Node *) makeString("binary"), -1);
+		copyOptions = list_make1(copyOption);
+	}
+
+	PartitionExchange *exchange = StartPartitionExchange(jobId, partitionId,
+														 mapTaskIdList, nodeNameList,
+														 nodePortList);
+
+	Relation copiedRelation = heap_openrv(relation, RowExclusiveLock);
+
+	CurrentPartitionExchange = exchange;
+
+	foreach(streamCell, exchange->streamList)
+	{
+		MapOutputStream *stream = (MapOutputStream *) lfirst(streamCell);
+
+		if (stream->spillFile != NULL && BufFileSeek(stream->spillFile, 0, 0L,
+													 SEEK_SET) != 0)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not rewind partition exchange file: %m")));
+		}
+
+		exchange->currentStream = stream;
+
+		CopyState copyState = BeginCopyFrom(NULL, copiedRelation, NULL, false,
+											ReadPartitionExchangeData, NIL,
+											copyOptions);
+		copiedRowTotal += CopyFrom(copyState);
+		EndCopyFrom(copyState);
+
+		CommandCounterIncrement();
+	}
+
+	CurrentPartitionExchange = NULL;
+
+	heap_close(copiedRelation, NoLock);
+
+	foreach(sourceCell, exchange->sourceList)
+	{
+		MapOutputSource *source = (MapOutputSource *) lfirst(sourceCell);
+
+		CloseConnection(source->connection);
+	}
+
+	ereport(DEBUG2, (errmsg("copied " UINT64_FORMAT " rows from %d map outputs on "
+							"%d nodes into table: \"%s.%s\"", copiedRowTotal,
+							list_length(exchange->streamList),
+							list_length(exchange->sourceList),
+							relation->schemaname, relation->relname)));
+
+	return copiedRowTotal;
+}
+
+
+/*
+ * StartPartitionExchange opens a connection to each node on which map tasks
+ * ran, and starts the transfer of the partition file of the first map task of
+ * the node over it.
+ */
+static PartitionExchange *
+StartPartitionExchange(uint64 jobId, uint32 partitionId, List *mapTaskIdList,
+					   List *nodeNameList, List *nodePortList)
+{
+	PartitionExchange *exchange = palloc0(sizeof(PartitionExchange));
+	List *connectionList = NIL;
+	ListCell *sourceCell = NULL;
+
+	/* connect as superuser to give file access */
+	char *nodeUser = CitusExtensionOwnerName();
+
+	exchange->jobId = jobId;
+	exchange->partitionId = partitionId;
+	exchange->userName = CurrentUserName();
+	exchange->sourceList = MapOutputSourceList(mapTaskIdList, nodeNameList,
+											   nodePortList);
+	exchange->streamList = MapOutputStreamsInTransmitOrder(exchange->sourceList);
+
+	foreach(sourceCell, exchange->sourceList)
+	{
+		MapOutputSource *source = (MapOutputSource *) lfirst(sourceCell);
+
+		source->connection = StartNodeUserDatabaseConnection(FORCE_NEW_CONNECTION,
+															 source->nodeName,
+															 source->nodePort,
+															 nodeUser, NULL);
+
+		connectionList = lappend(connectionList, source->connection);
+	}
+
+	FinishConnectionListEstablishment(connectionList);
+
+	/* additional 2 is for postmaster and latch */
+	exchange->eventSetSize = list_length(exchange->sourceList) + 2;
+	exchange->events = palloc0(exchange->eventSetSize * sizeof(WaitEvent));
+	exchange->waitEventSet = CreateWaitEventSet(CurrentMemoryContext,
+												exchange->eventSetSize);
+	EnsureReleaseResource((MemoryContextCallbackFunction) (&FreeWaitEventSet),
+						  exchange->waitEventSet);
+
+	foreach(sourceCell, exchange->sourceList)
+	{
+		MapOutputSource *source = (MapOutputSource *) lfirst(sourceCell);
+		MultiConnection *connection = source->connection;
+
+		if (PQstatus(connection->pgConn) != CONNECTION_OK)
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+
+		source->currentStreamCell = list_head(source->streamList);
+		StartMapOutputTransmit(exchange, source);
+
+		AddWaitEventToSet(exchange->waitEventSet, WL_SOCKET_READABLE,
+						  PQsocket(connection->pgConn), NULL, (void *) source);
+	}
+
+	AddWaitEventToSet(exchange->waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET,
+					  NULL, NULL);
+	AddWaitEventToSet(exchange->waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch,
+					  NULL);
+
+	return exchange;
+}
+
+
+/*
+ * MapOutputSourceList groups the given map tasks by the nodes at the same
+ * positions in the node lists, and returns a source for each node.
+ */
+static List *
+MapOutputSourceList(List *mapTaskIdList, List *nodeNameList, List *nodePortList)
+{
+	List *sourceList = NIL;
+	ListCell *mapTaskIdCell = NULL;
+	ListCell *nodeNameCell = NULL;
+	ListCell *nodePortCell = NULL;
+
+	forthree(mapTaskIdCell, mapTaskIdList, nodeNameCell, nodeNameList, nodePortCell,
+			 nodePortList)
+	{
+		char *nodeName = (char *) lfirst(nodeNameCell);
+		int nodePort = lfirst_int(nodePortCell);
+		MapOutputSource *source = NULL;
+		ListCell *sourceCell = NULL;
+
+		foreach(sourceCell, sourceList)
+		{
+			MapOutputSource *existingSource = (MapOutputSource *) lfirst(sourceCell);
+
+			if (strcmp(existingSource->nodeName, nodeName) == 0 &&
+				existingSource->nodePort == nodePort)
+			{
+				source = existingSource;
+				break;
+			}
+		}
+
+		if (source == NULL)
+		{
+			source = palloc0(sizeof(MapOutputSource));
+			source->nodeName = nodeName;
+			source->nodePort = nodePort;
+
+			sourceList = lappend(sourceList, source);
+		}
+
+		MapOutputStream *stream = palloc0(sizeof(MapOutputStream));
+		stream->mapTaskId = (uint32) lfirst_int(mapTaskIdCell);
+		stream->state = MAP_OUTPUT_QUEUED;
+		stream->buffer = makeStringInfo();
+
+		source->streamList = lappend(source->streamList, stream);
+	}
+
+	return sourceList;
+}
+
+
+/*
+ * MapOutputStreamsInTransmitOrder returns the streams of the given sources in
+ * the order in which their partition files are expected to arrive: the first
+ * stream of each source, then the second one, and so on. Copying them into the
+ * table in this order keeps the amount of buffered data low.
+ */
+static List *
+MapOutputStreamsInTransmitOrder(List *sourceList)
+{
+	List *streamList = NIL;
+	int sourceCount = list_length(sourceList);
+	ListCell **streamCells = palloc0(sourceCount * sizeof(ListCell *));
+	int remainingStreamCount = 0;
+	ListCell *sourceCell = NULL;
+	int sourceIndex = 0;
+
+	foreach(sourceCell, sourceList)
+	{
+		MapOutputSource *source = (MapOutputSource *) lfirst(sourceCell);
+
+		streamCells[sourceIndex] = list_head(source->streamList);
+		remainingStreamCount += list_length(source->streamList);
+		sourceIndex++;
+	}
+
+	while (remainingStreamCount > 0)
+	{
+		for (sourceIndex = 0; sourceIndex < sourceCount; sourceIndex++)
+		{
+			ListCell *streamCell = streamCells[sourceIndex];
+
+			if (streamCell == NULL)
+			{
+				continue;
+			}
+
+			streamList = lappend(streamList, lfirst(streamCell));
+			streamCells[sourceIndex] = lnext(streamCell);
+			remainingStreamCount--;
+		}
+	}
+
+	pfree(streamCells);
+
+	return streamList;
+}
+
+
+/*
+ * StartMapOutputTransmit sends the command to transmit the partition file of
+ * the current stream of the given source.
+ */
+static void
+StartMapOutputTransmit(PartitionExchange *exchange, MapOutputSource *source)
+{
+	MultiConnection *connection = source->connection;
+	MapOutputStream *stream = (MapOutputStream *) lfirst(source->currentStreamCell);
+
+	/* we've made sure the file names are sanitized, safe to fetch as superuser */
+	StringInfo taskDirectoryName = TaskDirectoryName(exchange->jobId, stream->mapTaskId);
+	StringInfo partitionFilename = PartitionFilename(taskDirectoryName,
+													 exchange->partitionId);
+	StringInfo transmitCommand = makeStringInfo();
+
+	appendStringInfo(transmitCommand, TRANSMIT_WITH_USER_COMMAND,
+					 partitionFilename->data, quote_literal_cstr(exchange->userName));
+
+	if (!SendRemoteCommand(connection, transmitCommand->data))
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+
+	stream->state = MAP_OUTPUT_STARTING;
+}
+
+
+/*
+ * ReadPartitionExchangeData is the COPY data source callback that reads the
+ * partition file of the current stream of the current exchange. It returns at
+ * least minread bytes, or fewer bytes at the end of the partition file.
+ */
+static int
+ReadPartitionExchangeData(void *outbuf, int minread, int maxread)
+{
+	PartitionExchange *exchange = CurrentPartitionExchange;
+	MapOutputStream *stream = exchange->currentStream;
+	int bytesRead = 0;
+
+	while (bytesRead < minread)
+	{
+		int receivedBytesRead = ReadReceivedMapOutput(exchange, stream,
+													  (char *) outbuf + bytesRead,
+													  maxread - bytesRead);
+		if (receivedBytesRead > 0)
+		{
+			bytesRead += receivedBytesRead;
+		}
+		else if (stream->state == MAP_OUTPUT_DONE)
+		{
+			/* all data of the partition file was read */
+			break;
+		}
+		else
+		{
+			WaitForMapOutputs(exchange);
+		}
+	}
+
+	return bytesRead;
+}
+
+
+/*
+ * ReadReceivedMapOutput reads up to maxread bytes of the data that was already
+ * received for the given stream, first from its spill file and then from its
+ * buffer, and returns the number of bytes read.
+ */
+static int
+ReadReceivedMapOutput(PartitionExchange *exchange, MapOutputStream *stream,
+					  char *outbuf, int maxread)
+{
+	if (stream->spillFile != NULL)
+	{
+		size_t spilledBytesRead = BufFileRead(stream->spillFile, outbuf, maxread);
+		if (spilledBytesRead > 0)
+		{
+			return (int) spilledBytesRead;
+		}
+
+		BufFileClose(stream->spillFile);
+		stream->spillFile = NULL;
+	}
+
+	int bufferedBytes = stream->buffer->len - stream->bufferOffset;
+	int bufferedBytesRead = Min(bufferedBytes, maxread);
+
+	if (bufferedBytesRead > 0)
+	{
+		memcpy(outbuf, stream->buffer->data + stream->bufferOffset, bufferedBytesRead);
+
+		stream->bufferOffset += bufferedBytesRead;
+		exchange->bufferedBytes -= bufferedBytesRead;
+
+		if (stream->bufferOffset == stream->buffer->len)
+		{
+			resetStringInfo(stream->buffer);
+			stream->bufferOffset = 0;
+		}
+	}
+
+	return bufferedBytesRead;
+}
+
+
+/*
+ * WaitForMapOutputs waits until data arrives on any of the connections of the
+ * exchange, and receives it into the buffers of the streams. Since all streams
+ * are received concurrently, the buffers of the streams that are not yet
+ * copied into the table can grow; once they exceed the buffer size they are
+ * spilled to disk.
+ */
+static void
+WaitForMapOutputs(PartitionExchange *exchange)
+{
+	long timeout = -1;
+
+	int eventCount = WaitEventSetWait(exchange->waitEventSet, timeout, exchange->events,
+									  exchange->eventSetSize, PG_WAIT_EXTENSION);
+
+	for (int eventIndex = 0; eventIndex < eventCount; eventIndex++)
+	{
+		WaitEvent *event = &exchange->events[eventIndex];
+
+		if (event->events & WL_POSTMASTER_DEATH)
+		{
+			ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+		}
+
+		if (event->events & WL_LATCH_SET)
+		{
+			ResetLatch(MyLatch);
+			CHECK_FOR_INTERRUPTS();
+			continue;
+		}
+
+		MapOutputSource *source = (MapOutputSource *) event->user_data;
+		ReceiveMapOutputs(exchange, source);
+	}
+
+	if (exchange->bufferedBytes > RepartitionExchangeBufferSize * 1024L)
+	{
+		SpillMapOutputs(exchange);
+	}
+}
+
+
+/*
+ * ReceiveMapOutputs receives the data that is available on the connection of
+ * the given source without blocking, and appends it to the buffer of the
+ * stream that is transmitted. When the transfer of a partition file finishes,
+ * the transfer of the next partition file of the source is started.
+ */
+static void
+ReceiveMapOutputs(PartitionExchange *exchange, MapOutputSource *source)
+{
+	MultiConnection *connection = source->connection;
+	PGconn *pgConn = connection->pgConn;
+
+	if (source->currentStreamCell == NULL)
+	{
+		/* drain the socket, to not wake up again for the same input */
+		PQconsumeInput(pgConn);
+		return;
+	}
+
+	if (PQconsumeInput(pgConn) == 0)
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+
+	while (source->currentStreamCell != NULL)
+	{
+		MapOutputStream *stream = (MapOutputStream *) lfirst(source->currentStreamCell);
+
+		if (stream->state == MAP_OUTPUT_STARTING)
+		{
+			if (PQisBusy(pgConn))
+			{
+				/* wait until the response to the transmit command arrives */
+				return;
+			}
+
+			PGresult *result = PQgetResult(pgConn);
+			if (PQresultStatus(result) != PGRES_COPY_OUT)
+			{
+				ReportResultError(connection, result, ERROR);
+			}
+
+			PQclear(result);
+
+			stream->state = MAP_OUTPUT_RECEIVING;
+		}
+
+		char *receiveBuffer = NULL;
+		bool asynchronous = true;
+		int receiveLength = PQgetCopyData(pgConn, &receiveBuffer, asynchronous);
+		while (receiveLength > 0)
+		{
+			appendBinaryStringInfo(stream->buffer, receiveBuffer, receiveLength);
+			exchange->bufferedBytes += receiveLength;
+
+			PQfreemem(receiveBuffer);
+			receiveLength = PQgetCopyData(pgConn, &receiveBuffer, asynchronous);
+		}
+
+		if (receiveLength == 0)
+		{
+			/* wait for more data */
+			return;
+		}
+		else if (receiveLength == -2)
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+
+		/* received copy done message */
+		bool raiseInterrupts = true;
+		PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
+		if (PQresultStatus(result) != PGRES_COMMAND_OK)
+		{
+			ReportResultError(connection, result, ERROR);
+		}
+
+		PQclear(result);
+		ForgetResults(connection);
+
+		stream->state = MAP_OUTPUT_DONE;
+
+		source->currentStreamCell = lnext(source->currentStreamCell);
+		if (source->currentStreamCell != NULL)
+		{
+			StartMapOutputTransmit(exchange, source);
+		}
+	}
+}
+
+
+/*
+ * SpillMapOutputs writes the buffers of the streams that are not currently
+ * copied into the table to their spill files, such that the memory usage of
+ * the exchange stays around the buffer size.
+ */
+static void
+SpillMapOutputs(PartitionExchange *exchange)
+{
+	ListCell *streamCell = NULL;
+
+	foreach(streamCell, exchange->streamList)
+	{
+		MapOutputStream *stream = (MapOutputStream *) lfirst(streamCell);
+		int bufferedBytes = stream->buffer->len - stream->bufferOffset;
+
+		if (stream == exchange->currentStream || bufferedBytes == 0)
+		{
+			continue;
+		}
+
+		if (stream->spillFile == NULL)
+		{
+			stream->spillFile = BufFileCreateTemp(false);
+		}
+
+		size_t bytesWritten = BufFileWrite(stream->spillFile,
+										   stream->buffer->data + stream->bufferOffset,
+										   bufferedBytes);
+		if (bytesWritten != (size_t) bufferedBytes)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not write to partition exchange file: %m")));
+		}
+
+		exchange->bufferedBytes -= bufferedBytes;
+
+		resetStringInfo(stream->buffer);
+		stream->bufferOffset = 0;
+	}
+}
@@ -14,6 +14,7 @@
 #include "pgstat.h"
 
 #include "distributed/commands/multi_copy.h"
+#include "distributed/intermediate_results.h"
 #include "distributed/multi_executor.h"
 #include "distributed/transmit.h"
 #include "distributed/version_compat.h"
@@ -45,11 +46,15 @@ typedef struct TaskFileDestReceiver
 	char *filePath;
 	FileCompat fileCompat;
 	bool binaryCopyFormat;
+	bool columnarFormat;
 
 	/* state on how to copy out data types */
 	CopyOutState copyOutState;
 	FmgrInfo *columnOutputFunctions;
 
+	/* buffers rows when writing in the columnar format */
+	ColumnarResultWriter *columnarWriter;
+
 	/* statistics */
 	uint64 tuplesSent;
 	uint64 bytesSent;
@@ -106,7 +111,7 @@ WorkerExecuteSqlTask(Query *query, char *taskFilename, bool binaryCopyFormat)
 	MemoryContext tupleContext = GetPerTupleMemoryContext(estate);
 	TaskFileDestReceiver *taskFileDest =
 		(TaskFileDestReceiver *) CreateFileDestReceiver(taskFilename, tupleContext,
-														binaryCopyFormat);
+														binaryCopyFormat, false);
 
 	ExecuteQueryIntoDestReceiver(query, paramListInfo, (DestReceiver *) taskFileDest);
 
@@ -121,10 +126,13 @@ WorkerExecuteSqlTask(Query *query, char *taskFilename, bool binaryCopyFormat)
 
 /*
  * CreateFileDestReceiver creates a DestReceiver for writing query results
- * to a file.
+ * to a file. When columnarFormat is true, the file is written in the columnar
+ * intermediate result format, which read_intermediate_result understands,
+ * with values in binary or text encoding depending on binaryCopyFormat.
  */
 DestReceiver *
-CreateFileDestReceiver(char *filePath, MemoryContext tupleContext, bool binaryCopyFormat)
+CreateFileDestReceiver(char *filePath, MemoryContext tupleContext, bool binaryCopyFormat,
+					   bool columnarFormat)
 {
 	TaskFileDestReceiver *taskFileDest = (TaskFileDestReceiver *) palloc0(
 		sizeof(TaskFileDestReceiver));
@@ -141,6 +149,7 @@ CreateFileDestReceiver(char *filePath, MemoryContext tupleContext, bool binaryCo
 	taskFileDest->memoryContext = CurrentMemoryContext;
 	taskFileDest->filePath = pstrdup(filePath);
 	taskFileDest->binaryCopyFormat = binaryCopyFormat;
+	taskFileDest->columnarFormat = columnarFormat;
 
 	return (DestReceiver *) taskFileDest;
 }
@@ -186,7 +195,17 @@ TaskFileDestReceiverStartup(DestReceiver *dest, int operation,
 														   fileFlags,
 														   fileMode));
 
-	if (copyOutState->binary)
+	if (taskFileDest->columnarFormat)
+	{
+		taskFileDest->columnarWriter =
+			CreateColumnarResultWriter(inputTupleDescriptor,
+									   taskFileDest->columnOutputFunctions,
+									   copyOutState->binary);
+
+		AppendColumnarResultHeader(taskFileDest->columnarWriter,
+								   copyOutState->fe_msgbuf);
+	}
+	else if (copyOutState->binary)
 	{
 		/* write headers when using binary encoding */
 		AppendCopyBinaryHeaders(copyOutState);
@@ -221,9 +240,22 @@ TaskFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 	Datum *columnValues = slot->tts_values;
 	bool *columnNulls = slot->tts_isnull;
 
-	/* construct row in COPY format */
-	AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
-					  copyOutState, columnOutputFunctions, NULL);
+	if (taskFileDest->columnarWriter != NULL)
+	{
+		/* buffer the row, and construct a block once enough rows are buffered */
+		bool blockFull = AppendColumnarResultRow(taskFileDest->columnarWriter,
+												 columnValues, columnNulls);
+		if (blockFull)
+		{
+			AppendColumnarResultBlock(taskFileDest->columnarWriter, copyData);
+		}
+	}
+	else
+	{
+		/* construct row in COPY format */
+		AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
+						  copyOutState, columnOutputFunctions, NULL);
+	}
 
 	if (copyData->len > COPY_BUFFER_SIZE)
 	{
@@ -276,7 +308,15 @@ TaskFileDestReceiverShutdown(DestReceiver *destReceiver)
 		resetStringInfo(copyOutState->fe_msgbuf);
 	}
 
-	if (copyOutState->binary)
+	if (taskFileDest->columnarWriter != NULL)
+	{
+		/* write the last block and the footer when using the columnar format */
+		AppendColumnarResultFooter(taskFileDest->columnarWriter,
+								   copyOutState->fe_msgbuf);
+		WriteToLocalFile(copyOutState->fe_msgbuf, taskFileDest);
+		resetStringInfo(copyOutState->fe_msgbuf);
+	}
+	else if (copyOutState->binary)
 	{
 		/* write footers when using binary encoding */
 		AppendCopyBinaryFooters(copyOutState);
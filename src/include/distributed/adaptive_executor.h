@@ -2,6 +2,7 @@
 #define ADAPTIVE_EXECUTOR_H
 
 #include "distributed/multi_physical_planner.h"
+#include "tcop/dest.h"
 
 /* GUC, determining whether Citus opens 1 connection per task */
 extern bool ForceMaxQueryParallelization;
@@ -10,11 +11,31 @@ extern int MaxAdaptiveExecutorPoolSize;
 /* GUC, number of ms to wait between opening connections to the same worker */
 extern int ExecutorSlowStartInterval;
 
+/* GUC, determining whether the workers return SELECT results in binary format */
+extern bool EnableBinaryProtocol;
+
+/* GUC, number of rows to fetch per result when libpq supports chunked mode */
+extern int ExecutorFetchBatchSize;
+
+/* GUC, determining whether eligible SELECTs return rows while they arrive */
+extern bool EnableStreamingExecution;
+
+/* GUC, determining whether SELECTs with a LIMIT stop once enough rows arrived */
+extern bool EnableEarlyLimitTermination;
+
+/* GUC, maximum number of tasks sent to a worker in a single request */
+extern int MaxCoalescedTasks;
+
 extern uint64 ExecuteTaskList(RowModifyLevel modLevel, List *taskList, int
 							  targetPoolSize);
 extern uint64 ExecuteTaskListOutsideTransaction(RowModifyLevel modLevel, List *taskList,
 												int
 												targetPoolSize);
+extern uint64 ExecuteTaskListInDependencyOrder(RowModifyLevel modLevel, List *taskList,
+											   int targetPoolSize);
+extern void ExecuteDistributedPlansIntoDestReceivers(List *distributedPlanList,
+													 List *tupleDescriptorList,
+													 List *destReceiverList);
 
 
 #endif /* ADAPTIVE_EXECUTOR_H */
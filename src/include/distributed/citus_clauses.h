@@ -17,6 +17,9 @@
 
 extern bool RequiresMasterEvaluation(Query *query);
 extern void ExecuteMasterEvaluableFunctions(Query *query, PlanState *planState);
+extern void ExecuteMasterEvaluableFunctionsKeepingParameters(Query *query,
+															 PlanState *planState);
+extern bool QueryReferencesAllParameters(Query *query, int parameterCount);
 extern Node * PartiallyEvaluateExpression(Node *expression, PlanState *planState);
 extern bool CitusIsVolatileFunction(Node *node);
 extern bool CitusIsMutableFunction(Node *node);
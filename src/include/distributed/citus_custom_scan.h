@@ -21,8 +21,18 @@ typedef struct CitusScanState
 	CustomScanState customScanState;  /* underlying custom scan node */
 	DistributedPlan *distributedPlan; /* distributed execution plan */
 	MultiExecutorType executorType;   /* distributed executor type */
+	int eflags;                       /* executor flags passed to BeginCustomScan */
 	bool finishedRemoteScan;          /* flag to check if remote scan is finished */
 	Tuplestorestate *tuplestorestate; /* tuple store to store distributed results */
+
+	/* execution that is still receiving rows into tuplestorestate, if any */
+	struct DistributedExecution *streamingExecution;
+
+	/* merge of the sorted task results, if the plan does not sort the rows itself */
+	struct SortedMergeState *sortedMergeState;
+
+	/* partitions of the rows for parallel aggregates, if the plan has a Gather */
+	struct ParallelCombineState *parallelCombineState;
 } CitusScanState;
 
 
@@ -42,4 +52,5 @@ extern EState * ScanStateGetExecutorState(CitusScanState *scanState);
 extern CustomScan * FetchCitusCustomScanIfExists(Plan *plan);
 extern bool IsCitusPlan(Plan *plan);
 extern bool IsCitusCustomScan(Plan *plan);
+extern bool IsTaskResultPassthroughPlan(Plan *plan);
 #endif /* CITUS_CUSTOM_SCAN_H */
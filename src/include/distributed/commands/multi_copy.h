@@ -24,6 +24,10 @@
 #define INVALID_PARTITION_COLUMN_INDEX -1
 
 
+/* config variable managed via guc.c */
+extern bool EnableCopyPassthrough;
+
+
 /*
  * A smaller version of copy.c's CopyStateData, trimmed to the elements
  * necessary to copy out results. While it'd be a bit nicer to share code,
@@ -107,6 +111,20 @@ typedef struct CitusCopyDestReceiver
 	CopyOutState copyOutState;
 	FmgrInfo *columnOutputFunctions;
 
+	/* state for serializing a row once for all placements of its shard */
+	CopyOutState rowOutputState;
+
+	/*
+	 * Whether rows are received as the raw text fields of the COPY input, in
+	 * which case only the partition column field is parsed.
+	 */
+	bool rawFieldPassthrough;
+	int partitionFieldIndex;
+	int rawFieldCount;
+	FmgrInfo partitionInputFunction;
+	Oid partitionTypeIOParam;
+	int32 partitionTypeMod;
+
 	/* instructions for coercing incoming tuples */
 	CopyCoercionData *columnCoercionPaths;
 
@@ -118,6 +136,15 @@ typedef struct CitusCopyDestReceiver
 
 	/* copy into intermediate result */
 	char *intermediateResultIdPrefix;
+
+	/* whether rows are parsed and serialized by parallel COPY workers */
+	bool parallelCopy;
+
+	/* whether tuples for placements on this node are inserted locally */
+	bool shouldUseLocalCopy;
+
+	/* executor state for the AFTER triggers of the local placements */
+	EState *localCopyExecutorState;
 } CitusCopyDestReceiver;
 
 
@@ -130,6 +157,7 @@ extern CitusCopyDestReceiver * CreateCitusCopyDestReceiver(Oid relationId,
 														   char *intermediateResultPrefix);
 extern FmgrInfo * ColumnOutputFunctions(TupleDesc rowDescriptor, bool binaryFormat);
 extern bool CanUseBinaryCopyFormat(TupleDesc tupleDescription);
+extern bool CanUseBinaryCopyFormatForTargetList(List *targetEntryList);
 extern bool CanUseBinaryCopyFormatForType(Oid typeId);
 extern void AppendCopyRowData(Datum *valueArray, bool *isNullArray,
 							  TupleDesc rowDescriptor,
@@ -143,6 +171,11 @@ extern Node * ProcessCopyStmt(CopyStmt *copyStatement, char *completionTag,
 							  const char *queryString);
 extern void CheckCopyPermissions(CopyStmt *copyStatement);
 extern bool IsCopyResultStmt(CopyStmt *copyStatement);
+extern bool ShouldUseLocalCopy(Oid relationId);
+extern void CitusCopyDestReceiverReceiveRow(CitusCopyDestReceiver *copyDest,
+											uint64 shardId, StringInfo rowData);
+extern uint32 AvailableColumnCount(TupleDesc tupleDescriptor);
+extern void ErrorPartitionColumnIsNull(Oid relationId);
 extern void ConversionPathForTypes(Oid inputType, Oid destType, CopyCoercionData *result);
 extern Datum CoerceColumnValue(Datum inputValue, CopyCoercionData *coercionPath);
 
@@ -0,0 +1,30 @@
+/*-------------------------------------------------------------------------
+ *
+ * parallel_copy.h
+ *    Declarations for parsing and routing the rows of a COPY into a
+ *    distributed table in parallel workers.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARALLEL_COPY_H
+#define PARALLEL_COPY_H
+
+
+#include "commands/copy.h"
+#include "distributed/commands/multi_copy.h"
+#include "storage/dsm.h"
+#include "storage/shm_toc.h"
+
+
+extern bool CanUseParallelCopy(CopyStmt *copyStatement, TupleDesc tupleDescriptor,
+							   int parallelWorkerCount);
+extern uint64 ParallelCopyToExistingShards(CopyState copyState,
+										   CitusCopyDestReceiver *copyDest,
+										   int parallelWorkerCount);
+extern void ParallelCopyWorkerMain(dsm_segment *segment, shm_toc *toc);
+
+
+#endif /* PARALLEL_COPY_H */
@@ -52,7 +52,13 @@ enum MultiConnectionMode
 	OUTSIDE_TRANSACTION = 1 << 4,
 
 	/* connection has not been used to access data */
-	REQUIRE_SIDECHANNEL = 1 << 5
+	REQUIRE_SIDECHANNEL = 1 << 5,
+
+	/*
+	 * Do not open a new connection if that would exceed the connection budget
+	 * that all backends share (citus.max_shared_pool_size), return NULL instead.
+	 */
+	OPTIONAL_CONNECTION = 1 << 6
 };
 
 /*
@@ -113,12 +119,21 @@ typedef struct MultiConnection
 	/* is the connection currently in use, and shouldn't be used by anything else */
 	bool claimedExclusively;
 
+	/* is the connection counted in the shared connection budget */
+	bool sharedCounterIncremented;
+
 	/* defines the purpose of the connection */
 	ConnectionPurpose purpose;
 
 	/* time connection establishment was started, for timeout */
 	TimestampTz connectionStart;
 
+	/* time connection establishment finished, 0 if not yet */
+	TimestampTz connectionEstablishmentEnd;
+
+	/* connection was started ahead of time by PrewarmWorkerConnections */
+	bool prewarmed;
+
 	/* membership in list of list of connections in ConnectionHashEntry */
 	dlist_node connectionNode;
 
@@ -133,6 +148,13 @@ typedef struct MultiConnection
 
 	/* number of bytes sent to PQputCopyData() since last flush */
 	uint64 copyBytesWrittenSinceLastFlush;
+
+	/* statements prepared on the connection, see prepared_statement_cache.c */
+	struct MemoryContextData *preparedStatementContext;
+	HTAB *preparedStatementCache;
+	uint64 preparedStatementGeneration;
+	uint64 preparedStatementCounter;
+	struct PreparedStatementCacheEntry *preparingStatement;
 } MultiConnection;
 
 
@@ -178,6 +200,9 @@ extern int NodeConnectionTimeout;
 /* maximum number of connections to cache per worker per session */
 extern int MaxCachedConnectionsPerWorker;
 
+/* whether to connect to all workers when a session starts using Citus */
+extern bool PrewarmConnections;
+
 /* parameters used for outbound connections */
 extern char *NodeConninfo;
 
@@ -191,6 +216,8 @@ extern struct MemoryContextData *ConnectionContext;
 
 extern void AfterXactConnectionHandling(bool isCommit);
 extern void InitializeConnectionManagement(void);
+extern void PrewarmWorkerConnections(List *placementList);
+extern void FinishPrewarmedConnections(void);
 
 extern void InitConnParams(void);
 extern void ResetConnParams(void);
@@ -225,6 +252,7 @@ extern void ShutdownConnection(MultiConnection *connection);
 /* dealing with a connection */
 extern void FinishConnectionListEstablishment(List *multiConnectionList);
 extern void FinishConnectionEstablishment(MultiConnection *connection);
+extern void MarkConnectionConnected(MultiConnection *connection);
 extern void ClaimConnectionExclusively(MultiConnection *connection);
 extern void UnclaimConnection(MultiConnection *connection);
 extern long DeadlineTimestampTzToTimeout(TimestampTz deadline);
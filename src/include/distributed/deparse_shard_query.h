@@ -15,13 +15,23 @@
 
 #include "c.h"
 
+#include "distributed/multi_physical_planner.h"
 #include "nodes/nodes.h"
 #include "nodes/parsenodes.h"
 #include "nodes/pg_list.h"
 
 
+/* Config variables managed via guc.c */
+extern bool EnableTaskQueryTemplates;
+
+
 extern void RebuildQueryStrings(Query *originalQuery, List *taskList);
 extern bool UpdateRelationToShardNames(Node *node, List *relationShardList);
+extern char * DeparseTaskQueryTemplate(Query *query, List *relationShardList);
+extern char * FillTaskQueryTemplate(char *queryTemplate, List *relationShardList);
+extern bool TaskQueryTemplateFits(char *queryTemplate, List *relationShardList);
+extern void SetTaskQueryTemplate(Task *task, char *queryTemplate);
+extern char * TaskQueryString(Task *task);
 
 
 #endif /* DEPARSE_SHARD_QUERY_H */
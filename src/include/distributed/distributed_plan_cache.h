@@ -0,0 +1,79 @@
+/*-------------------------------------------------------------------------
+ *
+ * distributed_plan_cache.h
+ *	  Cache of distributed plans for parameterized queries.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef DISTRIBUTED_PLAN_CACHE_H
+#define DISTRIBUTED_PLAN_CACHE_H
+
+#include "distributed/distributed_planner.h"
+#include "distributed/multi_physical_planner.h"
+#include "nodes/params.h"
+#include "portability/instr_time.h"
+
+
+/* whether a plan could be cached for a query */
+typedef enum DistributedPlanCacheState
+{
+	PLAN_CACHE_ENTRY_NEW,
+	PLAN_CACHE_ENTRY_CACHED,
+	PLAN_CACHE_ENTRY_NOT_CACHEABLE
+} DistributedPlanCacheState;
+
+
+/*
+ * DistributedPlanCacheEntry keeps the plan of a parameterized query, which was
+ * created without the parameter values such that the task queries refer to the
+ * parameters and the plan can be used for any parameter values.
+ */
+typedef struct DistributedPlanCacheEntry
+{
+	/* hash of the query tree and the parameter types, must be first */
+	uint64 queryId;
+
+	/* query tree and parameter types the entry is for, to detect collisions */
+	char *queryKey;
+
+	/* deparsed query, for citus_plan_cache_stats */
+	char *queryString;
+
+	DistributedPlanCacheState state;
+
+	/* standard_planner output and distributed plan for any parameter values */
+	PlannedStmt *localPlan;
+	DistributedPlan *distributedPlan;
+
+	/* restrictions on distributed tables that depend on the parameter values */
+	List *deferredPruningList;
+
+	/* statistics about planning the query */
+	uint64 calls;
+	uint64 cacheHits;
+	double totalPlanningTime;
+} DistributedPlanCacheEntry;
+
+
+extern int MaxCachedDistributedPlans;
+
+
+extern bool DistributedPlanCacheable(Query *originalQuery, ParamListInfo boundParams);
+extern DistributedPlanCacheEntry * LookupDistributedPlanCacheEntry(Query *originalQuery,
+																   ParamListInfo
+																   boundParams);
+extern void StoreDistributedPlanTemplate(DistributedPlanCacheEntry *cacheEntry,
+										 PlannedStmt *localPlan,
+										 DistributedPlan *distributedPlan,
+										 PlannerRestrictionContext *
+										 plannerRestrictionContext);
+extern DistributedPlan * DistributedPlanFromCache(DistributedPlanCacheEntry *cacheEntry,
+												  ParamListInfo boundParams);
+extern void RecordDistributedPlanningTime(DistributedPlanCacheEntry *cacheEntry,
+										  instr_time planningStart, bool cacheHit);
+extern void InvalidateDistributedPlanCache(void);
+
+#endif /* DISTRIBUTED_PLAN_CACHE_H */
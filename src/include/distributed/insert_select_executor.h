@@ -14,12 +14,23 @@
 #define INSERT_SELECT_EXECUTOR_H
 
 
+#include "distributed/multi_physical_planner.h"
 #include "executor/execdesc.h"
+#include "nodes/params.h"
+#include "nodes/plannodes.h"
+
+
+/* Config variables managed via guc.c */
+extern bool EnableRepartitionedInsertSelect;
 
 
 extern TupleTableSlot * CoordinatorInsertSelectExecScan(CustomScanState *node);
 extern bool ExecutingInsertSelect(void);
 extern Query * BuildSelectForInsertSelect(Query *insertSelectQuery);
+extern InsertSelectMethod InsertSelectMethodForQuery(Query *insertSelectQuery,
+													 ParamListInfo boundParams);
+extern PlannedStmt * PlanRedistributedSelect(Query *selectQuery,
+											 ParamListInfo paramListInfo);
 
 
 #endif /* INSERT_SELECT_EXECUTOR_H */
@@ -31,6 +31,7 @@ extern Query * ReorderInsertSelectTargetLists(Query *originalQuery,
 extern void CoordinatorInsertSelectExplainScan(CustomScanState *node, List *ancestors,
 											   struct ExplainState *es);
 extern DistributedPlan * CreateInsertSelectPlan(uint64 planId, Query *originalQuery,
+												ParamListInfo boundParams,
 												PlannerRestrictionContext *
 												plannerRestrictionContext);
 extern char * InsertSelectResultIdPrefix(uint64 planId);
@@ -15,22 +15,86 @@
 #include "fmgr.h"
 
 #include "distributed/commands/multi_copy.h"
+#include "distributed/metadata_cache.h"
 #include "nodes/execnodes.h"
 #include "nodes/pg_list.h"
 #include "tcop/dest.h"
 #include "utils/builtins.h"
 #include "utils/palloc.h"
+#include "utils/tuplestore.h"
+
+
+/*
+ * DistributedResultFragment represents a fragment of a distributed result
+ * that was written by worker_partition_query_result on one of the nodes.
+ */
+typedef struct DistributedResultFragment
+{
+	/* result's id, which can be used by read_intermediate_results(), etc. */
+	char *resultId;
+
+	/* location of the result */
+	uint32 nodeId;
+
+	/* number of rows in the result file */
+	uint64 rowCount;
+
+	/*
+	 * The fragment contains the rows which match the partitioning method
+	 * and partitioning ranges of targetShardId.
+	 */
+	uint64 targetShardId;
+
+	/* index of targetShardId in its relation's sorted shard list */
+	int targetShardIndex;
+} DistributedResultFragment;
+
+
+/* ColumnarResultWriter serialises rows into the columnar result format */
+typedef struct ColumnarResultWriter ColumnarResultWriter;
+
+
+/* GUC, number of nodes the coordinator and each relaying node send a result to */
+extern int IntermediateResultRelayFanout;
+
+/* GUC, whether to write intermediate results in the columnar format */
+extern bool ColumnarIntermediateResults;
 
 
 extern DestReceiver * CreateRemoteFileDestReceiver(char *resultId, EState *executorState,
 												   List *initialNodeList, bool
 												   writeLocalFile);
 extern void SendQueryResultViaCopy(const char *resultId);
-extern void ReceiveQueryResultViaCopy(const char *resultId);
+extern void ReceiveQueryResultViaCopy(const char *resultId, List *copyOptionList);
+extern void CloseResultRelayConnections(void);
 extern void RemoveIntermediateResultsDirectory(void);
 extern int64 IntermediateResultSize(char *resultId);
 extern char * QueryResultFileName(const char *resultId);
 extern char * CreateIntermediateResultsDirectory(void);
 
+/* distributed_intermediate_results.c */
+extern List * PartitionTasklistResults(char *resultIdPrefix, List *selectTaskList,
+									   int partitionColumnIndex,
+									   DistTableCacheEntry *targetRelation,
+									   bool binaryFormat);
+extern List ** RedistributeTaskListResults(char *resultIdPrefix, List *selectTaskList,
+										   int partitionColumnIndex,
+										   DistTableCacheEntry *targetRelation,
+										   bool binaryFormat);
+
+/* columnar_intermediate_results.c */
+extern ColumnarResultWriter * CreateColumnarResultWriter(TupleDesc tupleDescriptor,
+														 FmgrInfo *columnOutputFunctions,
+														 bool binaryFormat);
+extern void AppendColumnarResultHeader(ColumnarResultWriter *writer, StringInfo output);
+extern bool AppendColumnarResultRow(ColumnarResultWriter *writer, Datum *columnValues,
+									bool *columnNulls);
+extern void AppendColumnarResultBlock(ColumnarResultWriter *writer, StringInfo output);
+extern void AppendColumnarResultFooter(ColumnarResultWriter *writer, StringInfo output);
+extern bool IsColumnarResultFile(const char *fileName);
+extern void ReadColumnarResultFileIntoTupleStore(const char *fileName,
+												 TupleDesc tupleDescriptor,
+												 Tuplestorestate *tupleStore);
+
 
 #endif /* INTERMEDIATE_RESULTS_H */
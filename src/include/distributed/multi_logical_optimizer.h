@@ -153,5 +153,6 @@ extern void FindReferencedTableColumn(Expr *columnExpression, List *parentQueryL
 									  Query *query, Oid *relationId, Var **column);
 
 extern bool IsGroupBySubsetOfDistinct(List *groupClauses, List *distinctClauses);
+extern Oid CoordCombineAggOid(void);
 
 #endif   /* MULTI_LOGICAL_OPTIMIZER_H */
@@ -179,6 +179,9 @@ typedef struct MultiExtendedOp
 	bool hasDistinctOn;
 	bool hasWindowFuncs;
 	List *windowClause;
+
+	/* the coordinator merges the task results, which the workers sort */
+	bool sortedMerge;
 } MultiExtendedOp;
 
 
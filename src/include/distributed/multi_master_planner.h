@@ -19,11 +19,18 @@
 #include "nodes/plannodes.h"
 
 
+/* GUC, determining whether task results are merged rather than sorted */
+extern bool EnableSortedMerge;
+
+/* GUC, number of parallel workers that combine the aggregates on the coordinator */
+extern int MaxParallelCombineWorkers;
+
 /* Function declarations for building local plans on the master node */
 struct DistributedPlan;
 struct CustomScan;
 extern PlannedStmt * MasterNodeSelectPlan(struct DistributedPlan *distributedPlan,
-										  struct CustomScan *dataScan);
+										  struct CustomScan *dataScan,
+										  int cursorOptions);
 extern Unique * make_unique_from_sortclauses(Plan *lefttree, List *distinctList);
 
 
@@ -42,6 +42,8 @@
  (" UINT64_FORMAT ", %d, %s, '%s', '%s'::regtype, %s)"
 #define MERGE_FILES_INTO_TABLE_COMMAND "SELECT worker_merge_files_into_table \
  (" UINT64_FORMAT ", %d, '%s', '%s')"
+#define MERGE_MAP_OUTPUTS_INTO_TABLE_COMMAND "SELECT worker_merge_map_outputs_into_table \
+ (" UINT64_FORMAT ", %d, '%s', '%s', %u, %s, %s, %s)"
 #define MERGE_FILES_AND_RUN_QUERY_COMMAND \
 	"SELECT worker_merge_files_and_run_query(" UINT64_FORMAT ", %d, %s, %s)"
 
@@ -118,6 +120,14 @@ typedef enum RowModifyLevel
 	ROW_MODIFY_NONCOMMUTATIVE = 3
 } RowModifyLevel;
 
+
+/* Enumeration that defines how an INSERT ... SELECT via the coordinator runs */
+typedef enum InsertSelectMethod
+{
+	INSERT_SELECT_VIA_COORDINATOR = 0,
+	INSERT_SELECT_REPARTITION = 1
+} InsertSelectMethod;
+
 /*
  * Job represents a logical unit of work that contains one set of data transfers
  * in our physical plan. The physical planner maps each SQL query into one or
@@ -181,7 +191,20 @@ typedef struct Task
 	TaskType taskType;
 	uint64 jobId;
 	uint32 taskId;
+
+	/*
+	 * The query string of a task is built lazily by TaskQueryString() when the
+	 * planner only set one of the query references below. queryTemplate is a
+	 * template shared by similar tasks, in which the shard names of the task's
+	 * relationShardList are filled in (see FillTaskQueryTemplate()). shardQuery
+	 * is the query tree of the task with its relations updated to shards, which
+	 * is deparsed, or planned directly by the local executor. Once the query
+	 * string is set, it takes precedence over both references.
+	 */
 	char *queryString;
+	char *queryTemplate;
+	Query *shardQuery;
+
 	uint64 anchorShardId;       /* only applies to compute tasks */
 	List *taskPlacementList;    /* only applies to compute tasks */
 	List *dependentTaskList;     /* only applies to compute tasks */
@@ -275,6 +298,13 @@ typedef struct DistributedPlan
 	/* local query that merges results from the workers */
 	Query *masterQuery;
 
+	/*
+	 * The workers return the rows of each task in the order of the ORDER BY
+	 * of the masterQuery, and the executor merges the task results instead
+	 * of sorting all of them.
+	 */
+	bool sortedMerge;
+
 	/* query identifier (copied from the top-level PlannedStmt) */
 	uint64 queryId;
 
@@ -287,6 +317,9 @@ typedef struct DistributedPlan
 	/* INSERT .. SELECT via the coordinator */
 	Query *insertSelectQuery;
 
+	/* whether the results of insertSelectQuery are repartitioned on the workers */
+	InsertSelectMethod insertSelectMethod;
+
 	/*
 	 * If intermediateResultIdPrefix is non-null, an INSERT ... SELECT
 	 * via the coordinator is written to a set of intermediate results
@@ -350,6 +383,7 @@ typedef struct OperatorCacheEntry
 /* Config variable managed via guc.c */
 extern int TaskAssignmentPolicy;
 extern bool EnableUniqueJobIds;
+extern bool EnableRepartitionExchange;
 
 
 /* Function declarations for building physical plans and constructing queries */
@@ -179,6 +179,7 @@ extern void MultiTaskTrackerExecute(Job *job);
 
 /* Function declarations common to more than one executor */
 extern MultiExecutorType JobExecutorType(DistributedPlan *distributedPlan);
+extern bool HasReplicatedDistributedTable(List *relationOids);
 extern void RemoveJobDirectory(uint64 jobId);
 extern TaskExecution * InitTaskExecution(Task *task, TaskExecStatus initialStatus);
 extern bool CheckIfSizeLimitIsExceeded(DistributedExecutionStats *executionStats);
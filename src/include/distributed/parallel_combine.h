@@ -0,0 +1,26 @@
+/*-------------------------------------------------------------------------
+ *
+ * parallel_combine.h
+ *	  Declarations for combining the aggregates of a distributed query in
+ *	  parallel workers on the coordinator.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARALLEL_COMBINE_H
+#define PARALLEL_COMBINE_H
+
+#include "access/parallel.h"
+#include "distributed/citus_custom_scan.h"
+
+
+extern Size EstimateParallelCombine(CitusScanState *scanState, ParallelContext *pcxt);
+extern void InitializeParallelCombine(CitusScanState *scanState, ParallelContext *pcxt,
+									  void *coordinate);
+extern void ReinitializeParallelCombine(CitusScanState *scanState, void *coordinate);
+extern void AttachParallelCombine(CitusScanState *scanState, void *coordinate);
+extern TupleTableSlot * ReturnTupleFromParallelCombine(CitusScanState *scanState);
+extern void ShutdownParallelCombine(CitusScanState *scanState);
+
+#endif /* PARALLEL_COMBINE_H */
@@ -0,0 +1,32 @@
+/*-------------------------------------------------------------------------
+ *
+ * prepared_statement_cache.h
+ *   Cache of named prepared statements on the connections to the workers.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PREPARED_STATEMENT_CACHE_H
+#define PREPARED_STATEMENT_CACHE_H
+
+#include "libpq-fe.h"
+
+#include "distributed/connection_management.h"
+
+
+extern int MaxCachedStatementsPerConnection;
+
+
+extern const char * PreparedStatementName(MultiConnection *connection,
+										  const char *queryString, int parameterCount,
+										  const Oid *parameterTypes);
+extern bool StartPreparingStatement(MultiConnection *connection,
+									const char *queryString, int parameterCount,
+									const Oid *parameterTypes);
+extern void FinishPreparingStatement(MultiConnection *connection, PGresult *result);
+extern void FreePreparedStatementCache(MultiConnection *connection);
+extern void InvalidatePreparedStatementCaches(void);
+
+#endif /* PREPARED_STATEMENT_CACHE_H */
@@ -35,6 +35,7 @@ typedef enum
 	/* command execution */
 	REMOTE_TRANS_SENT_BEGIN,
 	REMOTE_TRANS_SENT_COMMAND,
+	REMOTE_TRANS_PREPARING_STATEMENT,
 	REMOTE_TRANS_FETCHING_RESULTS,
 	REMOTE_TRANS_CLEARING_RESULTS,
 
@@ -107,6 +108,7 @@ extern void RemoteTransactionPrepare(struct MultiConnection *connection);
 extern void StartRemoteTransactionCommit(struct MultiConnection *connection);
 extern void FinishRemoteTransactionCommit(struct MultiConnection *connection);
 extern void RemoteTransactionCommit(struct MultiConnection *connection);
+extern void RemoteTransactionListCommit(List *connectionList);
 
 extern void StartRemoteTransactionAbort(struct MultiConnection *connection);
 extern void FinishRemoteTransactionAbort(struct MultiConnection *connection);
@@ -125,6 +127,7 @@ extern void MarkRemoteTransactionFailed(struct MultiConnection *connection,
 										bool allowErrorPromotion);
 extern void MarkRemoteTransactionCritical(struct MultiConnection *connection);
 extern bool IsRemoteTransactionCritical(struct MultiConnection *connection);
+extern void DetachRemoteTransaction(struct MultiConnection *connection);
 
 
 /*
@@ -0,0 +1,43 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_connection_stats.h
+ *   Central management of the connections that all backends of the node
+ *   have open to each worker node.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARED_CONNECTION_STATS_H
+#define SHARED_CONNECTION_STATS_H
+
+#include "utils/timestamp.h"
+
+/* citus.max_shared_pool_size value that disables the shared connection budget */
+#define DISABLE_SHARED_CONNECTION_BUDGET -1
+
+
+/* latencies that we keep a histogram of */
+typedef enum LatencyMetric
+{
+	CONNECTION_ESTABLISHMENT_LATENCY,
+	FIRST_QUERY_LATENCY,
+	LATENCY_METRIC_COUNT
+} LatencyMetric;
+
+
+extern int MaxSharedPoolSize;
+
+
+extern void InitializeSharedConnectionStats(void);
+extern int GetMaxSharedPoolSize(void);
+extern bool TryToIncrementSharedConnectionCounter(const char *hostname, int port);
+extern void IncrementSharedConnectionCounter(const char *hostname, int port);
+extern void DecrementSharedConnectionCounter(const char *hostname, int port);
+extern void RecordLatency(LatencyMetric metric, TimestampTz startTime,
+						  TimestampTz endTime);
+extern void MarkFirstDistributedQueryStart(void);
+extern void MarkFirstDistributedQueryEnd(void);
+
+#endif /* SHARED_CONNECTION_STATS_H */
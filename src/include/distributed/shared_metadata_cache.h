@@ -0,0 +1,63 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_metadata_cache.h
+ *   Cache of the shard and placement metadata of distributed tables that is
+ *   shared by all backends of the node.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARED_METADATA_CACHE_H
+#define SHARED_METADATA_CACHE_H
+
+#include "nodes/parsenodes.h"
+#include "nodes/pg_list.h"
+
+
+/*
+ * ShardMetadataRow contains a pg_dist_shard row of a distributed table,
+ * together with the pg_dist_placement rows of the shard.
+ */
+typedef struct ShardMetadataRow
+{
+	uint64 shardId;
+	char storageType;
+
+	/* text representation of the min/max values, NULL if they are NULL */
+	char *minValue;
+	char *maxValue;
+
+	/* list of GroupShardPlacements */
+	List *placementList;
+} ShardMetadataRow;
+
+
+/*
+ * SharedMetadataVersion identifies the state of the metadata of a relation
+ * that rows were read at. Rows can only be shared if the version did not
+ * change while they were read from the catalogs.
+ */
+typedef struct SharedMetadataVersion
+{
+	uint64 globalVersion;
+	uint64 relationVersion;
+} SharedMetadataVersion;
+
+
+extern int SharedMetadataCacheSize;
+
+
+extern void InitializeSharedMetadataCache(void);
+extern bool LookupSharedShardMetadata(Oid relationId, List **shardRowList,
+									  SharedMetadataVersion *metadataVersion);
+extern void StoreSharedShardMetadata(Oid relationId, List *shardRowList,
+									 SharedMetadataVersion metadataVersion);
+extern void RecordSharedMetadataChange(Oid relationId);
+extern void SharedMetadataCacheTransactionStmt(TransactionStmt *transactionStmt);
+extern void SharedMetadataCacheCommit(void);
+extern void SharedMetadataCachePrepare(void);
+extern void SharedMetadataCacheAbort(void);
+
+#endif /* SHARED_METADATA_CACHE_H */
@@ -0,0 +1,53 @@
+/*-------------------------------------------------------------------------
+ *
+ * sorted_merge.h
+ *	  Declarations for merging the sorted results of the tasks of a
+ *	  distributed query on the coordinator.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SORTED_MERGE_H
+#define SORTED_MERGE_H
+
+#include "distributed/citus_custom_scan.h"
+#include "lib/binaryheap.h"
+#include "utils/sortsupport.h"
+#include "utils/tuplestore.h"
+
+
+/*
+ * SortedMergeState keeps the results of each task in a separate tuple store,
+ * and returns the rows of all tasks in the order of the sort clauses of the
+ * master query.
+ */
+typedef struct SortedMergeState
+{
+	/* results of each task, in the order of the task list */
+	int taskCount;
+	Tuplestorestate **tupleStores;
+
+	/* current row of each task */
+	TupleTableSlot **taskSlots;
+
+	/* how the rows are compared */
+	int sortKeyCount;
+	SortSupport sortKeys;
+
+	/* indexes of the tasks that have rows left, smallest current row on top */
+	binaryheap *taskHeap;
+	bool initialized;
+
+	/* task whose current row we returned last, -1 if none */
+	int lastTaskIndex;
+} SortedMergeState;
+
+
+extern SortedMergeState * CreateSortedMergeState(CitusScanState *scanState,
+												 int taskCount);
+extern TupleTableSlot * ReturnTupleFromSortedMerge(CitusScanState *scanState);
+extern void MergeSortedTaskResults(CitusScanState *scanState);
+extern void EndSortedMerge(CitusScanState *scanState);
+
+#endif /* SORTED_MERGE_H */
@@ -15,6 +15,7 @@
 #include "distributed/multi_physical_planner.h"
 
 extern int MaxIntermediateResult;
+extern int MaxConcurrentSubPlans;
 extern int SubPlanLevel;
 
 extern void ExecuteSubPlans(DistributedPlan *distributedPlan);
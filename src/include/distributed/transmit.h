@@ -18,8 +18,16 @@
 #include "storage/fd.h"
 
 
+/* function that receives copy data as it is redirected to a file */
+typedef void (*CopyDataForwardFunction)(StringInfo copyData, void *forwardArg);
+
+
 /* Function declarations for transmitting files between two nodes */
 extern void RedirectCopyDataToRegularFile(const char *filename);
+extern void RedirectCopyDataToRegularFileAndForward(const char *filename,
+													CopyDataForwardFunction
+													forwardFunction,
+													void *forwardArg);
 extern void SendRegularFile(const char *filename);
 extern File FileOpenForTransmit(const char *filename, int fileFlags, int fileMode);
 
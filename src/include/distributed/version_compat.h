@@ -32,6 +32,10 @@
 #define GetSysCacheOid2Compat GetSysCacheOid2
 #define GetSysCacheOid3Compat GetSysCacheOid3
 #define GetSysCacheOid4Compat GetSysCacheOid4
+#define CreateParallelContextCompat CreateParallelContext
+
+#define PglzDecompressCompat(source, slen, dest, rawsize) \
+	pglz_decompress(source, slen, dest, rawsize, true)
 
 #define fcGetArgValue(fc, n) ((fc)->args[n].value)
 #define fcGetArgNull(fc, n) ((fc)->args[n].isnull)
@@ -100,6 +104,14 @@ FileCompatFromFileStart(File fileDesc)
 #define GetSysCacheOid4Compat(cacheId, oidcol, key1, key2, key3, key4) \
 	GetSysCacheOid4(cacheId, key1, key2, key3, key4)
 
+/* PG12 allows parallel mode in serializable transactions */
+#define CreateParallelContextCompat(library, function, nworkers) \
+	CreateParallelContext(library, function, nworkers, false)
+
+/* PG12 added the check_complete argument to pglz_decompress */
+#define PglzDecompressCompat(source, slen, dest, rawsize) \
+	pglz_decompress(source, slen, dest, rawsize)
+
 #define LOCAL_FCINFO(name, nargs) \
 	FunctionCallInfoData name ## data; \
 	FunctionCallInfoData *name = &name ## data
@@ -102,6 +102,7 @@ typedef struct FileOutputStream
 
 /* Config variables managed via guc.c */
 extern int PartitionBufferSize;
+extern int RepartitionExchangeBufferSize;
 extern bool BinaryWorkerCopyFormat;
 
 
@@ -136,9 +137,13 @@ extern StringInfo UserTaskFilename(StringInfo directoryName, uint32 taskId);
 extern List * ColumnDefinitionList(List *columnNameList, List *columnTypeList);
 extern CreateStmt * CreateStatement(RangeVar *relation, List *columnDefinitionList);
 extern CopyStmt * CopyStatement(RangeVar *relation, char *sourceFilename);
+extern uint64 CopyMapOutputsIntoTable(RangeVar *relation, uint64 jobId,
+									  uint32 partitionId, List *mapTaskIdList,
+									  List *nodeNameList, List *nodePortList);
 extern DestReceiver * CreateFileDestReceiver(char *filePath,
 											 MemoryContext tupleContext,
-											 bool binaryCopyFormat);
+											 bool binaryCopyFormat,
+											 bool columnarFormat);
 extern void FileDestReceiverStats(DestReceiver *dest,
 								  uint64 *rowsSent,
 								  uint64 *bytesSent);
@@ -154,6 +159,7 @@ extern Datum worker_apply_shard_ddl_command(PG_FUNCTION_ARGS);
 extern Datum worker_range_partition_table(PG_FUNCTION_ARGS);
 extern Datum worker_hash_partition_table(PG_FUNCTION_ARGS);
 extern Datum worker_merge_files_into_table(PG_FUNCTION_ARGS);
+extern Datum worker_merge_map_outputs_into_table(PG_FUNCTION_ARGS);
 extern Datum worker_create_schema(PG_FUNCTION_ARGS);
 extern Datum worker_merge_files_and_run_query(PG_FUNCTION_ARGS);
 extern Datum worker_cleanup_job_schema_cache(PG_FUNCTION_ARGS);
@@ -0,0 +1,85 @@
+--
+-- COLUMNAR_RESULTS benchmark
+--
+-- Compares the size of intermediate results and the time it takes to write
+-- and read them in the binary COPY format and in the compressed columnar
+-- format (citus.columnar_intermediate_results), for a few typical shapes of
+-- data.
+--
+-- This script is not part of any schedule, run it manually against a cluster
+-- that was set up by the regression tests, e.g.:
+--
+--   psql -p 57636 -f src/test/regress/bench/columnar_results.sql
+--
+CREATE SCHEMA columnar_results_bench;
+SET search_path TO columnar_results_bench;
+
+CREATE FUNCTION result_format_stats(query text, columnar bool, column_list text)
+RETURNS TABLE (result_format text, rows_written bigint, bytes_written bigint,
+			   write_seconds numeric, read_seconds numeric)
+LANGUAGE plpgsql AS $$
+DECLARE
+	start_time timestamptz;
+	write_elapsed numeric;
+	read_elapsed numeric;
+	result_id text := CASE WHEN columnar THEN 'columnar_bench' ELSE 'binary_bench' END;
+	written bigint;
+	bytes bigint;
+BEGIN
+	PERFORM set_config('citus.columnar_intermediate_results', columnar::text, true);
+
+	start_time := clock_timestamp();
+
+	SELECT sum(r.rows_written), sum(r.bytes_written) INTO written, bytes
+	FROM worker_partition_query_result(result_id, query, 0, 'hash',
+									   '{-2147483648}'::text[], '{2147483647}'::text[],
+									   true, columnar) r;
+
+	write_elapsed := extract(epoch FROM clock_timestamp() - start_time);
+
+	start_time := clock_timestamp();
+
+	EXECUTE format('SELECT count(*) FROM read_intermediate_result(%L, ''binary'') '
+				   'AS res (%s)', result_id || '_0', column_list);
+
+	read_elapsed := extract(epoch FROM clock_timestamp() - start_time);
+
+	RETURN QUERY SELECT CASE WHEN columnar THEN 'columnar' ELSE 'binary' END,
+						written, bytes, round(write_elapsed, 2), round(read_elapsed, 2);
+END;
+$$;
+
+-- integers with few distinct values, e.g. foreign keys and status codes
+BEGIN;
+SELECT * FROM result_format_stats(
+	'SELECT s, s % 100, s % 7 FROM generate_series(1, 5000000) s', false,
+	'a int, b int, c int');
+SELECT * FROM result_format_stats(
+	'SELECT s, s % 100, s % 7 FROM generate_series(1, 5000000) s', true,
+	'a int, b int, c int');
+END;
+
+-- timestamps and short repetitive text
+BEGIN;
+SELECT * FROM result_format_stats(
+	'SELECT s, ''2020-01-01''::timestamptz + s * interval ''1 second'', '
+	'''status_'' || (s % 5) FROM generate_series(1, 5000000) s', false,
+	'a int, b timestamptz, c text');
+SELECT * FROM result_format_stats(
+	'SELECT s, ''2020-01-01''::timestamptz + s * interval ''1 second'', '
+	'''status_'' || (s % 5) FROM generate_series(1, 5000000) s', true,
+	'a int, b timestamptz, c text');
+END;
+
+-- random text, which does not compress and shows the overhead of trying
+BEGIN;
+SELECT * FROM result_format_stats(
+	'SELECT s, md5(s::text) FROM generate_series(1, 5000000) s', false,
+	'a int, b text');
+SELECT * FROM result_format_stats(
+	'SELECT s, md5(s::text) FROM generate_series(1, 5000000) s', true,
+	'a int, b text');
+END;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA columnar_results_bench CASCADE;
@@ -0,0 +1,97 @@
+--
+-- COPY_PASSTHROUGH benchmark
+--
+-- Measures the throughput of COPY into a hash-distributed table with 50
+-- columns, with all fields parsed on the coordinator and with only the
+-- distribution column parsed (citus.enable_copy_passthrough), for text and
+-- csv input.
+--
+-- This script is not part of any schedule, run it manually against a cluster
+-- that was set up by the regression tests, as a superuser since the input is
+-- read from a server-side file, e.g.:
+--
+--   psql -p 57636 -f src/test/regress/bench/copy_passthrough.sql
+--
+CREATE SCHEMA copy_passthrough_bench;
+SET search_path TO copy_passthrough_bench;
+SET citus.shard_count TO 32;
+SET citus.shard_replication_factor TO 1;
+
+-- 1 bigint key, 16 int, 8 bigint, 8 numeric, 9 text and 8 timestamp columns
+CREATE TABLE wide (
+	key bigint,
+	i1 int, i2 int, i3 int, i4 int, i5 int, i6 int, i7 int, i8 int,
+	i9 int, i10 int, i11 int, i12 int, i13 int, i14 int, i15 int, i16 int,
+	b1 bigint, b2 bigint, b3 bigint, b4 bigint,
+	b5 bigint, b6 bigint, b7 bigint, b8 bigint,
+	n1 numeric, n2 numeric, n3 numeric, n4 numeric,
+	n5 numeric, n6 numeric, n7 numeric, n8 numeric,
+	t1 text, t2 text, t3 text, t4 text, t5 text,
+	t6 text, t7 text, t8 text, t9 text,
+	ts1 timestamp, ts2 timestamp, ts3 timestamp, ts4 timestamp,
+	ts5 timestamp, ts6 timestamp, ts7 timestamp, ts8 timestamp
+);
+
+-- generate the input in a local table with the same columns
+CREATE TABLE wide_input (LIKE wide);
+INSERT INTO wide_input
+SELECT i,
+	   i, i % 7, i % 11, i % 13, i % 17, i % 19, i % 23, i % 29,
+	   i % 31, i % 37, i % 41, i % 43, i % 47, i % 53, i % 59, i % 61,
+	   i * 2, i * 3, i * 5, i * 7, i * 11, i * 13, i * 17, i * 19,
+	   i / 3.0, i / 7.0, i / 11.0, i / 13.0, i / 17.0, i / 19.0, i / 23.0, i / 29.0,
+	   md5(i::text), md5((i + 1)::text), md5((i + 2)::text), 'row ' || i,
+	   'value ' || i % 100, 'tab' || E'\t' || i, 'comma, ' || i, '', NULL,
+	   '2020-01-01'::timestamp + i * interval '1 second',
+	   '2020-01-01'::timestamp + i * interval '1 minute',
+	   '2020-01-01'::timestamp + i * interval '1 hour',
+	   '2020-01-01'::timestamp + i * interval '2 seconds',
+	   '2020-01-01'::timestamp + i * interval '3 seconds',
+	   '2020-01-01'::timestamp + i * interval '5 seconds',
+	   '2020-01-01'::timestamp + i * interval '7 seconds',
+	   '2020-01-01'::timestamp + i * interval '11 seconds'
+FROM generate_series(1, 1000000) i;
+
+COPY wide_input TO '/tmp/copy_passthrough_bench.txt';
+COPY wide_input TO '/tmp/copy_passthrough_bench.csv' WITH (format csv);
+
+SELECT create_distributed_table('wide', 'key');
+
+CREATE FUNCTION copy_rows_per_second(passthrough bool, input_format text)
+RETURNS TABLE (copy_passthrough bool, copy_format text, row_count bigint,
+			   seconds numeric, rows_per_second numeric)
+LANGUAGE plpgsql AS $$
+DECLARE
+	start_time timestamptz;
+	row_count bigint;
+	elapsed numeric;
+BEGIN
+	PERFORM set_config('citus.enable_copy_passthrough', passthrough::text, true);
+
+	TRUNCATE wide;
+
+	start_time := clock_timestamp();
+
+	EXECUTE format('COPY wide FROM %L WITH (format %s)',
+				   '/tmp/copy_passthrough_bench.' ||
+				   CASE input_format WHEN 'csv' THEN 'csv' ELSE 'txt' END,
+				   input_format);
+	GET DIAGNOSTICS row_count = ROW_COUNT;
+
+	elapsed := extract(epoch FROM clock_timestamp() - start_time);
+
+	RETURN QUERY SELECT $1, $2, row_count, round(elapsed, 2),
+						round(row_count / greatest(elapsed, 0.001));
+END;
+$$;
+
+-- warm up connections and caches
+SELECT * FROM copy_rows_per_second(false, 'text');
+
+SELECT * FROM copy_rows_per_second(false, 'text');
+SELECT * FROM copy_rows_per_second(true, 'text');
+SELECT * FROM copy_rows_per_second(false, 'csv');
+SELECT * FROM copy_rows_per_second(true, 'csv');
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA copy_passthrough_bench CASCADE;
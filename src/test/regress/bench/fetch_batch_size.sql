@@ -0,0 +1,70 @@
+--
+-- FETCH_BATCH_SIZE benchmark
+--
+-- Measures how many rows per second the adaptive executor ingests on the
+-- coordinator for a wide multi-shard scan, with results received one row at
+-- a time (citus.executor_fetch_batch_size = 1) and in batches. libpq only
+-- returns the rows of a batch in a single result when Citus is built against a
+-- libpq that supports chunked mode.
+--
+-- This script is not part of any schedule, run it manually against a cluster
+-- that was set up by the regression tests, e.g.:
+--
+--   psql -p 57636 -f src/test/regress/bench/fetch_batch_size.sql
+--
+CREATE SCHEMA fetch_batch_size_bench;
+SET search_path TO fetch_batch_size_bench;
+SET citus.shard_count TO 32;
+SET citus.shard_replication_factor TO 1;
+
+CREATE TABLE wide (
+	key bigint, c1 int, c2 int, c3 int, c4 int, c5 bigint, c6 bigint,
+	c7 numeric, c8 numeric, c9 text, c10 text, c11 timestamp, c12 timestamp
+);
+SELECT create_distributed_table('wide', 'key');
+
+INSERT INTO wide
+SELECT i, i, i % 100, i % 1000, i % 10000, i * 2, i * 3, i / 7.0, i / 13.0,
+	   md5(i::text), 'row ' || i, now() + i * interval '1 second', now()
+FROM generate_series(1, 10000000) i;
+
+VACUUM ANALYZE wide;
+
+CREATE FUNCTION scan_rows_per_second(batch_size int)
+RETURNS TABLE (fetch_batch_size int, row_count bigint, seconds numeric, rows_per_second numeric)
+LANGUAGE plpgsql AS $$
+DECLARE
+	start_time timestamptz;
+	row_count bigint := 0;
+	elapsed numeric;
+	r record;
+BEGIN
+	PERFORM set_config('citus.executor_fetch_batch_size', batch_size::text, true);
+
+	start_time := clock_timestamp();
+
+	FOR r IN SELECT * FROM wide LOOP
+		row_count := row_count + 1;
+	END LOOP;
+
+	elapsed := extract(epoch FROM clock_timestamp() - start_time);
+
+	RETURN QUERY SELECT $1, row_count, round(elapsed, 2),
+						round(row_count / greatest(elapsed, 0.001));
+END;
+$$;
+
+-- warm up connections and caches
+SELECT * FROM scan_rows_per_second(1);
+
+SELECT * FROM scan_rows_per_second(1);
+SELECT * FROM scan_rows_per_second(100);
+SELECT * FROM scan_rows_per_second(1000);
+SELECT * FROM scan_rows_per_second(10000);
+
+SET citus.enable_binary_protocol TO on;
+SELECT * FROM scan_rows_per_second(1);
+SELECT * FROM scan_rows_per_second(1000);
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA fetch_batch_size_bench CASCADE;
@@ -0,0 +1,69 @@
+--
+-- PARALLEL_COMBINE benchmark
+--
+-- Measures how long the coordinator takes to combine the partial aggregates
+-- of a GROUP BY query with millions of groups from 256 shards, with the
+-- coordinator backend alone (citus.max_parallel_combine_workers = 0) and
+-- with 1 to 8 parallel combine workers. The coordinator should allow at
+-- least 8 parallel workers (max_worker_processes and max_parallel_workers).
+--
+-- This script is not part of any schedule, run it manually against a cluster
+-- that was set up by the regression tests, e.g.:
+--
+--   psql -p 57636 -f src/test/regress/bench/parallel_combine.sql
+--
+-- and compare the times that psql reports for each setting.
+--
+CREATE SCHEMA parallel_combine_bench;
+SET search_path TO parallel_combine_bench;
+SET citus.shard_count TO 256;
+SET citus.shard_replication_factor TO 1;
+
+CREATE TABLE events (event_id bigint, user_id bigint, amount numeric, payload text);
+SELECT create_distributed_table('events', 'event_id');
+
+INSERT INTO events
+SELECT i, i % 4000000, i % 1000 / 10.0, md5(i::text)
+FROM generate_series(1, 20000000) i;
+
+VACUUM ANALYZE events;
+
+SET max_parallel_workers TO 8;
+
+-- the results are not interesting, only the time it takes to compute them
+\o /dev/null
+\timing on
+
+-- warm up connections and caches
+SET citus.max_parallel_combine_workers TO 0;
+SELECT user_id, count(*), sum(amount), avg(amount), max(payload)
+FROM events GROUP BY user_id;
+
+SET citus.max_parallel_combine_workers TO 0;
+SELECT user_id, count(*), sum(amount), avg(amount), max(payload)
+FROM events GROUP BY user_id;
+
+SET citus.max_parallel_combine_workers TO 1;
+SELECT user_id, count(*), sum(amount), avg(amount), max(payload)
+FROM events GROUP BY user_id;
+
+SET citus.max_parallel_combine_workers TO 2;
+SELECT user_id, count(*), sum(amount), avg(amount), max(payload)
+FROM events GROUP BY user_id;
+
+SET citus.max_parallel_combine_workers TO 4;
+SELECT user_id, count(*), sum(amount), avg(amount), max(payload)
+FROM events GROUP BY user_id;
+
+SET citus.max_parallel_combine_workers TO 8;
+SELECT user_id, count(*), sum(amount), avg(amount), max(payload)
+FROM events GROUP BY user_id;
+
+\timing off
+\o
+
+RESET citus.max_parallel_combine_workers;
+RESET max_parallel_workers;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA parallel_combine_bench CASCADE;
@@ -0,0 +1,39 @@
+--
+-- PREWARM_CONNECTIONS benchmark
+--
+-- Compares the latency of the first queries of short sessions that run router
+-- queries against different workers, without and with
+-- citus.prewarm_connections. Each session runs three router queries that
+-- usually hit different workers, like a short-lived application connection.
+--
+-- This script is not part of any schedule. It prepares the table and resets
+-- the latency histograms, then it prints pgbench commands that open a new
+-- session for every transaction (-C). Run it manually against a cluster that
+-- was set up by the regression tests, e.g.:
+--
+--   psql -p 57636 -f src/test/regress/bench/prewarm_connections.sql
+--
+-- and run the printed commands. After each run, the first_query_in_session
+-- and connection_establishment rows of citus_connection_latency_histogram
+-- show the distribution of the latencies:
+--
+--   SELECT * FROM citus_connection_latency_histogram WHERE count > 0;
+--
+CREATE SCHEMA prewarm_connections_bench;
+SET search_path TO prewarm_connections_bench;
+SET citus.shard_count TO 32;
+SET citus.shard_replication_factor TO 1;
+
+CREATE TABLE kv (key bigint PRIMARY KEY, value text);
+SELECT create_distributed_table('kv', 'key');
+INSERT INTO kv SELECT i, md5(i::text) FROM generate_series(1, 100000) i;
+
+\! printf '%s\n' '\set k1 random(1, 100000)' '\set k2 random(1, 100000)' '\set k3 random(1, 100000)' 'SELECT value FROM prewarm_connections_bench.kv WHERE key = :k1;' 'SELECT value FROM prewarm_connections_bench.kv WHERE key = :k2;' 'SELECT value FROM prewarm_connections_bench.kv WHERE key = :k3;' > /tmp/prewarm_connections_bench.pgbench
+
+SELECT citus_reset_connection_latency_histogram();
+
+\echo 'without prewarming:'
+\echo '  PGOPTIONS="-c citus.prewarm_connections=off" pgbench -n -C -c 8 -T 30 -f /tmp/prewarm_connections_bench.pgbench -p 57636'
+\echo 'then reset the histograms, and with prewarming:'
+\echo '  PGOPTIONS="-c citus.prewarm_connections=on" pgbench -n -C -c 8 -T 30 -f /tmp/prewarm_connections_bench.pgbench -p 57636'
+\echo 'clean up with: DROP SCHEMA prewarm_connections_bench CASCADE;'
@@ -0,0 +1,60 @@
+--
+-- RELAY_BROADCAST benchmark
+--
+-- Measures the time it takes to broadcast a large intermediate result to all
+-- workers, with the coordinator sending it to every worker and with the
+-- workers relaying it to each other (citus.intermediate_result_relay_fanout).
+-- The coordinator_sends column shows how many copies of the result leave the
+-- coordinator, which is what limits the flat broadcast on large clusters.
+--
+-- This script is not part of any schedule, run it manually against a cluster
+-- that was set up by the regression tests, e.g.:
+--
+--   psql -p 57636 -f src/test/regress/bench/relay_broadcast.sql
+--
+-- On the local regression cluster all nodes share a machine, so the numbers
+-- mostly show the overhead of the extra hop. Run it against a cluster with
+-- more workers on separate machines to see the effect on network bandwidth.
+--
+CREATE SCHEMA relay_broadcast_bench;
+SET search_path TO relay_broadcast_bench;
+
+CREATE FUNCTION broadcast_seconds(relay_fanout int, row_count bigint)
+RETURNS TABLE (fanout int, coordinator_sends bigint, rows_sent bigint,
+			   seconds numeric)
+LANGUAGE plpgsql AS $$
+DECLARE
+	start_time timestamptz;
+	node_count bigint;
+	rows_sent bigint;
+	elapsed numeric;
+BEGIN
+	PERFORM set_config('citus.intermediate_result_relay_fanout', relay_fanout::text,
+					   true);
+
+	SELECT count(*) INTO node_count FROM master_get_active_worker_nodes();
+
+	start_time := clock_timestamp();
+
+	SELECT broadcast_intermediate_result('relay_bench',
+		format('SELECT s, md5(s::text) FROM generate_series(1, %s) s', row_count))
+	INTO rows_sent;
+
+	elapsed := extract(epoch FROM clock_timestamp() - start_time);
+
+	RETURN QUERY SELECT $1,
+						CASE WHEN $1 > 0 THEN least($1, node_count) ELSE node_count END,
+						rows_sent, round(elapsed, 2);
+END;
+$$;
+
+-- warm up connections
+SELECT * FROM broadcast_seconds(0, 1000);
+
+SELECT * FROM broadcast_seconds(0, 5000000);
+SELECT * FROM broadcast_seconds(1, 5000000);
+SELECT * FROM broadcast_seconds(0, 20000000);
+SELECT * FROM broadcast_seconds(1, 20000000);
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA relay_broadcast_bench CASCADE;
@@ -0,0 +1,78 @@
+--
+-- TASK_QUERY_TEMPLATES benchmark
+--
+-- Measures the coordinator planning time of a multi-shard join against the
+-- shard count, with the task query strings deparsed once per shard and built
+-- from a template (citus.enable_task_query_templates).
+--
+-- This script is not part of any schedule, run it manually against a cluster
+-- that was set up by the regression tests, e.g.:
+--
+--   psql -p 57636 -f src/test/regress/bench/task_query_templates.sql
+--
+CREATE SCHEMA task_query_templates_bench;
+SET search_path TO task_query_templates_bench;
+SET citus.shard_replication_factor TO 1;
+
+CREATE FUNCTION create_bench_tables(shard_count int)
+RETURNS void
+LANGUAGE plpgsql AS $$
+BEGIN
+	PERFORM set_config('citus.shard_count', shard_count::text, true);
+
+	EXECUTE format('CREATE TABLE events_%s (user_id int, event_type int, '
+				   'payload text, created_at timestamptz)', shard_count);
+	EXECUTE format('CREATE TABLE users_%s (user_id int, name text, country text)',
+				   shard_count);
+
+	PERFORM create_distributed_table(format('events_%s', shard_count), 'user_id');
+	PERFORM create_distributed_table(format('users_%s', shard_count), 'user_id',
+									 colocate_with => format('events_%s', shard_count));
+END;
+$$;
+
+CREATE FUNCTION planning_milliseconds(shard_count int, use_templates bool,
+									  repetitions int DEFAULT 20)
+RETURNS TABLE (shards int, templates bool, avg_planning_ms numeric)
+LANGUAGE plpgsql AS $$
+DECLARE
+	plan json;
+	total numeric := 0;
+BEGIN
+	PERFORM set_config('citus.enable_task_query_templates', use_templates::text, true);
+
+	FOR i IN 1 .. repetitions LOOP
+		EXECUTE format(
+			'EXPLAIN (SUMMARY, FORMAT JSON) '
+			'SELECT u.country, e.event_type, count(*), max(e.created_at) '
+			'FROM events_%1$s e JOIN users_%1$s u USING (user_id) '
+			'WHERE e.event_type IN (1, 2, 3) AND u.name LIKE ''a%%'' '
+			'AND e.user_id IN (SELECT user_id FROM events_%1$s WHERE payload IS NOT NULL) '
+			'GROUP BY 1, 2', $1) INTO plan;
+
+		total := total + (plan->0->>'Planning Time')::numeric;
+	END LOOP;
+
+	RETURN QUERY SELECT $1, $2, round(total / repetitions, 3);
+END;
+$$;
+
+SELECT create_bench_tables(32);
+SELECT create_bench_tables(128);
+SELECT create_bench_tables(512);
+SELECT create_bench_tables(1024);
+
+-- warm up connections and caches
+SELECT * FROM planning_milliseconds(1024, true, 5);
+
+SELECT * FROM planning_milliseconds(32, false);
+SELECT * FROM planning_milliseconds(32, true);
+SELECT * FROM planning_milliseconds(128, false);
+SELECT * FROM planning_milliseconds(128, true);
+SELECT * FROM planning_milliseconds(512, false);
+SELECT * FROM planning_milliseconds(512, true);
+SELECT * FROM planning_milliseconds(1024, false);
+SELECT * FROM planning_milliseconds(1024, true);
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA task_query_templates_bench CASCADE;
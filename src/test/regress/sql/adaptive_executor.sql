@@ -34,4 +34,18 @@ SELECT sum(result::bigint) FROM run_command_on_workers($$
 $$);
 END;
 
+-- fetching the results in batches gives the same results
+SET citus.executor_fetch_batch_size TO 1000;
+SELECT * FROM test ORDER BY x;
+SELECT count(*) FROM test a JOIN test b USING (x);
+
+-- results that span many batches, the size limit is checked on every row
+INSERT INTO test SELECT i, i FROM generate_series(4, 1000) i;
+SET citus.executor_fetch_batch_size TO 7;
+SELECT count(*), sum(x), sum(y) FROM (SELECT * FROM test OFFSET 0) t;
+SET citus.max_intermediate_result_size TO 1;
+SELECT count(*), sum(x), sum(y) FROM (SELECT * FROM test OFFSET 0) t;
+RESET citus.max_intermediate_result_size;
+RESET citus.executor_fetch_batch_size;
+
 DROP SCHEMA adaptive_executor CASCADE;
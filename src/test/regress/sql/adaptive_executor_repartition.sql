@@ -29,6 +29,33 @@ INSERT INTO ab values(1, 2);
 SELECT count(*) FROM (SELECT k.a FROM ab k, ab l WHERE k.a = l.b) first, (SELECT * FROM ab) second WHERE first.a = second.b;
 ROLLBACK;
 
+-- tasks start as soon as the tasks they depend on have finished, so the
+-- tasks that depend on the map tasks of one side of a dual repartition join
+-- do not wait for the slow map tasks of the other side
+SELECT dependency_ordered_tasks AS tasks_before,
+       early_task_starts AS early_starts_before
+FROM citus_executor_task_stats
+\gset
+SELECT count(*) FROM ab k, ab l
+WHERE k.b = l.b AND (pg_sleep(0.3) IS NULL OR l.a IS NOT NULL);
+SELECT dependency_ordered_tasks > :tasks_before AS ran_dependent_tasks,
+       early_task_starts > :early_starts_before AS started_early
+FROM citus_executor_task_stats;
+
+-- stream map outputs directly into the merge tables
+SET citus.enable_repartition_exchange TO on;
+SELECT COUNT(*) FROM ab k, ab l
+WHERE k.a = l.b;
+
+SELECT COUNT(*) FROM ab k, ab l, ab m, ab t
+WHERE k.a = l.b AND k.a = m.b AND t.b = l.a;
+
+-- spill all map outputs that are not being copied to temporary files
+SET citus.repartition_exchange_buffer_size TO 0;
+SELECT count(*) FROM (SELECT k.a FROM ab k, ab l WHERE k.a = l.b) first, (SELECT * FROM ab) second WHERE first.a = second.b;
+RESET citus.repartition_exchange_buffer_size;
+RESET citus.enable_repartition_exchange;
+
 SET citus.enable_single_hash_repartition_joins TO ON;
 
 CREATE TABLE single_hash_repartition_first (id int, sum int, avg float);
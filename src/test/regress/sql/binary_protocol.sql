@@ -0,0 +1,43 @@
+--
+-- BINARY_PROTOCOL
+--
+-- Tests for receiving the results of SELECT queries in binary format
+CREATE SCHEMA binary_protocol;
+SET search_path TO binary_protocol;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4130000;
+
+CREATE TABLE t (key int, n numeric, ts timestamp, id uuid, t text);
+SELECT create_distributed_table('t', 'key');
+
+INSERT INTO t
+SELECT i, i * 1.5, '2020-01-01'::timestamp + i * interval '1 day',
+       ('00000000-0000-0000-0000-00000000000' || i)::uuid, 'text ' || i
+FROM generate_series(1, 5) i;
+INSERT INTO t VALUES (6, NULL, NULL, NULL, NULL);
+
+SET citus.enable_binary_protocol TO on;
+
+SELECT * FROM t ORDER BY key;
+SELECT count(*), sum(n), max(ts), count(DISTINCT id) FROM t;
+SELECT t, n FROM t WHERE key = 3;
+
+-- prepared statements send parameters and ask for binary results
+PREPARE binary_select(int) AS SELECT key, n, id FROM t WHERE key <= $1 ORDER BY key;
+EXECUTE binary_select(2);
+EXECUTE binary_select(3);
+
+-- user-defined composite types fall back to the text format
+CREATE TYPE pair AS (a int, b int);
+CREATE TABLE composite (key int, p pair);
+SELECT create_distributed_table('composite', 'key');
+INSERT INTO composite VALUES (1, (1,2)), (2, (3,4)), (3, NULL);
+SELECT * FROM composite ORDER BY key;
+
+-- text and binary format give the same results
+SET citus.enable_binary_protocol TO off;
+SELECT * FROM t ORDER BY key;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA binary_protocol CASCADE;
@@ -0,0 +1,120 @@
+--
+-- COLUMNAR_INTERMEDIATE_RESULTS
+--
+-- Tests for intermediate results in the compressed columnar format
+CREATE SCHEMA columnar_intermediate_results;
+SET search_path TO columnar_intermediate_results;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4270000;
+SET citus.columnar_intermediate_results TO on;
+
+-- the columnar format is detected regardless of the requested format
+BEGIN;
+SELECT create_intermediate_result('squares', 'SELECT s, s*s FROM generate_series(1,5) s');
+SELECT * FROM read_intermediate_result('squares', 'binary') AS res (x int, x2 int);
+SELECT * FROM read_intermediate_result('squares', 'text') AS res (x int, x2 int);
+SELECT * FROM read_intermediate_result('squares', 'binary') AS res (x int);
+END;
+
+-- results with NULLs and several blocks
+BEGIN;
+SELECT create_intermediate_result('many_rows',
+	'SELECT s, CASE WHEN s % 7 = 0 THEN NULL ELSE repeat(md5(s::text), s % 4) END '
+	'FROM generate_series(1, 25000) s');
+SELECT count(*), count(t), sum(x), sum(length(t))
+FROM read_intermediate_result('many_rows', 'binary') AS res (x int, t text);
+SELECT count(*) FROM (
+	SELECT s, CASE WHEN s % 7 = 0 THEN NULL ELSE repeat(md5(s::text), s % 4) END
+	FROM generate_series(1, 25000) s
+	EXCEPT
+	SELECT * FROM read_intermediate_result('many_rows', 'binary') AS res (x int, t text)
+) missing_rows;
+END;
+
+-- types without a binary encoding are written as text
+CREATE TYPE complex_number AS (r float8, i float8);
+BEGIN;
+SELECT create_intermediate_result('complex_numbers',
+	'SELECT s, (s, -s)::complex_number FROM generate_series(1,3) s');
+SELECT * FROM read_intermediate_result('complex_numbers', 'text') AS res (s int, c complex_number);
+END;
+
+-- worker_partition_query_result writes columnar files that are much smaller
+BEGIN;
+WITH binary_result AS (
+	SELECT sum(rows_written) AS rows_written, sum(bytes_written) AS bytes_written
+	FROM worker_partition_query_result('binary_ints',
+		'SELECT i, i % 10 FROM generate_series(1, 50000) i', 0, 'hash',
+		'{-2147483648,-1073741824,0,1073741824}'::text[],
+		'{-1073741825,-1,1073741823,2147483647}'::text[], true, false)
+), columnar_result AS (
+	SELECT sum(rows_written) AS rows_written, sum(bytes_written) AS bytes_written
+	FROM worker_partition_query_result('columnar_ints',
+		'SELECT i, i % 10 FROM generate_series(1, 50000) i', 0, 'hash',
+		'{-2147483648,-1073741824,0,1073741824}'::text[],
+		'{-1073741825,-1,1073741823,2147483647}'::text[], true, true)
+)
+SELECT b.rows_written, c.rows_written, 2 * c.bytes_written < b.bytes_written AS smaller
+FROM binary_result b, columnar_result c;
+SELECT count(*), sum(x), sum(y)
+FROM read_intermediate_result_array(ARRAY['columnar_ints_0', 'columnar_ints_1',
+										  'columnar_ints_2', 'columnar_ints_3'],
+									'binary') AS res (x int, y int);
+END;
+
+-- subplan results are sent to the workers in the columnar format
+SET citus.shard_count TO 4;
+CREATE TABLE interesting_squares (user_id text, interested_in text);
+SELECT create_distributed_table('interesting_squares', 'user_id');
+INSERT INTO interesting_squares VALUES ('jon', '2'), ('jon', '5'), ('jack', '3'), ('sam', '4'), ('lisa', '1');
+
+BEGIN;
+SELECT broadcast_intermediate_result('squares', 'SELECT s, s*s FROM generate_series(1,5) s');
+SELECT x, x2
+FROM interesting_squares
+JOIN (SELECT * FROM read_intermediate_result('squares', 'binary') AS res (x int, x2 int)) squares ON (x::text = interested_in)
+ORDER BY x;
+END;
+
+WITH top_users AS (
+	SELECT user_id FROM interesting_squares ORDER BY user_id LIMIT 2
+)
+SELECT user_id, interested_in FROM interesting_squares
+WHERE user_id IN (SELECT user_id FROM top_users)
+ORDER BY 1, 2;
+
+-- relayed results keep the format
+SET citus.intermediate_result_relay_fanout TO 1;
+WITH top_users AS (
+	SELECT user_id FROM interesting_squares ORDER BY user_id DESC LIMIT 2
+)
+SELECT user_id, interested_in FROM interesting_squares
+WHERE user_id IN (SELECT user_id FROM top_users)
+ORDER BY 1, 2;
+RESET citus.intermediate_result_relay_fanout;
+
+-- repartitioned INSERT ... SELECT
+SET citus.enable_repartitioned_insert_select TO on;
+CREATE TABLE source_table (a int, b int, c text);
+SELECT create_distributed_table('source_table', 'a');
+SET citus.shard_count TO 3;
+CREATE TABLE target_table (a int, b int, c text);
+SELECT create_distributed_table('target_table', 'b');
+
+INSERT INTO source_table SELECT i, i % 3, 'row ' || i FROM generate_series(1, 1000) i;
+INSERT INTO target_table SELECT * FROM source_table;
+SELECT b, count(*), sum(a), count(DISTINCT c) FROM target_table GROUP BY b ORDER BY b;
+RESET citus.enable_repartitioned_insert_select;
+
+RESET citus.columnar_intermediate_results;
+
+-- results in the columnar format can still be read when the setting is off
+BEGIN;
+SET LOCAL citus.columnar_intermediate_results TO on;
+SELECT create_intermediate_result('squares', 'SELECT s, s*s FROM generate_series(1,3) s');
+SET LOCAL citus.columnar_intermediate_results TO off;
+SELECT * FROM read_intermediate_result('squares', 'binary') AS res (x int, x2 int);
+END;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA columnar_intermediate_results CASCADE;
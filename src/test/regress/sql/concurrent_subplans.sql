@@ -0,0 +1,65 @@
+--
+-- CONCURRENT_SUBPLANS
+--
+-- Tests for executing independent CTEs and subqueries concurrently
+CREATE SCHEMA concurrent_subplans;
+SET search_path TO concurrent_subplans;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4250000;
+
+CREATE TABLE events (user_id int, value int);
+SELECT create_distributed_table('events', 'user_id');
+
+CREATE TABLE other_events (user_id int, value int);
+SELECT create_distributed_table('other_events', 'user_id');
+
+INSERT INTO events SELECT i % 10, i FROM generate_series(1, 100) i;
+INSERT INTO other_events SELECT i, i * 2 FROM generate_series(1, 20) i;
+
+SET citus.max_concurrent_subplans TO 4;
+
+-- independent CTEs run in batches of citus.max_concurrent_subplans
+WITH a AS (SELECT user_id, value FROM events WHERE value <= 10),
+     b AS (SELECT user_id, value FROM events WHERE value > 90),
+     c AS (SELECT user_id, value FROM events WHERE value % 10 = 0),
+     d AS (SELECT user_id, value FROM events WHERE user_id = 3),
+     e AS (SELECT user_id, value FROM other_events),
+     f AS (SELECT user_id, value FROM events WHERE value BETWEEN 40 AND 45)
+SELECT 'a' AS cte, count(*) AS result FROM a
+UNION ALL SELECT 'b', sum(value) FROM b
+UNION ALL SELECT 'c', count(*) FROM c
+UNION ALL SELECT 'd', sum(value) FROM d
+UNION ALL SELECT 'e', count(*) FROM e
+UNION ALL SELECT 'f', max(value) FROM f
+ORDER BY cte;
+
+-- b reads the result of a, so it runs after a and c
+WITH a AS (SELECT user_id, value FROM events WHERE value > 50),
+     b AS (SELECT e.user_id, e.value FROM events e JOIN a USING (value)),
+     c AS (SELECT user_id, value FROM other_events)
+SELECT count(*), sum(b.value) FROM b JOIN c USING (user_id);
+
+-- a needs the coordinator to apply the LIMIT, so it runs on its own
+WITH a AS (SELECT user_id, value FROM events ORDER BY value DESC LIMIT 5),
+     b AS (SELECT user_id, value FROM events WHERE value <= 5),
+     c AS (SELECT user_id, value FROM other_events WHERE user_id <= 5)
+SELECT 'a' AS cte, sum(value) AS result FROM a
+UNION ALL SELECT 'b', sum(value) FROM b
+UNION ALL SELECT 'c', sum(value) FROM c
+ORDER BY cte;
+
+-- concurrent subplans see the earlier writes of the transaction
+BEGIN;
+INSERT INTO events VALUES (3, 1000);
+WITH a AS (SELECT user_id, value FROM events WHERE user_id = 3),
+     b AS (SELECT user_id, value FROM events WHERE value > 95)
+SELECT 'a' AS cte, max(value) AS result FROM a
+UNION ALL SELECT 'b', count(*) FROM b
+ORDER BY cte;
+ROLLBACK;
+
+RESET citus.max_concurrent_subplans;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA concurrent_subplans CASCADE;
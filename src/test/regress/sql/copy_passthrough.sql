@@ -0,0 +1,83 @@
+--
+-- COPY_PASSTHROUGH
+--
+-- Tests for COPY into hash-distributed tables that only parses the
+-- distribution column of each row on the coordinator
+CREATE SCHEMA copy_passthrough;
+SET search_path TO copy_passthrough;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4220000;
+
+-- the distribution column comes after a dropped column
+CREATE TABLE events (a int, key text, b jsonb, c text, d timestamp);
+ALTER TABLE events DROP COLUMN a;
+SELECT create_distributed_table('events', 'key');
+
+CREATE TABLE events_parsed (key text, b jsonb, c text, d timestamp);
+SELECT create_distributed_table('events_parsed', 'key');
+
+SET citus.enable_copy_passthrough TO on;
+
+\copy events FROM STDIN
+1	{"x": 1}	tab\there	2020-01-01 00:00:00
+2	\N	back\\slash	\N
+3	[]	new\nline	2020-01-02 10:00:00
+\.
+\copy events FROM STDIN WITH (format csv)
+4,"{""y"": 2}","quoted, comma",
+5,,"",2020-01-03 00:00:00
+\.
+
+-- column lists do not use the passthrough path
+\copy events (key, c) FROM STDIN
+6	only c
+\.
+
+SET citus.enable_copy_passthrough TO off;
+
+\copy events_parsed FROM STDIN
+1	{"x": 1}	tab\there	2020-01-01 00:00:00
+2	\N	back\\slash	\N
+3	[]	new\nline	2020-01-02 10:00:00
+\.
+\copy events_parsed FROM STDIN WITH (format csv)
+4,"{""y"": 2}","quoted, comma",
+5,,"",2020-01-03 00:00:00
+\.
+\copy events_parsed (key, c) FROM STDIN
+6	only c
+\.
+
+SELECT key, b, replace(replace(c, E'\t', '<tab>'), E'\n', '<newline>') AS c, d
+FROM events ORDER BY key;
+
+-- rows are in the same shards as when all columns are parsed
+SELECT count(*) FROM events e JOIN events_parsed p
+ON (e.key = p.key AND e.b IS NOT DISTINCT FROM p.b AND
+    e.c IS NOT DISTINCT FROM p.c AND e.d IS NOT DISTINCT FROM p.d);
+
+SET citus.enable_copy_passthrough TO on;
+\set VERBOSITY terse
+
+-- the distribution column is checked on the coordinator
+\copy events FROM STDIN
+\N	{}	null key	\N
+\.
+\copy events FROM STDIN
+7	{}
+\.
+\copy events FROM STDIN
+8	{}	x	\N	extra
+\.
+
+-- other columns are validated by the workers
+\copy events FROM STDIN
+9	not json	x	\N
+\.
+
+\set VERBOSITY default
+SELECT count(*) FROM events;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA copy_passthrough CASCADE;
@@ -0,0 +1,72 @@
+--
+-- DISTRIBUTED_PLAN_CACHE
+--
+-- Tests for reusing the distributed plans of parameterized multi-shard
+-- queries across executions
+CREATE SCHEMA distributed_plan_cache;
+SET search_path TO distributed_plan_cache;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4200000;
+
+CREATE TABLE kv (key int, value int);
+SELECT create_distributed_table('kv', 'key');
+CREATE TABLE kv_details (key int, detail text);
+SELECT create_distributed_table('kv_details', 'key', colocate_with => 'kv');
+CREATE TABLE value_names (value int, name text);
+SELECT create_reference_table('value_names');
+
+INSERT INTO kv SELECT i, i % 10 FROM generate_series(1, 100) i;
+INSERT INTO kv_details SELECT i, 'detail ' || i FROM generate_series(1, 100) i;
+INSERT INTO value_names SELECT i, 'value ' || i FROM generate_series(0, 9) i;
+
+-- start with an empty cache
+\c - - - :master_port
+SET search_path TO distributed_plan_cache;
+SET citus.max_cached_distributed_plans TO 16;
+
+PREPARE count_above(int) AS SELECT count(*), sum(value) FROM kv WHERE value > $1;
+EXECUTE count_above(0);
+EXECUTE count_above(5);
+EXECUTE count_above(8);
+EXECUTE count_above(9);
+EXECUTE count_above(0);
+EXECUTE count_above(5);
+EXECUTE count_above(8);
+
+-- tasks are pruned using the parameter values
+PREPARE join_details(int, int) AS
+SELECT key, detail, name
+FROM kv JOIN kv_details USING (key) JOIN value_names USING (value)
+WHERE key IN ($1, $2) ORDER BY key;
+EXECUTE join_details(7, 42);
+EXECUTE join_details(1, 100);
+EXECUTE join_details(200, 300);
+EXECUTE join_details(7, 42);
+
+SET citus.multi_task_query_log_level TO notice;
+EXECUTE join_details(7, 7);
+EXECUTE count_above(8);
+RESET citus.multi_task_query_log_level;
+
+-- queries with parameters outside of their filters are not cached
+PREPARE top_values(int) AS SELECT key, value FROM kv ORDER BY value DESC, key LIMIT $1;
+EXECUTE top_values(2);
+EXECUTE top_values(3);
+
+SELECT query LIKE '%kv%' AS on_kv, cached, calls, cache_hits, mean_plan_time > 0 AS timed
+FROM citus_plan_cache_stats ORDER BY calls;
+
+-- DDL drops the cached plans
+ALTER TABLE kv ADD COLUMN extra int;
+EXECUTE count_above(5);
+SELECT cached, calls, cache_hits FROM citus_plan_cache_stats ORDER BY calls;
+
+-- the cache is only used when enabled
+SET citus.max_cached_distributed_plans TO 0;
+EXECUTE count_above(8);
+EXECUTE join_details(7, 42);
+SELECT cached, calls, cache_hits FROM citus_plan_cache_stats ORDER BY calls;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA distributed_plan_cache CASCADE;
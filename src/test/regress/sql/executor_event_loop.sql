@@ -0,0 +1,42 @@
+--
+-- EXECUTOR_EVENT_LOOP
+--
+-- Tests for the wait event set of the adaptive executor
+CREATE SCHEMA executor_event_loop;
+SET search_path TO executor_event_loop;
+SET citus.shard_count TO 32;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4310000;
+
+CREATE TABLE t (key int, value int);
+SELECT create_distributed_table('t', 'key');
+INSERT INTO t SELECT i, i % 10 FROM generate_series(1, 1000) i;
+
+SET citus.max_adaptive_executor_pool_size TO 4;
+
+-- the wait event set is built once and then updated
+SELECT loop_iterations AS iterations_before,
+       wait_event_set_rebuilds AS rebuilds_before,
+       wait_event_modifications AS modifications_before
+FROM citus_executor_event_loop_stats
+\gset
+SELECT count(*) FROM t;
+SELECT loop_iterations > :iterations_before AS ran_event_loop,
+       wait_event_set_rebuilds - :rebuilds_before AS rebuilds,
+       wait_event_modifications > :modifications_before AS modified_wait_events
+FROM citus_executor_event_loop_stats;
+
+-- connections that slow start opens later on are added to the wait event set
+SELECT wait_event_set_rebuilds AS rebuilds_before,
+       wait_event_additions AS additions_before
+FROM citus_executor_event_loop_stats
+\gset
+SELECT count(*) FROM t WHERE pg_sleep(0.001) IS NOT NULL;
+SELECT wait_event_set_rebuilds - :rebuilds_before AS rebuilds,
+       wait_event_additions > :additions_before AS added_connections
+FROM citus_executor_event_loop_stats;
+
+RESET citus.max_adaptive_executor_pool_size;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA executor_event_loop CASCADE;
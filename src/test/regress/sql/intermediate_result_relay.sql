@@ -0,0 +1,58 @@
+--
+-- INTERMEDIATE_RESULT_RELAY
+--
+-- Tests for relaying intermediate results through the workers
+CREATE SCHEMA intermediate_result_relay;
+SET search_path TO intermediate_result_relay;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4260000;
+
+CREATE TABLE interesting_squares (user_id text, interested_in text);
+SELECT create_distributed_table('interesting_squares', 'user_id');
+INSERT INTO interesting_squares VALUES ('jon', '2'), ('jon', '5'), ('jack', '3'), ('sam', '4'), ('lisa', '1');
+
+-- the coordinator sends results to one worker, which relays them to the other
+SET citus.intermediate_result_relay_fanout TO 1;
+
+BEGIN;
+SELECT broadcast_intermediate_result('squares', 'SELECT s, s*s FROM generate_series(1,5) s');
+SELECT x, x2
+FROM interesting_squares
+JOIN (SELECT * FROM read_intermediate_result('squares', 'binary') AS res (x int, x2 int)) squares ON (x::text = interested_in)
+ORDER BY x;
+END;
+
+-- subplan results are relayed as well
+WITH top_users AS (
+	SELECT user_id FROM interesting_squares ORDER BY user_id LIMIT 2
+)
+SELECT user_id, interested_in FROM interesting_squares
+WHERE user_id IN (SELECT user_id FROM top_users)
+ORDER BY 1, 2;
+
+-- relayed results in a transaction that uses 2PC
+BEGIN;
+WITH top_users AS (
+	SELECT user_id FROM interesting_squares ORDER BY user_id LIMIT 2
+)
+UPDATE interesting_squares SET interested_in = interested_in || '0'
+WHERE user_id IN (SELECT user_id FROM top_users);
+COMMIT;
+
+SELECT * FROM interesting_squares ORDER BY 1, 2;
+
+-- a fanout of at least the number of nodes sends results directly
+SET citus.intermediate_result_relay_fanout TO 2;
+
+WITH top_users AS (
+	SELECT user_id FROM interesting_squares ORDER BY user_id LIMIT 2
+)
+SELECT user_id, interested_in FROM interesting_squares
+WHERE user_id IN (SELECT user_id FROM top_users)
+ORDER BY 1, 2;
+
+RESET citus.intermediate_result_relay_fanout;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA intermediate_result_relay CASCADE;
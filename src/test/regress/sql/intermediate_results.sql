@@ -269,4 +269,29 @@ END;
 -- results should have been deleted after transaction commit
 SELECT * FROM read_intermediate_results(ARRAY['squares_1', 'squares_2']::text[], 'binary') AS res (x int, x2 int);
 
+-- fetch_intermediate_results_from_nodes fetches from multiple nodes at once
+BEGIN;
+SELECT store_intermediate_result_on_node('localhost', :worker_1_port,
+                                         'squares_1', 'SELECT s, s*s FROM generate_series(1, 2) s');
+SELECT store_intermediate_result_on_node('localhost', :worker_2_port,
+                                         'squares_2', 'SELECT s, s*s FROM generate_series(3, 4) s');
+SAVEPOINT s1;
+SELECT * FROM fetch_intermediate_results_from_nodes(ARRAY['squares_1', 'squares_2']::text[],
+                                                    ARRAY['localhost', 'localhost']::text[],
+                                                    ARRAY[:worker_1_port, :worker_2_port]);
+SELECT * FROM read_intermediate_results(ARRAY['squares_1', 'squares_2']::text[], 'binary') AS res (x int, x2 int);
+-- fetching again reuses the connections
+SELECT * FROM fetch_intermediate_results_from_nodes(ARRAY['squares_2', 'squares_1']::text[],
+                                                    ARRAY['localhost', 'localhost']::text[],
+                                                    ARRAY[:worker_2_port, :worker_1_port]);
+SELECT * FROM read_intermediate_results(ARRAY['squares_1', 'squares_2']::text[], 'binary') AS res (x int, x2 int);
+-- mismatching array lengths should error
+SELECT * FROM fetch_intermediate_results_from_nodes(ARRAY['squares_1', 'squares_2']::text[],
+                                                    ARRAY['localhost']::text[],
+                                                    ARRAY[:worker_1_port]);
+ROLLBACK TO SAVEPOINT s1;
+-- empty result id list should succeed
+SELECT * FROM fetch_intermediate_results_from_nodes(ARRAY[]::text[], ARRAY[]::text[], ARRAY[]::int[]);
+END;
+
 DROP SCHEMA intermediate_results CASCADE;
@@ -0,0 +1,45 @@
+--
+-- LIMIT_EARLY_TERMINATION
+--
+-- Tests for stopping multi-shard SELECTs once enough rows arrived
+CREATE SCHEMA limit_early_termination;
+SET search_path TO limit_early_termination;
+SET citus.shard_count TO 32;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4290000;
+
+CREATE TABLE t (key int, value int);
+SELECT create_distributed_table('t', 'key');
+INSERT INTO t SELECT i, i % 10 FROM generate_series(1, 10000) i;
+
+-- the remaining tasks are cancelled once the rows arrived
+SELECT 1 AS one FROM t LIMIT 3;
+SELECT 1 AS one FROM t WHERE value = 3 LIMIT 2 OFFSET 1;
+
+-- probes for the existence of a row
+SELECT 1 AS found FROM t WHERE value = 7 LIMIT 1;
+SELECT 1 AS found FROM t WHERE value = 11 LIMIT 1;
+
+-- limits that need more rows than the tasks return in total
+SELECT 1 AS one FROM t WHERE key <= 2 LIMIT 5;
+
+-- the connections are reused afterwards
+SELECT count(*) FROM t;
+SELECT count(*) FROM t WHERE value = 3;
+
+-- the execution is not stopped in transaction blocks
+BEGIN;
+SELECT 1 AS one FROM t LIMIT 2;
+SELECT count(*) FROM t WHERE value = 5;
+COMMIT;
+
+-- nor when the coordinator sorts or aggregates
+SELECT key FROM t ORDER BY key LIMIT 3;
+SELECT value, count(*) FROM t GROUP BY value ORDER BY value LIMIT 2;
+
+SET citus.enable_early_limit_termination TO off;
+SELECT 1 AS one FROM t LIMIT 3;
+RESET citus.enable_early_limit_termination;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA limit_early_termination CASCADE;
@@ -164,8 +164,8 @@ EXPLAIN (COSTS OFF) DELETE FROM distributed_table WHERE key = 1 AND age = 20;
 -- show that EXPLAIN ANALYZE deleted the row
 SELECT * FROM distributed_table WHERE key = 1 AND age = 20 ORDER BY 1,2,3;
 
--- copy always happens via distributed execution irrespective of the
--- shards that are accessed
+-- outside of transaction blocks, copy inserts into the shards on this
+-- node locally and uses connections for the other shards
 COPY reference_table FROM STDIN;
 6
 11
@@ -302,26 +302,37 @@ BEGIN;
 	TRUNCATE distributed_table CASCADE;
 ROLLBACK;
 
--- a local query is followed by a command that cannot be executed locally
+-- a local query is followed by a COPY, which copies into the local shards
+-- without a connection
 BEGIN;
 	SELECT count(*) FROM distributed_table WHERE key = 1;
 
-	-- even no need to supply any data
 	COPY distributed_table FROM STDIN WITH CSV;
+501,'501',25
+502,'502',26
+503,'503',27
+\.
+
+	-- the copied rows are visible to the rest of the transaction
+	SET LOCAL citus.log_local_commands TO off;
+	SELECT count(*) FROM distributed_table WHERE key BETWEEN 501 AND 503;
 ROLLBACK;
 
--- a local query is followed by a command that cannot be executed locally
+-- a local query is followed by an INSERT..SELECT via coordinator, whose
+-- COPY step also copies into the local shards
 BEGIN;
 	SELECT count(*) FROM distributed_table WHERE key = 1;
 
-	INSERT INTO distributed_table (key) SELECT i FROM generate_series(1,10)i;
+	INSERT INTO distributed_table (key) SELECT i FROM generate_series(501,510)i;
 ROLLBACK;
 
--- a local query is followed by a command that cannot be executed locally
+-- a local query is followed by an INSERT..SELECT via coordinator, whose
+-- SELECT is then executed locally as well
 BEGIN;
 	SELECT count(*) FROM distributed_table WHERE key = 1;
 
-	INSERT INTO distributed_table (key) SELECT key+1 FROM distributed_table;
+	SET LOCAL citus.log_local_commands TO off;
+	INSERT INTO distributed_table (key) SELECT key+500 FROM distributed_table;
 ROLLBACK;
 
 INSERT INTO distributed_table VALUES (1, '11',21) ON CONFLICT(key) DO UPDATE SET value = '29' RETURNING *;
@@ -681,6 +692,23 @@ CALL register_for_event(16, 1, 'yes');
 CALL register_for_event(16, 1, 'yes');
 CALL register_for_event(16, 1, 'yes');
 
+-- router queries are planned from their query tree, which also works with
+-- dropped columns
+SET citus.shard_count TO 4;
+SET citus.next_shard_id TO 1480000;
+CREATE TABLE local_shard_execution.dropped_column_table (key int, dropped int, value text);
+SELECT create_distributed_table('local_shard_execution.dropped_column_table', 'key');
+ALTER TABLE local_shard_execution.dropped_column_table DROP COLUMN dropped;
+INSERT INTO local_shard_execution.dropped_column_table VALUES (1, 'one');
+
+\c - - - :worker_1_port
+SET search_path TO local_shard_execution;
+SET client_min_messages TO LOG;
+SET citus.log_local_commands TO ON;
+SELECT * FROM dropped_column_table WHERE key = 1;
+SELECT value FROM dropped_column_table WHERE key = 1 AND value = 'one';
+\c - - - :master_port
+
 SET client_min_messages TO ERROR;
 SET search_path TO public;
 DROP SCHEMA local_shard_execution CASCADE;
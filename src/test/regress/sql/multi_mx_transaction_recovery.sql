@@ -82,12 +82,14 @@ COMMIT;
 SELECT count(*) FROM pg_dist_transaction;
 SELECT recover_prepared_transactions();
 
--- Committed INSERT..SELECT via coordinator should write 4 transaction recovery records
+-- Committed INSERT..SELECT via coordinator should write 2 transaction recovery records,
+-- since the COPY step inserts into the 2 shards on this node without connections
 INSERT INTO test_recovery (x) SELECT 'hello-'||s FROM generate_series(1,100) s;
 SELECT count(*) FROM pg_dist_transaction;
 SELECT recover_prepared_transactions();
 
--- Committed COPY should write 3 transaction records (2 fall into the same shard)
+-- Committed COPY should write 2 transaction records (2 rows fall into the same shard,
+-- and 1 row into a shard on this node)
 COPY test_recovery (x) FROM STDIN CSV;
 hello-0
 hello-1
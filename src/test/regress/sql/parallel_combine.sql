@@ -0,0 +1,42 @@
+--
+-- PARALLEL_COMBINE
+--
+-- Tests for combining the aggregates of multi-shard GROUP BY queries in
+-- parallel workers on the coordinator
+CREATE SCHEMA parallel_combine;
+SET search_path TO parallel_combine;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4160000;
+
+CREATE TABLE t (key int, value int, name text);
+SELECT create_distributed_table('t', 'key');
+INSERT INTO t SELECT i, i % 10, 'name' || (i % 3) FROM generate_series(1, 1000) i;
+INSERT INTO t VALUES (1001, NULL, NULL);
+
+SET citus.max_parallel_combine_workers TO 2;
+
+-- the coordinator aggregates below a gather node
+EXPLAIN (COSTS OFF) SELECT value, count(*) FROM t GROUP BY value ORDER BY value;
+
+SELECT value, count(*), sum(key) FROM t GROUP BY value ORDER BY value;
+SELECT value, name, count(*), max(key) FROM t WHERE key <= 30 OR key > 1000
+GROUP BY value, name HAVING count(*) < 2 ORDER BY value, name;
+
+-- the number of workers is capped by max_parallel_workers_per_gather
+SET max_parallel_workers_per_gather TO 1;
+EXPLAIN (COSTS OFF) SELECT value, count(*) FROM t GROUP BY value ORDER BY value;
+
+-- and the combine step stays in the leader when parallelism is disabled
+SET max_parallel_workers_per_gather TO 0;
+EXPLAIN (COSTS OFF) SELECT value, count(*) FROM t GROUP BY value ORDER BY value;
+RESET max_parallel_workers_per_gather;
+
+-- aggregates without a GROUP BY are combined in a single group
+EXPLAIN (COSTS OFF) SELECT count(*) FROM t;
+SELECT count(*) FROM t;
+
+RESET citus.max_parallel_combine_workers;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA parallel_combine CASCADE;
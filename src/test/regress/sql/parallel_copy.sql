@@ -0,0 +1,109 @@
+--
+-- PARALLEL_COPY
+--
+-- Tests for COPY into distributed tables whose rows are parsed and routed
+-- by parallel workers
+CREATE SCHEMA parallel_copy;
+SET search_path TO parallel_copy;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4230000;
+
+-- the distribution column comes after a dropped column
+CREATE TABLE events (a int, key int, b jsonb, c text, d timestamp);
+ALTER TABLE events DROP COLUMN a;
+SELECT create_distributed_table('events', 'key');
+
+CREATE TABLE events_serial (key int, b jsonb, c text, d timestamp);
+SELECT create_distributed_table('events_serial', 'key');
+
+CREATE TABLE countries (code text, name text);
+SELECT create_reference_table('countries');
+CREATE TABLE append_events (key int, c text);
+SELECT create_distributed_table('append_events', 'key', 'append');
+
+\copy events FROM STDIN WITH (workers 2)
+1	{"x": 1}	tab\there	2020-01-01 00:00:00
+2	\N	back\\slash	\N
+3	[]	new\nline	2020-01-02 10:00:00
+\.
+\copy events FROM STDIN WITH (format csv, workers 2)
+4,"{""y"": 2}","quoted, comma",
+5,,"",2020-01-03 00:00:00
+\.
+
+-- routed rows can also be serialized in binary format
+SET citus.binary_worker_copy_format TO on;
+\copy events FROM STDIN WITH (workers 1)
+6	{"z": 3}	binary	2020-01-04 00:00:00
+\.
+RESET citus.binary_worker_copy_format;
+
+-- no workers and column lists copy in the current backend, the latter with a notice
+\copy events FROM STDIN WITH (workers 0)
+7	{}	serial	\N
+\.
+\copy events (key, c) FROM STDIN WITH (workers 2)
+8	only c
+\.
+
+\copy events_serial FROM STDIN
+1	{"x": 1}	tab\there	2020-01-01 00:00:00
+2	\N	back\\slash	\N
+3	[]	new\nline	2020-01-02 10:00:00
+4	{"y": 2}	quoted, comma	\N
+5	\N		2020-01-03 00:00:00
+6	{"z": 3}	binary	2020-01-04 00:00:00
+7	{}	serial	\N
+8	\N	only c	\N
+\.
+
+SELECT key, b, replace(replace(c, E'\t', '<tab>'), E'\n', '<newline>') AS c, d
+FROM events ORDER BY key;
+
+-- rows are in the same shards as when they are routed in the current backend
+SELECT count(*) FROM events e JOIN events_serial s
+ON (e.key = s.key AND e.b IS NOT DISTINCT FROM s.b AND
+    e.c IS NOT DISTINCT FROM s.c AND e.d IS NOT DISTINCT FROM s.d);
+
+-- reference tables have a single shard
+\copy countries FROM STDIN WITH (workers 2)
+nl	Netherlands
+tr	Turkey
+\.
+SELECT * FROM countries ORDER BY code;
+
+-- the routed rows are written in the distributed transaction
+BEGIN;
+\copy events FROM STDIN WITH (workers 2)
+9	{}	rolled back	\N
+\.
+SELECT count(*) FROM events WHERE key = 9;
+ROLLBACK;
+SELECT count(*) FROM events WHERE key = 9;
+
+\set VERBOSITY terse
+
+-- errors of the workers are reported by the COPY
+\copy events FROM STDIN WITH (workers 2)
+\N	{}	null key	\N
+\.
+\copy events FROM STDIN WITH (workers 2)
+10	not json	x	\N
+\.
+
+-- the number of fields is checked while splitting the input
+\copy events FROM STDIN WITH (workers 2)
+11	{}
+\.
+
+COPY events FROM STDIN WITH (workers -1);
+
+-- append-distributed tables create new shards, which the workers cannot route to
+COPY append_events FROM STDIN WITH (workers 2);
+
+\set VERBOSITY default
+SELECT count(*) FROM events;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA parallel_copy CASCADE;
@@ -0,0 +1,89 @@
+--
+-- PREPARED_STATEMENT_CACHE
+--
+-- Tests for keeping queries with parameters prepared on the worker
+-- connections
+CREATE SCHEMA prepared_statement_cache;
+SET search_path TO prepared_statement_cache;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4190000;
+
+CREATE TABLE kv (key int, value int);
+SELECT create_distributed_table('kv', 'key');
+INSERT INTO kv SELECT i, i * 10 FROM generate_series(1, 100) i;
+
+SET citus.max_cached_statements_per_connection TO 16;
+
+PREPARE get_value(int) AS SELECT value FROM kv WHERE key = 7 AND value >= $1;
+EXECUTE get_value(0);
+EXECUTE get_value(0);
+EXECUTE get_value(70);
+EXECUTE get_value(71);
+EXECUTE get_value(0);
+EXECUTE get_value(0);
+EXECUTE get_value(0);
+
+-- the shard query is prepared the second time it is sent, and used afterwards
+SELECT statements_prepared > 0 AS prepared_statements,
+       prepared_statement_executions > 0 AS executed_prepared_statements
+FROM citus_prepared_statement_cache_stats;
+
+PREPARE put_value(int, int) AS UPDATE kv SET value = $2 WHERE key = $1;
+EXECUTE put_value(7, 71);
+EXECUTE put_value(7, 72);
+EXECUTE put_value(7, 73);
+EXECUTE put_value(7, 74);
+EXECUTE put_value(7, 75);
+EXECUTE put_value(7, 76);
+EXECUTE get_value(0);
+
+-- modifications that evaluate functions on the coordinator keep their parameters
+SELECT prepared_statement_executions AS executions_before
+FROM citus_prepared_statement_cache_stats
+\gset
+PREPARE put_value_checked(int) AS
+UPDATE kv SET value = $1 WHERE key = 7 AND current_user IS NOT NULL;
+EXECUTE put_value_checked(69);
+EXECUTE put_value_checked(70);
+EXECUTE put_value_checked(71);
+EXECUTE put_value_checked(72);
+EXECUTE put_value_checked(73);
+EXECUTE put_value_checked(74);
+EXECUTE put_value_checked(75);
+EXECUTE put_value_checked(76);
+SELECT prepared_statement_executions > :executions_before AS executed_prepared_statements
+FROM citus_prepared_statement_cache_stats;
+EXECUTE get_value(0);
+
+-- changing the result type deallocates the statements on the workers
+ALTER TABLE kv ALTER COLUMN value TYPE bigint;
+DEALLOCATE get_value;
+PREPARE get_value(int) AS SELECT value FROM kv WHERE key = 7 AND value >= $1;
+EXECUTE get_value(0);
+EXECUTE get_value(76);
+
+-- statements are not prepared in transaction blocks, but can be used there
+BEGIN;
+EXECUTE get_value(0);
+EXECUTE put_value(7, 77);
+EXECUTE get_value(0);
+ROLLBACK;
+EXECUTE get_value(0);
+
+-- a cache that is full starts over
+SET citus.max_cached_statements_per_connection TO 1;
+PREPARE get_values(int) AS SELECT key, value FROM kv WHERE key IN (1, 2) AND value > $1 ORDER BY key;
+EXECUTE get_values(0);
+EXECUTE get_value(0);
+EXECUTE get_values(10);
+EXECUTE get_value(0);
+EXECUTE get_values(0);
+
+-- disabling the cache leaves the prepared statements alone
+SET citus.max_cached_statements_per_connection TO 0;
+EXECUTE get_value(0);
+EXECUTE get_values(0);
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA prepared_statement_cache CASCADE;
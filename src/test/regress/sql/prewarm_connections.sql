@@ -0,0 +1,53 @@
+--
+-- PREWARM_CONNECTIONS
+--
+-- Tests for connecting to the workers ahead of the first query of a session,
+-- and for the latency histograms
+CREATE SCHEMA prewarm_connections;
+SET search_path TO prewarm_connections;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4180000;
+
+CREATE TABLE t (a int, b int);
+SELECT create_distributed_table('t', 'a');
+INSERT INTO t SELECT i, i * 10 FROM generate_series(1, 100) i;
+
+SELECT citus_reset_connection_latency_histogram();
+SELECT metric, count(*), sum(count) FROM citus_connection_latency_histogram
+GROUP BY metric ORDER BY metric;
+
+-- the first query of a new session connects to the workers it accesses
+\c - - - :master_port
+SET search_path TO prewarm_connections;
+SET citus.prewarm_connections TO on;
+SELECT b FROM t WHERE a = 1;
+SELECT b FROM t WHERE a = 2;
+SELECT count(*), sum(b) FROM t;
+
+SELECT metric, sum(count) >= 1 FROM citus_connection_latency_histogram
+GROUP BY metric ORDER BY metric;
+
+-- the last bucket has no upper bound
+SELECT metric, upper_bound_ms FROM citus_connection_latency_histogram
+WHERE upper_bound_ms IS NULL OR upper_bound_ms < 1 ORDER BY metric, upper_bound_ms;
+
+-- prewarming happens once per session, and leaves queries in transactions alone
+BEGIN;
+SELECT b FROM t WHERE a = 3;
+UPDATE t SET b = b + 1 WHERE a = 3;
+SELECT b FROM t WHERE a = 3;
+ROLLBACK;
+
+\c - - - :master_port
+SET search_path TO prewarm_connections;
+SET citus.prewarm_connections TO on;
+BEGIN;
+SELECT b FROM t WHERE a = 4;
+UPDATE t SET b = b + 1 WHERE a = 4;
+SELECT b FROM t WHERE a = 4;
+ROLLBACK;
+SELECT b FROM t WHERE a = 4;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA prewarm_connections CASCADE;
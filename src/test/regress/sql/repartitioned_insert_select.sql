@@ -0,0 +1,74 @@
+--
+-- REPARTITIONED_INSERT_SELECT
+--
+-- Tests for INSERT ... SELECT commands between non-colocated tables whose
+-- results are repartitioned on the workers instead of the coordinator
+CREATE SCHEMA repartitioned_insert_select;
+SET search_path TO repartitioned_insert_select;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4240000;
+SET citus.enable_repartitioned_insert_select TO on;
+
+SET citus.shard_count TO 4;
+CREATE TABLE source_table (a int, b int, c text);
+SELECT create_distributed_table('source_table', 'a');
+
+-- different shard count and distribution column than the source
+SET citus.shard_count TO 3;
+CREATE TABLE target_table (a int, b int, c text);
+SELECT create_distributed_table('target_table', 'b');
+
+CREATE TABLE target_upsert (key int PRIMARY KEY, value text);
+SELECT create_distributed_table('target_upsert', 'key');
+
+INSERT INTO source_table SELECT i, i % 3, 'row ' || i FROM generate_series(1, 10) i;
+
+\a\t
+EXPLAIN (COSTS OFF) INSERT INTO target_table SELECT * FROM source_table;
+
+-- the coordinator has to apply the LIMIT
+EXPLAIN (COSTS OFF) INSERT INTO target_table SELECT * FROM source_table LIMIT 3;
+
+SET citus.enable_repartitioned_insert_select TO off;
+EXPLAIN (COSTS OFF) INSERT INTO target_table SELECT * FROM source_table;
+SET citus.enable_repartitioned_insert_select TO on;
+\a\t
+
+INSERT INTO target_table SELECT * FROM source_table;
+SELECT b, count(*) FROM target_table GROUP BY b ORDER BY b;
+
+-- rows end up in the shards of their distribution column value
+SELECT * FROM target_table WHERE b = 1 ORDER BY a;
+
+SET citus.sort_returning TO on;
+INSERT INTO target_table SELECT a + 10, b, c FROM source_table WHERE a <= 3 RETURNING *;
+RESET citus.sort_returning;
+
+-- parameters are resolved before the select tasks are wrapped
+PREPARE insert_above(int) AS
+INSERT INTO target_table SELECT a + 20, b, c FROM source_table WHERE a > $1;
+EXECUTE insert_above(8);
+EXECUTE insert_above(9);
+SELECT * FROM target_table WHERE a > 20 ORDER BY a;
+
+INSERT INTO target_upsert SELECT a, c FROM source_table;
+INSERT INTO target_upsert SELECT a, 'new ' || c FROM source_table WHERE a > 5
+ON CONFLICT (key) DO UPDATE SET value = EXCLUDED.value;
+SELECT * FROM target_upsert ORDER BY key;
+
+-- repartitioning happens in a transaction block along with other commands
+BEGIN;
+DELETE FROM target_table;
+INSERT INTO target_table SELECT * FROM source_table;
+SELECT count(*) FROM target_table;
+ROLLBACK;
+
+\set VERBOSITY terse
+INSERT INTO source_table VALUES (11, NULL, 'null b');
+INSERT INTO target_table SELECT * FROM source_table;
+\set VERBOSITY default
+
+SELECT count(*) FROM target_table;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA repartitioned_insert_select CASCADE;
@@ -0,0 +1,47 @@
+--
+-- SHARED_CONNECTION_STATS
+--
+-- Tests for the connection budget that the backends of the coordinator share
+CREATE SCHEMA shared_connection_stats;
+SET search_path TO shared_connection_stats;
+SET citus.shard_count TO 32;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4170000;
+
+CREATE TABLE t (a int, b int);
+SELECT create_distributed_table('t', 'a');
+INSERT INTO t SELECT i, i % 10 FROM generate_series(1, 1000) i;
+
+-- the backend keeps a connection to each worker after the query
+SELECT count(*), sum(b) FROM t;
+SELECT hostname, port, connection_count_to_node >= 1
+FROM citus_remote_connection_stats
+WHERE port IN (:worker_1_port, :worker_2_port)
+ORDER BY port;
+
+-- with a budget of one connection per worker, the tasks share one connection per worker
+ALTER SYSTEM SET citus.max_shared_pool_size TO 1;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.1);
+SHOW citus.max_shared_pool_size;
+
+SELECT count(*), sum(b) FROM t;
+SELECT count(DISTINCT pid) FROM (SELECT pg_backend_pid() AS pid FROM t) pids;
+
+BEGIN;
+UPDATE t SET b = b + 1;
+SELECT count(*), sum(b) FROM t;
+ROLLBACK;
+
+-- disabling the budget does not affect the queries either
+ALTER SYSTEM SET citus.max_shared_pool_size TO -1;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.1);
+
+SELECT count(*), sum(b) FROM t;
+
+ALTER SYSTEM RESET citus.max_shared_pool_size;
+SELECT pg_reload_conf();
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA shared_connection_stats CASCADE;
@@ -0,0 +1,70 @@
+--
+-- SHARED_METADATA_CACHE
+--
+-- Tests for sharing the shard metadata of distributed tables between the
+-- backends of a node
+CREATE SCHEMA shared_metadata_cache;
+SET search_path TO shared_metadata_cache;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4210000;
+
+SHOW citus.shared_metadata_cache_size;
+
+CREATE TABLE ranges (key int, value int);
+SELECT create_distributed_table('ranges', 'key', 'range');
+SELECT master_create_empty_shard('ranges') AS first_shard
+\gset
+UPDATE pg_dist_shard SET shardminvalue = 1, shardmaxvalue = 10
+WHERE shardid = :first_shard;
+SELECT master_create_empty_shard('ranges') AS second_shard
+\gset
+UPDATE pg_dist_shard SET shardminvalue = 11, shardmaxvalue = 20
+WHERE shardid = :second_shard;
+
+-- the first backend that needs the metadata reads it from the catalogs
+SELECT rebuilds AS rebuilds_before FROM citus_shared_metadata_cache_stats
+\gset
+SELECT get_shard_id_for_distribution_column('ranges', 15) = :second_shard AS correct_shard;
+SELECT rebuilds > :rebuilds_before AS read_catalogs,
+       cached_relations > 0 AS has_relations,
+       memory_bytes > 0 AS uses_memory
+FROM citus_shared_metadata_cache_stats;
+
+-- other backends copy it from shared memory
+\c - - - :master_port
+SET search_path TO shared_metadata_cache;
+SELECT hits AS hits_before FROM citus_shared_metadata_cache_stats
+\gset
+SELECT get_shard_id_for_distribution_column('ranges', 15) = :second_shard AS correct_shard;
+SELECT hits > :hits_before AS used_shared_cache FROM citus_shared_metadata_cache_stats;
+
+-- uncommitted changes are only visible to the transaction itself
+BEGIN;
+UPDATE pg_dist_shard SET shardminvalue = 21, shardmaxvalue = 30
+WHERE shardid = :second_shard;
+SELECT get_shard_id_for_distribution_column('ranges', 25) = :second_shard AS correct_shard;
+ROLLBACK;
+
+\c - - - :master_port
+SET search_path TO shared_metadata_cache;
+SELECT get_shard_id_for_distribution_column('ranges', 15) = :second_shard AS correct_shard;
+
+-- changes make the shared rows stale before they are committed
+SELECT invalidations AS invalidations_before FROM citus_shared_metadata_cache_stats
+\gset
+BEGIN;
+UPDATE pg_dist_shard SET shardminvalue = 11, shardmaxvalue = 20
+WHERE shardid = :first_shard;
+UPDATE pg_dist_shard SET shardminvalue = 1, shardmaxvalue = 10
+WHERE shardid = :second_shard;
+SELECT invalidations > :invalidations_before AS invalidated
+FROM citus_shared_metadata_cache_stats;
+COMMIT;
+
+\c - - - :master_port
+SET search_path TO shared_metadata_cache;
+SELECT get_shard_id_for_distribution_column('ranges', 15) = :first_shard AS correct_shard;
+SELECT get_shard_id_for_distribution_column('ranges', 5) = :second_shard AS correct_shard;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA shared_metadata_cache CASCADE;
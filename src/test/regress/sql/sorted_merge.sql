@@ -0,0 +1,46 @@
+--
+-- SORTED_MERGE
+--
+-- Tests for merging the sorted results of the tasks on the coordinator
+CREATE SCHEMA sorted_merge;
+SET search_path TO sorted_merge;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4150000;
+
+CREATE TABLE t (key int, value int, name text);
+SELECT create_distributed_table('t', 'key');
+INSERT INTO t SELECT i, i % 7, 'name' || (i % 5) FROM generate_series(1, 100) i;
+INSERT INTO t VALUES (101, NULL, NULL), (102, NULL, 'x');
+
+SET citus.enable_sorted_merge TO on;
+
+-- the workers sort the rows and the coordinator does not
+EXPLAIN (COSTS OFF) SELECT key, value FROM t ORDER BY key;
+EXPLAIN (COSTS OFF) SELECT key, value FROM t ORDER BY key LIMIT 3;
+
+SELECT key, value FROM t WHERE key <= 10 ORDER BY key;
+SELECT key, value FROM t ORDER BY key DESC LIMIT 5;
+SELECT key, value FROM t ORDER BY value NULLS FIRST, key LIMIT 5;
+SELECT name, key FROM t WHERE key <= 12 ORDER BY name, key;
+
+-- sort columns that are not in the target list are sorted on the coordinator,
+-- so the workers do not sort either
+EXPLAIN (COSTS OFF) SELECT key FROM t WHERE key > 95 ORDER BY value DESC, key;
+SELECT key FROM t WHERE key > 95 ORDER BY value DESC, key;
+
+-- scrollable cursors merge all the rows up front
+BEGIN;
+DECLARE c SCROLL CURSOR FOR SELECT key FROM t WHERE key <= 6 ORDER BY key;
+FETCH 3 FROM c;
+FETCH BACKWARD 2 FROM c;
+CLOSE c;
+COMMIT;
+
+-- queries that aggregate on the coordinator still sort there
+SELECT value, count(*) FROM t GROUP BY value ORDER BY value LIMIT 3;
+
+RESET citus.enable_sorted_merge;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA sorted_merge CASCADE;
@@ -0,0 +1,45 @@
+--
+-- STREAMING_EXECUTION
+--
+-- Tests for returning the rows of SELECT queries while they arrive
+CREATE SCHEMA streaming_execution;
+SET search_path TO streaming_execution;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4140000;
+
+CREATE TABLE t (key int, value int);
+SELECT create_distributed_table('t', 'key');
+INSERT INTO t SELECT i, i % 10 FROM generate_series(1, 10000) i;
+
+SET citus.enable_streaming_execution TO on;
+
+-- multi-shard queries without coordinator-side sort or aggregate
+SELECT value FROM t WHERE key <= 40 AND value = 0;
+SELECT 1 AS one FROM t WHERE key IN (1, 2, 3, 4, 5);
+
+-- single shard queries are sorted on the worker
+SELECT * FROM t WHERE key = 7 ORDER BY value;
+
+-- the scan stops reading early, then the connections are reused
+SELECT 1 AS one FROM t LIMIT 3;
+SELECT 1 AS one FROM t WHERE value = 3 LIMIT 1;
+SELECT count(*) FROM t;
+
+-- queries that sort or aggregate on the coordinator are not streamed
+SELECT * FROM t WHERE key <= 5 ORDER BY key;
+SELECT value, count(*) FROM t GROUP BY value ORDER BY value LIMIT 3;
+
+-- cursors and transaction blocks are not streamed
+BEGIN;
+DECLARE c CURSOR FOR SELECT 1 AS one FROM t WHERE key <= 20;
+FETCH 2 FROM c;
+FETCH 1 FROM c;
+CLOSE c;
+SELECT count(*) FROM t WHERE key <= 20;
+COMMIT;
+
+RESET citus.enable_streaming_execution;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA streaming_execution CASCADE;
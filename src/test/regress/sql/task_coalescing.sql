@@ -0,0 +1,64 @@
+--
+-- TASK_COALESCING
+--
+-- Tests for sending the commands of multiple tasks to a worker at once
+CREATE SCHEMA task_coalescing;
+SET search_path TO task_coalescing;
+SET citus.shard_count TO 8;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4300000;
+
+CREATE TABLE t (key int, value int);
+SELECT create_distributed_table('t', 'key');
+INSERT INTO t SELECT i, i % 10 FROM generate_series(1, 1000) i;
+
+SET citus.max_coalesced_tasks TO 8;
+SET citus.max_adaptive_executor_pool_size TO 1;
+
+-- the results of each task go to the right place
+SELECT coalesced_tasks AS coalesced_before FROM citus_executor_task_stats
+\gset
+SELECT count(*) FROM t;
+SELECT coalesced_tasks > :coalesced_before AS coalesced
+FROM citus_executor_task_stats;
+SELECT sum(value) FROM t;
+SELECT key FROM t WHERE key <= 5 ORDER BY key;
+
+-- modifications
+UPDATE t SET value = value + 1 WHERE key <= 100;
+SELECT sum(value) FROM t;
+DELETE FROM t WHERE key > 900;
+SELECT count(*), sum(value) FROM t;
+
+BEGIN;
+UPDATE t SET value = 0 WHERE key <= 10;
+SELECT sum(value) FROM t;
+ROLLBACK;
+SELECT sum(value) FROM t;
+
+-- commands with a semicolon or parameters are sent separately
+SELECT count(*) FROM t WHERE value::text <> 'a;b';
+PREPARE count_values(int) AS SELECT count(*) FROM t WHERE value = $1;
+EXECUTE count_values(3);
+
+-- replicated tables
+SET citus.shard_replication_factor TO 2;
+CREATE TABLE r (a int, b int);
+SELECT create_distributed_table('r', 'a');
+INSERT INTO r SELECT i, 0 FROM generate_series(1, 100) i;
+UPDATE r SET b = 1;
+SELECT count(*), sum(b) FROM r;
+
+-- every task is sent separately when coalescing is disabled
+SET citus.max_coalesced_tasks TO 1;
+SELECT coalesced_tasks AS coalesced_before FROM citus_executor_task_stats
+\gset
+SELECT count(*) FROM t;
+SELECT coalesced_tasks = :coalesced_before AS not_coalesced
+FROM citus_executor_task_stats;
+
+RESET citus.max_adaptive_executor_pool_size;
+RESET citus.max_coalesced_tasks;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA task_coalescing CASCADE;
@@ -0,0 +1,58 @@
+--
+-- TASK_QUERY_TEMPLATES
+--
+-- Tests for building the query strings of multi-shard queries from a template
+CREATE SCHEMA "Task Query Templates";
+SET search_path TO "Task Query Templates";
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+SET citus.next_shard_id TO 4280000;
+
+CREATE TABLE "Events Table" (id int, "Value" text, updated_at timestamptz);
+SELECT create_distributed_table('"Events Table"', 'id');
+CREATE TABLE users (id int, name text);
+SELECT create_distributed_table('users', 'id');
+CREATE TABLE countries (name text);
+SELECT create_reference_table('countries');
+
+INSERT INTO "Events Table" SELECT i, 'value ' || i FROM generate_series(1, 10) i;
+INSERT INTO users SELECT i, 'user ' || i FROM generate_series(1, 10) i;
+INSERT INTO countries VALUES ('NL'), ('TR');
+
+-- shard names that need quoting
+SELECT count(*), max("Value") FROM "Events Table";
+
+-- joins with co-located and reference tables
+SELECT e.id, u.name, count(c.name)
+FROM "Events Table" e JOIN users u USING (id), countries c
+WHERE e.id <= 3
+GROUP BY 1, 2
+ORDER BY 1;
+
+-- subqueries that are pushed down
+SELECT count(*) FROM "Events Table" e WHERE e.id IN (SELECT id FROM users WHERE name <> 'user 1');
+SELECT count(*) FROM "Events Table" e LEFT JOIN users u USING (id) WHERE u.name IS NOT NULL;
+
+-- the query contains the byte that delimits the slots, each task is deparsed
+SELECT count(*) FROM "Events Table" WHERE "Value" <> E'\001';
+
+-- modifications whose query strings are rebuilt after evaluating functions
+UPDATE "Events Table" SET updated_at = now() WHERE id > 5;
+SELECT count(*) FROM "Events Table" WHERE updated_at IS NOT NULL;
+DELETE FROM "Events Table" WHERE updated_at < now() + interval '1 day' AND id > 8;
+SELECT count(*), sum(id) FROM "Events Table";
+
+-- the same results when every task is deparsed
+SET citus.enable_task_query_templates TO off;
+SELECT count(*), max("Value") FROM "Events Table";
+SELECT e.id, u.name, count(c.name)
+FROM "Events Table" e JOIN users u USING (id), countries c
+WHERE e.id <= 3
+GROUP BY 1, 2
+ORDER BY 1;
+UPDATE "Events Table" SET updated_at = NULL WHERE updated_at < now() + interval '1 day';
+SELECT count(*) FROM "Events Table" WHERE updated_at IS NOT NULL;
+RESET citus.enable_task_query_templates;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA "Task Query Templates" CASCADE;